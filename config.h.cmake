@@ -1,7 +1,9 @@
 #cmakedefine HAVE_EVENT_BASE_NEW
 #cmakedefine HAVE_EVENT_BASE_FREE
 #cmakedefine HAVE_EVENT_H
+#cmakedefine HAVE_EXECINFO_H
 #cmakedefine HAVE_INTTYPES_H
+#cmakedefine HAVE_LINUX_IO_URING_H
 #cmakedefine HAVE_MGMAPI_H
 #cmakedefine HAVE_NETINET_IN_H
 #cmakedefine HAVE_NET_IF_H
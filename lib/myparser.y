@@ -841,6 +841,7 @@ insert_stmt ::= insert_cmd(R) INTO fullname(X) idlist_opt(F) values(S)
         ON DUPLICATE KEY UPDATE exprlist. {
   sql_insert_t* p = sql_insert_new();
   p->is_replace = R;
+  p->is_dup_update = 1;
   p->table = X;
   p->columns = F;
   p->sel_val = S;
@@ -945,9 +946,17 @@ expr(A) ::= func_expr(X). {
 func_expr(A) ::= ID(X) LP distinct(D) exprlist(Y) RP(R). {
     A = function_expr_new(&X, Y, &R);
     if (strncasecmp(X.z, "last_insert_id", X.n) == 0) {
-        sql_context_set_error(context, PARSE_NOT_SUPPORT,
-            "(proxy)LAST_INSERT_ID() not supported");
-        //TODO: parse interupted, func_expr free?
+        if (context->parsing_place == SELECT_COLUMN && Y == 0) {
+            context->clause_flags |= CF_LOCAL_QUERY;   /* answered by proxy */
+        } else {
+            sql_context_set_error(context, PARSE_NOT_SUPPORT,
+                "(proxy)LAST_INSERT_ID() not supported");
+            //TODO: parse interupted, func_expr free?
+        }
+    }
+    if (X.n == 7 && strncasecmp(X.z, "nextval", X.n) == 0
+        && context->parsing_place == SELECT_COLUMN) {
+        context->clause_flags |= CF_LOCAL_QUERY;   /* served by sequence of proxy */
     }
     if (sql_func_type(X.z) != FT_UNKNOWN) {
         A->flags |= EP_AGGREGATE;
@@ -1014,8 +1023,9 @@ func_expr(A) ::= CETUS_VERSION(N) opt_parentheses. {
         context->clause_flags |= CF_LOCAL_QUERY;
     }
 }
-func_expr(A) ::= CAST(N) LP expr AS cast_type RP(R). {
-    A = function_expr_new(&N, 0, &R);
+func_expr(A) ::= CAST(N) LP expr(X) AS cast_type(T) RP(R). {
+    A = function_expr_new(&N, sql_expr_list_append(0, X), &R);
+    A->num_value = T;
 }
 func_expr(A) ::= DATABASE(N) LP RP(R). {
     A = function_expr_new(&N, 0, &R);
@@ -1162,20 +1172,25 @@ expr(A) ::= LP(L) select(X) RP(R). {
     sql_expr_free(X);
   };
 }
-/* example: (id, name) IN (select ..) */
-expr(A) ::= LP(L) expr(B) COMMA nexprlist RP in_op(N) LP select(Y) RP(R). [IN] {
-  A = sql_expr_new(TK_IN, 0);
+/* row value, example: (id, name) IN (select ..), (id, name) = (1, 'a') */
+expr(A) ::= LP(L) expr(X) COMMA nexprlist(Y) RP(R). {
+  A = sql_expr_new(TK_VECTOR, 0);
   if (A) {
-      A->select = Y;
-      sql_expr_attach_subtrees(A, B, NULL);
+      sql_expr_list_t *elems = sql_expr_list_append(0, X);
+      int i;
+      for (i = 0; i < Y->len; ++i) {
+          sql_expr_list_append(elems, g_ptr_array_index(Y, i));
+      }
+      g_free(g_ptr_array_free(Y, FALSE)); /* elements moved */
+      A->list = elems;
       spanSet(A, &L, &R);
   } else {
-      sql_select_free(Y);
-      sql_expr_free(B);
+      sql_expr_free(X);
+      sql_expr_list_free(Y);
   }
-  A = exprNot(N, A);
 }
 expr(A) ::= expr(B) in_op(N) LP select(Y) RP(R).  [IN] {
+  context->clause_flags |= CF_SUBQUERY;
   A = sql_expr_new(TK_IN, 0);
   if (A) {
       sql_expr_attach_subtrees(A, B, NULL);
@@ -1188,6 +1203,7 @@ expr(A) ::= expr(B) in_op(N) LP select(Y) RP(R).  [IN] {
   A = exprNot(N, A);
 }
 expr(A) ::= EXISTS(E) LP select(Y) RP(R). {
+  context->clause_flags |= CF_SUBQUERY;
   A = sql_expr_new(TK_EXISTS, 0);
   A->select = Y;
   spanSet(A, &E, &R);
@@ -1286,13 +1302,16 @@ cmd ::= UNLOCK TABLES. {
                           "(cetus) UNLOCK TABLES not supported");
 }
 
-cast_type ::= SIGNED.
-cast_type ::= UNSIGNED.
-cast_type ::= SIGNED INT_SYM.
-cast_type ::= UNSIGNED INT_SYM.
-cast_type ::= BINARY opt_field_length.
-cast_type ::= NCHAR opt_field_length.
-cast_type ::= DECIMAL float_options.
+%type cast_type {uint64_t}
+cast_type(A) ::= SIGNED.                  {A = CAST_SIGNED;}
+cast_type(A) ::= UNSIGNED.                {A = CAST_UNSIGNED;}
+cast_type(A) ::= SIGNED INT_SYM.          {A = CAST_SIGNED;}
+cast_type(A) ::= UNSIGNED INT_SYM.        {A = CAST_UNSIGNED;}
+cast_type(A) ::= BINARY opt_field_length(L).
+                                          {A = CAST_BINARY | (L << CAST_LENGTH_SHIFT);}
+cast_type(A) ::= NCHAR opt_field_length(L).
+                                          {A = CAST_CHAR | (L << CAST_LENGTH_SHIFT);}
+cast_type(A) ::= DECIMAL float_options.   {A = CAST_OTHER;}
 
 float_options ::= .
 float_options ::= field_length.
@@ -1300,6 +1319,9 @@ float_options ::= precision.
 
 precision ::= LP INTEGER COMMA INTEGER RP.
 
-field_length ::= LP INTEGER RP.
-opt_field_length ::= .
-opt_field_length ::= field_length.
+/* n + 1, 0 for no length */
+%type field_length {uint64_t}
+field_length(A) ::= LP INTEGER(X) RP.     {A = MIN(g_ascii_strtoull(X.z, NULL, 10), G_MAXUINT32) + 1;}
+%type opt_field_length {uint64_t}
+opt_field_length(A) ::= .                 {A = 0;}
+opt_field_length(A) ::= field_length(A).
@@ -20,6 +20,7 @@
 
 #include "sql-construction.h"
 #include <inttypes.h>
+#include <string.h>
 
 #include "myparser.y.h"
 
@@ -100,6 +101,12 @@ sql_append_expr(GString *s, sql_expr_t *p)
         }
         break;
     case TK_FUNCTION:{
+        if (strcasecmp(p->token_text, "cast") == 0 && p->start && p->end) {
+            /* the target type is not kept in the tree */
+            g_string_append_c(s, ' ');
+            g_string_append_len(s, p->start, p->end - p->start);
+            break;
+        }
         g_string_append(s, " ");
         g_string_append(s, p->token_text);
         g_string_append(s, "(");
@@ -117,6 +124,20 @@ sql_append_expr(GString *s, sql_expr_t *p)
         g_string_append(s, ")");
         break;
     }
+    case TK_VECTOR:{
+        g_string_append(s, " (");
+        sql_expr_list_t *args = p->list;
+        int i;
+        for (i = 0; args && i < args->len; ++i) {
+            sql_expr_t *arg = g_ptr_array_index(args, i);
+            sql_expr_traverse(s, arg);
+            if (i < args->len - 1) {
+                g_string_append_c(s, ',');
+            }
+        }
+        g_string_append(s, ")");
+        break;
+    }
     case TK_BETWEEN:{
         sql_append_expr(s, p->left);
         g_string_append(s, " BETWEEN ");
@@ -225,6 +246,7 @@ sql_expr_is_leaf_node(sql_expr_t *expr)
         ||(expr->op == TK_BETWEEN)
         || (expr->op == TK_NOT)
         || (expr->op == TK_EXISTS)
+        || (expr->op == TK_VECTOR)
         || (expr->op == TK_IN);
 }
 
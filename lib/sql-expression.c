@@ -134,6 +134,23 @@ sql_expr_new(int op, const sql_token_t *token)
     return expr;
 }
 
+sql_expr_t *
+sql_expr_new_int(uint64_t value)
+{
+    char buf[32];
+    int n = snprintf(buf, sizeof(buf), "%" PRIu64, value);
+    sql_expr_t *expr = g_malloc0(sizeof(sql_expr_t) + n + 1);
+    expr->op = TK_INTEGER;
+    expr->num_value = value;
+    expr->token_text = (char *)&expr[1];
+    memcpy(expr->token_text, buf, n + 1);
+    expr->start = expr->token_text;
+    expr->end = expr->token_text + n;
+    expr->height = 1;
+    expr->var_scope = SCOPE_SESSION;
+    return expr;
+}
+
 /**
  * Only duplicate the root node
  */
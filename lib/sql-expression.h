@@ -153,14 +153,28 @@ enum sql_func_type_t {
     FT_MIN,
 };
 
+/* target type of CAST(x AS type), kept in num_value of the function */
+enum sql_cast_type_t {
+    CAST_OTHER = 0,
+    CAST_SIGNED,
+    CAST_UNSIGNED,
+    CAST_CHAR,
+    CAST_BINARY,
+};
+
+/* CHAR(n) and BINARY(n) keep n + 1 above the type, 0 without a length */
+#define CAST_LENGTH_SHIFT 8
+#define CAST_TYPE(v) ((v) & ((1 << CAST_LENGTH_SHIFT) - 1))
+#define CAST_LENGTH(v) ((uint64_t)(v) >> CAST_LENGTH_SHIFT)
+
 struct sql_expr_t {
     uint16_t op;                /* Operation performed by this node */
     char *token_text;           /* Token value. Zero terminated and dequoted */
-    uint64_t num_value;         /* Non-negative integer value */
+    uint64_t num_value;         /* Non-negative integer value, or sql_cast_type_t of CAST */
     sql_expr_t *left;
     sql_expr_t *right;
 
-    sql_expr_list_t *list;      /* op = IN, EXISTS, SELECT, CASE, FUNCTION, BETWEEN */
+    sql_expr_list_t *list;      /* op = IN, EXISTS, SELECT, CASE, FUNCTION, BETWEEN, VECTOR */
     sql_select_t *select;       /* EP_xIsSelect and op = IN, EXISTS, SELECT */
 
     int height;                 /* Height of the tree headed by this node */
@@ -215,6 +229,7 @@ struct sql_update_t {
 
 struct sql_insert_t {
     int is_replace;
+    int is_dup_update;          /* ON DUPLICATE KEY UPDATE */
     sql_src_list_t *table;
     sql_select_t *sel_val;      /* [1] select...  [2] values(...) */
     sql_id_list_t *columns;
@@ -254,6 +269,9 @@ sql_expr_t *sql_expr_new(int op, const sql_token_t *token);
 
 sql_expr_t *sql_expr_dup(const sql_expr_t *);
 
+/* integer literal made by proxy, its text is kept inside the node */
+sql_expr_t *sql_expr_new_int(uint64_t value);
+
 void sql_expr_attach_subtrees(sql_expr_t *p, sql_expr_t *left, sql_expr_t *right);
 
 void sql_expr_free(void *p);
@@ -20,6 +20,7 @@
 
 #include "sql-property.h"
 
+#include <stdlib.h>
 #include <string.h>
 
 enum property_parse_state_t {
@@ -42,6 +43,8 @@ sql_property_is_valid(sql_property_t *p)
 {
     if (p->table && p->group)   /* mutual exclusive */
         return FALSE;
+    if (p->batch == ERROR_VALUE || (p->batch > 0 && !p->batch_key))
+        return FALSE;
     return TRUE;
 }
 
@@ -54,6 +57,8 @@ sql_property_free(sql_property_t *p)
         g_free(p->table);
     if (p->key)
         g_free(p->key);
+    if (p->batch_key)
+        g_free(p->batch_key);
     g_free(p);
 }
 
@@ -84,6 +89,16 @@ string_to_code(const char *str)
     return ERROR_VALUE;
 }
 
+static int
+string_to_int(const char *str)
+{
+    char *end = NULL;
+    long n = strtol(str, &end, 10);
+    if (end == str || *end != '\0' || n <= 0 || n > G_MAXINT)
+        return ERROR_VALUE;
+    return n;
+}
+
 static gboolean
 parser_find_key(sql_property_parser_t *parser, const char *token, int len)
 {
@@ -99,7 +114,9 @@ parser_find_key(sql_property_parser_t *parser, const char *token, int len)
         "transaction", offsetof(struct sql_property_t, transaction), TYPE_INT, string_to_code}, {
         "group", offsetof(struct sql_property_t, group), TYPE_STRING, NULL}, {
         "table", offsetof(struct sql_property_t, table), TYPE_STRING, NULL}, {
-    "key", offsetof(struct sql_property_t, key), TYPE_STRING, NULL},};
+        "key", offsetof(struct sql_property_t, key), TYPE_STRING, NULL}, {
+        "batch", offsetof(struct sql_property_t, batch), TYPE_INT, string_to_int}, {
+    "batch_key", offsetof(struct sql_property_t, batch_key), TYPE_STRING, NULL},};
     int i = 0;
     for (i = 0; i < sizeof(desc) / sizeof(*desc); ++i) {
         if (strcasecmp(token, desc[i].name) == 0) {
@@ -41,6 +41,8 @@ typedef struct sql_property_t {
     char *group;
     char *table;
     char *key;
+    int batch;                  /* batch DML: key range per batch, 0 if disabled */
+    char *batch_key;            /* batch DML: integer key column */
 } sql_property_t;
 
 void sql_property_free(sql_property_t *);
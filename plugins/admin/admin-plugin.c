@@ -29,12 +29,17 @@
 #include <string.h>
 #include <malloc.h>
 
+#include "cetus-capture.h"
+#include "cetus-ddl-job.h"
+#include "cetus-memory.h"
 #include "cetus-users.h"
 #include "cetus-util.h"
 #include "cetus-variable.h"
+#include "cetus-workers.h"
 #include "character-set.h"
 #include "chassis-event.h"
 #include "chassis-options.h"
+#include "chassis-uring.h"
 #include "cetus-monitor.h"
 #include "glib-ext.h"
 #include "network-mysqld-packet.h"
@@ -69,6 +74,7 @@ struct chassis_plugin_config {
 };
 
 static struct event *g_sampling_timer = NULL;
+static struct event *g_memory_timer = NULL;
 
 /*
  * tokenize input, alloc and return nth token
@@ -647,6 +653,21 @@ admin_show_connectionlist(network_mysqld_con *admin_con, const char *sql)
     field->type = MYSQL_TYPE_STRING;
     g_ptr_array_add(fields, field);
 
+    field = network_mysqld_proto_fielddef_new();
+    field->name = g_strdup("Buffered");
+    field->type = MYSQL_TYPE_STRING;
+    g_ptr_array_add(fields, field);
+
+    field = network_mysqld_proto_fielddef_new();
+    field->name = g_strdup("Memory");
+    field->type = MYSQL_TYPE_STRING;
+    g_ptr_array_add(fields, field);
+
+    field = network_mysqld_proto_fielddef_new();
+    field->name = g_strdup("Mem_peak");
+    field->type = MYSQL_TYPE_STRING;
+    g_ptr_array_add(fields, field);
+
     if (config->has_shard_plugin) {
         field = network_mysqld_proto_fielddef_new();
         field->name = g_strdup("Xa");
@@ -720,6 +741,19 @@ admin_show_connectionlist(network_mysqld_con *admin_con, const char *sql)
 
         g_ptr_array_add(row, g_strdup(network_mysqld_con_st_name(con->state)));
 
+        snprintf(buffer, sizeof(buffer), "%llu%s", (unsigned long long)con->client->send_queue->len,
+                 con->shard_reads_paused ? " (paused)" : "");
+        g_ptr_array_add(row, g_strdup(buffer));
+
+        gsize usage = network_mysqld_con_memory(con);
+        if (usage > con->mem_peak) {
+            con->mem_peak = usage;
+        }
+        snprintf(buffer, sizeof(buffer), "%llu", (unsigned long long)usage);
+        g_ptr_array_add(row, g_strdup(buffer));
+        snprintf(buffer, sizeof(buffer), "%llu", (unsigned long long)con->mem_peak);
+        g_ptr_array_add(row, g_strdup(buffer));
+
         if (config->has_shard_plugin) {
             g_ptr_array_add(row, g_strdup(get_conn_xa_state_name(con->dist_tran_state)));
             if (con->dist_tran) {
@@ -1347,6 +1381,195 @@ admin_set_maintain(network_mysqld_con *con, const char *sql)
     return PROXY_SEND_RESULT;
 }
 
+static int
+admin_capture_start(network_mysqld_con *con, const char *sql)
+{
+    chassis *srv = con->srv;
+
+    if (!srv->capture_dir) {
+        network_mysqld_con_send_error(con->client, C("capture-dir is not set"));
+        return PROXY_SEND_RESULT;
+    }
+    if (srv->capture) {
+        network_mysqld_con_send_error(con->client, C("capture is running"));
+        return PROXY_SEND_RESULT;
+    }
+    srv->capture = capture_new(srv->capture_dir, srv->capture_max_size);
+    if (!srv->capture) {
+        network_mysqld_con_send_error(con->client, C("can't create capture file, see the log"));
+        return PROXY_SEND_RESULT;
+    }
+    network_mysqld_con_send_ok(con->client);
+    return PROXY_SEND_RESULT;
+}
+
+static int
+admin_capture_stop(network_mysqld_con *con, const char *sql)
+{
+    if (con->srv->capture) {
+        capture_free(con->srv->capture);
+        con->srv->capture = NULL;
+    }
+    network_mysqld_con_send_ok(con->client);
+    return PROXY_SEND_RESULT;
+}
+
+static int
+admin_send_capture_status(network_mysqld_con *con, const char *sql)
+{
+    capture_t *cap = con->srv->capture;
+    GPtrArray *fields = network_mysqld_proto_fielddefs_new();
+    GPtrArray *rows = g_ptr_array_new_with_free_func((void *)network_mysqld_mysql_field_row_free);
+    char records[32], bytes[32];
+
+    MAKE_FIELD_DEF_2_COL(fields, "Variable_name", "Value");
+    APPEND_ROW_2_COL(rows, "status", cap ? (capture_is_full(cap) ? "full" : "running") : "stopped");
+    APPEND_ROW_2_COL(rows, "file", cap ? (char *)capture_filename(cap) : "");
+    snprintf(records, sizeof(records), "%" G_GUINT64_FORMAT, cap ? capture_records(cap) : 0);
+    snprintf(bytes, sizeof(bytes), "%" G_GUINT64_FORMAT, cap ? capture_bytes(cap) : 0);
+    APPEND_ROW_2_COL(rows, "records", records);
+    APPEND_ROW_2_COL(rows, "bytes", bytes);
+
+    network_mysqld_con_send_resultset(con->client, fields, rows);
+
+    network_mysqld_proto_fielddefs_free(fields);
+    g_ptr_array_free(rows, TRUE);
+    return PROXY_SEND_RESULT;
+}
+
+#define MEMORY_TOP_CONNS 20
+
+typedef struct {
+    network_mysqld_con *con;
+    gsize usage;
+} con_memory_t;
+
+static gint
+con_memory_cmp(gconstpointer a, gconstpointer b)
+{
+    const con_memory_t *ca = a;
+    const con_memory_t *cb = b;
+    return ca->usage < cb->usage ? 1 : (ca->usage > cb->usage ? -1 : 0);
+}
+
+static void
+append_memory_row(GPtrArray *rows, const char *scope, const char *name,
+                  guint conns, guint64 current, guint64 peak)
+{
+    GPtrArray *row = g_ptr_array_new_with_free_func(g_free);
+    g_ptr_array_add(row, g_strdup(scope));
+    g_ptr_array_add(row, g_strdup(name));
+    g_ptr_array_add(row, g_strdup_printf("%u", conns));
+    g_ptr_array_add(row, g_strdup_printf("%" G_GUINT64_FORMAT, current));
+    g_ptr_array_add(row, g_strdup_printf("%" G_GUINT64_FORMAT, peak));
+    g_ptr_array_add(rows, row);
+}
+
+static int
+admin_select_memory_top(network_mysqld_con *con, const char *sql)
+{
+    chassis *chas = con->srv;
+    memory_stats_t *stats = chas->mem_stats;
+    GPtrArray *cons = chas->priv->cons;
+    static const char *names[] = { "Scope", "Name", "Conns", "Memory", "Peak" };
+    guint i;
+
+    memory_stats_sample(chas);
+
+    GPtrArray *fields = network_mysqld_proto_fielddefs_new();
+    for (i = 0; i < G_N_ELEMENTS(names); i++) {
+        MYSQL_FIELD *field = network_mysqld_proto_fielddef_new();
+        field->name = g_strdup(names[i]);
+        field->type = MYSQL_TYPE_STRING;
+        g_ptr_array_add(fields, field);
+    }
+
+    GPtrArray *rows = g_ptr_array_new_with_free_func((void *)network_mysqld_mysql_field_row_free);
+    append_memory_row(rows, "global", "", stats->conns, stats->total, stats->peak);
+
+    GHashTableIter iter;
+    gpointer key, value;
+    g_hash_table_iter_init(&iter, stats->users);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        memory_user_t *user = value;
+        append_memory_row(rows, "user", key, user->conns, user->current, user->peak);
+    }
+
+    GArray *usages = g_array_sized_new(FALSE, FALSE, sizeof(con_memory_t), cons->len);
+    for (i = 0; i < cons->len; i++) {
+        network_mysqld_con *c = g_ptr_array_index(cons, i);
+        if (!c->client || !c->plugin_con_state) {
+            continue;
+        }
+        con_memory_t item = { c, network_mysqld_con_memory(c) };
+        g_array_append_val(usages, item);
+    }
+    g_array_sort(usages, con_memory_cmp);
+
+    for (i = 0; i < usages->len && i < MEMORY_TOP_CONNS; i++) {
+        con_memory_t *item = &g_array_index(usages, con_memory_t, i);
+        network_socket *client = item->con->client;
+        char *name = g_strdup_printf("%s@%s",
+                                     client->response ? client->response->username->str : "",
+                                     client->src->name->str);
+        append_memory_row(rows, "connection", name, 1, item->usage, item->con->mem_peak);
+        g_free(name);
+    }
+    g_array_free(usages, TRUE);
+
+    network_mysqld_con_send_resultset(con->client, fields, rows);
+
+    network_mysqld_proto_fielddefs_free(fields);
+    g_ptr_array_free(rows, TRUE);
+    return PROXY_SEND_RESULT;
+}
+
+static int
+admin_select_workers(network_mysqld_con *con, const char *sql)
+{
+    chassis *chas = con->srv;
+    cetus_workers_t *workers = chas->workers;
+    static const char *names[] = { "Worker", "PID", "CPU", "Starts", "Started", "Connections",
+        "Client_query", "Proxyed_query"
+    };
+    guint i;
+
+    GPtrArray *fields = network_mysqld_proto_fielddefs_new();
+    for (i = 0; i < G_N_ELEMENTS(names); i++) {
+        MYSQL_FIELD *field = network_mysqld_proto_fielddef_new();
+        field->name = g_strdup(names[i]);
+        field->type = MYSQL_TYPE_STRING;
+        g_ptr_array_add(fields, field);
+    }
+
+    GPtrArray *rows = g_ptr_array_new_with_free_func((void *)network_mysqld_mysql_field_row_free);
+    for (i = 0; workers && i < workers->count; i++) {
+        cetus_worker_stats_t *w = &workers->worker[i];
+        char started[32] = "";
+        time_t t = (time_t)w->started;
+
+        if (w->starts) {
+            chassis_epoch_to_string(&t, C(started));
+        }
+        GPtrArray *row = g_ptr_array_new_with_free_func(g_free);
+        g_ptr_array_add(row, g_strdup_printf("%u%s", i, i == chas->worker_index ? " (this)" : ""));
+        g_ptr_array_add(row, g_strdup_printf("%d", w->pid));
+        g_ptr_array_add(row, g_strdup_printf("%d", w->cpu));
+        g_ptr_array_add(row, g_strdup_printf("%u", w->starts));
+        g_ptr_array_add(row, g_strdup(started));
+        g_ptr_array_add(row, g_strdup_printf("%" G_GUINT64_FORMAT, w->client_conns));
+        g_ptr_array_add(row, g_strdup_printf("%" G_GUINT64_FORMAT, w->client_query.ro + w->client_query.rw));
+        g_ptr_array_add(row, g_strdup_printf("%" G_GUINT64_FORMAT, w->proxyed_query.ro + w->proxyed_query.rw));
+        g_ptr_array_add(rows, row);
+    }
+
+    network_mysqld_con_send_resultset(con->client, fields, rows);
+
+    network_mysqld_proto_fielddefs_free(fields);
+    g_ptr_array_free(rows, TRUE);
+    return PROXY_SEND_RESULT;
+}
+
 static int
 admin_reload_shard(network_mysqld_con *con, const char *sql)
 {
@@ -1753,14 +1976,20 @@ admin_get_stats(network_mysqld_con *con, const char *sql)
     char buf1[32] = { 0 };
     char buf2[32] = { 0 };
     int i;
+    rw_op_t client_query = stats->client_query;
+    rw_op_t proxyed_query = stats->proxyed_query;
+    if (chas->workers) {
+        /* summed over all workers, the tables below stay per worker */
+        cetus_workers_query_total(chas->workers, &client_query, &proxyed_query);
+    }
     if (strcasecmp(p, "client_query") == 0) {
-        snprintf(buf1, 32, "%lu", stats->client_query.ro);
-        snprintf(buf2, 32, "%lu", stats->client_query.rw);
+        snprintf(buf1, 32, "%lu", client_query.ro);
+        snprintf(buf2, 32, "%lu", client_query.rw);
         APPEND_ROW_2_COL(rows, "client_query.ro", buf1);
         APPEND_ROW_2_COL(rows, "client_query.rw", buf2);
     } else if (strcasecmp(p, "proxyed_query") == 0) {
-        snprintf(buf1, 32, "%lu", stats->proxyed_query.ro);
-        snprintf(buf2, 32, "%lu", stats->proxyed_query.rw);
+        snprintf(buf1, 32, "%lu", proxyed_query.ro);
+        snprintf(buf2, 32, "%lu", proxyed_query.rw);
         APPEND_ROW_2_COL(rows, "proxyed_query.ro", buf1);
         APPEND_ROW_2_COL(rows, "proxyed_query.rw", buf2);
     } else if (strcasecmp(p, "query_time_table") == 0) {
@@ -1948,6 +2177,13 @@ admin_send_status(network_mysqld_con *con, const char *sql)
     GString *plugin_names = g_string_new(0);
     get_module_names(con->srv, plugin_names);
     APPEND_ROW_2_COL(rows, "Loaded modules", plugin_names->str);
+    APPEND_ROW_2_COL(rows, "Event method", (char *)chassis_event_loop_method(con->srv->event_base));
+    APPEND_ROW_2_COL(rows, "IO engine", chassis_uring_enabled() ? "io_uring" : "libevent");
+    char worker[32];
+    if (con->srv->workers) {
+        snprintf(worker, sizeof(worker), "%d of %d", con->srv->worker_index, con->srv->workers->count);
+        APPEND_ROW_2_COL(rows, "Worker", worker);
+    }
     const int bsize = 32;
     static char buf1[32], buf2[32], buf3[32];
     snprintf(buf1, bsize, "%d", network_backends_idle_conns(g->backends));
@@ -1968,6 +2204,26 @@ admin_send_status(network_mysqld_con *con, const char *sql)
         APPEND_ROW_2_COL(rows, "XA count", xacount);
     }
 
+    char merge_buffered[64];
+    snprintf(merge_buffered, sizeof(merge_buffered), "%lld (%d paused)",
+             (long long)con->srv->merge_buffered, con->srv->merge_paused);
+    APPEND_ROW_2_COL(rows, "Merge buffered bytes", merge_buffered);
+
+    char memory[128];
+    memory_stats_t *mem_stats = con->srv->mem_stats;
+    snprintf(memory, sizeof(memory), "%" G_GUINT64_FORMAT " (%u conns, peak %" G_GUINT64_FORMAT ", %"
+             G_GUINT64_FORMAT " killed, %" G_GUINT64_FORMAT " per idle conn)", mem_stats->total, mem_stats->conns,
+             mem_stats->peak, mem_stats->killed,
+             mem_stats->idle_conns ? mem_stats->idle_total / mem_stats->idle_conns : 0);
+    APPEND_ROW_2_COL(rows, "Client memory bytes", memory);
+
+    char spill[64];
+    if (config->has_shard_plugin) {
+        snprintf(spill, sizeof(spill), "%lld in memory, %llu spilled",
+                 (long long)con->srv->spill_resident, (unsigned long long)con->srv->spill_bytes);
+        APPEND_ROW_2_COL(rows, "Cross-shard rows bytes", spill);
+    }
+
     char qps[64];
     calc_qps_average(C(qps));
     APPEND_ROW_2_COL(rows, "QPS (1min, 5min, 15min)", qps);
@@ -2029,6 +2285,161 @@ admin_send_group_info(network_mysqld_con *con, const char *sql)
 
 }
 
+/* statement as sent by the client, the sql passed to handlers is normalized */
+static char *
+admin_raw_query(network_mysqld_con *con)
+{
+    GString *packet = g_queue_peek_head(con->client->recv_queue->chunks);
+    char *raw = g_strndup(packet->str + NET_HEADER_SIZE + 1, packet->len - NET_HEADER_SIZE - 1);
+    return g_strstrip(raw);
+}
+
+static const char *
+skip_token(const char *p)
+{
+    while (*p && !isspace(*p))
+        ++p;
+    while (isspace(*p))
+        ++p;
+    return p;
+}
+
+static int
+admin_submit_ddl_job(network_mysqld_con *con, const char *sql)
+{
+    char *raw = admin_raw_query(con);
+    const char *p = skip_token(skip_token(raw));    /* "ddl submit" */
+    ddl_job_options_t opts = { 0 };
+    char *db = NULL;
+    char *groups = NULL;
+    for (;;) {
+        const char *end = p;
+        while (*end && !isspace(*end))
+            ++end;
+        if (g_ascii_strncasecmp(p, C("parallel=")) == 0) {
+            opts.parallel = atoi(p + sizeof("parallel=") - 1);
+        } else if (g_ascii_strncasecmp(p, C("max_lag=")) == 0) {
+            opts.max_lag_msec = atoi(p + sizeof("max_lag=") - 1);
+        } else if (g_ascii_strncasecmp(p, C("db=")) == 0) {
+            g_free(db);
+            db = g_strndup(p + sizeof("db=") - 1, end - p - (sizeof("db=") - 1));
+        } else if (g_ascii_strncasecmp(p, C("groups=")) == 0) {
+            g_free(groups);
+            groups = g_strndup(p + sizeof("groups=") - 1, end - p - (sizeof("groups=") - 1));
+        } else {
+            break;
+        }
+        p = skip_token(p);
+    }
+    char *stmt = g_strdup(p);
+    g_strchomp(stmt);
+    size_t len = strlen(stmt);
+    if (len > 0 && stmt[len - 1] == ';') {
+        stmt[len - 1] = '\0';
+        g_strchomp(stmt);
+    }
+
+    GString *err = g_string_new(NULL);
+    guint job_id = 0;
+    if (stmt[0] == '\0') {
+        g_string_assign(err, "usage: ddl submit [parallel=<n>] [max_lag=<ms>] [db=<name>] [groups=<g1,g2>] <statement>");
+    } else {
+        opts.sql = stmt;
+        opts.db = db;
+        opts.groups = groups ? g_strsplit(groups, ",", -1) : NULL;
+        job_id = cetus_ddl_job_submit(con->srv, &opts, err);
+        g_strfreev(opts.groups);
+    }
+
+    if (job_id == 0) {
+        network_mysqld_con_send_error(con->client, S(err));
+    } else {
+        GPtrArray *fields = network_mysqld_proto_fielddefs_new();
+        MAKE_FIELD_DEF_1_COL(fields, "job_id");
+        GPtrArray *rows = g_ptr_array_new_with_free_func((void *)network_mysqld_mysql_field_row_free);
+        char idstr[16];
+        snprintf(idstr, sizeof(idstr), "%u", job_id);
+        APPEND_ROW_1_COL(rows, idstr);
+        network_mysqld_con_send_resultset(con->client, fields, rows);
+        network_mysqld_proto_fielddefs_free(fields);
+        g_ptr_array_free(rows, TRUE);
+    }
+    g_string_free(err, TRUE);
+    g_free(stmt);
+    g_free(db);
+    g_free(groups);
+    g_free(raw);
+    return PROXY_SEND_RESULT;
+}
+
+static int
+admin_control_ddl_job(network_mysqld_con *con, const char *sql)
+{
+    char *action = str_nth_token(sql, 1);
+    char *id = str_nth_token(sql, 2);
+    if (!action || !id) {
+        g_free(action);
+        g_free(id);
+        return PROXY_NO_DECISION;
+    }
+    GString *err = g_string_new(NULL);
+    gboolean ok;
+    if (strcasecmp(action, "retry") == 0) {
+        ok = cetus_ddl_job_retry(atoi(id), err);
+    } else {
+        ok = cetus_ddl_job_cancel(atoi(id), err);
+    }
+    if (ok) {
+        network_mysqld_con_send_ok(con->client);
+    } else {
+        network_mysqld_con_send_error(con->client, S(err));
+    }
+    g_string_free(err, TRUE);
+    g_free(action);
+    g_free(id);
+    return PROXY_SEND_RESULT;
+}
+
+static int
+admin_send_ddl_jobs(network_mysqld_con *con, const char *sql)
+{
+    GPtrArray *fields = network_mysqld_proto_fielddefs_new();
+    const char *names[] = { "job_id", "group", "state", "elapsed_ms", "error", "sql" };
+    int i;
+    for (i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+        MYSQL_FIELD *field = network_mysqld_proto_fielddef_new();
+        field->name = g_strdup(names[i]);
+        field->type = FIELD_TYPE_VAR_STRING;
+        g_ptr_array_add(fields, field);
+    }
+
+    GPtrArray *rows = g_ptr_array_new_with_free_func((void *)network_mysqld_mysql_field_row_free);
+    GPtrArray *status = cetus_ddl_job_status();
+    GPtrArray *numbers = g_ptr_array_new_with_free_func(g_free);
+    for (i = 0; i < status->len; ++i) {
+        ddl_shard_status_t *st = g_ptr_array_index(status, i);
+        GPtrArray *row = g_ptr_array_new();
+        char *job_id = g_strdup_printf("%u", st->job_id);
+        char *elapsed = g_strdup_printf("%" G_GINT64_FORMAT, st->elapsed_msec);
+        g_ptr_array_add(numbers, job_id);
+        g_ptr_array_add(numbers, elapsed);
+        g_ptr_array_add(row, job_id);
+        g_ptr_array_add(row, st->group);
+        g_ptr_array_add(row, (char *)st->state);
+        g_ptr_array_add(row, elapsed);
+        g_ptr_array_add(row, st->error);
+        g_ptr_array_add(row, st->sql);
+        g_ptr_array_add(rows, row);
+    }
+    network_mysqld_con_send_resultset(con->client, fields, rows);
+
+    network_mysqld_proto_fielddefs_free(fields);
+    g_ptr_array_free(rows, TRUE);
+    g_ptr_array_free(numbers, TRUE);
+    g_ptr_array_free(status, TRUE);
+    return PROXY_SEND_RESULT;
+}
+
 static int admin_help(network_mysqld_con *con, const char *sql);
 
 typedef int (*sql_handler_func) (network_mysqld_con *, const char *);
@@ -2041,6 +2452,13 @@ struct sql_handler_entry_t {
 };
 
 static struct sql_handler_entry_t sql_handler_shard_map[] = {
+    {"ddl submit ", admin_submit_ddl_job,
+     "ddl submit [parallel=<n>] [max_lag=<ms>] [db=<name>] [groups=<g1,g2>] <statement>",
+     "run statement on all groups in background"},
+    {"ddl retry ", admin_control_ddl_job, "ddl retry <job_id>", "run failed or cancelled groups of the job again"},
+    {"ddl cancel ", admin_control_ddl_job, "ddl cancel <job_id>", "cancel pending groups of the job"},
+    {"select * from ddl_jobs", admin_send_ddl_jobs,
+     "select * from ddl_jobs", "show ddl jobs and their progress on each group"},
     {"select conn_details from backend", admin_send_backend_detail_info,
      "select conn_details from backend", "display the idle conns"},
     {"select * from backends", admin_send_backends_info,
@@ -2067,6 +2485,16 @@ static struct sql_handler_entry_t sql_handler_shard_map[] = {
      "reduce memory", "reduce memory occupied by system"},
     {"set maintain ", admin_set_maintain,
      "set maintain (true|false)", "close all client connections if set to true"},
+    {"capture start", admin_capture_start,
+     "capture start", "capture client traffic into a new file in capture-dir"},
+    {"capture stop", admin_capture_stop,
+     "capture stop", "stop capturing client traffic"},
+    {"select * from capture", admin_send_capture_status,
+     "select * from capture", "show the state of the traffic capture"},
+    {"select * from memory_top", admin_select_memory_top,
+     "select * from memory_top", "list the client connections and users holding most memory"},
+    {"select * from workers", admin_select_workers,
+     "select * from workers", "list the prefork worker processes and their counters"},
     {"reload shard", admin_reload_shard,
      "reload shard", "reload sharding config from remote db"},
     {"show status", admin_show_status,
@@ -2140,6 +2568,16 @@ static struct sql_handler_entry_t sql_handler_rw_map[] = {
      "reduce memory", "reduce memory occupied by system"},
     {"set maintain ", admin_set_maintain,
      "set maintain (true|false)", "close all client connections if set to true"},
+    {"capture start", admin_capture_start,
+     "capture start", "capture client traffic into a new file in capture-dir"},
+    {"capture stop", admin_capture_stop,
+     "capture stop", "stop capturing client traffic"},
+    {"select * from capture", admin_send_capture_status,
+     "select * from capture", "show the state of the traffic capture"},
+    {"select * from memory_top", admin_select_memory_top,
+     "select * from memory_top", "list the client connections and users holding most memory"},
+    {"select * from workers", admin_select_workers,
+     "select * from workers", "list the prefork worker processes and their counters"},
     {"show status", admin_show_status,
      "show status [like '%<pattern>%']", "show select/update/insert/delete statistics"},
     {"show variables", admin_show_variables,
@@ -2186,6 +2624,32 @@ static struct sql_handler_entry_t sql_handler_rw_map[] = {
     {NULL, NULL, NULL, NULL}
 };
 
+/*
+ * commands changing the state of the process, with prefork workers each
+ * admin port reaches one worker only, so they are refused there
+ */
+static sql_handler_func admin_write_handlers[] = {
+    admin_add_allow_ip, admin_add_deny_ip, admin_delete_allow_ip, admin_delete_deny_ip,
+    admin_set_reduce_conns, admin_reduce_memory, admin_set_maintain,
+    admin_capture_start, admin_capture_stop, admin_reload_shard,
+    admin_update_user_password, admin_delete_user_password,
+    admin_insert_backend, admin_add_backend, admin_update_backend, admin_delete_backend,
+    admin_set_config, admin_reset_stats, admin_submit_ddl_job, admin_control_ddl_job,
+    NULL
+};
+
+static gboolean
+admin_handler_is_write(sql_handler_func func)
+{
+    int i;
+    for (i = 0; admin_write_handlers[i]; ++i) {
+        if (admin_write_handlers[i] == func) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
 static int
 admin_help(network_mysqld_con *con, const char *sql)
 {
@@ -2251,6 +2715,11 @@ admin_process_query(network_mysqld_con *con)
     int i;
     for (i = 0; sql_handler_map[i].prefix; ++i) {
         if (strcasestr(sql, sql_handler_map[i].prefix)) {
+            if (con->srv->workers && admin_handler_is_write(sql_handler_map[i].func)) {
+                network_mysqld_con_send_error(con->client,
+                                              C("not supported with worker-processes, change the config and restart"));
+                return PROXY_SEND_RESULT;
+            }
             return sql_handler_map[i].func(con, sql);
         }
     }
@@ -2313,13 +2782,14 @@ NETWORK_MYSQLD_PLUGIN_PROTO(admin_disconnect_client)
 static int
 network_mysqld_server_connection_init(network_mysqld_con *con)
 {
-    con->plugins.con_init = server_con_init;
-
-    con->plugins.con_read_auth = server_read_auth;
+    static const network_mysqld_hooks hooks = {
+        .con_init = server_con_init,
+        .con_read_auth = server_read_auth,
+        .con_read_query = server_read_query,
+        .con_cleanup = admin_disconnect_client,
+    };
 
-    con->plugins.con_read_query = server_read_query;
-
-    con->plugins.con_cleanup = admin_disconnect_client;
+    con->plugins = &hooks;
 
     return 0;
 }
@@ -2350,6 +2820,11 @@ network_mysqld_admin_plugin_free(chassis *chas, chassis_plugin_config *config)
         g_free(g_sampling_timer);
         g_sampling_timer = NULL;
     }
+    if (g_memory_timer) {
+        evtimer_del(g_memory_timer);
+        g_free(g_memory_timer);
+        g_memory_timer = NULL;
+    }
 
     if (config->admin_username)
         g_free(config->admin_username);
@@ -2468,6 +2943,20 @@ sql_stats_sampling_func(int fd, short what, void *arg)
     chassis_event_add_with_timeout(chas, g_sampling_timer, &ten_sec);
 }
 
+static void
+memory_sampling_func(int fd, short what, void *arg)
+{
+    chassis *chas = arg;
+
+    network_mysqld_con *largest = memory_stats_sample(chas);
+    if (chas->mem_kill_threshold > 0 && largest && chas->mem_stats->total > chas->mem_kill_threshold) {
+        memory_kill_connection(chas, largest, network_mysqld_con_memory(largest));
+    }
+
+    static struct timeval one_sec = { 1, 0 };
+    chassis_event_add_with_timeout(chas, g_memory_timer, &one_sec);
+}
+
 /**
  * init the plugin with the parsed config
  */
@@ -2541,6 +3030,16 @@ network_mysqld_admin_plugin_apply_config(chassis *chas, chassis_plugin_config *c
      */
     network_mysqld_server_connection_init(con);
 
+    if (chas->workers && chas->worker_index > 0) {
+        /* one admin port per worker, the changes made there apply to that worker only */
+        char *address = cetus_workers_admin_address(config->address, chas->worker_index);
+        if (chas->proxy_address == config->address) {
+            chas->proxy_address = address;
+        }
+        g_free(config->address);
+        config->address = address;
+    }
+
     g_message("%s:admin-server listening on port:%s", G_STRLOC, config->address);
     /* FIXME: network_socket_set_address() */
     if (0 != network_address_set_address(listen_sock->dst, config->address)) {
@@ -2570,6 +3069,11 @@ network_mysqld_admin_plugin_apply_config(chassis *chas, chassis_plugin_config *c
     evtimer_set(g_sampling_timer, sql_stats_sampling_func, chas);
     struct timeval ten_sec = { 10, 0 };
     chassis_event_add_with_timeout(chas, g_sampling_timer, &ten_sec);
+
+    g_memory_timer = g_new0(struct event, 1);
+    evtimer_set(g_memory_timer, memory_sampling_func, chas);
+    struct timeval one_sec = { 1, 0 };
+    chassis_event_add_with_timeout(chas, g_memory_timer, &one_sec);
     return 0;
 }
 
@@ -63,6 +63,9 @@ typedef int socklen_t;
 #include "character-set.h"
 #include "cetus-util.h"
 #include "cetus-users.h"
+#include "cetus-resolver.h"
+#include "cetus-upgrade.h"
+#include "cetus-workers.h"
 #include "plugin-common.h"
 #include "chassis-options.h"
 
@@ -367,35 +370,6 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_auth)
     return do_read_auth(con, con->config->allow_ip_table, con->config->deny_ip_table);
 }
 
-static int
-network_mysqld_con_handle_insert_id_response(network_mysqld_con *con, const char *name, int last_packet_id)
-{
-    char buffer[16];
-    GPtrArray *fields;
-    GPtrArray *rows;
-
-    fields = g_ptr_array_new_with_free_func((void *)network_mysqld_proto_fielddef_free);
-
-    MYSQL_FIELD *field;
-    field = network_mysqld_proto_fielddef_new();
-    field->name = g_strdup(name);
-    field->type = MYSQL_TYPE_LONGLONG;
-    g_ptr_array_add(fields, field);
-
-    rows = g_ptr_array_new_with_free_func((void *)network_mysqld_mysql_field_row_free);
-
-    GPtrArray *row = g_ptr_array_new();
-    snprintf(buffer, sizeof(buffer), "%d", last_packet_id);
-    g_ptr_array_add(row, buffer);
-    g_ptr_array_add(rows, row);
-
-    network_mysqld_con_send_resultset(con->client, fields, rows);
-
-    g_ptr_array_free(rows, TRUE);
-    g_ptr_array_free(fields, TRUE);
-    return 0;
-}
-
 static int
 process_non_trans_prepare_stmt(network_mysqld_con *con)
 {
@@ -459,19 +433,18 @@ process_other_set_command(network_mysqld_con *con, const char *key, const char *
 {
     g_debug("%s: vist process_other_set_command", G_STRLOC);
     network_socket *sock = con->client;
-    size_t s_len = strlen(s);
 
     if (strcasecmp(key, "character_set_client") == 0) {
-        g_string_assign_len(sock->charset_client, s, s_len);
+        network_socket_set_attr(sock, SOCKET_ATTR_CHARSET_CLIENT, s, strlen(s));
         query_attr->charset_client_set = 1;
     } else if (strcasecmp(key, "character_set_connection") == 0) {
-        g_string_assign_len(sock->charset_connection, s, s_len);
+        network_socket_set_attr(sock, SOCKET_ATTR_CHARSET_CONNECTION, s, strlen(s));
         query_attr->charset_connection_set = 1;
     } else if (strcasecmp(key, "character_set_results") == 0) {
-        g_string_assign_len(sock->charset_results, s, s_len);
+        network_socket_set_attr(sock, SOCKET_ATTR_CHARSET_RESULTS, s, strlen(s));
         query_attr->charset_results_set = 1;
     } else if (strcasecmp(key, "sql_mode") == 0) {
-        g_string_assign_len(sock->sql_mode, s, s_len);
+        network_socket_set_attr(sock, SOCKET_ATTR_SQL_MODE, s, strlen(s));
         query_attr->sql_mode_set = 1;
     }
     return 0;
@@ -481,11 +454,7 @@ static int
 process_set_names(network_mysqld_con *con, char *s, mysqld_query_attr_t *query_attr)
 {
     network_socket *sock = con->client;
-    size_t s_len = strlen(s);
-    g_string_assign_len(sock->charset, s, s_len);
-    g_string_assign_len(sock->charset_client, s, s_len);
-    g_string_assign_len(sock->charset_connection, s, s_len);
-    g_string_assign_len(sock->charset_results, s, s_len);
+    network_socket_set_names(sock, s, strlen(s));
 
     query_attr->charset_client_set = 1;
     query_attr->charset_connection_set = 1;
@@ -553,8 +522,8 @@ process_non_trans_query(network_mysqld_con *con, sql_context_t *context, mysqld_
             }
         }
         if (is_insert_id == TRUE) {
-            g_debug("%s: buffered last insert id:%d", G_STRLOC, (int)con->last_insert_id);
-            network_mysqld_con_handle_insert_id_response(con, last_insert_id_name, con->last_insert_id);
+            g_debug("%s: buffered last insert id:%llu", G_STRLOC, (unsigned long long)con->last_insert_id);
+            network_mysqld_con_send_insert_id(con->client, last_insert_id_name, con->last_insert_id);
             return PROXY_SEND_RESULT;
         }
         break;
@@ -609,7 +578,7 @@ process_non_trans_query(network_mysqld_con *con, sql_context_t *context, mysqld_
         if (con->is_auto_commit) {
             if (context->stmt_type == STMT_USE) {
                 char *dbname = (char *)context->sql_statement;
-                g_string_assign(con->client->default_db, dbname);
+                network_socket_set_attr(con->client, SOCKET_ATTR_DEFAULT_DB, dbname, strlen(dbname));
                 g_debug("%s:set default db:%s for con:%p", G_STRLOC, con->client->default_db->str, con);
             }
         }
@@ -728,136 +697,81 @@ change_server_by_rw(network_mysqld_con *con, int backend_ndx)
 static int
 adjust_sql_mode(network_mysqld_con *con, mysqld_query_attr_t *query_attr)
 {
-    char *clt_sql_mode, *srv_sql_mode;
+    network_socket *client = con->client;
+    network_socket *server = con->server;
 
-    if (con->client->sql_mode == NULL) {
-        clt_sql_mode = "";
-    } else {
-        clt_sql_mode = con->client->sql_mode->str;
+    if (!query_attr->sql_mode_set) {
+        if (!network_socket_attr_equal(client, server, SOCKET_ATTR_SQL_MODE)
+            && strcasecmp(network_socket_attr(client, SOCKET_ATTR_SQL_MODE),
+                          network_socket_attr(server, SOCKET_ATTR_SQL_MODE)) != 0) {
+            GString *packet = g_string_new(NULL);
+            g_string_append_c(packet, (char)COM_QUERY);
+            g_string_append(packet, "SET sql_mode='");
+            g_string_append(packet, network_socket_attr(client, SOCKET_ATTR_SQL_MODE));
+            g_string_append(packet, "'");
+            proxy_inject_packet(con, PROXY_QUEUE_ADD_PREPEND, INJ_ID_CHANGE_SQL_MODE, packet, TRUE);
+        }
     }
+    network_socket_copy_attr(server, client, SOCKET_ATTR_SQL_MODE);
 
-    if (con->server->sql_mode == NULL) {
-        srv_sql_mode = "";
-    } else {
-        srv_sql_mode = con->server->sql_mode->str;
-    }
+    return 0;
+}
 
-    if (!query_attr->sql_mode_set) {
-        if (strcasecmp(clt_sql_mode, srv_sql_mode) != 0) {
-            if (strcmp(clt_sql_mode, "") != 0) {
-                GString *packet = g_string_new(NULL);
-                g_string_append_c(packet, (char)COM_QUERY);
-                g_string_append(packet, "SET sql_mode='");
-                g_string_append_len(packet, con->client->sql_mode->str, con->client->sql_mode->len);
-                g_string_append(packet, "'");
-                proxy_inject_packet(con, PROXY_QUEUE_ADD_PREPEND, INJ_ID_CHANGE_SQL_MODE, packet, TRUE);
-            } else {
-                GString *packet = g_string_new(NULL);
-                g_string_append_c(packet, (char)COM_QUERY);
-                g_string_append(packet, "SET sql_mode=''");
-                proxy_inject_packet(con, PROXY_QUEUE_ADD_PREPEND, INJ_ID_CHANGE_SQL_MODE, packet, TRUE);
-            }
+static void
+adjust_charset_var(network_mysqld_con *con, socket_attr_t attr, const char *var, int inj_id, gboolean null_if_empty)
+{
+    network_socket *client = con->client;
+    network_socket *server = con->server;
 
-            g_string_assign_len(con->server->sql_mode, con->client->sql_mode->str, con->client->sql_mode->len);
+    if (!network_socket_attr_equal(client, server, attr)) {
+        if (client->attr[attr] != 0 || null_if_empty) {
+            GString *packet = g_string_new(NULL);
+            g_string_append_c(packet, (char)COM_QUERY);
+            g_string_append_printf(packet, "SET %s = %s", var,
+                                   client->attr[attr] != 0 ? network_socket_attr(client, attr) : "NULL");
+            proxy_inject_packet(con, PROXY_QUEUE_ADD_PREPEND, inj_id, packet, TRUE);
         }
-    } else {
-        g_string_assign_len(con->server->sql_mode, con->client->sql_mode->str, con->client->sql_mode->len);
     }
-
-    return 0;
 }
 
 static int
 adjust_charset(network_mysqld_con *con, mysqld_query_attr_t *query_attr)
 {
-    char *charset_str = NULL;
+    network_socket *client = con->client;
+    network_socket *server = con->server;
 
     if (!query_attr->charset_set) {
-        if (!g_string_equal(con->client->charset, con->server->charset)) {
-            GString *charset = con->client->charset;
-            if (charset->len > 0) {
+        if (!network_socket_attr_equal(client, server, SOCKET_ATTR_CHARSET)) {
+            if (client->attr[SOCKET_ATTR_CHARSET] != 0) {
                 query_attr->charset_reset = 1;
-                charset_str = charset->str;
-                g_string_assign_len(con->server->charset_client, charset->str, charset->len);
-                g_string_assign_len(con->server->charset_connection, charset->str, charset->len);
-                g_string_assign_len(con->server->charset_results, charset->str, charset->len);
+                /* SET NAMES below covers the other three as well */
+                network_socket_copy_names(server, client);
             }
-            g_string_assign_len(con->server->charset, charset->str, charset->len);
         }
-    } else {
-        GString *charset = con->client->charset;
-        g_string_assign_len(con->server->charset, charset->str, charset->len);
     }
+    network_socket_copy_attr(server, client, SOCKET_ATTR_CHARSET);
 
     if (!query_attr->charset_client_set) {
-        if (!g_string_equal(con->client->charset_client, con->server->charset_client)) {
-            if (con->client->charset_client->len > 0) {
-                GString *packet = g_string_new(NULL);
-                g_string_append_c(packet, (char)COM_QUERY);
-                g_string_append(packet, "SET character_set_client = ");
-                g_string_append(packet, con->client->charset_client->str);
-                proxy_inject_packet(con, PROXY_QUEUE_ADD_PREPEND, INJ_ID_CHAR_SET_CLT, packet, TRUE);
-            }
-            GString *charset_client = con->client->charset_client;
-            g_string_assign_len(con->server->charset_client, charset_client->str, charset_client->len);
-        }
-    } else {
-        GString *charset_client = con->client->charset_client;
-        g_string_assign_len(con->server->charset_client, charset_client->str, charset_client->len);
+        adjust_charset_var(con, SOCKET_ATTR_CHARSET_CLIENT, "character_set_client", INJ_ID_CHAR_SET_CLT, FALSE);
     }
+    network_socket_copy_attr(server, client, SOCKET_ATTR_CHARSET_CLIENT);
 
     if (!query_attr->charset_connection_set) {
-        if (!g_string_equal(con->client->charset_connection, con->server->charset_connection)) {
-            if (con->client->charset_connection->len > 0) {
-                GString *packet = g_string_new(NULL);
-                g_string_append_c(packet, (char)COM_QUERY);
-                g_string_append(packet, "SET character_set_connection = ");
-                g_string_append(packet, con->client->charset_connection->str);
-                proxy_inject_packet(con, PROXY_QUEUE_ADD_PREPEND, INJ_ID_CHAR_SET_CONN, packet, TRUE);
-            }
-            GString *charset_conn = con->client->charset_connection;
-            g_string_assign_len(con->server->charset_connection, charset_conn->str, charset_conn->len);
-        }
-    } else {
-        GString *charset_conn = con->client->charset_connection;
-        g_string_assign_len(con->server->charset_connection, charset_conn->str, charset_conn->len);
+        adjust_charset_var(con, SOCKET_ATTR_CHARSET_CONNECTION, "character_set_connection",
+                           INJ_ID_CHAR_SET_CONN, FALSE);
     }
+    network_socket_copy_attr(server, client, SOCKET_ATTR_CHARSET_CONNECTION);
 
     if (!query_attr->charset_results_set) {
-        if (!g_string_equal(con->client->charset_results, con->server->charset_results)) {
-            if (con->client->charset_results->len > 0) {
-                GString *packet = g_string_new(NULL);
-                g_string_append_c(packet, (char)COM_QUERY);
-                g_string_append(packet, "SET character_set_results = ");
-                g_string_append(packet, con->client->charset_results->str);
-                proxy_inject_packet(con, PROXY_QUEUE_ADD_PREPEND, INJ_ID_CHAR_SET_RESULTS, packet, TRUE);
-            } else {
-                GString *packet = g_string_new(NULL);
-                g_string_append_c(packet, (char)COM_QUERY);
-                g_string_append(packet, "SET character_set_results = NULL");
-                proxy_inject_packet(con, PROXY_QUEUE_ADD_PREPEND, INJ_ID_CHAR_SET_RESULTS, packet, TRUE);
-            }
-
-            GString *charset_results = con->client->charset_results;
-            g_string_assign_len(con->server->charset_results, charset_results->str, charset_results->len);
-        }
-    } else {
-        GString *charset_results = con->client->charset_results;
-        g_string_assign_len(con->server->charset_results, charset_results->str, charset_results->len);
+        adjust_charset_var(con, SOCKET_ATTR_CHARSET_RESULTS, "character_set_results", INJ_ID_CHAR_SET_RESULTS, TRUE);
     }
+    network_socket_copy_attr(server, client, SOCKET_ATTR_CHARSET_RESULTS);
 
     if (query_attr->charset_reset) {
         GString *packet = g_string_new(NULL);
         g_string_append_c(packet, (char)COM_QUERY);
         g_string_append(packet, "SET NAMES ");
-
-        if (strcmp(con->client->charset->str, "") == 0) {
-            g_warning("%s: client charset is empty:%s", G_STRLOC, con->client->src->name->str);
-            g_string_append(packet, "''");
-        } else {
-            g_string_append(packet, charset_str);
-        }
-
+        g_string_append(packet, network_socket_attr(client, SOCKET_ATTR_CHARSET));
         proxy_inject_packet(con, PROXY_QUEUE_ADD_PREPEND, INJ_ID_SET_NAMES, packet, TRUE);
     }
 
@@ -868,13 +782,12 @@ static int
 adjust_default_db(network_mysqld_con *con, enum enum_server_command cmd)
 {
     GString *clt_default_db = con->client->default_db;
-    GString *srv_default_db = con->server->default_db;
 
-    g_debug(G_STRLOC " default client db:%s", clt_default_db ? clt_default_db->str : "null");
-    g_debug(G_STRLOC " default server db:%s", srv_default_db ? srv_default_db->str : "null");
+    g_debug(G_STRLOC " default client db:%s", clt_default_db->str);
+    g_debug(G_STRLOC " default server db:%s", con->server->default_db->str);
 
     if (clt_default_db->len > 0) {
-        if (!g_string_equal(clt_default_db, srv_default_db)) {
+        if (!network_socket_attr_equal(con->client, con->server, SOCKET_ATTR_DEFAULT_DB)) {
             GString *packet = g_string_new(NULL);
             g_string_append_c(packet, (char)COM_INIT_DB);
             g_string_append_len(packet, clt_default_db->str, clt_default_db->len);
@@ -1375,12 +1288,15 @@ network_read_query(network_mysqld_con *con, proxy_plugin_con_t *st)
         g_debug("%s: set is_server_conn_reserved true:%p", G_STRLOC, con);
     }
 
-    adjust_sql_mode(con, &query_attr);
+    /* nothing to sync when the packed signatures match */
+    if (!network_socket_attrs_equal(con->client, con->server)) {
+        adjust_sql_mode(con, &query_attr);
 
-    adjust_charset(con, &query_attr);
+        adjust_charset(con, &query_attr);
 
-    if (command != COM_INIT_DB && con->rob_other_conn == 0) {
-        adjust_default_db(con, command);
+        if (command != COM_INIT_DB && con->rob_other_conn == 0) {
+            adjust_default_db(con, command);
+        }
     }
 
     if (command != COM_SET_OPTION) {
@@ -2156,17 +2072,18 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_disconnect_client)
 int
 network_mysqld_proxy_connection_init(network_mysqld_con *con)
 {
-    con->plugins.con_init = proxy_init;
-    con->plugins.con_connect_server = proxy_connect_server;
-    con->plugins.con_read_handshake = NULL;
-    con->plugins.con_read_auth = proxy_read_auth;
-    con->plugins.con_read_auth_result = NULL;
-    con->plugins.con_read_query = proxy_read_query;
-    con->plugins.con_get_server_conn_list = NULL;
-    con->plugins.con_read_query_result = proxy_read_query_result;
-    con->plugins.con_send_query_result = proxy_send_query_result;
-    con->plugins.con_cleanup = proxy_disconnect_client;
-    con->plugins.con_timeout = proxy_timeout;
+    static const network_mysqld_hooks hooks = {
+        .con_init = proxy_init,
+        .con_connect_server = proxy_connect_server,
+        .con_read_auth = proxy_read_auth,
+        .con_read_query = proxy_read_query,
+        .con_read_query_result = proxy_read_query_result,
+        .con_send_query_result = proxy_send_query_result,
+        .con_cleanup = proxy_disconnect_client,
+        .con_timeout = proxy_timeout,
+    };
+
+    con->plugins = &hooks;
 
     return 0;
 }
@@ -2328,6 +2245,8 @@ network_mysqld_proxy_plugin_apply_config(chassis *chas, chassis_plugin_config *c
         return -1;
     }
 
+    /* every prefork worker binds its own socket on the same port */
+    listen_sock->reuse_port = chas->workers != NULL;
     if (network_socket_bind(listen_sock)) {
         return -1;
     }
@@ -2347,6 +2266,9 @@ network_mysqld_proxy_plugin_apply_config(chassis *chas, chassis_plugin_config *c
     if (network_backends_load_config(g->backends, chas) != -1) {
         network_connection_pool_create_conns(chas);
     }
+    cetus_resolver_start(chas);
+    cetus_upgrade_init(chas);
+    cetus_workers_start(chas);
     chassis_config_register_service(chas->config_manager, config->address, "proxy");
 
     sql_filter_vars_load_default_rules();
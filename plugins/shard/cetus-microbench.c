@@ -0,0 +1,806 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+/*
+ * cetus-microbench: per-query CPU cost of the hot paths
+ *
+ *   parse/   sql_context_parse_len() over typical statement shapes
+ *   route/   sharding_parse_groups() against a large sharding config
+ *   merge/   resultset_merge() and callback_merge() on synthetic shard results
+ *   queue/   network_queue_pop_str() and packet framing
+ *   date/    chassis_epoch_from_string() and chassis_datetime_parse()
+ *
+ * Each case runs until --min-time has passed and reports ns/op and
+ * allocations/op. The malloc() family is interposed to count allocations
+ * (glibc only), which also covers g_malloc() and friends.
+ *
+ *   cetus-microbench --save=base.txt             # on the old build
+ *   cetus-microbench --baseline=base.txt         # on the new one
+ *
+ * with --baseline, the exit status is 1 if any case is slower than the
+ * baseline by more than --threshold percent or allocates more per op
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <glib.h>
+
+#include "chassis-mainloop.h"
+#include "chassis-timings.h"
+#include "network-mysqld.h"
+#include "network-mysqld-proto.h"
+#include "network-mysqld-packet.h"
+#include "resultset_merge.h"
+#include "shard-plugin-con.h"
+#include "sharding-config.h"
+#include "sharding-parser.h"
+#include "sql-context.h"
+
+#ifdef __GLIBC__
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+extern void *__libc_memalign(size_t alignment, size_t size);
+
+static guint64 alloc_count = 0;
+
+void *
+malloc(size_t size)
+{
+    alloc_count++;
+    return __libc_malloc(size);
+}
+
+void *
+calloc(size_t nmemb, size_t size)
+{
+    alloc_count++;
+    return __libc_calloc(nmemb, size);
+}
+
+void *
+realloc(void *ptr, size_t size)
+{
+    alloc_count++;
+    return __libc_realloc(ptr, size);
+}
+
+/* the aligned variants too, so that nothing reaches free() from another allocator */
+void *
+memalign(size_t alignment, size_t size)
+{
+    alloc_count++;
+    return __libc_memalign(alignment, size);
+}
+
+void *
+aligned_alloc(size_t alignment, size_t size)
+{
+    alloc_count++;
+    return __libc_memalign(alignment, size);
+}
+
+int
+posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    alloc_count++;
+    *memptr = __libc_memalign(alignment, size);
+    return *memptr ? 0 : ENOMEM;
+}
+
+void
+free(void *ptr)
+{
+    __libc_free(ptr);
+}
+#define ALLOCS_COUNTED 1
+#else
+static guint64 alloc_count = 0;
+#define ALLOCS_COUNTED 0
+#endif
+
+#define BENCH_NUM_GROUPS 32
+#define BENCH_NUM_TABLES 300
+
+/* measured section of a case, a case may start and stop it many times */
+typedef struct bench_timer_t {
+    gint64 elapsed_ns;
+    guint64 allocs;
+    gint64 start_ns;
+    guint64 start_allocs;
+} bench_timer_t;
+
+typedef struct bench_case_t {
+    char *name;
+    void (*run)(bench_timer_t *, gpointer arg, long n);
+    gpointer arg;
+} bench_case_t;
+
+static gint64
+now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (gint64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline void
+timer_start(bench_timer_t *t)
+{
+    t->start_allocs = alloc_count;
+    t->start_ns = now_ns();
+}
+
+static inline void
+timer_stop(bench_timer_t *t)
+{
+    t->elapsed_ns += now_ns() - t->start_ns;
+    t->allocs += alloc_count - t->start_allocs;
+}
+
+/* the lexer needs 2 trailing NULs */
+static GString *
+sql_buffer_new(const char *s)
+{
+    GString *sql = g_string_new(s);
+    g_string_append_c(sql, '\0');
+    g_string_append_c(sql, '\0');
+    return sql;
+}
+
+/*
+ * parse
+ */
+static const char *parse_corpus[][2] = {
+    {"point-select", "SELECT id, k, c, pad FROM sbtest1 WHERE id = 4711"},
+    {"range-order", "SELECT c FROM sbtest1 WHERE id BETWEEN 100 AND 199 ORDER BY c LIMIT 10"},
+    {"join", "SELECT o.id, o.amount, u.name FROM orders o JOIN users u ON o.user_id = u.id"
+     " WHERE u.id = 42 AND o.created >= '2018-01-01' ORDER BY o.id DESC LIMIT 20"},
+    {"group-having", "SELECT user_id, count(*), sum(amount), max(created) FROM orders WHERE status IN (1, 2, 3)"
+     " GROUP BY user_id HAVING count(*) > 2 ORDER BY user_id LIMIT 100"},
+    {"subquery", "SELECT id FROM users WHERE id IN (SELECT user_id FROM orders WHERE amount > 100)"
+     " AND name LIKE 'a%'"},
+    {"insert-multi", "INSERT INTO orders (id, user_id, amount, status, created) VALUES"
+     " (1, 10, 9.5, 1, '2018-01-01 10:00:00'), (2, 11, 19.5, 1, '2018-01-01 10:00:01'),"
+     " (3, 12, 29.5, 2, '2018-01-01 10:00:02'), (4, 13, 39.5, 2, '2018-01-01 10:00:03')"},
+    {"update", "UPDATE sbtest1 SET k = k + 1, c = 'abcdefghij' WHERE id = 4711"},
+    {"delete", "DELETE FROM sbtest1 WHERE id = 4711 AND k < 100"},
+    {"set-names", "SET NAMES utf8mb4"},
+    {"commented", "/*# group=data1 */ SELECT id FROM sbtest1 WHERE id = 1"},
+    {NULL, NULL}
+};
+
+static void
+run_parse(bench_timer_t *t, gpointer arg, long n)
+{
+    GString *sql = sql_buffer_new(arg);
+    sql_context_t context;
+    long i;
+
+    sql_context_init(&context);
+    timer_start(t);
+    for (i = 0; i < n; i++) {
+        sql_context_parse_len(&context, sql);
+    }
+    timer_stop(t);
+    sql_context_destroy(&context);
+    g_string_free(sql, TRUE);
+}
+
+/*
+ * route
+ */
+static const char *route_corpus[][2] = {
+    {"hash-point", "SELECT * FROM t0 WHERE id = 4711"},
+    {"hash-in-list", "SELECT * FROM t3 WHERE id IN (1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16)"},
+    {"hash-fanout", "SELECT * FROM t6 WHERE k > 10 ORDER BY id LIMIT 10"},
+    {"range-between", "SELECT * FROM t1 WHERE id BETWEEN 100000 AND 800000"},
+    {"date-point", "SELECT * FROM t2 WHERE created = '2016-06-15 10:20:30'"},
+    {"date-range", "SELECT count(*) FROM t2 WHERE created >= '2016-02-01' AND created < '2016-05-01'"},
+    {"date-in-list", "SELECT * FROM t5 WHERE created IN ('2015-03-02', '2018-11-30 23:59:59', '2016-07-07')"},
+    {"date-insert", "INSERT INTO t2 (id, created) VALUES (1, '2017-01-31 08:00:00')"},
+    {"date-update", "UPDATE t5 SET c = 'z' WHERE created = '2019-12-01 00:00:00' AND id = 7"},
+    {"join-same-key", "SELECT * FROM t0 a JOIN t3 b ON a.id = b.id WHERE a.id = 99"},
+    {"insert-hash", "INSERT INTO t0 (id, c) VALUES (77, 'x')"},
+    {"update-range", "UPDATE t1 SET c = 'y' WHERE id = 300001"},
+    {NULL, NULL}
+};
+
+/*
+ * vdb 1: int hash over 1024 logical shards, vdb 2: int range,
+ * vdb 3: monthly datetime intervals; BENCH_NUM_TABLES tables spread over them
+ */
+static char *
+route_config_new(void)
+{
+    GString *json = g_string_new("{\"vdb\": [");
+    int i, j;
+
+    g_string_append(json, "{\"id\": 1, \"type\": \"int\", \"method\": \"hash\", \"num\": 1024, \"partitions\": {");
+    for (i = 0; i < BENCH_NUM_GROUPS; i++) {
+        g_string_append_printf(json, "%s\"data%d\": [", i ? ", " : "", i + 1);
+        for (j = 0; j < 1024 / BENCH_NUM_GROUPS; j++) {
+            g_string_append_printf(json, "%s%d", j ? "," : "", i * (1024 / BENCH_NUM_GROUPS) + j);
+        }
+        g_string_append(json, "]");
+    }
+    g_string_append(json, "}}, {\"id\": 2, \"type\": \"int\", \"method\": \"range\", \"num\": 0, \"partitions\": {");
+    for (i = 0; i < BENCH_NUM_GROUPS; i++) {
+        g_string_append_printf(json, "%s\"data%d\": %d", i ? ", " : "", i + 1, (i + 1) * 100000 - 1);
+    }
+    g_string_append(json, "}}, {\"id\": 3, \"type\": \"datetime\", \"method\": \"range\", \"num\": 0,"
+                    " \"interval\": {\"unit\": \"month\", \"start\": \"2010-01-01\", \"ahead\": 3, \"groups\": [");
+    for (i = 0; i < BENCH_NUM_GROUPS; i++) {
+        g_string_append_printf(json, "%s\"data%d\"", i ? ", " : "", i + 1);
+    }
+    g_string_append(json, "]}}], \"table\": [");
+    for (i = 0; i < BENCH_NUM_TABLES; i++) {
+        int vdb = i % 3 + 1;
+        g_string_append_printf(json, "%s{\"vdb\": %d, \"db\": \"bench%d\", \"table\": \"t%d\", \"pkey\": \"%s\"}",
+                               i ? ", " : "", vdb, vdb, i, vdb == 3 ? "created" : "id");
+    }
+    g_string_append(json, "]}");
+    return g_string_free(json, FALSE);
+}
+
+static void
+run_route(bench_timer_t *t, gpointer arg, long n)
+{
+    GString *sql = sql_buffer_new(arg);
+    sql_context_t context;
+    query_stats_t stats;
+    long i;
+
+    /* t0, t3.. live in bench1, t1.. in bench2, t2.. in bench3 */
+    const char *p = strstr(arg, " t");
+    int table_no = p ? atoi(p + 2) : 0;
+    char db[16];
+    snprintf(db, sizeof(db), "bench%d", table_no % 3 + 1);
+    GString *default_db = g_string_new(db);
+
+    sql_context_init(&context);
+    memset(&stats, 0, sizeof(stats));
+    sql_context_parse_len(&context, sql);
+    timer_start(t);
+    for (i = 0; i < n; i++) {
+        sharding_plan_t *plan = sharding_plan_new(sql);
+        sharding_parse_groups(default_db, &context, &stats, 0, plan);
+        sharding_plan_free(plan);
+    }
+    timer_stop(t);
+    sql_context_destroy(&context);
+    g_string_free(default_db, TRUE);
+    g_string_free(sql, TRUE);
+}
+
+/*
+ * date, the literal parsing of datetime sharding keys alone
+ */
+static const char *date_corpus[][2] = {
+    {"datetime", "2017-06-15 10:20:30"},
+    {"date", "2016-02-01"},
+    {NULL, NULL}
+};
+
+static volatile gint64 date_sink;  /* keeps the loops */
+
+static void
+run_date_epoch(bench_timer_t *t, gpointer arg, long n)
+{
+    gint64 sum = 0;
+    gboolean ok;
+    long i;
+
+    timer_start(t);
+    for (i = 0; i < n; i++) {
+        sum += chassis_epoch_from_string(arg, &ok);
+    }
+    timer_stop(t);
+    date_sink = sum;
+}
+
+static void
+run_date_parse(bench_timer_t *t, gpointer arg, long n)
+{
+    gint64 sum = 0;
+    long i;
+
+    timer_start(t);
+    for (i = 0; i < n; i++) {
+        gint64 seconds = 0;
+        chassis_datetime_parse(arg, &seconds);
+        sum += seconds;
+    }
+    timer_stop(t);
+    date_sink = sum;
+}
+
+/*
+ * merge
+ */
+typedef struct merge_case_t {
+    const char *sql;
+    int shards;
+    int rows;                   /* per shard */
+    int batches;                /* > 1 streams the rows through callback_merge() */
+    gboolean overlapping;       /* same keys on all shards, for GROUP BY */
+} merge_case_t;
+
+static merge_case_t merge_cases[] = {
+    {"SELECT id, k FROM sbtest ORDER BY id LIMIT 100", 8, 1000, 1, FALSE},
+    {"SELECT id, k FROM sbtest ORDER BY id", 8, 1000, 1, FALSE},
+    {"SELECT id, k FROM sbtest", 8, 1000, 1, FALSE},
+    {"SELECT id, count(*) FROM sbtest GROUP BY id", 8, 1000, 1, TRUE},
+    {"SELECT id, k FROM sbtest ORDER BY id", 8, 1000, 10, FALSE},
+};
+
+static MYSQL_FIELD *
+merge_field_new(const char *name)
+{
+    MYSQL_FIELD *field = network_mysqld_proto_fielddef_new();
+    field->name = g_strdup(name);
+    field->org_name = g_strdup(name);
+    field->table = g_strdup("sbtest");
+    field->org_table = g_strdup("sbtest");
+    field->db = g_strdup("bench");
+    field->type = MYSQL_TYPE_LONGLONG;
+    field->flags = NUM_FLAG;
+    field->length = 20;
+    return field;
+}
+
+/* rows [from, to) of a shard, as the packets the server socket would have read */
+static void
+merge_fill_queue(network_socket *server, const merge_case_t *mc, int shard, int from, int to,
+                 gboolean header, gboolean eof)
+{
+    GPtrArray *fields = network_mysqld_proto_fielddefs_new();
+    GPtrArray *rows = g_ptr_array_new();
+    network_queue *recv_queue = server->recv_queue;
+    GString *packet;
+    int i;
+
+    g_ptr_array_add(fields, merge_field_new("id"));
+    g_ptr_array_add(fields, merge_field_new(mc->overlapping ? "count(*)" : "k"));
+    for (i = from; i < to; i++) {
+        GPtrArray *row = g_ptr_array_new();
+        long id = mc->overlapping ? i + 1 : (long)i * mc->shards + shard + 1;
+        g_ptr_array_add(row, g_strdup_printf("%ld", id));
+        g_ptr_array_add(row, g_strdup_printf("%d", shard + 1));
+        g_ptr_array_add(rows, row);
+    }
+
+    network_mysqld_queue_reset(server);
+    network_mysqld_con_send_resultset(server, fields, rows);
+
+    /* send_resultset() always writes a complete result set, keep the requested part */
+    guint skip = header ? 0 : fields->len + 2;
+    guint keep = server->send_queue->chunks->length - skip - (eof ? 0 : 1);
+    for (i = 0; (packet = g_queue_pop_head(server->send_queue->chunks)) != NULL; i++) {
+        if (i >= skip && i < skip + keep) {
+            network_queue_append(recv_queue, packet);
+        } else {
+            g_string_free(packet, TRUE);
+        }
+    }
+    server->send_queue->len = 0;
+    server->send_queue->offset = 0;
+
+    for (i = 0; i < rows->len; i++) {
+        GPtrArray *row = g_ptr_array_index(rows, i);
+        g_ptr_array_foreach(row, (GFunc)g_free, NULL);
+        g_ptr_array_free(row, TRUE);
+    }
+    g_ptr_array_free(rows, TRUE);
+    network_mysqld_proto_fielddefs_free(fields);
+}
+
+static void
+merge_data_free(network_mysqld_con *con)
+{
+    merge_parameters_t *data = con->data;
+    if (!data)
+        return;
+    g_free(data->heap);
+    g_free(data->elements);
+    g_free(data->candidates);
+    g_free(data);
+    con->data = NULL;
+}
+
+static void
+run_merge(bench_timer_t *t, gpointer arg, long n)
+{
+    const merge_case_t *mc = arg;
+    GString *sql = sql_buffer_new(mc->sql);
+    sql_context_t context;
+    shard_plugin_con_t *st = shard_plugin_con_new();
+    network_mysqld_con *con = network_mysqld_con_new();
+    chassis *srv = g_new0(chassis, 1);
+    network_queue *send_queue = network_queue_new();
+    GPtrArray *recv_queues = g_ptr_array_new();
+    int i, b;
+    long op;
+
+    sql_context_init(&context);
+    sql_context_parse_len(&context, sql);
+    st->sql_context = &context;
+
+    srv->merged_output_size = G_MAXINT32;
+    srv->compressed_merged_output_size = G_MAXINT32;
+    con->srv = srv;
+    con->plugin_con_state = st;
+    g_string_assign(con->orig_sql, mc->sql);
+    con->client = network_socket_new();
+    con->servers = g_ptr_array_new();
+    for (i = 0; i < mc->shards; i++) {
+        server_session_t *ss = g_new0(server_session_t, 1);
+        ss->server = network_socket_new();
+        ss->server->is_waiting = 1;     /* no read events, rows are fed below */
+        ss->index = i;
+        ss->con = con;
+        g_ptr_array_add(con->servers, ss);
+        g_ptr_array_add(recv_queues, ss->server->recv_queue);
+    }
+
+    for (op = 0; op < n; op++) {
+        int per_batch = (mc->rows + mc->batches - 1) / mc->batches;
+        uint64_t uniq_id = 0;
+        result_merge_t merged = { RM_SUCCESS, NULL };
+
+        con->partially_merged = 0;
+        con->num_pending_servers = mc->batches > 1 ? mc->shards : 0;
+        for (i = 0; i < mc->shards; i++) {
+            server_session_t *ss = g_ptr_array_index(con->servers, i);
+            merge_fill_queue(ss->server, mc, i, 0, MIN(per_batch, mc->rows), TRUE, mc->batches == 1);
+        }
+
+        timer_start(t);
+        resultset_merge(send_queue, recv_queues, con, &uniq_id, &merged);
+        timer_stop(t);
+
+        for (b = 1; b < mc->batches && merged.status == RM_SUCCESS; b++) {
+            gboolean last = (b == mc->batches - 1);
+            merge_parameters_t *data = con->data;
+            con->num_pending_servers = last ? 0 : mc->shards;
+            for (i = 0; i < mc->shards; i++) {
+                server_session_t *ss = g_ptr_array_index(con->servers, i);
+                merge_fill_queue(ss->server, mc, i, b * per_batch, MIN((b + 1) * per_batch, mc->rows), FALSE, last);
+                if (data->candidates[i] == NULL) {
+                    data->candidates[i] = g_queue_peek_head_link(ss->server->recv_queue->chunks);
+                }
+            }
+            timer_start(t);
+            if (callback_merge(con, data, last) == RM_FAIL) {
+                merged.status = RM_FAIL;
+            }
+            timer_stop(t);
+        }
+        if (merged.status != RM_SUCCESS) {
+            g_critical("%s: merge failed: %s", G_STRLOC, mc->sql);
+            exit(1);
+        }
+
+        merge_data_free(con);
+        network_queue_clear(send_queue);
+        for (i = 0; i < mc->shards; i++) {
+            network_queue_clear(g_ptr_array_index(recv_queues, i));
+        }
+    }
+
+    for (i = 0; i < mc->shards; i++) {
+        server_session_t *ss = g_ptr_array_index(con->servers, i);
+        network_socket_free(ss->server);
+        g_free(ss);
+    }
+    g_ptr_array_free(con->servers, TRUE);
+    con->servers = NULL;
+    network_socket_free(con->client);
+    con->client = NULL;
+    g_string_free(con->orig_sql, TRUE);
+    g_free(con);
+    g_free(srv);
+    g_free(st);
+    g_ptr_array_free(recv_queues, TRUE);
+    network_queue_free(send_queue);
+    sql_context_destroy(&context);
+    g_string_free(sql, TRUE);
+}
+
+/*
+ * queue
+ */
+static void
+run_queue_pop(bench_timer_t *t, gpointer arg, long n)
+{
+    gsize payload_len = GPOINTER_TO_UINT(arg);
+    network_queue *queue = network_queue_new();
+    GString *stream = g_string_new(NULL);
+    GString *header = g_string_sized_new(NET_HEADER_SIZE);
+    long i;
+    gsize off;
+
+    /* one batch of packets, delivered in segments of 1460 bytes */
+    for (i = 0; i < 64; i++) {
+        network_mysqld_proto_append_packet_len(stream, payload_len);
+        network_mysqld_proto_append_packet_id(stream, i);
+        g_string_set_size(stream, stream->len + payload_len);
+    }
+
+    long done = 0;
+    while (done < n) {
+        for (off = 0; off < stream->len; off += 1460) {
+            network_queue_append(queue, g_string_new_len(stream->str + off, MIN(1460, stream->len - off)));
+        }
+        timer_start(t);
+        while (done < n && network_queue_peek_str(queue, NET_HEADER_SIZE, header)) {
+            guint32 len = network_mysqld_proto_get_packet_len(header);
+            GString *packet = network_queue_pop_str(queue, NET_HEADER_SIZE + len, NULL);
+            if (!packet)
+                break;
+            g_string_free(packet, TRUE);
+            g_string_truncate(header, 0);
+            done++;
+        }
+        timer_stop(t);
+        network_queue_clear(queue);
+        g_string_truncate(header, 0);
+    }
+
+    g_string_free(header, TRUE);
+    g_string_free(stream, TRUE);
+    network_queue_free(queue);
+}
+
+static void
+run_queue_frame(bench_timer_t *t, gpointer arg, long n)
+{
+    gsize payload_len = GPOINTER_TO_UINT(arg);
+    network_socket *sock = network_socket_new();
+    char *payload = g_malloc0(payload_len);
+    long i;
+
+    network_mysqld_queue_reset(sock);
+    timer_start(t);
+    for (i = 0; i < n; i++) {
+        network_mysqld_queue_append(sock, sock->send_queue, payload, payload_len);
+        if (sock->send_queue->chunks->length >= 64) {
+            network_queue_clear(sock->send_queue);
+        }
+    }
+    timer_stop(t);
+    network_socket_free(sock);
+    g_free(payload);
+}
+
+static GPtrArray *
+bench_cases_new(void)
+{
+    GPtrArray *cases = g_ptr_array_new();
+    bench_case_t *c;
+    int i;
+
+#define ADD_CASE(_name, _run, _arg) do {            \
+        c = g_new0(bench_case_t, 1);                \
+        c->name = _name;                            \
+        c->run = _run;                              \
+        c->arg = (gpointer)(_arg);                  \
+        g_ptr_array_add(cases, c);                  \
+    } while (0)
+
+    for (i = 0; parse_corpus[i][0]; i++) {
+        ADD_CASE(g_strdup_printf("parse/%s", parse_corpus[i][0]), run_parse, parse_corpus[i][1]);
+    }
+    for (i = 0; route_corpus[i][0]; i++) {
+        ADD_CASE(g_strdup_printf("route/%s", route_corpus[i][0]), run_route, route_corpus[i][1]);
+    }
+    for (i = 0; i < G_N_ELEMENTS(merge_cases); i++) {
+        merge_case_t *mc = &merge_cases[i];
+        const char *kind = strstr(mc->sql, "GROUP BY") ? "group-by" : strstr(mc->sql, "LIMIT") ? "order-by-limit"
+            : strstr(mc->sql, "ORDER BY") ? "order-by" : "plain";
+        ADD_CASE(g_strdup_printf("merge/%s-%dx%d%s", kind, mc->shards, mc->rows,
+                                 mc->batches > 1 ? "-streamed" : ""), run_merge, mc);
+    }
+    ADD_CASE(g_strdup("queue/pop-str-200b"), run_queue_pop, GUINT_TO_POINTER(200));
+    ADD_CASE(g_strdup("queue/pop-str-4kb"), run_queue_pop, GUINT_TO_POINTER(4096));
+    ADD_CASE(g_strdup("queue/frame-200b"), run_queue_frame, GUINT_TO_POINTER(200));
+    ADD_CASE(g_strdup("queue/frame-64kb"), run_queue_frame, GUINT_TO_POINTER(65536));
+    for (i = 0; date_corpus[i][0]; i++) {
+        ADD_CASE(g_strdup_printf("date/epoch-%s", date_corpus[i][0]), run_date_epoch, date_corpus[i][1]);
+        ADD_CASE(g_strdup_printf("date/parse-%s", date_corpus[i][0]), run_date_parse, date_corpus[i][1]);
+    }
+#undef ADD_CASE
+
+    return cases;
+}
+
+typedef struct bench_result_t {
+    double ns_per_op;
+    double allocs_per_op;
+} bench_result_t;
+
+/* doubles the op count until a run takes at least min_time_ms */
+static void
+bench_measure(bench_case_t *c, int min_time_ms, bench_result_t *result)
+{
+    long n = 1;
+    bench_timer_t t;
+
+    for (;;) {
+        memset(&t, 0, sizeof(t));
+        c->run(&t, c->arg, n);
+        if (t.elapsed_ns >= (gint64)min_time_ms * 1000000 || n >= (1L << 30))
+            break;
+        if (t.elapsed_ns < 1000000) {
+            n *= 10;
+        } else {
+            n = MAX(n + 1, (long)(n * 1.2 * min_time_ms * 1000000 / t.elapsed_ns));
+        }
+    }
+    result->ns_per_op = (double)t.elapsed_ns / n;
+    result->allocs_per_op = (double)t.allocs / n;
+}
+
+/* "name ns_per_op allocs_per_op" per line, '#' starts a comment */
+static GHashTable *
+baseline_load(const char *filename)
+{
+    GHashTable *baseline = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    gchar *content = NULL;
+    GError *err = NULL;
+    gchar **lines;
+    int i;
+
+    if (!g_file_get_contents(filename, &content, NULL, &err)) {
+        fprintf(stderr, "can't read baseline: %s\n", err->message);
+        g_clear_error(&err);
+        g_hash_table_destroy(baseline);
+        return NULL;
+    }
+    lines = g_strsplit(content, "\n", -1);
+    for (i = 0; lines[i]; i++) {
+        char name[256];
+        bench_result_t r;
+        if (lines[i][0] == '#')
+            continue;
+        if (sscanf(lines[i], "%255s %lf %lf", name, &r.ns_per_op, &r.allocs_per_op) == 3) {
+            g_hash_table_insert(baseline, g_strdup(name), g_memdup(&r, sizeof(r)));
+        }
+    }
+    g_strfreev(lines);
+    g_free(content);
+    return baseline;
+}
+
+static gchar *opt_filter = NULL;
+static gchar *opt_baseline = NULL;
+static gchar *opt_save = NULL;
+static gint opt_min_time = 300;
+static gint opt_threshold = 10;
+static gboolean opt_list = FALSE;
+
+static GOptionEntry microbench_entries[] = {
+    {"filter", 'f', 0, G_OPTION_ARG_STRING, &opt_filter, "only run cases whose name contains this", "<str>"},
+    {"min-time", 't', 0, G_OPTION_ARG_INT, &opt_min_time, "milliseconds to run each case (default: 300)", "<ms>"},
+    {"baseline", 'b', 0, G_OPTION_ARG_FILENAME, &opt_baseline, "compare with a file written by --save", "<file>"},
+    {"threshold", 0, 0, G_OPTION_ARG_INT, &opt_threshold, "percent slower that counts as regression (default: 10)",
+     "<pct>"},
+    {"save", 's', 0, G_OPTION_ARG_FILENAME, &opt_save, "write the results as a baseline", "<file>"},
+    {"list", 'l', 0, G_OPTION_ARG_NONE, &opt_list, "list the cases", NULL},
+    {NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL}
+};
+
+int
+main(int argc, char **argv)
+{
+    GOptionContext *context;
+    GError *gerr = NULL;
+    GHashTable *baseline = NULL;
+    GString *saved = g_string_new("# cetus-microbench: name ns/op allocs/op\n");
+    int regressions = 0;
+    int i;
+
+    context = g_option_context_new("- microbenchmarks of the query hot paths");
+    g_option_context_add_main_entries(context, microbench_entries, NULL);
+    if (!g_option_context_parse(context, &argc, &argv, &gerr)) {
+        fprintf(stderr, "%s\n", gerr->message);
+        g_clear_error(&gerr);
+        g_option_context_free(context);
+        return 1;
+    }
+    g_option_context_free(context);
+
+    GPtrArray *cases = bench_cases_new();
+    if (opt_list) {
+        for (i = 0; i < cases->len; i++) {
+            bench_case_t *c = g_ptr_array_index(cases, i);
+            printf("%s\n", c->name);
+        }
+        return 0;
+    }
+    if (opt_baseline && !(baseline = baseline_load(opt_baseline))) {
+        return 1;
+    }
+
+    char *json = route_config_new();
+    if (!shard_conf_load(json, BENCH_NUM_GROUPS)) {
+        fprintf(stderr, "sharding config load error\n");
+        g_free(json);
+        return 1;
+    }
+    g_free(json);
+
+    printf("%-40s %12s %10s", "case", "ns/op", "allocs/op");
+    if (baseline)
+        printf(" %12s %8s", "base ns/op", "delta");
+    printf("\n");
+
+    for (i = 0; i < cases->len; i++) {
+        bench_case_t *c = g_ptr_array_index(cases, i);
+        bench_result_t r;
+
+        if (opt_filter && !strstr(c->name, opt_filter))
+            continue;
+
+        bench_measure(c, opt_min_time, &r);
+        if (ALLOCS_COUNTED) {
+            printf("%-40s %12.1f %10.2f", c->name, r.ns_per_op, r.allocs_per_op);
+        } else {
+            printf("%-40s %12.1f %10s", c->name, r.ns_per_op, "-");
+        }
+        g_string_append_printf(saved, "%s %.1f %.2f\n", c->name, r.ns_per_op, r.allocs_per_op);
+
+        bench_result_t *base = baseline ? g_hash_table_lookup(baseline, c->name) : NULL;
+        if (base) {
+            double delta = base->ns_per_op > 0 ? (r.ns_per_op - base->ns_per_op) * 100 / base->ns_per_op : 0;
+            gboolean slower = delta > opt_threshold;
+            gboolean more_allocs = ALLOCS_COUNTED && r.allocs_per_op > base->allocs_per_op + 0.5;
+            printf(" %12.1f %+7.1f%%%s%s", base->ns_per_op, delta,
+                   slower ? " SLOWER" : "", more_allocs ? " MORE-ALLOCS" : "");
+            if (slower || more_allocs)
+                regressions++;
+        }
+        printf("\n");
+        fflush(stdout);
+    }
+
+    if (opt_save && !g_file_set_contents(opt_save, saved->str, saved->len, &gerr)) {
+        fprintf(stderr, "can't write %s: %s\n", opt_save, gerr->message);
+        g_clear_error(&gerr);
+    }
+    g_string_free(saved, TRUE);
+    if (baseline) {
+        printf("%d regression(s) against %s\n", regressions, opt_baseline);
+        g_hash_table_destroy(baseline);
+    }
+
+    for (i = 0; i < cases->len; i++) {
+        bench_case_t *c = g_ptr_array_index(cases, i);
+        g_free(c->name);
+        g_free(c);
+    }
+    g_ptr_array_free(cases, TRUE);
+    shard_conf_destroy();
+    return regressions > 0 ? 1 : 0;
+}
@@ -33,6 +33,11 @@
 #include "chassis-event.h"
 #include "chassis-options.h"
 #include "cetus-monitor.h"
+#include "cetus-resolver.h"
+#include "cetus-upgrade.h"
+#include "cetus-workers.h"
+#include "cetus-row-cache.h"
+#include "cetus-sequence.h"
 #include "glib-ext.h"
 #include "network-backend.h"
 #include "network-conn-pool.h"
@@ -44,9 +49,12 @@
 #include "server-session.h"
 #include "shard-plugin-con.h"
 #include "sharding-config.h"
+#include "sharding-batch.h"
+#include "sharding-join.h"
 #include "sharding-parser.h"
 #include "sharding-query-plan.h"
 #include "sql-filter-variables.h"
+#include "sql-property.h"
 #include "cetus-log.h"
 
 #ifdef NETWORK_DEBUG_TRACE_STATE_CHANGES
@@ -63,6 +71,9 @@
 
 #define XA_LOG_BUF_LEN 2048
 
+/* rolls date partitions of interval vdbs */
+static struct event *g_partition_timer = NULL;
+
 struct chassis_plugin_config {
     /**< listening address of the proxy */
     gchar *address;
@@ -87,6 +98,13 @@ struct chassis_plugin_config {
 
     gchar *deny_ip;
     GHashTable *deny_ip_table;
+
+    /* limits of driver side rows and buffered memory for cross-shard join */
+    gint join_max_rows;
+    gint64 join_max_bytes;
+
+    /* max groups running batches of chunked UPDATE/DELETE at the same time */
+    gint batch_parallel;
 };
 
 /**
@@ -149,10 +167,9 @@ process_other_set_command(network_mysqld_con *con, const char *key, const char *
     g_debug("%s: vist process_other_set_command", G_STRLOC);
     con->conn_attr_check_omit = 1;
     network_socket *sock = con->client;
-    size_t s_len = strlen(s);
 
     if (strcasecmp(key, "sql_mode") == 0) {
-        g_string_assign_len(sock->sql_mode, s, s_len);
+        network_socket_set_attr(sock, SOCKET_ATTR_SQL_MODE, s, strlen(s));
         query_attr->sql_mode_set = 1;
     }
     return 0;
@@ -162,8 +179,7 @@ static int
 process_set_names(network_mysqld_con *con, char *s, mysqld_query_attr_t *query_attr)
 {
     network_socket *sock = con->client;
-    size_t s_len = strlen(s);
-    g_string_assign_len(sock->charset, s, s_len);
+    network_socket_set_names(sock, s, strlen(s));
 
     con->conn_attr_check_omit = 1;
 
@@ -183,7 +199,8 @@ check_backends_attr_changed(network_mysqld_con *con)
 
     for (i = 0; i < con->servers->len; i++) {
         server_session_t *ss = g_ptr_array_index(con->servers, i);
-        if (ss->backend->type != con->last_backends_type[i]) {
+        int last_type = con->last_backends_type ? con->last_backends_type[i] : 0;
+        if (ss->backend->type != last_type) {
             server_attr_changed = 1;
             break;
         }
@@ -249,6 +266,9 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_query)
         network_queue_clear(con->client->recv_queue);
         network_mysqld_queue_reset(con->client);
         return NETWORK_SOCKET_SUCCESS;
+    case PROXY_WAIT_SEQUENCE:
+        cetus_sequence_park(con);
+        return NETWORK_SOCKET_WAIT_FOR_EVENT;
     default:
         g_assert(0);
         break;
@@ -294,6 +314,9 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_query)
     case PROXY_NO_DECISION:
         con->state = ST_GET_SERVER_CONNECTION_LIST;
         break;
+    case PROXY_WAIT_SEQUENCE:
+        cetus_sequence_park(con);
+        return NETWORK_SOCKET_WAIT_FOR_EVENT;
 
     default:
         g_critical("%s: plugin(GET_SERVER_LIST) failed", G_STRLOC);
@@ -337,7 +360,8 @@ explain_shard_sql(network_mysqld_con *con, sharding_plan_t *plan)
 
     if (con->client->default_db->len == 0) {
         if (con->srv->default_db != NULL) {
-            g_string_assign_len(con->client->default_db, con->srv->default_db, strlen(con->srv->default_db));
+            network_socket_set_attr(con->client, SOCKET_ATTR_DEFAULT_DB, con->srv->default_db,
+                                    strlen(con->srv->default_db));
             g_debug("%s:set client default db:%s for con:%p", G_STRLOC, con->client->default_db->str, con);
         }
     }
@@ -353,7 +377,7 @@ explain_shard_sql(network_mysqld_con *con, sharding_plan_t *plan)
 
     sharding_plan_sort_groups(plan);
     int abnormal = 0;
-    if (rv == ERROR_UNPARSABLE) {
+    if (rv == ERROR_UNPARSABLE || rv == WAIT_SEQUENCE_LEASE) {
         const char *msg = st->sql_context->message ? : "sql parse error";
         network_mysqld_con_send_error_full(con->client, L(msg), ER_CETUS_PARSE_SHARDING, "HY000");
         g_message(G_STRLOC ": unparsable sql:%s", con->orig_sql->str);
@@ -397,10 +421,25 @@ proxy_generate_shard_explain_packet(network_mysqld_con *con)
         g_ptr_array_add(rows, row);
     }
 
+    GString *probe_sql = NULL;
+    if (plan->join) {           /* bind join: driver groups above, then the probe */
+        probe_sql = sharding_join_probe_sql(plan->join, "<keys from step 1>");
+        for (i = 0; i < plan->join->probe_groups->len; i++) {
+            GPtrArray *row = g_ptr_array_new();
+            GString *group = g_ptr_array_index(plan->join->probe_groups, i);
+            g_ptr_array_add(row, group->str);
+            g_ptr_array_add(row, probe_sql->str);
+            g_ptr_array_add(rows, row);
+        }
+    }
+
     network_mysqld_con_send_resultset(con->client, fields, rows);
 
     network_mysqld_proto_fielddefs_free(fields);
     g_ptr_array_free(rows, TRUE);
+    if (probe_sql) {
+        g_string_free(probe_sql, TRUE);
+    }
     sharding_plan_free(plan);
 }
 
@@ -513,7 +552,7 @@ analysis_query(network_mysqld_con *con, mysqld_query_attr_t *query_attr)
         break;
     case STMT_USE:{
         char *dbname = (char *)context->sql_statement;
-        g_string_assign(con->client->default_db, dbname);
+        network_socket_set_attr(con->client, SOCKET_ATTR_DEFAULT_DB, dbname, strlen(dbname));
         g_debug("%s:set default db:%s for con:%p", G_STRLOC, con->client->default_db->str, con);
         break;
     }
@@ -531,6 +570,71 @@ analysis_query(network_mysqld_con *con, mysqld_query_attr_t *query_attr)
     return PROXY_NO_DECISION;
 }
 
+/* SELECT NEXTVAL(seq [, k]) returns k rows */
+static int
+mysqld_con_send_nextval(network_mysqld_con *con, sql_expr_t *func)
+{
+    sql_expr_list_t *args = func->list;
+    const char *name = NULL;
+    gint64 count = 1;
+    if (args && args->len >= 1 && args->len <= 2) {
+        sql_expr_t *arg = g_ptr_array_index(args, 0);
+        if (arg->op == TK_ID || arg->op == TK_STRING) {
+            name = arg->token_text;
+        }
+        if (args->len == 2 && !sql_expr_get_int(g_ptr_array_index(args, 1), &count)) {
+            name = NULL;
+        }
+    }
+    if (!name || count < 1 || count > SEQUENCE_MAX_FETCH) {
+        network_mysqld_con_send_error_full(con->client,
+                                           C("(cetus) usage: NEXTVAL(sequence_name[, count <= 10000])"),
+                                           ER_CETUS_SEQUENCE, "HY000");
+        return PROXY_SEND_RESULT;
+    }
+    if (!cetus_sequence_enabled()) {
+        network_mysqld_con_send_error_full(con->client, C("(cetus) sequence not configured"),
+                                           ER_CETUS_SEQUENCE, "HY000");
+        return PROXY_SEND_RESULT;
+    }
+    guint64 *ids = g_new0(guint64, count);
+    int rc = cetus_sequence_next(name, count, ids);
+    if (rc != SEQUENCE_OK) {
+        g_free(ids);
+        if (rc == SEQUENCE_PENDING) {
+            return PROXY_WAIT_SEQUENCE;
+        }
+        network_mysqld_con_send_error_full(con->client, C("(cetus) sequence unavailable, retry later"),
+                                           ER_CETUS_SEQUENCE, "HY000");
+        return PROXY_SEND_RESULT;
+    }
+
+    GPtrArray *fields = network_mysqld_proto_fielddefs_new();
+    MYSQL_FIELD *field = network_mysqld_proto_fielddef_new();
+    field->name = g_strdup("NEXTVAL");
+    field->type = MYSQL_TYPE_LONGLONG;
+    g_ptr_array_add(fields, field);
+
+    GPtrArray *values = g_ptr_array_new_with_free_func(g_free);
+    GPtrArray *rows = g_ptr_array_new_with_free_func((void *)network_mysqld_mysql_field_row_free);
+    gint64 i;
+    for (i = 0; i < count; i++) {
+        char *value = g_strdup_printf("%llu", (unsigned long long)ids[i]);
+        g_ptr_array_add(values, value);
+        GPtrArray *row = g_ptr_array_new();
+        g_ptr_array_add(row, value);
+        g_ptr_array_add(rows, row);
+    }
+
+    network_mysqld_con_send_resultset(con->client, fields, rows);
+
+    network_mysqld_proto_fielddefs_free(fields);
+    g_ptr_array_free(rows, TRUE);
+    g_ptr_array_free(values, TRUE);
+    g_free(ids);
+    return PROXY_SEND_RESULT;
+}
+
 static int
 shard_handle_local_query(network_mysqld_con *con, sql_context_t *context)
 {
@@ -546,6 +650,10 @@ shard_handle_local_query(network_mysqld_con *con, sql_context_t *context)
         network_mysqld_con_send_current_date(con->client, "CURRENT_DATE");
     } else if (sql_expr_is_function(col, "CETUS_SEQUENCE")) {
         mysqld_con_send_sequence(con);
+    } else if (sql_expr_is_function(col, "NEXTVAL")) {
+        return mysqld_con_send_nextval(con, col);
+    } else if (sql_expr_is_function(col, "LAST_INSERT_ID")) {
+        network_mysqld_con_send_insert_id(con->client, "LAST_INSERT_ID()", con->last_insert_id);
     } else if (sql_expr_is_function(col, "CETUS_VERSION")) {
         network_mysqld_con_send_cetus_version(con->client);
     }
@@ -692,6 +800,9 @@ record_last_backends_type(network_mysqld_con *con)
     size_t i;
 
     g_debug("%s record_last_backends_type", G_STRLOC);
+    if (con->last_backends_type == NULL) {
+        con->last_backends_type = g_new0(char, MAX_SERVER_NUM);
+    }
     for (i = 0; i < con->servers->len; i++) {
         server_session_t *ss = g_ptr_array_index(con->servers, i);
         con->last_backends_type[i] = ss->backend->type;
@@ -782,7 +893,7 @@ process_init_db_when_get_server_list(network_mysqld_con *con, sharding_plan_t *p
         if (con->dist_tran) {
             *rv = USE_PREVIOUS_TRAN_CONNS;
         } else {
-            g_string_assign_len(con->client->default_db, db_name, name_len);
+            network_socket_set_attr(con->client, SOCKET_ATTR_DEFAULT_DB, db_name, name_len);
             sharding_plan_add_groups(plan, groups);
             g_ptr_array_free(groups, TRUE);
             network_mysqld_con_set_sharding_plan(con, plan);
@@ -1108,6 +1219,177 @@ make_decisions(network_mysqld_con *con, int rv, int *disp_flag)
     return 1;
 }
 
+/*
+ * declared global table has same data on every group of its vdb,
+ * prefer the group already holding a backend connection
+ */
+static void
+route_global_read_to_held_group(network_mysqld_con *con, sharding_plan_t *plan)
+{
+    if (plan->global_db == NULL || plan->groups->len != 1 || con->servers == NULL || con->servers->len == 0) {
+        return;
+    }
+    GString *fixed = g_ptr_array_index(plan->groups, 0);
+    GPtrArray *groups = g_ptr_array_new();
+    shard_conf_get_all_groups(groups, plan->global_db);
+
+    int i, j;
+    for (i = 0; i < con->servers->len; i++) {
+        server_session_t *ss = g_ptr_array_index(con->servers, i);
+        if (ss == NULL || ss->server == NULL || ss->server->group == NULL) {
+            continue;
+        }
+        if (g_string_equal(ss->server->group, fixed)) {
+            break;
+        }
+        for (j = 0; j < groups->len; j++) {
+            GString *gp = g_ptr_array_index(groups, j);
+            if (g_string_equal(ss->server->group, gp)) {
+                g_debug("%s: global table read uses held group:%s", G_STRLOC, gp->str);
+                sharding_plan_clear_group(plan);
+                sharding_plan_add_group(plan, gp);
+                g_ptr_array_free(groups, TRUE);
+                return;
+            }
+        }
+    }
+    g_ptr_array_free(groups, TRUE);
+}
+
+/**
+ * cross-shard join runs in 2 phases, hand the join over to connection,
+ * the core will issue the probe query after the driver results arrive
+ */
+static void
+prepare_bind_join(network_mysqld_con *con, sharding_plan_t *plan, int *rv)
+{
+    shard_plugin_con_t *st = con->plugin_con_state;
+    sharding_join_t *join = plan->join;
+    plan->join = NULL;
+
+    if (!con->is_auto_commit || con->is_in_transaction || con->dist_tran) {
+        sql_context_append_msg(st->sql_context, "(cetus) cross-shard JOIN inside transaction not supported");
+        st->sql_context->rc = PARSE_NOT_SUPPORT;
+        sharding_join_free(join);
+        sharding_plan_clear_group(plan);
+        *rv = ERROR_UNPARSABLE;
+        return;
+    }
+
+    chassis_plugin_config *config = con->config;
+    if (config->join_max_rows > 0) {
+        join->max_rows = config->join_max_rows;
+    }
+    if (config->join_max_bytes > 0) {
+        join->max_bytes = config->join_max_bytes;
+    }
+    GString *packet = g_queue_peek_head(con->client->recv_queue->chunks);
+    join->query_packet = g_string_new_len(S(packet));
+    con->bind_join = join;
+    con->could_be_tcp_streamed = 0;
+    g_debug("%s: bind join driver sql:%s", G_STRLOC, join->driver_sql->str);
+}
+
+/**
+ * chunked UPDATE/DELETE, ask every group for the bound of its first batch,
+ * the core will issue the batches and seek the next bounds
+ */
+static void
+prepare_batch_dml(network_mysqld_con *con, sharding_plan_t *plan, int *rv)
+{
+    shard_plugin_con_t *st = con->plugin_con_state;
+    sharding_batch_t *batch = NULL;
+
+    if (!con->is_auto_commit || con->is_in_transaction || con->dist_tran) {
+        sql_context_set_error(st->sql_context, PARSE_NOT_SUPPORT, "(cetus) batch DML inside transaction not supported");
+    } else if (plan->table_type == GLOBAL_TABLE) {
+        sql_context_set_error(st->sql_context, PARSE_NOT_SUPPORT, "(cetus) batch DML on global table not supported");
+    } else {
+        batch = sharding_batch_plan(st->sql_context, con->orig_sql);
+    }
+    if (!batch) {
+        sharding_plan_clear_group(plan);
+        *rv = ERROR_UNPARSABLE;
+        return;
+    }
+
+    chassis_plugin_config *config = con->config;
+    if (config->batch_parallel > 0) {
+        batch->parallel = config->batch_parallel;
+    }
+    int i;
+    for (i = 0; i < plan->groups->len; ++i) {
+        GString *group = g_ptr_array_index(plan->groups, i);
+        sharding_plan_add_group_sql(plan, group, sharding_batch_add_group(batch, group));
+    }
+    GString *packet = g_queue_peek_head(con->client->recv_queue->chunks);
+    batch->query_packet = g_string_new_len(S(packet));
+    con->batch_dml = batch;
+    con->could_be_tcp_streamed = 0;
+    *rv = USE_ANY_SHARDINGS;    /* every batch commits on its own, no XA */
+    g_debug("%s: batch DML on %u groups, step:%" G_GINT64_FORMAT, G_STRLOC, plan->groups->len, batch->step);
+}
+
+/**
+ * point lookups on sharding key are answered by the row cache, writes drop
+ * the keys they touch when they are sent and again when they are done
+ * @return TRUE if the result is sent from the cache
+ */
+static gboolean
+check_row_cache(network_mysqld_con *con, sharding_plan_t *plan, int rv)
+{
+    chassis *srv = con->srv;
+    network_socket *client = con->client;
+    shard_plugin_con_t *st = con->plugin_con_state;
+    sql_context_t *context = st->sql_context;
+
+    if (!srv->row_cache || rv == ERROR_UNPARSABLE || con->parse.command != COM_QUERY) {
+        return FALSE;
+    }
+    row_cache_ref_t *ref = sharding_row_cache_ref(context, client->default_db->str, plan);
+    if (!ref) {
+        return FALSE;
+    }
+    if (ref->is_write) {
+        row_cache_invalidate(srv->row_cache, ref);
+        con->row_cache_ref = ref;
+        return FALSE;
+    }
+
+    sql_select_t *select = context->sql_statement;
+    sql_expr_t *key = plan->point_key;
+    const char *sql = con->orig_sql->str;
+    const char *sql_end = sql + con->orig_sql->len;
+    if (rv != USE_SHARDING || plan->groups->len != 1 || con->is_in_transaction || !con->is_auto_commit
+        || con->is_client_compressed || con->last_record_updated || srv->master_preferred
+        || (context->rw_flag & (CF_WRITE | CF_FORCE_MASTER | CF_FORCE_SLAVE))
+        || !sql_context_is_cacheable(context) || (select->flags & SF_CALC_FOUND_ROWS)
+        || key->start < sql || key->end > sql_end) {
+        row_cache_ref_free(ref);
+        return FALSE;
+    }
+
+    /* statement shape with the key replaced, then the key literal */
+    g_string_printf(ref->lookup, "%s\n%s\n%s\n", client->response->username->str,
+                    network_socket_attr(client, SOCKET_ATTR_CHARSET_RESULTS), ref->table->str);
+    g_string_append_len(ref->lookup, sql, key->start - sql);
+    g_string_append_c(ref->lookup, '?');
+    g_string_append_len(ref->lookup, key->end, sql_end - key->end);
+    g_string_append_c(ref->lookup, '\n');
+    g_string_append_len(ref->lookup, key->start, key->end - key->start);
+
+    if (row_cache_lookup(srv->row_cache, ref, client->send_queue)) {
+        row_cache_ref_free(ref);
+        return TRUE;
+    }
+    client->do_query_cache = 1;
+    client->cache_queue = network_queue_new();
+    con->query_cache_judged = 1;    /* not for the query cache */
+    con->could_be_tcp_streamed = 0;
+    con->row_cache_ref = ref;
+    return FALSE;
+}
+
 static int
 proxy_get_server_list(network_mysqld_con *con)
 {
@@ -1117,13 +1399,23 @@ proxy_get_server_list(network_mysqld_con *con)
 
     before_get_server_list(con);
 
-    if (con->client->default_db->len == 0) {
-        g_string_assign(con->client->default_db, con->srv->default_db);
+    if (con->client->default_db->len == 0 && con->srv->default_db) {
+        network_socket_set_attr(con->client, SOCKET_ATTR_DEFAULT_DB, con->srv->default_db,
+                                strlen(con->srv->default_db));
         g_debug("%s:set default db:%s for con:%p", G_STRLOC, con->client->default_db->str, con);
     }
 
     con->use_all_prev_servers = 0;
 
+    if (con->bind_join) {       /* left over by an aborted join */
+        sharding_join_free(con->bind_join);
+        con->bind_join = NULL;
+    }
+    if (con->batch_dml) {
+        sharding_batch_free(con->batch_dml);
+        con->batch_dml = NULL;
+    }
+
     query_stats_t *stats = &(con->srv->query_stats);
     sharding_plan_t *plan = sharding_plan_new(con->orig_sql);
     int rv = 0, disp_flag = 0;
@@ -1138,6 +1430,25 @@ proxy_get_server_list(network_mysqld_con *con)
         break;
     default:
         rv = sharding_parse_groups(con->client->default_db, st->sql_context, stats, con->key, plan);
+        if (rv == WAIT_SEQUENCE_LEASE) {
+            sharding_plan_free(plan);
+            return PROXY_WAIT_SEQUENCE;
+        }
+        if (rv == USE_NON_SHARDING_TABLE && st->sql_context->stmt_type == STMT_SELECT
+            && plan->table_type == GLOBAL_TABLE) {
+            route_global_read_to_held_group(con, plan);
+        }
+        if (plan->join) {
+            prepare_bind_join(con, plan, &rv);
+        }
+        if (rv != ERROR_UNPARSABLE && st->sql_context->property && st->sql_context->property->batch > 0
+            && plan->groups->len > 0) {
+            prepare_batch_dml(con, plan, &rv);
+        }
+        if (check_row_cache(con, plan, rv)) {
+            sharding_plan_free(plan);
+            return PROXY_SEND_RESULT;
+        }
         break;
     }
 
@@ -1451,7 +1762,7 @@ check_and_set_attr_bitmap(network_mysqld_con *con)
 {
     size_t i;
     gboolean result = TRUE;
-    gboolean consistant;
+    gboolean consistant, attrs_same;
 
     if (con->conn_attr_check_omit) {    /* current sql is a SET statement */
         mysqld_query_attr_t *query_attr = &(con->query_attr);
@@ -1462,7 +1773,7 @@ check_and_set_attr_bitmap(network_mysqld_con *con)
         for (i = 0; i < con->servers->len; i++) {
             server_session_t *ss = g_ptr_array_index(con->servers, i);
             if (query_attr->charset_set) {
-                g_string_assign(ss->server->charset, con->client->charset->str);
+                network_socket_copy_names(ss->server, con->client);
             }
         }
         return result;
@@ -1484,6 +1795,8 @@ check_and_set_attr_bitmap(network_mysqld_con *con)
 
         consistant = TRUE;
         ss->attr_diff = 0;
+        /* one compare for the common case that nothing changed */
+        attrs_same = network_socket_attrs_equal(con->client, ss->server);
 
         if (ss->server->is_robbed) {
             ss->attr_diff = ATTR_DIF_CHANGE_USER;
@@ -1491,9 +1804,9 @@ check_and_set_attr_bitmap(network_mysqld_con *con)
             con->unmatched_attribute |= ATTR_DIF_CHANGE_USER;
             consistant = FALSE;
         } else {
-            if (con->parse.command != COM_INIT_DB) {
+            if (!attrs_same && con->parse.command != COM_INIT_DB) {
                 /* check default db */
-                if (!g_string_equal(con->client->default_db, ss->server->default_db)) {
+                if (!network_socket_attr_equal(con->client, ss->server, SOCKET_ATTR_DEFAULT_DB)) {
                     g_debug("%s:default db for client:%s", G_STRLOC, con->client->default_db->str);
                     ss->attr_diff = ATTR_DIF_DEFAULT_DB;
                     result = FALSE;
@@ -1504,17 +1817,20 @@ check_and_set_attr_bitmap(network_mysqld_con *con)
             }
         }
 
-        if (!g_string_equal(con->client->sql_mode, ss->server->sql_mode)) {
-            g_warning("%s: not support different sql modes", G_STRLOC);
-        }
+        if (!attrs_same) {
+            if (!network_socket_attr_equal(con->client, ss->server, SOCKET_ATTR_SQL_MODE)) {
+                g_warning("%s: not support different sql modes", G_STRLOC);
+            }
 
-        if (!g_string_equal(con->client->charset, ss->server->charset)) {
-            ss->attr_diff |= ATTR_DIF_CHARSET;
-            con->unmatched_attribute |= ATTR_DIF_CHARSET;
-            result = FALSE;
-            consistant = FALSE;
-            g_debug("%s: charset different, clt:%s, srv:%s, server:%p",
-                    G_STRLOC, con->client->charset->str, ss->server->charset->str, ss->server);
+            if (!network_socket_attr_equal(con->client, ss->server, SOCKET_ATTR_CHARSET)) {
+                ss->attr_diff |= ATTR_DIF_CHARSET;
+                con->unmatched_attribute |= ATTR_DIF_CHARSET;
+                result = FALSE;
+                consistant = FALSE;
+                g_debug("%s: charset different, clt:%s, srv:%s, server:%p", G_STRLOC,
+                        network_socket_attr(con->client, SOCKET_ATTR_CHARSET),
+                        network_socket_attr(ss->server, SOCKET_ATTR_CHARSET), ss->server);
+            }
         }
 
         if (con->client->is_multi_stmt_set != ss->server->is_multi_stmt_set) {
@@ -1719,10 +2035,8 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_get_server_conn_list)
         g_debug("%s: check_and_set_attr_bitmap is the same:%p", G_STRLOC, con);
         if (con->dist_tran && !con->dist_tran_xa_start_generated) {
             /* append xa query to send queue */
-            chassis *srv = con->srv;
             con->dist_tran_state = NEXT_ST_XA_QUERY;
-            con->xa_id = srv->dist_tran_id++;
-            snprintf(con->xid_str, XID_LEN, "'%s_%02d_%llu'", srv->dist_tran_prefix, tc_get_log_hour(), con->xa_id);
+            network_mysqld_con_make_xid(con);
             con->dist_tran_xa_start_generated = 1;
 
             con->is_start_trans_buffered = 0;
@@ -2019,17 +2333,18 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_disconnect_client)
 int
 network_mysqld_shard_connection_init(network_mysqld_con *con)
 {
-    con->plugins.con_init = proxy_init;
-    con->plugins.con_connect_server = proxy_connect_server;
-    con->plugins.con_read_handshake = NULL;
-    con->plugins.con_read_auth = proxy_read_auth;
-    con->plugins.con_read_auth_result = NULL;
-    con->plugins.con_read_query = proxy_read_query;
-    con->plugins.con_get_server_conn_list = proxy_get_server_conn_list;
-    con->plugins.con_read_query_result = NULL;
-    con->plugins.con_send_query_result = proxy_send_query_result;
-    con->plugins.con_cleanup = proxy_disconnect_client;
-    con->plugins.con_timeout = proxy_timeout;
+    static const network_mysqld_hooks hooks = {
+        .con_init = proxy_init,
+        .con_connect_server = proxy_connect_server,
+        .con_read_auth = proxy_read_auth,
+        .con_read_query = proxy_read_query,
+        .con_get_server_conn_list = proxy_get_server_conn_list,
+        .con_send_query_result = proxy_send_query_result,
+        .con_cleanup = proxy_disconnect_client,
+        .con_timeout = proxy_timeout,
+    };
+
+    con->plugins = &hooks;
 
     return 0;
 }
@@ -2071,6 +2386,11 @@ network_mysqld_shard_plugin_free(chassis *chas, chassis_plugin_config *config)
         chassis_config_unregister_service(chas->config_manager, config->address);
         g_free(config->address);
     }
+    if (g_partition_timer) {
+        evtimer_del(g_partition_timer);
+        g_free(g_partition_timer);
+        g_partition_timer = NULL;
+    }
     sql_filter_vars_destroy();
     g_debug("%s: call shard_conf_destroy", G_STRLOC);
     shard_conf_destroy();
@@ -2116,6 +2436,18 @@ network_mysqld_shard_plugin_get_options(chassis_plugin_config *config)
     chassis_options_add(&opts, "proxy-deny-ip",
                         0, 0, OPTION_ARG_STRING, &(config->deny_ip), "deny user@IP for proxy permission", NULL);
 
+    chassis_options_add(&opts, "proxy-join-max-rows",
+                        0, 0, OPTION_ARG_INT, &(config->join_max_rows),
+                        "max rows of driver side in cross-shard join (default: 10000)", NULL);
+
+    chassis_options_add(&opts, "proxy-join-max-bytes",
+                        0, 0, OPTION_ARG_INT64, &(config->join_max_bytes),
+                        "max memory buffered by cross-shard join (default: 16M)", NULL);
+
+    chassis_options_add(&opts, "proxy-batch-parallel",
+                        0, 0, OPTION_ARG_INT, &(config->batch_parallel),
+                        "max groups running chunked UPDATE/DELETE batches at the same time (default: 4)", NULL);
+
     return opts.options;
 }
 
@@ -2138,6 +2470,18 @@ sharding_conf_reload_callback(int fd, short what, void *arg)
     g_free(shard_json);
 }
 
+static void
+sharding_partition_rolling_func(int fd, short what, void *arg)
+{
+    chassis *chas = arg;
+
+    shard_conf_roll_partitions();
+
+    static struct timeval one_min = { 60, 0 };
+    /* EV_PERSIST not work for libevent1.4, re-activate timer each time */
+    chassis_event_add_with_timeout(chas, g_partition_timer, &one_min);
+}
+
 /**
  * init the plugin with the parsed config
  */
@@ -2204,6 +2548,8 @@ network_mysqld_shard_plugin_apply_config(chassis *chas, chassis_plugin_config *c
         return -1;
     }
 
+    /* every prefork worker binds its own socket on the same port */
+    listen_sock->reuse_port = chas->workers != NULL;
     if (network_socket_bind(listen_sock)) {
         return -1;
     }
@@ -2223,6 +2569,11 @@ network_mysqld_shard_plugin_apply_config(chassis *chas, chassis_plugin_config *c
     g_assert(chas->priv->monitor);
     cetus_monitor_register_object(chas->priv->monitor, "sharding", sharding_conf_reload_callback, chas);
 
+    g_partition_timer = g_new0(struct event, 1);
+    evtimer_set(g_partition_timer, sharding_partition_rolling_func, chas);
+    struct timeval one_min = { 60, 0 };
+    chassis_event_add_with_timeout(chas, g_partition_timer, &one_min);
+
     /**
      * call network_mysqld_con_accept() with this connection when we are done
      */
@@ -2235,6 +2586,9 @@ network_mysqld_shard_plugin_apply_config(chassis *chas, chassis_plugin_config *c
     if (network_backends_load_config(g->backends, chas) != -1) {
         network_connection_pool_create_conns(chas);
     }
+    cetus_resolver_start(chas);
+    cetus_upgrade_init(chas);
+    cetus_workers_start(chas);
     chassis_config_register_service(chas->config_manager, config->address, "shard");
 
     sql_filter_vars_shard_load_default_rules();
@@ -0,0 +1,68 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+/*
+ * sharding-ids-test: generated sharding keys of a multi-row INSERT follow
+ * row order, the first VALUES row gets the first id
+ *
+ * run by ctest, the exit status is 1 on failure
+ */
+
+#include <stdio.h>
+#include <glib.h>
+
+#include "sharding-parser.h"
+#include "sql-context.h"
+
+int
+main(int argc, char **argv)
+{
+    /* the scanner wants two trailing NULs */
+    GString *sql = g_string_new("INSERT INTO t0 (c, k) VALUES ('a', 1), ('b', 2), ('c', 3), ('d', 4)");
+    g_string_append_c(sql, '\0');
+    g_string_append_c(sql, '\0');
+    sql_context_t context;
+    int rc = 0;
+    guint64 ids[4] = { 1001, 1002, 1003, 1004 };
+
+    sql_context_init(&context);
+    sql_context_parse_len(&context, sql);
+    sql_insert_t *insert = context.sql_statement;
+    if (context.rc != PARSE_OK || context.stmt_type != STMT_INSERT || !insert->sel_val) {
+        fprintf(stderr, "can't parse %s\n", sql->str);
+        rc = 1;
+    } else {
+        sharding_values_append_ids(insert->sel_val, ids, 4);
+        sql_select_t *values;
+        for (values = insert->sel_val; values; values = values->prior) {
+            /* column k is the row number 1..4 */
+            sql_expr_t *row_no = g_ptr_array_index(values->columns, 1);
+            sql_expr_t *id = g_ptr_array_index(values->columns, values->columns->len - 1);
+            if (id->num_value != ids[row_no->num_value - 1]) {
+                fprintf(stderr, "row %" G_GUINT64_FORMAT " got id %" G_GUINT64_FORMAT "\n",
+                        (guint64)row_no->num_value, (guint64)id->num_value);
+                rc = 1;
+            }
+        }
+    }
+    sql_context_destroy(&context);
+    g_string_free(sql, TRUE);
+    return rc;
+}
@@ -31,6 +31,10 @@
 #include "sql-construction.h"
 #include "sql-property.h"
 #include "sharding-config.h"
+#include "sharding-join.h"
+#include "sharding-batch.h"
+#include "cetus-row-cache.h"
+#include "cetus-sequence.h"
 
 static gboolean
 is_compare_op(int op)
@@ -83,9 +87,49 @@ expr_is_compound_value(sql_expr_t *p)
         return FALSE;
     return p->op == TK_FUNCTION || p->op == TK_SELECT ||    /* subquery */
         p->op == TK_ID || p->op == TK_DOT ||    /* col, tbl.col */
+        p->op == TK_VECTOR ||   /* (a, b) */
         is_arithmetic_op(p->op);    /* 1+1, 3%2, 4 * 5, etc */
 }
 
+/* mark the sharding key inside a row value (a, b, ...) */
+static gboolean
+row_value_mark_key(sql_expr_t *row, const sql_src_item_t *tb, const char *key)
+{
+    if (row->op != TK_VECTOR || !row->list) {
+        return FALSE;
+    }
+    int i;
+    for (i = 0; i < row->list->len; ++i) {
+        sql_expr_t *elem = g_ptr_array_index(row->list, i);
+        if ((elem->op == TK_ID || elem->op == TK_DOT) && expr_is_sharding_key(elem, tb, key)) {
+            elem->flags |= EP_SHARD_COND;
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/**
+ * the item of row value 'value' at the position of the marked sharding key in 'key_row'
+ *   (id, name) = (1, 'a') ==> 1
+ * @return NULL if not comparable
+ */
+static sql_expr_t *
+row_value_key_item(const sql_expr_t *key_row, sql_expr_t *value)
+{
+    if (!value || value->op != TK_VECTOR || !value->list || value->list->len != key_row->list->len) {
+        return NULL;
+    }
+    int i;
+    for (i = 0; i < key_row->list->len; ++i) {
+        sql_expr_t *elem = g_ptr_array_index(key_row->list, i);
+        if (elem->flags & EP_SHARD_COND) {
+            return g_ptr_array_index(value->list, i);
+        }
+    }
+    return NULL;
+}
+
 static unsigned int
 supplemental_hash(unsigned int value)
 {
@@ -410,6 +454,18 @@ partitions_get(GPtrArray *from_partitions, struct condition_t cond)
     return NULL;
 }
 
+static gboolean
+partitions_contain(GPtrArray *partitions, sharding_partition_t *part)
+{
+    int i = 0;
+    for (i = 0; i < partitions->len; ++i) {
+        if (g_ptr_array_index(partitions, i) == part) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
 static void
 partitions_merge(GPtrArray *partitions, GPtrArray *other)
 {
@@ -443,9 +499,7 @@ string_to_sharding_value(const char *str, int expected, struct condition_t *cond
     if (expected == SHARD_DATA_TYPE_STR) {
         cond->v.str = str;
     } else if (expected == SHARD_DATA_TYPE_DATE || expected == SHARD_DATA_TYPE_DATETIME) {
-        gboolean ok;
-        cond->v.num = chassis_epoch_from_string(str, &ok);
-        if (!ok) {
+        if (!chassis_datetime_parse(str, &cond->v.num)) {
             g_warning(G_STRLOC ":error datetime format: %s", str);
             return PARSE_ERROR;
         }
@@ -463,8 +517,141 @@ string_to_sharding_value(const char *str, int expected, struct condition_t *cond
     return PARSE_OK;
 }
 
+static gboolean
+expr_is_cast(sql_expr_t *p, enum sql_cast_type_t type)
+{
+    return p->op == TK_FUNCTION && CAST_TYPE(p->num_value) == type && p->list && p->list->len == 1
+        && strcasecmp(p->token_text, "cast") == 0;
+}
+
+/* no overflow, operands of '*' are limited to 32 bits */
+static gboolean
+fold_int_arithmetic(int op, gint64 l, gint64 r, gint64 *value)
+{
+    switch (op) {
+    case TK_PLUS:
+        if ((r > 0 && l > G_MAXINT64 - r) || (r < 0 && l < G_MININT64 - r))
+            return FALSE;
+        *value = l + r;
+        return TRUE;
+    case TK_MINUS:
+        if ((r < 0 && l > G_MAXINT64 + r) || (r > 0 && l < G_MININT64 + r))
+            return FALSE;
+        *value = l - r;
+        return TRUE;
+    case TK_STAR:
+        if (l > G_MAXINT32 || l < -G_MAXINT32 || r > G_MAXINT32 || r < -G_MAXINT32)
+            return FALSE;
+        *value = l * r;
+        return TRUE;
+    case TK_SLASH:             /* result is a decimal unless divisible */
+        if (r == 0 || (l == G_MININT64 && r == -1) || l % r != 0)
+            return FALSE;
+        *value = l / r;
+        return TRUE;
+    case TK_REM:               /* sign follows the dividend, same as MySQL */
+        if (r == 0 || (l == G_MININT64 && r == -1))
+            return FALSE;
+        *value = l % r;
+        return TRUE;
+    default:
+        return FALSE;
+    }
+}
+
+/**
+ * fold a constant integer expression
+ *   1+0, -(2*3), 10 DIV 2 is not folded
+ *   CAST('5' AS SIGNED), CAST(5 AS UNSIGNED)
+ */
+static gboolean
+expr_fold_int(sql_expr_t *p, gint64 *value)
+{
+    gint64 l, r;
+    if (!p) {
+        return FALSE;
+    }
+    switch (p->op) {
+    case TK_INTEGER:
+        if (p->num_value > G_MAXINT64)
+            return FALSE;
+        *value = p->num_value;
+        return TRUE;
+    case TK_UMINUS:
+        if (!expr_fold_int(p->left, &l) || l == G_MININT64)
+            return FALSE;
+        *value = -l;
+        return TRUE;
+    case TK_UPLUS:
+        return expr_fold_int(p->left, value);
+    case TK_FUNCTION:
+        if (expr_is_cast(p, CAST_SIGNED) || expr_is_cast(p, CAST_UNSIGNED)) {
+            sql_expr_t *arg = g_ptr_array_index(p->list, 0);
+            if (arg->op == TK_STRING) {
+                char *endptr = NULL;
+                errno = 0;
+                l = g_ascii_strtoll(arg->token_text, &endptr, 10);
+                if (endptr == arg->token_text || *endptr != '\0' || errno != 0)
+                    return FALSE;
+            } else if (!expr_fold_int(arg, &l)) {
+                return FALSE;
+            }
+            if (l < 0 && expr_is_cast(p, CAST_UNSIGNED))
+                return FALSE;   /* wraps around */
+            *value = l;
+            return TRUE;
+        }
+        return FALSE;
+    default:
+        if (is_arithmetic_op(p->op)) {
+            return expr_fold_int(p->left, &l) && expr_fold_int(p->right, &r)
+                && fold_int_arithmetic(p->op, l, r, value);
+        }
+        return FALSE;
+    }
+}
+
+/*
+ * string literal, or CAST('abc' AS CHAR(n)). A cast that would truncate
+ * or pad the string is not folded, it routes to all shards.
+ */
+static const char *
+expr_fold_string(sql_expr_t *p)
+{
+    const char *str;
+    guint64 length;
+
+    if (p->op == TK_STRING) {
+        return p->token_text;
+    }
+    if (expr_is_cast(p, CAST_CHAR)) {
+        if ((str = expr_fold_string(g_ptr_array_index(p->list, 0))) == NULL) {
+            return NULL;
+        }
+        length = CAST_LENGTH(p->num_value);
+        if (length > 0 && strlen(str) > length - 1) {
+            /* CHAR(n) counts characters of the connection charset, utf8 only */
+            if (!g_utf8_validate(str, -1, NULL) || (guint64)g_utf8_strlen(str, -1) > length - 1) {
+                return NULL;
+            }
+        }
+        return str;
+    }
+    if (expr_is_cast(p, CAST_BINARY)) {
+        if ((str = expr_fold_string(g_ptr_array_index(p->list, 0))) == NULL) {
+            return NULL;
+        }
+        length = CAST_LENGTH(p->num_value);
+        if (length > 0 && strlen(str) != length - 1) {
+            return NULL;        /* BINARY(n) truncates or pads with 0x00 */
+        }
+        return str;
+    }
+    return NULL;
+}
+
 /**
- * parse cond.v from sql expression
+ * parse cond.v from sql expression, constant expressions are folded
  */
 static int
 expr_parse_sharding_value(sql_expr_t *p, int expected, struct condition_t *cond)
@@ -472,10 +659,11 @@ expr_parse_sharding_value(sql_expr_t *p, int expected, struct condition_t *cond)
     assert(p);
     assert(cond);
     gint64 intval;
-    if (sql_expr_get_int(p, &intval) && expected == SHARD_DATA_TYPE_INT) {
+    const char *str;
+    if (expected == SHARD_DATA_TYPE_INT && expr_fold_int(p, &intval)) {
         cond->v.num = intval;
-    } else if (p->op == TK_STRING) {
-        return string_to_sharding_value(p->token_text, expected, cond);
+    } else if ((str = expr_fold_string(p)) != NULL) {
+        return string_to_sharding_value(str, expected, cond);
     } else if (expr_is_compound_value(p)) {
         g_debug(G_STRLOC ":compound value, use all shard");
         return PARSE_UNRECOGNIZED;
@@ -498,9 +686,16 @@ partitions_filter_inequation_expr(GPtrArray *partitions, sql_expr_t *expr)
         return PARSE_OK;
     }
 
+    sql_expr_t *value = expr->right;
+    if (expr->left->op == TK_VECTOR) {  /* (key, b) = (1, 2) */
+        value = row_value_key_item(expr->left, expr->right);
+        if (!value) {
+            return PARSE_UNRECOGNIZED;
+        }
+    }
     struct condition_t cond = { 0 };
     cond.op = expr->op;
-    int rc = expr_parse_sharding_value(expr->right, conf->key_type, &cond);
+    int rc = expr_parse_sharding_value(value, conf->key_type, &cond);
     if (rc != PARSE_OK)
         return rc;
     partitions_filter(partitions, cond);
@@ -553,30 +748,38 @@ partitions_collect_IN_expr(GPtrArray *partitions, sql_expr_t *expr)
 
     struct condition_t cond = { 0 };
     if (expr->list && expr->list->len > 0) {
-        GPtrArray *partitions = g_ptr_array_new();
+        GPtrArray *collected = g_ptr_array_new();
 
         sql_expr_list_t *args = expr->list;
         int i;
         for (i = 0; i < args->len; ++i) {
             sql_expr_t *arg = g_ptr_array_index(args, i);
+            if (expr->left->op == TK_VECTOR) {  /* (key, b) IN ((1, 2), (3, 4)) */
+                arg = row_value_key_item(expr->left, arg);
+                if (!arg) {
+                    g_ptr_array_free(collected, TRUE);
+                    return PARSE_UNRECOGNIZED;
+                }
+            }
             cond.op = TK_EQ;
             int rc = expr_parse_sharding_value(arg, conf->key_type, &cond);
             if (rc != PARSE_OK) {
-                g_ptr_array_free(partitions, TRUE);
+                g_ptr_array_free(collected, TRUE);
                 return rc;
             }
-            partitions_collect(partitions, cond, partitions);
+            sharding_partition_t *part = partitions_get(partitions, cond);
+            if (part && !partitions_contain(collected, part)) {
+                g_ptr_array_add(collected, part);
+            }
         }
 
-        /* transfer partitions to partitions as output */
-        for (i = partitions->len - 1; i >= 0; --i) {
-            g_ptr_array_remove_index(partitions, i);
-        }
-        for (i = 0; i < partitions->len; ++i) {
-            gpointer *gp = g_ptr_array_index(partitions, i);
+        /* transfer collected partitions to partitions as output */
+        g_ptr_array_set_size(partitions, 0);
+        for (i = 0; i < collected->len; ++i) {
+            gpointer *gp = g_ptr_array_index(collected, i);
             g_ptr_array_add(partitions, gp);
         }
-        g_ptr_array_free(partitions, TRUE);
+        g_ptr_array_free(collected, TRUE);
         return PARSE_OK;
 
     } else {
@@ -684,6 +887,21 @@ optimize_sharding_condition(sql_expr_t *where, const sql_src_item_t *src, const
             continue;
         }
         if (is_compare_op(p->op) && !(p->flags & EP_JOIN_LINK)) {
+            if (p->left->op == TK_VECTOR || p->right->op == TK_VECTOR) {
+                /* only row equation decides the key, unify as (field, ..) = (CONST, ..) */
+                if (p->op == TK_EQ && p->left->op == TK_VECTOR && p->right->op == TK_VECTOR) {
+                    if (!row_value_mark_key(p->left, src, field) && row_value_mark_key(p->right, src, field)) {
+                        sql_expr_t *tmp = p->left;
+                        p->left = p->right;
+                        p->right = tmp;
+                    }
+                    if (row_value_key_item(p->left, p->right)) {
+                        p->flags |= EP_SHARD_COND;
+                        key_occur += 1;
+                    }
+                }
+                continue;
+            }
             /* the key might be on either side, unify as field = CONST */
             sql_expr_t *lhs = NULL, *rhs = NULL;
             if (p->left->op == TK_ID || p->left->op == TK_DOT) {
@@ -711,7 +929,7 @@ optimize_sharding_condition(sql_expr_t *where, const sql_src_item_t *src, const
                 key_occur += 1;
             }
         } else if (p->op == TK_IN) {
-            if (expr_is_sharding_key(p->left, src, field)) {
+            if (expr_is_sharding_key(p->left, src, field) || row_value_mark_key(p->left, src, field)) {
                 p->flags |= EP_SHARD_COND;
                 key_occur += 1;
             }
@@ -852,9 +1070,351 @@ sql_select_get_single_tables(sql_select_t *select, char *current_db, GList **sin
     }
 }
 
+#define JOIN_REF_LEFT 0x01
+#define JOIN_REF_RIGHT 0x02
+#define JOIN_REF_UNKNOWN 0x04
+
+static gboolean
+src_item_has_prefix(const sql_src_item_t *src, const char *prefix)
+{
+    if (src->table_alias) {
+        return strcmp(prefix, src->table_alias) == 0;
+    }
+    return strcasecmp(prefix, src->table_name) == 0;
+}
+
+/* which tables of a 2-table join are referenced by the expression */
 static int
-routing_select(sql_context_t *context, const sql_select_t *select,
-               char *default_db, guint32 fixture, query_stats_t *stats, GPtrArray *groups /* out */ )
+join_expr_refs(const sql_expr_t *p, const sql_src_item_t *left, const sql_src_item_t *right)
+{
+    if (!p) {
+        return 0;
+    }
+    if (p->select) {            /* sub-query */
+        return JOIN_REF_UNKNOWN;
+    }
+    if (p->op == TK_ID) {       /* unqualified column */
+        return JOIN_REF_UNKNOWN;
+    }
+    if (p->op == TK_DOT) {
+        const char *prefix = p->left->token_text;
+        if (p->right->op == TK_DOT) {   /* db.table.col */
+            prefix = p->right->left->token_text;
+        }
+        if (src_item_has_prefix(left, prefix)) {
+            return JOIN_REF_LEFT;
+        } else if (src_item_has_prefix(right, prefix)) {
+            return JOIN_REF_RIGHT;
+        }
+        return JOIN_REF_UNKNOWN;
+    }
+    int refs = join_expr_refs(p->left, left, right) | join_expr_refs(p->right, left, right);
+    int i;
+    for (i = 0; p->list && i < p->list->len; ++i) {
+        refs |= join_expr_refs(g_ptr_array_index(p->list, i), left, right);
+    }
+    return refs;
+}
+
+static void
+expr_split_conjuncts(sql_expr_t *p, GPtrArray *conjuncts)
+{
+    if (!p) {
+        return;
+    }
+    if (p->op == TK_AND) {
+        expr_split_conjuncts(p->left, conjuncts);
+        expr_split_conjuncts(p->right, conjuncts);
+    } else {
+        g_ptr_array_add(conjuncts, p);
+    }
+}
+
+static void
+append_expr_text(GString *s, const sql_expr_t *p)
+{
+    g_string_append_len(s, p->start, p->end - p->start);
+}
+
+static void
+append_src_text(GString *s, const sql_src_item_t *src)
+{
+    if (src->dbname) {
+        g_string_append_printf(s, "`%s`.", src->dbname);
+    }
+    g_string_append_printf(s, "`%s`", src->table_name);
+    if (src->table_alias) {
+        g_string_append_printf(s, " %s", src->table_alias);
+    }
+}
+
+static void
+append_conds_text(GString *s, GPtrArray *conds)
+{
+    int i;
+    for (i = 0; i < conds->len; ++i) {
+        g_string_append(s, i == 0 ? "(" : " AND (");
+        append_expr_text(s, g_ptr_array_index(conds, i));
+        g_string_append_c(s, ')');
+    }
+}
+
+static GString *
+sharding_join_route_key(sharding_join_t *join, const char *key)
+{
+    GPtrArray *partitions = g_ptr_array_new();
+    shard_conf_table_partitions(partitions, join->probe_db->str, join->probe_table->str);
+    GString *group = NULL;
+    if (partitions->len > 0) {
+        sharding_partition_t *part = g_ptr_array_index(partitions, 0);
+        struct condition_t cond = { TK_EQ, {0} };
+        if (string_to_sharding_value(key, part->vdb->key_type, &cond) == PARSE_OK) {
+            part = partitions_get(partitions, cond);
+            group = part ? part->group_name : NULL;
+        }
+    }
+    g_ptr_array_free(partitions, TRUE);
+    return group;
+}
+
+/**
+ * plan a bind join for 2 sharding tables which are not joined on sharding key,
+ * one side must be linked to the other by equation on its sharding key,
+ * it becomes the probe side. only simple select list and AND-ed conditions.
+ * @param groups [out] groups of driver side
+ */
+static sharding_join_t *
+sharding_join_plan(const sql_select_t *select, char *default_db, GPtrArray *groups)
+{
+    sql_src_list_t *sources = select->from_src;
+    if (select->prior || select->groupby_clause || select->having_clause || select->orderby_clause
+        || select->limit || (select->flags & SF_DISTINCT) || sources->len != 2
+        || sql_expr_list_find_aggregate(select->columns)) {
+        return NULL;
+    }
+    sql_src_item_t *src[2] = { g_ptr_array_index(sources, 0), g_ptr_array_index(sources, 1) };
+    if ((src[1]->jointype & (JT_LEFT | JT_RIGHT | JT_NATURAL)) || src[1]->pUsing) {
+        return NULL;
+    }
+    char *dbs[2];
+    sharding_table_t *info[2];
+    int i;
+    for (i = 0; i < 2; ++i) {
+        if (!src[i]->table_name) {
+            return NULL;
+        }
+        dbs[i] = src[i]->dbname ? src[i]->dbname : default_db;
+        info[i] = shard_conf_get_info(dbs[i], src[i]->table_name);
+        if (!info[i]) {
+            return NULL;
+        }
+    }
+
+    GPtrArray *conjuncts = g_ptr_array_new();
+    expr_split_conjuncts(select->where_clause, conjuncts);
+    expr_split_conjuncts(src[0]->on_clause, conjuncts);
+    expr_split_conjuncts(src[1]->on_clause, conjuncts);
+
+    GPtrArray *conds[2] = { g_ptr_array_new(), g_ptr_array_new() };
+    GString *cols[2] = { g_string_new(NULL), g_string_new(NULL) };
+    int ncols[2] = { 0, 0 };
+    sql_expr_t *link = NULL;
+    sharding_join_t *join = NULL;
+    gboolean ok = TRUE;
+    for (i = 0; i < conjuncts->len && ok; ++i) {
+        sql_expr_t *p = g_ptr_array_index(conjuncts, i);
+        int refs = join_expr_refs(p, src[0], src[1]);
+        if ((refs & JOIN_REF_UNKNOWN) || !p->start || !p->end) {
+            ok = FALSE;
+        } else if (refs == (JOIN_REF_LEFT | JOIN_REF_RIGHT)) {
+            if (link || p->op != TK_EQ || !sql_expr_is_field_name(p->left) || !sql_expr_is_field_name(p->right)
+                || join_expr_refs(p->left, src[0], src[1]) == join_expr_refs(p->right, src[0], src[1])) {
+                ok = FALSE;
+            }
+            link = p;
+        } else {
+            g_ptr_array_add(conds[refs == JOIN_REF_RIGHT ? 1 : 0], p);
+        }
+    }
+    if (!ok || !link) {
+        goto out;
+    }
+
+    sql_expr_t *link_col[2];
+    if (join_expr_refs(link->left, src[0], src[1]) == JOIN_REF_LEFT) {
+        link_col[0] = link->left;
+        link_col[1] = link->right;
+    } else {
+        link_col[0] = link->right;
+        link_col[1] = link->left;
+    }
+    if (!link_col[0]->start || !link_col[1]->start) {
+        goto out;
+    }
+
+    /* probe side is the one joined on its sharding key, prefer the right side */
+    int probe;
+    if (expr_is_sharding_key(link_col[1], src[1], info[1]->pkey->str)) {
+        probe = 1;
+    } else if (expr_is_sharding_key(link_col[0], src[0], info[0]->pkey->str)) {
+        probe = 0;
+    } else {
+        goto out;
+    }
+    int driver = 1 - probe;
+
+    join = sharding_join_new();
+    for (i = 0; i < select->columns->len; ++i) {
+        sql_expr_t *col = g_ptr_array_index(select->columns, i);
+        int refs = join_expr_refs(col, src[0], src[1]);
+        if (col->op == TK_STAR || (col->op == TK_DOT && col->right->op == TK_STAR) || !col->start || !col->end
+            || (refs & JOIN_REF_UNKNOWN) || refs == (JOIN_REF_LEFT | JOIN_REF_RIGHT)) {
+            ok = FALSE;
+            break;
+        }
+        int side = (refs == JOIN_REF_RIGHT) ? 1 : 0;
+        if (ncols[side] > 0) {
+            g_string_append(cols[side], ", ");
+        }
+        append_expr_text(cols[side], col);
+        if (col->alias && col->alias[0]) {
+            g_string_append_printf(cols[side], " AS `%s`", col->alias);
+        }
+        struct join_out_col_t out = { side == driver ? JOIN_SIDE_DRIVER : JOIN_SIDE_PROBE, ncols[side]++ };
+        g_array_append_val(join->out_cols, out);
+    }
+    if (!ok) {
+        sharding_join_free(join);
+        join = NULL;
+        goto out;
+    }
+
+    GString *sql = join->driver_sql;
+    g_string_append(sql, "SELECT ");
+    if (ncols[driver] > 0) {
+        g_string_append_printf(sql, "%s, ", cols[driver]->str);
+    }
+    append_expr_text(sql, link_col[driver]);
+    g_string_append(sql, " FROM ");
+    append_src_text(sql, src[driver]);
+    if (conds[driver]->len > 0) {
+        g_string_append(sql, " WHERE ");
+        append_conds_text(sql, conds[driver]);
+    }
+
+    sql = join->probe_sql_prefix;
+    g_string_append(sql, "SELECT ");
+    if (ncols[probe] > 0) {
+        g_string_append_printf(sql, "%s, ", cols[probe]->str);
+    }
+    append_expr_text(sql, link_col[probe]);
+    g_string_append(sql, " FROM ");
+    append_src_text(sql, src[probe]);
+    g_string_append(sql, " WHERE ");
+    if (conds[probe]->len > 0) {
+        append_conds_text(sql, conds[probe]);
+        g_string_append(sql, " AND ");
+    }
+    append_expr_text(sql, link_col[probe]);
+    g_string_append(sql, " IN (");
+
+    join->driver_ncols = ncols[driver];
+    join->probe_ncols = ncols[probe];
+    g_string_assign(join->probe_db, dbs[probe]);
+    g_string_assign(join->probe_table, src[probe]->table_name);
+    join->probe_key_is_str = info[probe]->shard_key_type != SHARD_DATA_TYPE_INT;
+    join->route_key = sharding_join_route_key;
+    shard_conf_get_table_groups(join->probe_groups, dbs[probe], src[probe]->table_name);
+
+    /* prune driver groups by its own sharding key conditions */
+    GPtrArray *partitions = g_ptr_array_new();
+    shard_conf_table_partitions(partitions, dbs[driver], src[driver]->table_name);
+    for (i = 0; i < conds[driver]->len; ++i) {
+        sql_expr_t *p = g_ptr_array_index(conds[driver], i);
+        if (optimize_sharding_condition(p, src[driver], info[driver]->pkey->str)) {
+            GPtrArray *filtered = partitions_dup(partitions);
+            if (partitions_filter_expr(filtered, p) == PARSE_OK) {
+                g_ptr_array_free(partitions, TRUE);
+                partitions = filtered;
+            } else {
+                g_ptr_array_free(filtered, TRUE);
+            }
+        }
+    }
+    partitions_get_group_names(partitions, groups);
+    g_ptr_array_free(partitions, TRUE);
+    if (groups->len == 0) {
+        shard_conf_get_table_groups(groups, dbs[driver], src[driver]->table_name);
+    }
+
+  out:
+    g_ptr_array_free(conjuncts, TRUE);
+    g_ptr_array_free(conds[0], TRUE);
+    g_ptr_array_free(conds[1], TRUE);
+    g_string_free(cols[0], TRUE);
+    g_string_free(cols[1], TRUE);
+    return join;
+}
+
+static gboolean
+expr_is_simple_value(sql_expr_t *p)
+{
+    return p->op == TK_INTEGER || p->op == TK_STRING || p->op == TK_UMINUS || p->op == TK_UPLUS;
+}
+
+/* value of the top level equation on sharding key, NULL if none */
+static sql_expr_t *
+sharding_key_equation_value(sql_expr_t *where)
+{
+    if (!where) {
+        return NULL;
+    }
+    GQueue *stack = g_queue_new();
+    g_queue_push_head(stack, where);
+    sql_expr_t *value = NULL;
+    while (!g_queue_is_empty(stack) && !value) {
+        sql_expr_t *p = g_queue_pop_head(stack);
+        if (p->op == TK_AND) {
+            if (p->right)
+                g_queue_push_head(stack, p->right);
+            if (p->left)
+                g_queue_push_head(stack, p->left);
+        } else if ((p->flags & EP_SHARD_COND) && p->op == TK_EQ && expr_is_simple_value(p->right)
+                   && p->right->start && p->right->end) {
+            value = p->right;
+        }
+    }
+    g_queue_free(stack);
+    return value;
+}
+
+/* db of the FROM tables if all are declared global tables of one db, otherwise NULL */
+static const char *
+sql_select_global_tables_db(const sql_select_t *select, char *default_db)
+{
+    sql_src_list_t *sources = select->from_src;
+    const char *global_db = NULL;
+    int i;
+    for (i = 0; sources && i < sources->len; ++i) {
+        sql_src_item_t *src = g_ptr_array_index(sources, i);
+        if (src->select || !src->table_name) {
+            return NULL;
+        }
+        char *db = src->dbname ? src->dbname : default_db;
+        if (!db || !shard_conf_is_global_table(db, src->table_name)) {
+            return NULL;
+        }
+        if (global_db && strcasecmp(global_db, db) != 0) {
+            return NULL;
+        }
+        global_db = db;
+    }
+    return global_db;
+}
+
+static int
+routing_select(sql_context_t *context, const sql_select_t *select, char *default_db, guint32 fixture,
+               query_stats_t *stats, GPtrArray *groups /* out */ , sharding_plan_t *plan /* out */ )
 {
     sql_src_list_t *sources = select->from_src;
     if (!sources) {
@@ -877,6 +1437,7 @@ routing_select(sql_context_t *context, const sql_select_t *select,
             }
             shard_conf_get_table_groups(groups, db, table);
             g_ptr_array_free(sharding_tables, TRUE);
+            plan->table_type = SHARDED_TABLE;
             return USE_ALL_SHARDINGS;
         }
         if (src->select) {      /* subquery not contain sharding table, try to find single table */
@@ -915,19 +1476,33 @@ routing_select(sql_context_t *context, const sql_select_t *select,
         } else {
             g_ptr_array_free(sharding_tables, TRUE);
             g_list_free(single_tables);
+            if (plan->table_type == GLOBAL_TABLE) {
+                plan->table_type = SINGLE_TABLE;
+            }
             return USE_NON_SHARDING_TABLE;
         }
     }
 
     if (sharding_tables->len == 0) {
         shard_conf_get_fixed_group(groups, db, fixture);
+        plan->global_db = sql_select_global_tables_db(select, default_db);
         g_ptr_array_free(sharding_tables, TRUE);
         stats->com_select_global += 1;
         return USE_NON_SHARDING_TABLE;
     }
 
+    /* global tables joined with sharding table exist on every group, route as sharding table alone */
+    plan->table_type = SHARDED_TABLE;
+
     if (sharding_tables->len >= 2) {
         if (!join_on_sharding_key(db, sharding_tables, select->where_clause)) {
+            if (sharding_tables->len == 2 && !plan->join) {
+                plan->join = sharding_join_plan(select, default_db, groups);
+                if (plan->join) {
+                    g_ptr_array_free(sharding_tables, TRUE);
+                    return USE_SHARDING;
+                }
+            }
             g_ptr_array_free(sharding_tables, TRUE);
             sql_context_append_msg(context, "(proxy)JOIN must inside VDB and have explicit join-on condition");
             return ERROR_UNPARSABLE;
@@ -975,6 +1550,12 @@ routing_select(sql_context_t *context, const sql_select_t *select,
     }
 
     if (groups->len > 0) {
+        if (groups->len == 1 && sources->len == 1 && !select->prior && select == context->sql_statement) {
+            sql_src_item_t *shard_table = g_ptr_array_index(sharding_tables, 0);
+            plan->point_key = sharding_key_equation_value(select->where_clause);
+            plan->point_db = db;
+            plan->point_table = shard_table->table_name;
+        }
         g_ptr_array_free(sharding_tables, TRUE);
         return USE_SHARDING;
     } else {
@@ -1187,6 +1768,57 @@ insert_multi_value(sql_context_t *context, sql_insert_t *insert,
     return rc;
 }
 
+void
+sharding_values_append_ids(sql_select_t *values, const guint64 *ids, guint count)
+{
+    /* the chain runs from the last row back to the first */
+    guint i = count;
+    for (; values && i > 0; values = values->prior) {
+        g_ptr_array_add(values->columns, sql_expr_new_int(ids[--i]));
+    }
+}
+
+/**
+ * sharding key omitted, append it to every VALUES tuple with ids from the
+ * table's sequence, all ids are taken in one call
+ * @return index of the sharding key, -1 on error, WAIT_SEQUENCE_LEASE if drained
+ */
+static int
+insert_fill_sharding_key(sql_context_t *context, sql_insert_t *insert, sharding_table_t *shard_info,
+                         sharding_plan_t *plan)
+{
+    sql_select_t *sel_val = insert->sel_val;
+    if (!sel_val || !sel_val->columns || sel_val->from_src) {
+        sql_context_append_msg(context, "(proxy)sharding key can only be generated for INSERT ... VALUES");
+        return -1;
+    }
+    guint count = 0;
+    sql_select_t *values;
+    for (values = sel_val; values; values = values->prior) {
+        if (!values->columns || values->columns->len != insert->columns->len) {
+            sql_context_append_msg(context, "(proxy)column count doesn't match value count");
+            return -1;
+        }
+        count++;
+    }
+    guint64 *ids = g_new0(guint64, count);
+    int rc = cetus_sequence_next(shard_info->sequence->str, count, ids);
+    if (rc != SEQUENCE_OK) {
+        g_free(ids);
+        if (rc == SEQUENCE_PENDING) {
+            sql_context_append_msg(context, "(proxy)sequence lease in progress, retry later");
+            return WAIT_SEQUENCE_LEASE;
+        }
+        sql_context_append_msg(context, "(proxy)sequence unavailable for sharding key");
+        return -1;
+    }
+    sharding_values_append_ids(sel_val, ids, count);
+    g_ptr_array_add(insert->columns, g_strdup(shard_info->pkey->str));
+    plan->generated_insert_id = ids[0];
+    g_free(ids);
+    return insert->columns->len - 1;
+}
+
 static int
 routing_insert(sql_context_t *context, sql_insert_t *insert, char *default_db, sharding_plan_t *plan, guint32 fixture)
 {
@@ -1236,6 +1868,17 @@ routing_insert(sql_context_t *context, sql_insert_t *insert, char *default_db, s
             break;
         }
     }
+    gboolean key_generated = FALSE;
+    if (shard_key_index == -1 && shard_info->sequence) {
+        shard_key_index = insert_fill_sharding_key(context, insert, shard_info, plan);
+        if (shard_key_index == WAIT_SEQUENCE_LEASE) {
+            return WAIT_SEQUENCE_LEASE;
+        }
+        if (shard_key_index == -1) {
+            return ERROR_UNPARSABLE;
+        }
+        key_generated = TRUE;
+    }
     if (shard_key_index == -1) {
         g_warning(G_STRLOC ":cannot find sharding colomn %s", shard_key);
         sql_context_append_msg(context, "(proxy)INSERTion into sharding table must use sharding key");
@@ -1274,7 +1917,13 @@ routing_insert(sql_context_t *context, sql_insert_t *insert, char *default_db, s
     GPtrArray *groups = g_ptr_array_new();
     partitions_get_group_names(partitions, groups);
     g_ptr_array_free(partitions, TRUE);
-    sharding_plan_add_groups(plan, groups);
+    if (key_generated && groups->len == 1) {
+        GString *sql = g_string_new(NULL);
+        sql_construct_insert(sql, insert);
+        sharding_plan_add_group_sql(plan, g_ptr_array_index(groups, 0), sql);
+    } else {
+        sharding_plan_add_groups(plan, groups);
+    }
     g_ptr_array_free(groups, TRUE);
 
     if (plan->groups->len == 0) {
@@ -1365,6 +2014,124 @@ routing_delete(sql_context_t *context, sql_delete_t *delete,
     return ERROR_UNPARSABLE;
 }
 
+/* find the longest IN list of sharding key, only those AND-ed at top level */
+static sql_expr_t *
+sharding_IN_expr_find(sql_expr_t *where)
+{
+    GQueue *stack = g_queue_new();
+    g_queue_push_head(stack, where);
+    sql_expr_t *found = NULL;
+    while (!g_queue_is_empty(stack)) {
+        sql_expr_t *p = g_queue_pop_head(stack);
+        if (p->op == TK_AND) {
+            if (p->right)
+                g_queue_push_head(stack, p->right);
+            if (p->left)
+                g_queue_push_head(stack, p->left);
+            continue;
+        }
+        if (p->op == TK_IN && (p->flags & EP_SHARD_COND) && p->list && p->list->len > 1) {
+            if (!found || p->list->len > found->list->len) {
+                found = p;
+            }
+        }
+    }
+    g_queue_free(stack);
+    return found;
+}
+
+/**
+ * rewrite IN list of sharding key, so that each group only receives the keys it owns
+ *   "id IN (1,2,3,4)" ==> group1: "id IN (1,3)", group2: "id IN (2,4)"
+ * rows of other keys never reside in this group, so the result is unchanged
+ */
+static void
+sharding_split_IN_list(sql_src_list_t *sources, sql_expr_t *where, char *default_db, sharding_plan_t *plan)
+{
+    if (!sources || !where || plan->groups->len < 2 || plan->sql_list) {
+        return;
+    }
+    char *db = default_db;
+    sharding_table_t *info = NULL;
+    int i, j;
+    for (i = 0; i < sources->len && !info; ++i) {
+        sql_src_item_t *src = g_ptr_array_index(sources, i);
+        db = src->dbname ? src->dbname : db;
+        if (src->table_name) {
+            info = shard_conf_get_info(db, src->table_name);
+        }
+    }
+    if (!info) {
+        return;
+    }
+    sql_expr_t *in_expr = sharding_IN_expr_find(where);
+    if (!in_expr) {
+        return;
+    }
+    sql_expr_list_t *args = in_expr->list;
+    for (i = 0; i < args->len; ++i) {
+        sql_expr_t *arg = g_ptr_array_index(args, i);
+        if (!arg->start || !arg->end) {
+            return;
+        }
+    }
+
+    GPtrArray *partitions = g_ptr_array_new();
+    shard_conf_table_partitions(partitions, db, info->name->str);
+
+    GPtrArray *key_lists = g_ptr_array_new();   /* GPtrArray<GString *>, same index as plan->groups */
+    for (j = 0; j < plan->groups->len; ++j) {
+        g_ptr_array_add(key_lists, g_string_new(NULL));
+    }
+    gboolean ok = TRUE;
+    for (i = 0; i < args->len; ++i) {
+        sql_expr_t *arg = g_ptr_array_index(args, i);
+        sql_expr_t *value = arg;
+        if (in_expr->left->op == TK_VECTOR) {   /* the whole row goes to the group */
+            value = row_value_key_item(in_expr->left, arg);
+        }
+        struct condition_t cond = { TK_EQ, {0} };
+        if (!value || expr_parse_sharding_value(value, info->shard_key_type, &cond) != PARSE_OK) {
+            ok = FALSE;
+            break;
+        }
+        sharding_partition_t *part = partitions_get(partitions, cond);
+        if (!part) {
+            continue;           /* out of range, no group owns it */
+        }
+        for (j = 0; j < plan->groups->len; ++j) {
+            GString *group = g_ptr_array_index(plan->groups, j);
+            if (g_string_equal(group, part->group_name)) {
+                GString *keys = g_ptr_array_index(key_lists, j);
+                if (keys->len > 0) {
+                    g_string_append_c(keys, ',');
+                }
+                g_string_append_len(keys, arg->start, arg->end - arg->start);
+                break;
+            }
+        }
+    }
+    g_ptr_array_free(partitions, TRUE);
+
+    for (j = 0; ok && j < key_lists->len; ++j) {
+        GString *keys = g_ptr_array_index(key_lists, j);
+        if (keys->len == 0) {
+            ok = FALSE;         /* group chosen by other conditions, keep the whole list */
+        }
+    }
+    sql_expr_t *first = g_ptr_array_index(args, 0);
+    sql_expr_t *last = g_ptr_array_index(args, args->len - 1);
+    if (ok && sharding_plan_set_in_list(plan, first->start, last->end)) {
+        for (j = 0; j < key_lists->len; ++j) {
+            sharding_plan_add_group_in_list(plan, g_ptr_array_index(plan->groups, j), g_ptr_array_index(key_lists, j));
+        }
+        g_ptr_array_free(key_lists, TRUE);
+    } else {
+        g_ptr_array_set_free_func(key_lists, g_string_true_free);
+        g_ptr_array_free(key_lists, TRUE);
+    }
+}
+
 int
 routing_by_property(sql_context_t *context, sql_property_t *property, char *default_db, GPtrArray *groups /* out */ )
 {
@@ -1453,15 +2220,27 @@ sharding_parse_groups(GString *default_db, sql_context_t *context, query_stats_t
     case STMT_SELECT:{
         sql_select_t *select = context->sql_statement;
         while (select) {
-            rc = routing_select(context, select, db, fixture, stats, groups);
+            rc = routing_select(context, select, db, fixture, stats, groups, plan);
             if (rc < 0) {
                 break;
             }
             select = select->prior; /* select->prior UNION select */
         }
+        if (((sql_select_t *)context->sql_statement)->prior) {
+            plan->global_db = NULL;
+        }
         sharding_plan_add_groups(plan, groups);
         g_ptr_array_free(groups, TRUE);
 
+        if (plan->join) {       /* groups are the driver side of bind join */
+            int i;
+            for (i = 0; i < plan->groups->len; ++i) {
+                GString *gp = g_ptr_array_index(plan->groups, i);
+                sharding_plan_add_group_sql(plan, gp, g_string_new(plan->join->driver_sql->str));
+            }
+            return rc;
+        }
+
         if ((rc == USE_SHARDING || rc == USE_ALL_SHARDINGS) && plan->groups->len > 1) {
             sharding_filter_sql(context);   /* only filter queries with sharding table */
             if (context->rc == PARSE_NOT_SUPPORT) {
@@ -1469,22 +2248,36 @@ sharding_parse_groups(GString *default_db, sql_context_t *context, query_stats_t
                 return ERROR_UNPARSABLE;
             }
         }
+        select = context->sql_statement;
+        if (rc == USE_SHARDING && !select->prior) {
+            sharding_split_IN_list(select->from_src, select->where_clause, db, plan);
+        }
         return rc;              /* TODO: result of first select */
     }
-    case STMT_UPDATE:
-        rc = routing_update(context, context->sql_statement, db, plan, groups, fixture);
+    case STMT_UPDATE:{
+        sql_update_t *update = context->sql_statement;
+        rc = routing_update(context, update, db, plan, groups, fixture);
         sharding_plan_add_groups(plan, groups);
         g_ptr_array_free(groups, TRUE);
+        if (rc == USE_DIS_TRAN) {
+            sharding_split_IN_list(update->table, update->where_clause, db, plan);
+        }
         return rc;
+    }
     case STMT_INSERT:
         rc = routing_insert(context, context->sql_statement, db, plan, fixture);
         g_ptr_array_free(groups, TRUE);
         return rc;
-    case STMT_DELETE:
-        rc = routing_delete(context, context->sql_statement, db, plan, groups, fixture);
+    case STMT_DELETE:{
+        sql_delete_t *delete = context->sql_statement;
+        rc = routing_delete(context, delete, db, plan, groups, fixture);
         sharding_plan_add_groups(plan, groups);
         g_ptr_array_free(groups, TRUE);
+        if (rc == USE_DIS_TRAN && delete) {
+            sharding_split_IN_list(delete->from_src, delete->where_clause, db, plan);
+        }
         return rc;
+    }
     case STMT_SHOW_WARNINGS:
         g_ptr_array_free(groups, TRUE);
         return USE_PREVIOUS_WARNING_CONN;
@@ -1755,3 +2548,254 @@ sharding_filter_sql(sql_context_t *context)
         }
     }
 }
+
+static gboolean
+is_plain_identifier(const char *name)
+{
+    const char *p;
+    for (p = name; *p; ++p) {
+        if (!g_ascii_isalnum(*p) && *p != '_' && *p != '.') {
+            return FALSE;
+        }
+    }
+    return p != name;
+}
+
+sharding_batch_t *
+sharding_batch_plan(sql_context_t *context, const GString *orig_sql)
+{
+    sql_property_t *property = context->property;
+    sql_src_list_t *tables = NULL;
+    sql_expr_t *where = NULL;
+    if (context->stmt_type == STMT_DELETE) {
+        sql_delete_t *delete = context->sql_statement;
+        if (delete->orderby_clause || delete->limit) {
+            sql_context_set_error(context, PARSE_NOT_SUPPORT, "(cetus) batch DELETE with ORDER BY or LIMIT");
+            return NULL;
+        }
+        tables = delete->from_src;
+        where = delete->where_clause;
+    } else if (context->stmt_type == STMT_UPDATE) {
+        sql_update_t *update = context->sql_statement;
+        if (update->orderby_clause || update->limit) {
+            sql_context_set_error(context, PARSE_NOT_SUPPORT, "(cetus) batch UPDATE with ORDER BY or LIMIT");
+            return NULL;
+        }
+        tables = update->table;
+        where = update->where_clause;
+    } else {
+        sql_context_set_error(context, PARSE_NOT_SUPPORT, "(cetus) batch only supports UPDATE and DELETE");
+        return NULL;
+    }
+    if (!tables || tables->len != 1) {
+        sql_context_set_error(context, PARSE_NOT_SUPPORT, "(cetus) batch only supports single table");
+        return NULL;
+    }
+    if (!is_plain_identifier(property->batch_key)) {
+        sql_context_set_error(context, PARSE_NOT_SUPPORT, "(cetus) invalid batch_key");
+        return NULL;
+    }
+
+    /* the condition is copied verbatim, nothing may follow it */
+    const char *sql = orig_sql->str;
+    const char *sql_end = sql + orig_sql->len;
+    while (sql_end > sql && (g_ascii_isspace(sql_end[-1]) || sql_end[-1] == ';' || sql_end[-1] == '\0')) {
+        sql_end--;
+    }
+    if (where && (where->start < sql || where->start >= where->end || where->end != sql_end)) {
+        sql_context_set_error(context, PARSE_NOT_SUPPORT, "(cetus) batch condition not supported");
+        return NULL;
+    }
+
+    sharding_batch_t *batch = sharding_batch_new();
+    batch->step = property->batch;
+    g_string_assign(batch->key, property->batch_key);
+    if (where) {
+        g_string_append_len(batch->head, sql, where->start - sql);
+        g_string_append_len(batch->cond, where->start, where->end - where->start);
+    } else {
+        g_string_append_len(batch->head, sql, sql_end - sql);
+        g_string_append(batch->head, " WHERE ");
+    }
+
+    sql_src_item_t *src = g_ptr_array_index(tables, 0);
+    g_string_printf(batch->seek_sql, "SELECT MAX(%s) FROM (SELECT %s FROM ", batch->key->str, batch->key->str);
+    if (src->dbname) {
+        g_string_append_printf(batch->seek_sql, "`%s`.", src->dbname);
+    }
+    g_string_append_printf(batch->seek_sql, "`%s`", src->table_name);
+    if (src->table_alias) {
+        g_string_append_printf(batch->seek_sql, " AS `%s`", src->table_alias);
+    }
+    return batch;
+}
+
+/* text of a sharding key value, the same for every literal of the value */
+static gboolean
+sharding_key_text(sql_expr_t *p, int key_type, GString *out)
+{
+    struct condition_t cond = { TK_EQ, {0} };
+    if (!expr_is_simple_value(p) || expr_parse_sharding_value(p, key_type, &cond) != PARSE_OK) {
+        return FALSE;
+    }
+    if (key_type == SHARD_DATA_TYPE_STR) {
+        /* collations might ignore case and trailing spaces */
+        gchar *lower = g_ascii_strdown(cond.v.str, -1);
+        g_string_assign(out, g_strchomp(lower));
+        g_free(lower);
+    } else {
+        g_string_printf(out, "%" G_GINT64_FORMAT, cond.v.num);
+    }
+    return TRUE;
+}
+
+static row_cache_ref_t *
+row_cache_ref_for_table(const char *db, const char *table)
+{
+    if (!shard_conf_is_shard_table(db, table)) {
+        return NULL;
+    }
+    GString *name = g_string_new(NULL);
+    g_string_printf(name, "%s.%s", db, table);
+    row_cache_ref_t *ref = row_cache_ref_new(name->str);
+    g_string_free(name, TRUE);
+    return ref;
+}
+
+/* add keys of the top level equation or IN list on sharding key */
+static void
+row_cache_ref_add_where_keys(row_cache_ref_t *ref, sql_expr_t *where, int key_type)
+{
+    GString *key = g_string_new(NULL);
+    sql_expr_t *value = sharding_key_equation_value(where);
+    if (value) {
+        if (sharding_key_text(value, key_type, key)) {
+            row_cache_ref_add_key(ref, key->str);
+        }
+    } else if (where && (value = sharding_IN_expr_find(where)) && value->list) {
+        int i;
+        for (i = 0; i < value->list->len; ++i) {
+            if (!sharding_key_text(g_ptr_array_index(value->list, i), key_type, key)) {
+                g_ptr_array_set_size(ref->keys, 0);
+                break;
+            }
+            row_cache_ref_add_key(ref, key->str);
+        }
+    }
+    g_string_free(key, TRUE);
+}
+
+static void
+row_cache_ref_add_insert_keys(row_cache_ref_t *ref, sql_insert_t *insert, sharding_table_t *info)
+{
+    if (insert->is_replace || insert->is_dup_update || !insert->columns || !insert->sel_val
+        || insert->sel_val->from_src) {
+        return;                 /* other rows might be changed, whole table */
+    }
+    int key_index = -1;
+    int i;
+    for (i = 0; i < insert->columns->len; ++i) {
+        if (strcasecmp(g_ptr_array_index(insert->columns, i), info->pkey->str) == 0) {
+            key_index = i;
+            break;
+        }
+    }
+    if (key_index == -1) {
+        return;
+    }
+    GString *key = g_string_new(NULL);
+    sql_select_t *values;
+    for (values = insert->sel_val; values; values = values->prior) {
+        if (!values->columns || values->columns->len <= key_index
+            || !sharding_key_text(g_ptr_array_index(values->columns, key_index), info->shard_key_type, key)) {
+            g_ptr_array_set_size(ref->keys, 0);
+            break;
+        }
+        row_cache_ref_add_key(ref, key->str);
+    }
+    g_string_free(key, TRUE);
+}
+
+/**
+ * keys of the row cache, for SELECT it is the point lookup found by
+ * routing_select(), for INSERT/UPDATE/DELETE the sharding keys written,
+ * no keys means the whole table, an empty table name means all tables.
+ * @return NULL if sharding tables are not involved
+ */
+row_cache_ref_t *
+sharding_row_cache_ref(sql_context_t *context, char *default_db, sharding_plan_t *plan)
+{
+    row_cache_ref_t *ref = NULL;
+    sharding_table_t *info = NULL;
+    char *db = default_db;
+    sql_src_item_t *src = NULL;
+
+    switch (context->stmt_type) {
+    case STMT_SELECT:
+        if (plan->point_key) {
+            info = shard_conf_get_info(plan->point_db, plan->point_table);
+            ref = row_cache_ref_for_table(plan->point_db, plan->point_table);
+        }
+        if (ref) {
+            GString *key = g_string_new(NULL);
+            if (sharding_key_text(plan->point_key, info->shard_key_type, key)) {
+                row_cache_ref_add_key(ref, key->str);
+            } else {
+                row_cache_ref_free(ref);
+                ref = NULL;
+            }
+            g_string_free(key, TRUE);
+        }
+        return ref;
+    case STMT_UPDATE:{
+        sql_update_t *update = context->sql_statement;
+        if (update->table->len != 1) {
+            ref = row_cache_ref_new("");
+            ref->is_write = TRUE;
+            return ref;
+        }
+        src = g_ptr_array_index(update->table, 0);
+        db = src->dbname ? src->dbname : db;
+        if ((ref = row_cache_ref_for_table(db, src->table_name))) {
+            info = shard_conf_get_info(db, src->table_name);
+            row_cache_ref_add_where_keys(ref, update->where_clause, info->shard_key_type);
+        }
+        break;
+    }
+    case STMT_DELETE:{
+        sql_delete_t *delete = context->sql_statement;
+        if (!delete || delete->from_src->len != 1) {
+            ref = row_cache_ref_new("");
+            ref->is_write = TRUE;
+            return ref;
+        }
+        src = g_ptr_array_index(delete->from_src, 0);
+        db = src->dbname ? src->dbname : db;
+        if ((ref = row_cache_ref_for_table(db, src->table_name))) {
+            info = shard_conf_get_info(db, src->table_name);
+            row_cache_ref_add_where_keys(ref, delete->where_clause, info->shard_key_type);
+        }
+        break;
+    }
+    case STMT_INSERT:{
+        sql_insert_t *insert = context->sql_statement;
+        src = g_ptr_array_index(insert->table, 0);
+        db = src->dbname ? src->dbname : db;
+        if ((ref = row_cache_ref_for_table(db, src->table_name))) {
+            info = shard_conf_get_info(db, src->table_name);
+            row_cache_ref_add_insert_keys(ref, insert, info);
+        }
+        break;
+    }
+    case STMT_COMMON_DDL:
+    case STMT_CALL:
+        ref = row_cache_ref_new("");
+        break;
+    default:
+        return NULL;
+    }
+    if (ref) {
+        ref->is_write = TRUE;
+    }
+    return ref;
+}
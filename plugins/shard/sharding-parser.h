@@ -36,6 +36,7 @@
 #define USE_NONE 8
 #define USE_PREVIOUS_TRAN_CONNS 9
 #define ERROR_UNPARSABLE -1
+#define WAIT_SEQUENCE_LEASE -2  /* sharding key needs ids of a running lease */
 
 NETWORK_API int sharding_parse_groups(GString *, sql_context_t *, query_stats_t *, unsigned int, sharding_plan_t *);
 
@@ -43,4 +44,22 @@ NETWORK_API GString *sharding_modify_sql(sql_context_t *, having_condition_t *);
 
 NETWORK_API void sharding_filter_sql(sql_context_t *);
 
+/**
+ * append ids[] as one more value to each VALUES tuple, ids[0] to the first row
+ * @param values head of the tuple chain, the last row (linked by ->prior)
+ */
+NETWORK_API void sharding_values_append_ids(sql_select_t *values, const guint64 *ids, guint count);
+
+/**
+ * chunked UPDATE/DELETE requested by comment property "batch=<n> batch_key=<column>"
+ * @return NULL with reason set in context if the statement can't be batched
+ */
+NETWORK_API struct sharding_batch_t *sharding_batch_plan(sql_context_t *, const GString *orig_sql);
+
+/**
+ * point lookup or written keys of the statement for the row cache
+ * @return NULL if no sharding table is involved
+ */
+NETWORK_API struct row_cache_ref_t *sharding_row_cache_ref(sql_context_t *, char *default_db, sharding_plan_t *);
+
 #endif //__SHARDING_PARSER_H__
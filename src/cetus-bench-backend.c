@@ -0,0 +1,675 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+/*
+ * fake MySQL backend of cetus-bench
+ *
+ * Speaks just enough of the server side protocol for cetus (and its
+ * monitor) to use it as a backend: a handshake that accepts any account,
+ * OK for statements that don't return rows, and synthetic result sets
+ * for SELECT/SHOW. Result sets are generated incrementally while the
+ * socket drains, so million-row streams don't sit in memory.
+ *
+ * column 0 is "id" (BIGINT, counting from 1), the other columns are
+ * "c1".."cN" holding the row id as zero padded text of value_size bytes
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include <glib.h>
+#include <mysql.h>
+#include <mysqld_error.h>
+
+#include "cetus-bench-backend.h"
+#include "cetus-util.h"
+#include "chassis-event.h"
+#include "network-socket.h"
+#include "network-mysqld-proto.h"
+#include "network-mysqld-packet.h"
+
+#define BENCH_SERVER_VERSION 50720
+#define BENCH_SEND_BATCH 16384          /* bytes of packets per send_queue chunk */
+#define BENCH_SEND_HIGH_WATER 262144    /* stop generating rows above this */
+
+struct bench_backend_t {
+    bench_backend_config_t *config;
+    chassis_event_loop_t *loop;
+    network_socket *listen_sock;
+    GThread *thread;
+    guint32 next_thread_id;
+    GString *zeros;             /* padding of the text columns */
+};
+
+typedef struct bench_conn_t {
+    bench_backend_t *backend;
+    network_socket *sock;
+    GString *input;             /* received bytes not parsed yet */
+
+    gint64 rows_left;           /* rows of the open result set still to send */
+    gint64 next_row_id;
+
+    guint16 server_status;
+
+    struct event write_event;
+    struct event delay_event;
+
+    unsigned int is_authed:1;
+    unsigned int resultset_open:1;
+    unsigned int write_pending:1;
+    unsigned int delay_pending:1;
+    unsigned int is_closing:1;
+} bench_conn_t;
+
+enum {
+    SEND_DONE,
+    SEND_WAIT,
+    SEND_CLOSED
+};
+
+static void bench_conn_process(bench_conn_t *conn);
+
+/*
+ * packets are built straight into a batch buffer, the header is patched
+ * once the payload is known
+ */
+static gsize
+packet_begin(GString *batch)
+{
+    gsize pos = batch->len;
+    g_string_append_len(batch, "\0\0\0\0", 4);
+    return pos;
+}
+
+static void
+packet_end(bench_conn_t *conn, GString *batch, gsize pos)
+{
+    guint32 len = batch->len - pos - 4;
+    batch->str[pos] = len & 0xff;
+    batch->str[pos + 1] = (len >> 8) & 0xff;
+    batch->str[pos + 2] = (len >> 16) & 0xff;
+    batch->str[pos + 3] = ++conn->sock->last_packet_id;
+}
+
+static void
+batch_flush(bench_conn_t *conn, GString **batch)
+{
+    if ((*batch)->len > 0) {
+        network_queue_append(conn->sock->send_queue, *batch);
+        *batch = g_string_sized_new(BENCH_SEND_BATCH + 512);
+    }
+}
+
+static void
+append_ok(bench_conn_t *conn, GString *batch)
+{
+    gsize pos = packet_begin(batch);
+    network_mysqld_ok_packet_t *ok = network_mysqld_ok_packet_new();
+    ok->server_status = conn->server_status;
+    network_mysqld_proto_append_ok_packet(batch, ok);
+    network_mysqld_ok_packet_free(ok);
+    packet_end(conn, batch, pos);
+}
+
+static void
+append_err(bench_conn_t *conn, GString *batch, guint16 errcode, const char *msg)
+{
+    gsize pos = packet_begin(batch);
+    network_mysqld_err_packet_t *err = network_mysqld_err_packet_new();
+    err->errcode = errcode;
+    g_string_assign(err->errmsg, msg);
+    g_string_assign(err->sqlstate, "HY000");
+    network_mysqld_proto_append_err_packet(batch, err);
+    network_mysqld_err_packet_free(err);
+    packet_end(conn, batch, pos);
+}
+
+static void
+append_eof(bench_conn_t *conn, GString *batch)
+{
+    gsize pos = packet_begin(batch);
+    network_mysqld_proto_append_int8(batch, 0xfe);
+    network_mysqld_proto_append_int16(batch, 0);    /* warnings */
+    network_mysqld_proto_append_int16(batch, conn->server_status);
+    packet_end(conn, batch, pos);
+}
+
+static void
+append_field(bench_conn_t *conn, GString *batch, const char *name,
+             guint8 type, guint16 charset, guint32 length, guint16 flags)
+{
+    gsize pos = packet_begin(batch);
+    network_mysqld_proto_append_lenenc_str(batch, "def");
+    network_mysqld_proto_append_lenenc_str(batch, "bench");
+    network_mysqld_proto_append_lenenc_str(batch, "sbtest");
+    network_mysqld_proto_append_lenenc_str(batch, "sbtest");
+    network_mysqld_proto_append_lenenc_str(batch, name);
+    network_mysqld_proto_append_lenenc_str(batch, name);
+    network_mysqld_proto_append_int8(batch, 0x0c);  /* length of the fixed fields */
+    network_mysqld_proto_append_int16(batch, charset);
+    network_mysqld_proto_append_int32(batch, length);
+    network_mysqld_proto_append_int8(batch, type);
+    network_mysqld_proto_append_int16(batch, flags);
+    network_mysqld_proto_append_int8(batch, 0);     /* decimals */
+    network_mysqld_proto_append_int16(batch, 0);    /* filler */
+    packet_end(conn, batch, pos);
+}
+
+/* skips blanks and comments, returns NULL at the end of the statement */
+static const char *
+sql_skip_blank(const char *p, const char *end)
+{
+    while (p < end) {
+        if (g_ascii_isspace(*p)) {
+            p++;
+        } else if (p + 1 < end && p[0] == '/' && p[1] == '*') {
+            const char *close = g_strstr_len(p + 2, end - p - 2, "*/");
+            if (!close)
+                return NULL;
+            p = close + 2;
+        } else {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+static gboolean
+sql_starts_with(const char *p, const char *end, const char *words)
+{
+    gsize n = strlen(words);
+    if (!p || (gsize)(end - p) < n || g_ascii_strncasecmp(p, words, n) != 0)
+        return FALSE;
+    return p + n == end || !(g_ascii_isalnum(p[n]) || p[n] == '_');
+}
+
+static gboolean
+is_ident_char(char c)
+{
+    return g_ascii_isalnum(c) || c == '_' || c == '`';
+}
+
+/* last occurence of a keyword, outside of identifiers */
+static const char *
+sql_find_word(const char *sql, const char *end, const char *word)
+{
+    gsize n = strlen(word);
+    const char *p;
+
+    if ((gsize)(end - sql) < n)
+        return NULL;
+    for (p = end - n; p >= sql; --p) {
+        if (g_ascii_strncasecmp(p, word, n) == 0
+            && (p == sql || !is_ident_char(p[-1]))
+            && (p + n == end || !is_ident_char(p[n]))) {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+static const char *
+sql_parse_number(const char *p, const char *end, gint64 *num)
+{
+    gint64 v = 0;
+    const char *start;
+
+    while (p < end && g_ascii_isspace(*p))
+        p++;
+    start = p;
+    while (p < end && g_ascii_isdigit(*p) && v < G_MAXINT32) {
+        v = v * 10 + (*p - '0');
+        p++;
+    }
+    if (p == start)
+        return NULL;
+    *num = v;
+    return p;
+}
+
+/* LIMIT n, LIMIT m, n and LIMIT n OFFSET m all return n rows */
+static gboolean
+sql_get_limit(const char *sql, const char *end, gint64 *rows)
+{
+    const char *p = sql_find_word(sql, end, "limit");
+    gint64 first = 0, second = 0;
+
+    if (!p)
+        return FALSE;
+    p = sql_parse_number(p + 5, end, &first);
+    if (!p)
+        return FALSE;
+    while (p < end && g_ascii_isspace(*p))
+        p++;
+    if (p < end && *p == ',' && sql_parse_number(p + 1, end, &second)) {
+        *rows = second;
+    } else {
+        *rows = first;
+    }
+    return TRUE;
+}
+
+static void
+bench_conn_begin_resultset(bench_conn_t *conn, GString *batch, const char *sql, const char *end)
+{
+    bench_backend_config_t *config = conn->backend->config;
+    gint64 rows = config->rows;
+    int i;
+
+    if (!sql_find_word(sql, end, "from")) {
+        rows = 1;               /* SELECT 1, SELECT @@var */
+    }
+    sql_get_limit(sql, end, &rows);
+
+    gsize pos = packet_begin(batch);
+    network_mysqld_proto_append_lenenc_int(batch, config->columns);
+    packet_end(conn, batch, pos);
+
+    append_field(conn, batch, "id", MYSQL_TYPE_LONGLONG, 63, 20,
+                 NOT_NULL_FLAG | PRI_KEY_FLAG | BINARY_FLAG | NUM_FLAG);
+    for (i = 1; i < config->columns; i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "c%d", i);
+        append_field(conn, batch, name, MYSQL_TYPE_VAR_STRING, 33, config->value_size * 3, 0);
+    }
+    append_eof(conn, batch);
+
+    conn->rows_left = rows;
+    conn->next_row_id = 1;
+    conn->resultset_open = 1;
+}
+
+/* generates rows until the send queue is full enough */
+static void
+bench_conn_fill_rows(bench_conn_t *conn)
+{
+    bench_backend_t *backend = conn->backend;
+    bench_backend_config_t *config = backend->config;
+    GString *batch;
+
+    if (!conn->resultset_open || conn->sock->send_queue->len >= BENCH_SEND_HIGH_WATER)
+        return;
+
+    batch = g_string_sized_new(BENCH_SEND_BATCH + 512);
+    while (conn->rows_left > 0 && conn->sock->send_queue->len < BENCH_SEND_HIGH_WATER) {
+        char id[24];
+        int id_len = snprintf(id, sizeof(id), "%" G_GINT64_FORMAT, conn->next_row_id);
+        int i;
+
+        gsize pos = packet_begin(batch);
+        network_mysqld_proto_append_lenenc_str_len(batch, id, id_len);
+        for (i = 1; i < config->columns; i++) {
+            network_mysqld_proto_append_lenenc_int(batch, MAX(config->value_size, id_len));
+            if (config->value_size > id_len) {
+                g_string_append_len(batch, backend->zeros->str, config->value_size - id_len);
+            }
+            g_string_append_len(batch, id, id_len);
+        }
+        packet_end(conn, batch, pos);
+
+        conn->next_row_id++;
+        conn->rows_left--;
+        if (batch->len >= BENCH_SEND_BATCH) {
+            batch_flush(conn, &batch);
+        }
+    }
+    if (conn->rows_left == 0) {
+        append_eof(conn, batch);
+        conn->resultset_open = 0;
+    }
+    batch_flush(conn, &batch);
+    g_string_free(batch, TRUE);
+}
+
+static void
+bench_conn_handle_query(bench_conn_t *conn, GString *batch, const char *sql, const char *end)
+{
+    const char *p = sql_skip_blank(sql, end);
+
+    if (sql_starts_with(p, end, "select") || sql_starts_with(p, end, "show")) {
+        bench_conn_begin_resultset(conn, batch, sql, end);
+        return;
+    }
+
+    if (sql_starts_with(p, end, "begin") || sql_starts_with(p, end, "start transaction")
+        || sql_starts_with(p, end, "xa start") || sql_starts_with(p, end, "xa begin")) {
+        conn->server_status |= SERVER_STATUS_IN_TRANS;
+    } else if (sql_starts_with(p, end, "commit") || sql_starts_with(p, end, "rollback")
+               || sql_starts_with(p, end, "xa end")) {
+        conn->server_status &= ~SERVER_STATUS_IN_TRANS;
+    } else if (sql_starts_with(p, end, "set autocommit=0") || sql_starts_with(p, end, "set autocommit = 0")) {
+        conn->server_status &= ~SERVER_STATUS_AUTOCOMMIT;
+    } else if (sql_starts_with(p, end, "set autocommit=1") || sql_starts_with(p, end, "set autocommit = 1")) {
+        conn->server_status |= SERVER_STATUS_AUTOCOMMIT;
+    } else if (!(conn->server_status & SERVER_STATUS_AUTOCOMMIT)
+               && (sql_starts_with(p, end, "insert") || sql_starts_with(p, end, "update")
+                   || sql_starts_with(p, end, "delete") || sql_starts_with(p, end, "replace"))) {
+        conn->server_status |= SERVER_STATUS_IN_TRANS;
+    }
+    append_ok(conn, batch);
+}
+
+/*
+ * handles one complete packet of the input buffer
+ *
+ * @return FALSE if no complete packet is buffered
+ */
+static gboolean
+bench_conn_handle_packet(bench_conn_t *conn)
+{
+    GString *input = conn->input;
+    guint32 len;
+    const char *payload;
+    GString *batch;
+
+    if (input->len < NET_HEADER_SIZE)
+        return FALSE;
+    len = (guchar)input->str[0] | ((guchar)input->str[1] << 8) | ((guchar)input->str[2] << 16);
+    if (input->len < NET_HEADER_SIZE + len)
+        return FALSE;
+
+    /* responses continue the sequence of the request */
+    conn->sock->last_packet_id = (guint8)input->str[3];
+    conn->sock->packet_id_is_reset = FALSE;
+    payload = input->str + NET_HEADER_SIZE;
+
+    batch = g_string_sized_new(512);
+    if (!conn->is_authed) {
+        /* any user, any password */
+        conn->is_authed = 1;
+        append_ok(conn, batch);
+    } else if (len == 0) {
+        append_err(conn, batch, ER_UNKNOWN_COM_ERROR, "empty packet");
+    } else {
+        switch ((guchar)payload[0]) {
+        case COM_QUERY:
+            bench_conn_handle_query(conn, batch, payload + 1, payload + len);
+            break;
+        case COM_QUIT:
+            conn->is_closing = 1;
+            break;
+        case COM_PING:
+        case COM_INIT_DB:
+        case COM_CHANGE_USER:
+        case COM_RESET_CONNECTION:
+            conn->server_status = SERVER_STATUS_AUTOCOMMIT;
+            append_ok(conn, batch);
+            break;
+        default:
+            append_err(conn, batch, ER_UNKNOWN_COM_ERROR, "command not supported by cetus-bench backend");
+            break;
+        }
+    }
+    batch_flush(conn, &batch);
+    g_string_free(batch, TRUE);
+
+    g_string_erase(input, 0, NET_HEADER_SIZE + len);
+    return TRUE;
+}
+
+static void
+bench_conn_free(bench_conn_t *conn)
+{
+    if (conn->write_pending)
+        event_del(&conn->write_event);
+    if (conn->delay_pending)
+        event_del(&conn->delay_event);
+    network_socket_free(conn->sock);
+    g_string_free(conn->input, TRUE);
+    g_free(conn);
+}
+
+static void bench_conn_write_cb(int fd, short what, void *arg);
+
+/*
+ * writes the send queue, topping it up from the open result set
+ */
+static int
+bench_conn_send(bench_conn_t *conn)
+{
+    for (;;) {
+        bench_conn_fill_rows(conn);
+        if (conn->sock->send_queue->chunks->length == 0)
+            return SEND_DONE;
+
+        switch (network_socket_write(conn->sock, -1)) {
+        case NETWORK_SOCKET_SUCCESS:
+            if (!conn->resultset_open)
+                return SEND_DONE;
+            break;
+        case NETWORK_SOCKET_WAIT_FOR_EVENT:
+            event_set(&conn->write_event, conn->sock->fd, EV_WRITE, bench_conn_write_cb, conn);
+            event_base_set(conn->backend->loop, &conn->write_event);
+            event_add(&conn->write_event, NULL);
+            conn->write_pending = 1;
+            return SEND_WAIT;
+        default:
+            bench_conn_free(conn);
+            return SEND_CLOSED;
+        }
+    }
+}
+
+static void
+bench_conn_write_cb(int fd, short what, void *arg)
+{
+    bench_conn_t *conn = arg;
+
+    conn->write_pending = 0;
+    if (bench_conn_send(conn) == SEND_DONE) {
+        bench_conn_process(conn);
+    }
+}
+
+static void
+bench_conn_delay_cb(int fd, short what, void *arg)
+{
+    bench_conn_t *conn = arg;
+
+    conn->delay_pending = 0;
+    if (bench_conn_send(conn) == SEND_DONE) {
+        bench_conn_process(conn);
+    }
+}
+
+/*
+ * answers the buffered requests one at a time, a request is only
+ * handled after the response of the previous one is on the wire
+ */
+static void
+bench_conn_process(bench_conn_t *conn)
+{
+    bench_backend_config_t *config = conn->backend->config;
+
+    while (!conn->write_pending && !conn->delay_pending && !conn->resultset_open) {
+        if (!bench_conn_handle_packet(conn))
+            return;
+        if (conn->is_closing) {
+            bench_conn_free(conn);
+            return;
+        }
+        if (config->latency_us > 0) {
+            struct timeval tv;
+            tv.tv_sec = config->latency_us / 1000000;
+            tv.tv_usec = config->latency_us % 1000000;
+            evtimer_set(&conn->delay_event, bench_conn_delay_cb, conn);
+            event_base_set(conn->backend->loop, &conn->delay_event);
+            evtimer_add(&conn->delay_event, &tv);
+            conn->delay_pending = 1;
+            return;
+        }
+        if (bench_conn_send(conn) != SEND_DONE)
+            return;
+    }
+}
+
+static void
+bench_conn_read_cb(int fd, short what, void *arg)
+{
+    bench_conn_t *conn = arg;
+    char buf[16384];
+
+    for (;;) {
+        ssize_t len = recv(fd, buf, sizeof(buf), 0);
+        if (len > 0) {
+            g_string_append_len(conn->input, buf, len);
+            if (len < (ssize_t)sizeof(buf))
+                break;
+        } else if (len == 0) {
+            bench_conn_free(conn);
+            return;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            break;
+        } else if (errno != EINTR) {
+            bench_conn_free(conn);
+            return;
+        }
+    }
+    bench_conn_process(conn);
+}
+
+static void
+bench_backend_accept_cb(int fd, short what, void *arg)
+{
+    bench_backend_t *backend = arg;
+    network_socket *sock;
+    int reason = 0;
+
+    while ((sock = network_socket_accept(backend->listen_sock, &reason)) != NULL) {
+        bench_conn_t *conn = g_new0(bench_conn_t, 1);
+        conn->backend = backend;
+        conn->sock = sock;
+        conn->input = g_string_sized_new(1024);
+        conn->server_status = SERVER_STATUS_AUTOCOMMIT;
+
+        network_mysqld_auth_challenge *challenge = network_mysqld_auth_challenge_new();
+        challenge->server_version_str = g_strdup("5.7.20-cetus-bench");
+        challenge->server_version = BENCH_SERVER_VERSION;
+        challenge->charset = 33;    /* utf8_general_ci */
+        challenge->server_status = SERVER_STATUS_AUTOCOMMIT;
+        challenge->thread_id = ++backend->next_thread_id;
+        network_mysqld_auth_challenge_set_challenge(challenge);
+
+        GString *packet = g_string_new(NULL);
+        network_mysqld_proto_append_auth_challenge(packet, challenge);
+        network_mysqld_queue_reset(sock);
+        network_mysqld_queue_append(sock, sock->send_queue, S(packet));
+        g_string_free(packet, TRUE);
+        network_mysqld_auth_challenge_free(challenge);
+
+        event_set(&sock->event, sock->fd, EV_READ | EV_PERSIST, bench_conn_read_cb, conn);
+        event_base_set(backend->loop, &sock->event);
+        event_add(&sock->event, NULL);
+
+        bench_conn_send(conn);
+    }
+    if (reason != EAGAIN && reason != EWOULDBLOCK && reason != 0) {
+        g_warning("%s: accept() failed: %s (%d)", G_STRLOC, g_strerror(reason), reason);
+    }
+}
+
+bench_backend_t *
+bench_backend_new(bench_backend_config_t *config)
+{
+    bench_backend_t *backend;
+    network_socket *sock = network_socket_new();
+
+    if (network_address_set_address(sock->dst, config->address) != 0) {
+        g_critical("%s: invalid backend address: %s", G_STRLOC, config->address);
+        network_socket_free(sock);
+        return NULL;
+    }
+    if (network_socket_bind(sock) != NETWORK_SOCKET_SUCCESS) {
+        network_socket_free(sock);
+        return NULL;
+    }
+    network_socket_set_non_blocking(sock);
+
+    backend = g_new0(bench_backend_t, 1);
+    backend->config = config;
+    backend->listen_sock = sock;
+    backend->loop = chassis_event_loop_new();
+    backend->zeros = g_string_new(NULL);
+    while (backend->zeros->len < (gsize)config->value_size)
+        g_string_append_c(backend->zeros, '0');
+
+    event_set(&sock->event, sock->fd, EV_READ | EV_PERSIST, bench_backend_accept_cb, backend);
+    event_base_set(backend->loop, &sock->event);
+    event_add(&sock->event, NULL);
+
+    return backend;
+}
+
+/* connections still open at exit are left to the OS */
+void
+bench_backend_free(bench_backend_t *backend)
+{
+    if (!backend)
+        return;
+    network_socket_free(backend->listen_sock);
+    chassis_event_loop_free(backend->loop);
+    g_string_free(backend->zeros, TRUE);
+    g_free(backend);
+}
+
+void
+bench_backend_run(bench_backend_t *backend)
+{
+    g_message("%s: fake backend listening on %s", G_STRLOC, backend->config->address);
+    chassis_event_loop(backend->loop);
+}
+
+static void *
+bench_backend_mainloop(void *data)
+{
+    bench_backend_run(data);
+    return NULL;
+}
+
+gboolean
+bench_backend_start_thread(bench_backend_t *backend)
+{
+#if !GLIB_CHECK_VERSION(2, 32, 0)
+    GError *error = NULL;
+    backend->thread = g_thread_create(bench_backend_mainloop, backend, TRUE, &error);
+    if (backend->thread == NULL && error != NULL) {
+        g_critical("Create thread error: %s", error->message);
+        g_clear_error(&error);
+    }
+#else
+    backend->thread = g_thread_new("bench-backend", bench_backend_mainloop, backend);
+    if (backend->thread == NULL) {
+        g_critical("Create thread error.");
+    }
+#endif
+    return backend->thread != NULL;
+}
+
+void
+bench_backend_join_thread(bench_backend_t *backend)
+{
+    if (backend->thread) {
+        g_thread_join(backend->thread);
+        backend->thread = NULL;
+    }
+}
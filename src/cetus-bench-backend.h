@@ -0,0 +1,53 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#ifndef _CETUS_BENCH_BACKEND_H_
+#define _CETUS_BENCH_BACKEND_H_
+
+#include <glib.h>
+
+/**
+ * shape of the synthetic result sets returned by the fake backend
+ */
+typedef struct bench_backend_config_t {
+    gchar *address;             /* ip:port to listen on */
+    gint rows;                  /* rows of a SELECT without LIMIT */
+    gint columns;               /* column 0 is "id", the others are text */
+    gint value_size;            /* bytes of each text column */
+    gint latency_us;            /* delay before each response */
+} bench_backend_config_t;
+
+typedef struct bench_backend_t bench_backend_t;
+
+/**
+ * a minimal MySQL server: accepts any user, answers SELECT/SHOW with
+ * generated rows and everything else with OK
+ */
+bench_backend_t *bench_backend_new(bench_backend_config_t *config);
+void bench_backend_free(bench_backend_t *backend);
+
+/* serve in the calling thread until chassis_set_shutdown() */
+void bench_backend_run(bench_backend_t *backend);
+
+/* serve in a thread of its own, stopped with chassis_set_shutdown() */
+gboolean bench_backend_start_thread(bench_backend_t *backend);
+void bench_backend_join_thread(bench_backend_t *backend);
+
+#endif /* _CETUS_BENCH_BACKEND_H_ */
@@ -0,0 +1,680 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+/*
+ * cetus-bench: end-to-end benchmark of the proxy
+ *
+ * Runs a fixed scenario over N client connections for a fixed time and
+ * prints QPS and latency percentiles as one JSON object, so runs can be
+ * diffed for regression tracking. With --backend it also starts a fake
+ * MySQL server (cetus-bench-backend.c) to put behind the proxy, which
+ * keeps the numbers free of real storage costs.
+ *
+ *   cetus-bench --backend=127.0.0.1:13306 --backend-only
+ *   cetus --proxy-backend-addresses=127.0.0.1:13306 ...
+ *   cetus-bench --target=127.0.0.1:6001 --scenario=point-select -c 64 -t 30
+ *
+ * without --target the load goes straight to the fake backend, which
+ * gives the baseline to subtract
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <mysql.h>
+#include <errmsg.h>
+
+#include "cetus-bench-backend.h"
+#include "cetus-util.h"
+#include "chassis-mainloop.h"
+
+/*
+ * latency histogram in microseconds: exact below 64, then 32 buckets
+ * per power of two (about 3% error), up to 2^40 us
+ */
+#define HIST_LINEAR 64
+#define HIST_SUB_BITS 5
+#define HIST_BUCKETS (HIST_LINEAR + 36 * (1 << HIST_SUB_BITS))
+
+typedef struct bench_histogram_t {
+    guint64 counts[HIST_BUCKETS];
+    guint64 total;
+    guint64 sum;
+    guint64 max;
+} bench_histogram_t;
+
+typedef struct bench_worker_t bench_worker_t;
+
+typedef struct bench_scenario_t {
+    const char *name;
+    const char *sql;            /* '?' is replaced by a random key */
+    int (*run)(bench_worker_t *, const char *sql);
+    const char *description;
+} bench_scenario_t;
+
+struct bench_worker_t {
+    int id;
+    GThread *thread;
+    MYSQL *mysql;
+    GRand *rand;
+    const bench_scenario_t *scenario;
+    const char *sql;
+
+    guint64 ops;
+    guint64 errors;
+    guint64 rows;
+    bench_histogram_t hist;
+};
+
+static gchar *opt_target = NULL;
+static gchar *opt_user = "root";
+static gchar *opt_password = "";
+static gchar *opt_database = NULL;
+static gchar *opt_scenario = "point-select";
+static gchar *opt_sql = NULL;
+static gchar *opt_report = NULL;
+static gint opt_connections = 16;
+static gint opt_duration = 10;
+static gint opt_warmup = 0;
+static gint opt_keys = 100000;
+static gchar *opt_backend = NULL;
+static gboolean opt_backend_only = FALSE;
+static gint opt_rows = 1000;
+static gint opt_columns = 2;
+static gint opt_value_size = 32;
+static gint opt_latency_us = 0;
+static gboolean opt_list = FALSE;
+static gint opt_proxy_pid = 0;
+
+static volatile gint bench_recording = 0;
+static volatile gint bench_stop = 0;
+
+static char *target_host = NULL;
+static guint target_port = 3306;
+
+static guint
+hist_index(guint64 v)
+{
+    guint msb;
+
+    if (v < HIST_LINEAR)
+        return (guint)v;
+    msb = g_bit_storage(v) - 1;
+    guint idx = (msb - HIST_SUB_BITS) * (1 << HIST_SUB_BITS)
+        + ((v >> (msb - HIST_SUB_BITS)) & ((1 << HIST_SUB_BITS) - 1)) + (1 << HIST_SUB_BITS);
+    return MIN(idx, HIST_BUCKETS - 1);
+}
+
+/* upper end of a bucket */
+static guint64
+hist_value(guint idx)
+{
+    guint k, msb;
+
+    if (idx < HIST_LINEAR)
+        return idx;
+    k = idx - (1 << HIST_SUB_BITS);
+    msb = k / (1 << HIST_SUB_BITS) + HIST_SUB_BITS;
+    return ((guint64)((1 << HIST_SUB_BITS) + k % (1 << HIST_SUB_BITS) + 1) << (msb - HIST_SUB_BITS)) - 1;
+}
+
+static void
+hist_record(bench_histogram_t *h, guint64 v)
+{
+    h->counts[hist_index(v)]++;
+    h->total++;
+    h->sum += v;
+    if (v > h->max)
+        h->max = v;
+}
+
+static void
+hist_merge(bench_histogram_t *to, const bench_histogram_t *from)
+{
+    int i;
+    for (i = 0; i < HIST_BUCKETS; i++)
+        to->counts[i] += from->counts[i];
+    to->total += from->total;
+    to->sum += from->sum;
+    if (from->max > to->max)
+        to->max = from->max;
+}
+
+static guint64
+hist_percentile(const bench_histogram_t *h, double pct)
+{
+    guint64 rank, seen = 0;
+    int i;
+
+    if (h->total == 0)
+        return 0;
+    rank = (guint64)(h->total * pct / 100.0 + 0.5);
+    if (rank == 0)
+        rank = 1;
+    for (i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen >= rank)
+            return MIN(hist_value(i), h->max);
+    }
+    return h->max;
+}
+
+/* replaces each '?' of the template by a random key */
+static void
+bench_format_sql(bench_worker_t *w, GString *out, const char *tmpl)
+{
+    const char *p;
+
+    g_string_truncate(out, 0);
+    for (p = tmpl; *p; p++) {
+        if (*p == '?') {
+            g_string_append_printf(out, "%d", g_rand_int_range(w->rand, 1, opt_keys + 1));
+        } else {
+            g_string_append_c(out, *p);
+        }
+    }
+}
+
+static MYSQL *
+bench_connect(void)
+{
+    MYSQL *mysql = mysql_init(NULL);
+    unsigned int timeout = 5;
+
+    if (mysql == NULL)
+        return NULL;
+    mysql_options(mysql, MYSQL_OPT_CONNECT_TIMEOUT, &timeout);
+    if (!mysql_real_connect(mysql, target_host, opt_user, opt_password, opt_database, target_port, NULL, 0)) {
+        g_debug("%s: connect %s:%u failed: %s", G_STRLOC, target_host, target_port, mysql_error(mysql));
+        mysql_close(mysql);
+        return NULL;
+    }
+    return mysql;
+}
+
+static int
+bench_query(bench_worker_t *w, const char *sql, gboolean stream)
+{
+    MYSQL_RES *res;
+
+    if (mysql_real_query(w->mysql, sql, strlen(sql)) != 0)
+        return -1;
+
+    do {
+        res = stream ? mysql_use_result(w->mysql) : mysql_store_result(w->mysql);
+        if (res) {
+            while (mysql_fetch_row(res))
+                w->rows++;
+            mysql_free_result(res);
+        } else if (mysql_field_count(w->mysql) != 0) {
+            return -1;
+        }
+    } while (mysql_next_result(w->mysql) == 0);
+
+    return mysql_errno(w->mysql) ? -1 : 0;
+}
+
+static int
+run_select(bench_worker_t *w, const char *tmpl)
+{
+    GString *sql = g_string_sized_new(128);
+    int rv;
+
+    bench_format_sql(w, sql, tmpl);
+    rv = bench_query(w, sql->str, FALSE);
+    g_string_free(sql, TRUE);
+    return rv;
+}
+
+static int
+run_stream(bench_worker_t *w, const char *tmpl)
+{
+    GString *sql = g_string_sized_new(128);
+    int rv;
+
+    bench_format_sql(w, sql, tmpl);
+    rv = bench_query(w, sql->str, TRUE);
+    g_string_free(sql, TRUE);
+    return rv;
+}
+
+/* statements of the template are separated by ';', one op is the whole transaction */
+static int
+run_transaction(bench_worker_t *w, const char *tmpl)
+{
+    gchar **stmts = g_strsplit(tmpl, ";", -1);
+    GString *sql = g_string_sized_new(128);
+    int i, rv = 0;
+
+    if (bench_query(w, "BEGIN", FALSE) != 0) {
+        rv = -1;
+    }
+    for (i = 0; rv == 0 && stmts[i]; i++) {
+        if (*g_strstrip(stmts[i]) == '\0')
+            continue;
+        bench_format_sql(w, sql, stmts[i]);
+        rv = bench_query(w, sql->str, FALSE);
+    }
+    if (rv == 0) {
+        rv = bench_query(w, "COMMIT", FALSE);
+    } else if (w->mysql) {
+        mysql_real_query(w->mysql, C("ROLLBACK"));
+    }
+    g_string_free(sql, TRUE);
+    g_strfreev(stmts);
+    return rv;
+}
+
+/* a fresh connection per op, measures the handshake path */
+static int
+run_connect(bench_worker_t *w, const char *tmpl)
+{
+    int rv;
+
+    if (w->mysql) {
+        mysql_close(w->mysql);
+        w->mysql = NULL;
+    }
+    w->mysql = bench_connect();
+    if (!w->mysql)
+        return -1;
+    rv = run_select(w, tmpl);
+    mysql_close(w->mysql);
+    w->mysql = NULL;
+    return rv;
+}
+
+static const bench_scenario_t bench_scenarios[] = {
+    {"point-select", "SELECT id, c1 FROM sbtest WHERE id = ?", run_select,
+     "single row by primary key, the read/write splitting path"},
+    {"fanout-order", "SELECT id, c1 FROM sbtest WHERE id > ? ORDER BY id LIMIT 100", run_select,
+     "range over all shards, merged by ORDER BY"},
+    {"fanout-group", "SELECT id, count(*) FROM sbtest WHERE id > ? GROUP BY id ORDER BY id LIMIT 100", run_select,
+     "range over all shards, merged by GROUP BY"},
+    {"large-result", "SELECT id, c1 FROM sbtest", run_stream,
+     "whole table streamed to the client, rows set by --rows of the backend"},
+    {"xa-write", "UPDATE sbtest SET c1 = 'x' WHERE id = ?; UPDATE sbtest SET c1 = 'y' WHERE id = ?", run_transaction,
+     "two updates on random keys in one transaction, distributed on sharding"},
+    {"connect-storm", "SELECT 1", run_connect,
+     "connect, one query, disconnect"},
+    {"idle", NULL, NULL,
+     "hold idle connections, with --proxy-pid report the CPU time the proxy spends on them"},
+    {NULL, NULL, NULL, NULL}
+};
+
+static void *
+bench_worker_main(void *arg)
+{
+    bench_worker_t *w = arg;
+
+    mysql_thread_init();
+    while (!g_atomic_int_get(&bench_stop)) {
+        gint64 start;
+        int rv;
+
+        if (w->mysql == NULL && w->scenario->run != run_connect) {
+            w->mysql = bench_connect();
+            if (w->mysql == NULL) {
+                if (g_atomic_int_get(&bench_recording))
+                    w->errors++;
+                g_usleep(100 * 1000);
+                continue;
+            }
+        }
+
+        start = g_get_monotonic_time();
+        rv = w->scenario->run(w, w->sql);
+        if (!g_atomic_int_get(&bench_recording))
+            continue;
+
+        if (rv == 0) {
+            hist_record(&w->hist, g_get_monotonic_time() - start);
+            w->ops++;
+        } else {
+            w->errors++;
+            if (w->mysql && w->errors <= 3) {
+                g_warning("%s: worker %d: %s", G_STRLOC, w->id, mysql_error(w->mysql));
+            }
+            if (w->mysql && (mysql_errno(w->mysql) == CR_SERVER_GONE_ERROR
+                             || mysql_errno(w->mysql) == CR_SERVER_LOST)) {
+                mysql_close(w->mysql);
+                w->mysql = NULL;
+            }
+        }
+    }
+    if (w->mysql) {
+        mysql_close(w->mysql);
+        w->mysql = NULL;
+    }
+    mysql_thread_end();
+    return NULL;
+}
+
+static GThread *
+bench_thread_new(const char *name, GThreadFunc func, gpointer data)
+{
+    GThread *thread;
+#if !GLIB_CHECK_VERSION(2, 32, 0)
+    GError *error = NULL;
+    thread = g_thread_create(func, data, TRUE, &error);
+    if (thread == NULL && error != NULL) {
+        g_critical("Create thread error: %s", error->message);
+        g_clear_error(&error);
+    }
+#else
+    thread = g_thread_new(name, func, data);
+    if (thread == NULL) {
+        g_critical("Create thread error.");
+    }
+#endif
+    return thread;
+}
+
+static void
+bench_report(FILE *out, const bench_scenario_t *scenario, bench_worker_t *workers, double elapsed)
+{
+    bench_histogram_t *all = g_new0(bench_histogram_t, 1);
+    guint64 ops = 0, errors = 0, rows = 0;
+    int i;
+
+    for (i = 0; i < opt_connections; i++) {
+        hist_merge(all, &workers[i].hist);
+        ops += workers[i].ops;
+        errors += workers[i].errors;
+        rows += workers[i].rows;
+    }
+
+    fprintf(out, "{\"scenario\": \"%s\", \"target\": \"%s:%u\", \"connections\": %d,"
+            " \"duration_sec\": %.3f,\n", scenario->name, target_host, target_port, opt_connections, elapsed);
+    fprintf(out, " \"ops\": %" G_GUINT64_FORMAT ", \"errors\": %" G_GUINT64_FORMAT
+            ", \"rows\": %" G_GUINT64_FORMAT ", \"qps\": %.1f,\n", ops, errors, rows, elapsed > 0 ? ops / elapsed : 0);
+    fprintf(out, " \"latency_us\": {\"avg\": %.1f, \"p50\": %" G_GUINT64_FORMAT ", \"p90\": %" G_GUINT64_FORMAT
+            ", \"p99\": %" G_GUINT64_FORMAT ", \"p999\": %" G_GUINT64_FORMAT ", \"max\": %" G_GUINT64_FORMAT "}}\n",
+            all->total ? (double)all->sum / all->total : 0.0,
+            hist_percentile(all, 50), hist_percentile(all, 90), hist_percentile(all, 99),
+            hist_percentile(all, 99.9), all->max);
+    g_free(all);
+}
+
+/* utime + stime of a process in clock ticks, -1 on error */
+static gint64
+proc_cpu_ticks(int pid)
+{
+    gchar *path = g_strdup_printf("/proc/%d/stat", pid);
+    gchar *content = NULL;
+    gint64 ticks = -1;
+
+    if (g_file_get_contents(path, &content, NULL, NULL)) {
+        /* comm may contain spaces, the fields after it are fixed */
+        char *p = strrchr(content, ')');
+        unsigned long utime, stime;
+        if (p && sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) == 2) {
+            ticks = (gint64)utime + stime;
+        }
+    }
+    g_free(content);
+    g_free(path);
+    return ticks;
+}
+
+static void
+bench_idle_report(FILE *out, int opened, double elapsed, double cpu_ms)
+{
+    fprintf(out, "{\"scenario\": \"idle\", \"target\": \"%s:%u\", \"connections\": %d, \"opened\": %d,"
+            " \"duration_sec\": %.3f, \"proxy_cpu_ms_per_sec\": %.3f}\n", target_host, target_port,
+            opt_connections, opened, elapsed, cpu_ms >= 0 && elapsed > 0 ? cpu_ms / elapsed : -1.0);
+}
+
+/*
+ * opens the connections one by one from this thread and keeps them open
+ * without traffic, the proxy is expected to do no work for them
+ */
+static int
+bench_idle(FILE *out)
+{
+    MYSQL **conns = g_new0(MYSQL *, opt_connections);
+    gint64 cpu_start = -1, cpu_end = -1, start, end;
+    double elapsed, cpu_ms = -1;
+    int opened = 0;
+    int i;
+
+    for (i = 0; i < opt_connections; i++) {
+        conns[i] = bench_connect();
+        if (conns[i] == NULL) {
+            g_warning("%s: connect %d failed, holding %d connections", G_STRLOC, i, opened);
+            break;
+        }
+        opened++;
+    }
+
+    if (opt_warmup > 0)
+        g_usleep((gulong)opt_warmup * G_USEC_PER_SEC);
+    if (opt_proxy_pid > 0)
+        cpu_start = proc_cpu_ticks(opt_proxy_pid);
+    start = g_get_monotonic_time();
+    g_usleep((gulong)opt_duration * G_USEC_PER_SEC);
+    end = g_get_monotonic_time();
+    if (opt_proxy_pid > 0)
+        cpu_end = proc_cpu_ticks(opt_proxy_pid);
+
+    elapsed = (end - start) / 1000000.0;
+    if (cpu_start >= 0 && cpu_end >= cpu_start) {
+        cpu_ms = (cpu_end - cpu_start) * 1000.0 / sysconf(_SC_CLK_TCK);
+    }
+    bench_idle_report(out, opened, elapsed, cpu_ms);
+    if (opt_report) {
+        FILE *f = fopen(opt_report, "a");
+        if (f) {
+            bench_idle_report(f, opened, elapsed, cpu_ms);
+            fclose(f);
+        } else {
+            fprintf(stderr, "can't open %s\n", opt_report);
+        }
+    }
+
+    for (i = 0; i < opened; i++) {
+        mysql_close(conns[i]);
+    }
+    g_free(conns);
+    return opened > 0 ? 0 : 1;
+}
+
+static GOptionEntry bench_entries[] = {
+    {"target", 0, 0, G_OPTION_ARG_STRING, &opt_target, "proxy address (default: the fake backend)", "<host:port>"},
+    {"user", 'u', 0, G_OPTION_ARG_STRING, &opt_user, "user name (default: root)", "<user>"},
+    {"password", 'p', 0, G_OPTION_ARG_STRING, &opt_password, "password", "<password>"},
+    {"database", 'D', 0, G_OPTION_ARG_STRING, &opt_database, "default database", "<db>"},
+    {"scenario", 's', 0, G_OPTION_ARG_STRING, &opt_scenario, "scenario to run (default: point-select)", "<name>"},
+    {"sql", 0, 0, G_OPTION_ARG_STRING, &opt_sql, "statement replacing the one of the scenario, '?' is a random key",
+     "<sql>"},
+    {"connections", 'c', 0, G_OPTION_ARG_INT, &opt_connections, "client connections (default: 16)", "<n>"},
+    {"duration", 't', 0, G_OPTION_ARG_INT, &opt_duration, "seconds to measure (default: 10)", "<sec>"},
+    {"warmup", 0, 0, G_OPTION_ARG_INT, &opt_warmup, "seconds to run before measuring (default: 0)", "<sec>"},
+    {"keys", 0, 0, G_OPTION_ARG_INT, &opt_keys, "random keys are in [1, keys] (default: 100000)", "<n>"},
+    {"report", 'o', 0, G_OPTION_ARG_FILENAME, &opt_report, "append the JSON result to this file", "<file>"},
+    {"list", 'l', 0, G_OPTION_ARG_NONE, &opt_list, "list the scenarios", NULL},
+    {"backend", 0, 0, G_OPTION_ARG_STRING, &opt_backend, "start a fake MySQL backend on this address", "<host:port>"},
+    {"backend-only", 0, 0, G_OPTION_ARG_NONE, &opt_backend_only, "only serve the fake backend, no load", NULL},
+    {"rows", 0, 0, G_OPTION_ARG_INT, &opt_rows, "backend: rows of a SELECT without LIMIT (default: 1000)", "<n>"},
+    {"columns", 0, 0, G_OPTION_ARG_INT, &opt_columns, "backend: columns of a result set (default: 2)", "<n>"},
+    {"value-size", 0, 0, G_OPTION_ARG_INT, &opt_value_size, "backend: bytes of a text column (default: 32)", "<n>"},
+    {"latency-us", 0, 0, G_OPTION_ARG_INT, &opt_latency_us, "backend: delay of each response (default: 0)", "<us>"},
+    {"proxy-pid", 0, 0, G_OPTION_ARG_INT, &opt_proxy_pid, "idle: pid of the proxy to measure CPU time of", "<pid>"},
+    {NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL}
+};
+
+static gboolean
+parse_host_port(const char *addr, char **host, guint *port)
+{
+    const char *colon = strrchr(addr, ':');
+    if (!colon || colon == addr || colon[1] == '\0')
+        return FALSE;
+    *host = g_strndup(addr, colon - addr);
+    *port = atoi(colon + 1);
+    return *port > 0 && *port < 65536;
+}
+
+int
+main(int argc, char **argv)
+{
+    GOptionContext *context;
+    GError *gerr = NULL;
+    const bench_scenario_t *scenario = NULL;
+    bench_backend_config_t backend_config;
+    bench_backend_t *backend = NULL;
+    bench_worker_t *workers;
+    gint64 start, end;
+    int i;
+
+#if !GLIB_CHECK_VERSION(2, 32, 0)
+    g_thread_init(NULL);
+#endif
+    signal(SIGPIPE, SIG_IGN);
+
+    context = g_option_context_new("- end-to-end benchmark of cetus");
+    g_option_context_add_main_entries(context, bench_entries, NULL);
+    if (!g_option_context_parse(context, &argc, &argv, &gerr)) {
+        fprintf(stderr, "%s\n", gerr->message);
+        g_clear_error(&gerr);
+        g_option_context_free(context);
+        return 1;
+    }
+    g_option_context_free(context);
+
+    if (opt_list) {
+        for (scenario = bench_scenarios; scenario->name; scenario++) {
+            printf("%-14s %s\n", scenario->name, scenario->description);
+            if (scenario->sql)
+                printf("  %s\n", scenario->sql);
+        }
+        return 0;
+    }
+
+    for (i = 0; bench_scenarios[i].name; i++) {
+        if (strcmp(bench_scenarios[i].name, opt_scenario) == 0) {
+            scenario = &bench_scenarios[i];
+            break;
+        }
+    }
+    if (!scenario) {
+        fprintf(stderr, "unknown scenario: %s, see --list\n", opt_scenario);
+        return 1;
+    }
+    if (opt_connections <= 0 || opt_duration <= 0 || opt_warmup < 0 || opt_keys <= 0
+        || opt_rows < 0 || opt_columns <= 0 || opt_value_size < 0 || opt_latency_us < 0) {
+        fprintf(stderr, "invalid option value\n");
+        return 1;
+    }
+
+    if (opt_backend) {
+        backend_config.address = opt_backend;
+        backend_config.rows = opt_rows;
+        backend_config.columns = opt_columns;
+        backend_config.value_size = opt_value_size;
+        backend_config.latency_us = opt_latency_us;
+        backend = bench_backend_new(&backend_config);
+        if (!backend) {
+            fprintf(stderr, "can't listen on %s\n", opt_backend);
+            return 1;
+        }
+        if (opt_backend_only) {
+            bench_backend_run(backend);     /* until killed */
+            bench_backend_free(backend);
+            return 0;
+        }
+        if (!bench_backend_start_thread(backend)) {
+            bench_backend_free(backend);
+            return 1;
+        }
+    } else if (opt_backend_only) {
+        fprintf(stderr, "--backend-only needs --backend\n");
+        return 1;
+    }
+
+    if (!parse_host_port(opt_target ? opt_target : (opt_backend ? opt_backend : ""), &target_host, &target_port)) {
+        fprintf(stderr, "need --target=<host:port> or --backend=<host:port>\n");
+        return 1;
+    }
+
+    mysql_library_init(0, NULL, NULL);
+
+    if (scenario->run == NULL) {
+        int rv = bench_idle(stdout);
+        if (backend) {
+            chassis_set_shutdown();
+            bench_backend_join_thread(backend);
+            bench_backend_free(backend);
+        }
+        mysql_library_end();
+        g_free(target_host);
+        return rv;
+    }
+
+    workers = g_new0(bench_worker_t, opt_connections);
+    for (i = 0; i < opt_connections; i++) {
+        workers[i].id = i;
+        workers[i].rand = g_rand_new_with_seed(i + 1);
+        workers[i].scenario = scenario;
+        workers[i].sql = opt_sql ? opt_sql : scenario->sql;
+        workers[i].thread = bench_thread_new("bench-worker", bench_worker_main, &workers[i]);
+        if (!workers[i].thread) {
+            opt_connections = i;
+            break;
+        }
+    }
+
+    if (opt_warmup > 0)
+        g_usleep((gulong)opt_warmup * G_USEC_PER_SEC);
+    start = g_get_monotonic_time();
+    g_atomic_int_set(&bench_recording, 1);
+    g_usleep((gulong)opt_duration * G_USEC_PER_SEC);
+    g_atomic_int_set(&bench_stop, 1);
+    end = g_get_monotonic_time();
+
+    for (i = 0; i < opt_connections; i++) {
+        g_thread_join(workers[i].thread);
+        g_rand_free(workers[i].rand);
+    }
+
+    bench_report(stdout, scenario, workers, (end - start) / 1000000.0);
+    if (opt_report) {
+        FILE *f = fopen(opt_report, "a");
+        if (f) {
+            bench_report(f, scenario, workers, (end - start) / 1000000.0);
+            fclose(f);
+        } else {
+            fprintf(stderr, "can't open %s\n", opt_report);
+        }
+    }
+    g_free(workers);
+
+    if (backend) {
+        chassis_set_shutdown();
+        bench_backend_join_thread(backend);
+        bench_backend_free(backend);
+    }
+    mysql_library_end();
+    g_free(target_host);
+    return 0;
+}
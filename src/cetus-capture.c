@@ -0,0 +1,333 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#include "cetus-capture.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cetus-util.h"
+#include "network-mysqld.h"
+#include "network-mysqld-packet.h"
+
+/* records are buffered and written in chunks of this size */
+#define CAPTURE_FLUSH_SIZE (64 * 1024)
+
+struct capture_t {
+    gchar *filename;
+    int fd;
+    guint32 gen;                /* tells connections seen by an earlier capture */
+    guint32 next_id;
+    gint64 start_us;
+    GString *buf;
+    GString *payload;
+
+    guint64 records;
+    guint64 bytes;
+    guint64 max_bytes;
+    gboolean is_full;
+};
+
+static guint32 capture_gen = 0;
+
+static gint64
+timeval_us(const struct timeval *tv)
+{
+    return (gint64)tv->tv_sec * G_USEC_PER_SEC + tv->tv_usec;
+}
+
+static void
+put_varint(GString *out, guint64 v)
+{
+    while (v >= 0x80) {
+        g_string_append_c(out, (char)(v | 0x80));
+        v >>= 7;
+    }
+    g_string_append_c(out, (char)v);
+}
+
+static void
+put_str(GString *out, const GString *s)
+{
+    if (s) {
+        put_varint(out, s->len);
+        g_string_append_len(out, s->str, s->len);
+    } else {
+        put_varint(out, 0);
+    }
+}
+
+static void
+put_cstr(GString *out, const char *s)
+{
+    gsize len = strlen(s);
+
+    put_varint(out, len);
+    g_string_append_len(out, s, len);
+}
+
+static void
+capture_flush(capture_t *cap)
+{
+    gsize off = 0;
+
+    while (off < cap->buf->len) {
+        ssize_t n = write(cap->fd, cap->buf->str + off, cap->buf->len - off);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            g_critical("%s: write %s failed: %s, capture stopped", G_STRLOC, cap->filename, g_strerror(errno));
+            cap->is_full = TRUE;
+            break;
+        }
+        off += n;
+    }
+    g_string_truncate(cap->buf, 0);
+}
+
+static void
+capture_append(capture_t *cap, guint8 type, guint32 conn_id, gint64 at_us, const GString *payload)
+{
+    gsize old_len = cap->buf->len;
+
+    if (cap->is_full)
+        return;
+
+    g_string_append_c(cap->buf, type);
+    put_varint(cap->buf, conn_id);
+    put_varint(cap->buf, MAX(at_us - cap->start_us, 0));
+    put_varint(cap->buf, payload ? payload->len : 0);
+    if (payload)
+        g_string_append_len(cap->buf, payload->str, payload->len);
+
+    cap->records++;
+    cap->bytes += cap->buf->len - old_len;
+    if (cap->max_bytes && cap->bytes >= cap->max_bytes) {
+        g_message("%s: capture reached %" G_GUINT64_FORMAT " bytes, stopped", G_STRLOC, cap->bytes);
+        cap->is_full = TRUE;
+    }
+    if (cap->buf->len >= CAPTURE_FLUSH_SIZE || cap->is_full)
+        capture_flush(cap);
+}
+
+capture_t *
+capture_new(const char *dir, guint64 max_bytes)
+{
+    capture_t *cap;
+    struct timeval now;
+    char stamp[32];
+    time_t t;
+    guint32 version = GUINT32_TO_LE(CAPTURE_VERSION);
+    guint64 start;
+
+    gettimeofday(&now, NULL);
+    t = now.tv_sec;
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", localtime(&t));
+
+    cap = g_new0(capture_t, 1);
+    cap->filename = g_strdup_printf("%s/cetus-%d-%s.cap", dir, (int)getpid(), stamp);
+    cap->fd = open(cap->filename, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0640);
+    if (cap->fd < 0) {
+        g_critical("%s: can't create %s: %s", G_STRLOC, cap->filename, g_strerror(errno));
+        g_free(cap->filename);
+        g_free(cap);
+        return NULL;
+    }
+    cap->gen = ++capture_gen;
+    cap->start_us = timeval_us(&now);
+    cap->max_bytes = max_bytes;
+    cap->buf = g_string_sized_new(CAPTURE_FLUSH_SIZE + 1024);
+    cap->payload = g_string_sized_new(1024);
+
+    start = GUINT64_TO_LE((guint64)cap->start_us);
+    g_string_append_len(cap->buf, C(CAPTURE_MAGIC));
+    g_string_append_len(cap->buf, (char *)&version, sizeof(version));
+    g_string_append_len(cap->buf, (char *)&start, sizeof(start));
+    cap->bytes = cap->buf->len;
+
+    g_message("%s: capture client traffic to %s", G_STRLOC, cap->filename);
+    return cap;
+}
+
+void
+capture_free(capture_t *cap)
+{
+    if (!cap)
+        return;
+    capture_flush(cap);
+    close(cap->fd);
+    g_message("%s: capture %s closed, %" G_GUINT64_FORMAT " records, %" G_GUINT64_FORMAT " bytes",
+              G_STRLOC, cap->filename, cap->records, cap->bytes);
+    g_string_free(cap->buf, TRUE);
+    g_string_free(cap->payload, TRUE);
+    g_free(cap->filename);
+    g_free(cap);
+}
+
+void
+capture_command(capture_t *cap, network_mysqld_con *con)
+{
+    network_socket *client = con->client;
+    GString *payload = cap->payload;
+    GList *l;
+
+    if (cap->is_full)
+        return;
+
+    /* first request of the connection in this capture, save the session to start from */
+    if (con->capture_gen != cap->gen) {
+        guint8 flags = 0;
+
+        con->capture_gen = cap->gen;
+        con->capture_id = ++cap->next_id;
+        if (con->is_auto_commit)
+            flags |= CAPTURE_FLAG_AUTOCOMMIT;
+        if (con->is_in_transaction)
+            flags |= CAPTURE_FLAG_IN_TRANSACTION;
+
+        g_string_truncate(payload, 0);
+        put_str(payload, client->response ? client->response->username : NULL);
+        put_str(payload, client->default_db);
+        put_cstr(payload, network_socket_attr(client, SOCKET_ATTR_CHARSET));
+        g_string_append_c(payload, flags);
+        capture_append(cap, CAPTURE_OPEN, con->capture_id, timeval_us(&con->req_recv_time), payload);
+    }
+
+    g_string_truncate(payload, 0);
+    for (l = client->recv_queue->chunks->head; l; l = l->next) {
+        GString *packet = l->data;
+        if (packet->len > NET_HEADER_SIZE)
+            g_string_append_len(payload, packet->str + NET_HEADER_SIZE, packet->len - NET_HEADER_SIZE);
+    }
+    capture_append(cap, CAPTURE_COMMAND, con->capture_id, timeval_us(&con->req_recv_time), payload);
+    con->capture_pending = 1;
+
+    if (payload->allocated_len > CAPTURE_FLUSH_SIZE) {  /* don't keep a large statement around */
+        g_string_free(payload, TRUE);
+        cap->payload = g_string_sized_new(1024);
+    }
+}
+
+void
+capture_response(capture_t *cap, network_mysqld_con *con)
+{
+    gint64 latency;
+
+    if (con->capture_gen != cap->gen || !con->capture_pending)
+        return;
+    con->capture_pending = 0;
+
+    latency = timeval_us(&con->resp_send_time) - timeval_us(&con->req_recv_time);
+    g_string_truncate(cap->payload, 0);
+    put_varint(cap->payload, MAX(latency, 0));
+    capture_append(cap, CAPTURE_RESPONSE, con->capture_id, timeval_us(&con->resp_send_time), cap->payload);
+}
+
+void
+capture_close(capture_t *cap, network_mysqld_con *con)
+{
+    struct timeval now;
+
+    if (con->capture_gen != cap->gen)
+        return;
+    gettimeofday(&now, NULL);
+    capture_append(cap, CAPTURE_CLOSE, con->capture_id, timeval_us(&now), NULL);
+    con->capture_gen = 0;
+}
+
+const char *
+capture_filename(capture_t *cap)
+{
+    return cap->filename;
+}
+
+guint64
+capture_records(capture_t *cap)
+{
+    return cap->records;
+}
+
+guint64
+capture_bytes(capture_t *cap)
+{
+    return cap->bytes;
+}
+
+gboolean
+capture_is_full(capture_t *cap)
+{
+    return cap->is_full;
+}
+
+static gboolean
+get_varint(FILE *fp, guint64 *v)
+{
+    int shift, c;
+
+    *v = 0;
+    for (shift = 0; shift < 64; shift += 7) {
+        if ((c = getc(fp)) == EOF)
+            return FALSE;
+        *v |= (guint64)(c & 0x7f) << shift;
+        if (!(c & 0x80))
+            return TRUE;
+    }
+    return FALSE;
+}
+
+gboolean
+capture_read_header(FILE *fp, guint64 *start_us)
+{
+    char magic[sizeof(CAPTURE_MAGIC) - 1];
+    guint32 version;
+    guint64 start;
+
+    if (fread(magic, sizeof(magic), 1, fp) != 1 || memcmp(magic, CAPTURE_MAGIC, sizeof(magic)) != 0)
+        return FALSE;
+    if (fread(&version, sizeof(version), 1, fp) != 1 || GUINT32_FROM_LE(version) != CAPTURE_VERSION)
+        return FALSE;
+    if (fread(&start, sizeof(start), 1, fp) != 1)
+        return FALSE;
+    *start_us = GUINT64_FROM_LE(start);
+    return TRUE;
+}
+
+int
+capture_read_record(FILE *fp, guint8 *type, guint32 *conn_id, guint64 *ts_us, GString *buf)
+{
+    guint64 id, len;
+    int c;
+
+    if ((c = getc(fp)) == EOF)
+        return 0;
+    *type = c;
+    if (!get_varint(fp, &id) || !get_varint(fp, ts_us) || !get_varint(fp, &len) || len > G_MAXUINT32)
+        return -1;
+    *conn_id = id;
+
+    g_string_set_size(buf, len);
+    if (len && fread(buf->str, len, 1, fp) != 1)
+        return -1;
+    return 1;
+}
@@ -0,0 +1,88 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#ifndef _CETUS_CAPTURE_H_
+#define _CETUS_CAPTURE_H_
+
+#include <stdio.h>
+#include <glib.h>
+
+/**
+ * Traffic capture of client connections, replayed by cetus-replay.
+ *
+ * One file holds the interleaved streams of all connections, every record
+ * is tagged with the capture id of its connection:
+ *
+ *   file:    "CETUSCAP" <u32 version> <u64 start time, us since epoch>
+ *   record:  <u8 type> <varint conn id> <varint us since start> <varint len> <payload>
+ *
+ * integers are little-endian, varints are LEB128
+ */
+#define CAPTURE_MAGIC "CETUSCAP"
+#define CAPTURE_VERSION 1
+
+enum capture_record_type {
+    CAPTURE_OPEN = 1,           /* <str user> <str db> <str charset> <u8 flags>, str is <varint len> <bytes> */
+    CAPTURE_COMMAND = 2,        /* command byte and arguments, packet headers stripped */
+    CAPTURE_RESPONSE = 3,       /* <varint latency in us> of the last command */
+    CAPTURE_CLOSE = 4,          /* empty */
+};
+
+/* flags of CAPTURE_OPEN */
+#define CAPTURE_FLAG_AUTOCOMMIT     0x01
+#define CAPTURE_FLAG_IN_TRANSACTION 0x02
+
+typedef struct capture_t capture_t;
+struct network_mysqld_con;
+
+/**
+ * start capturing into a new file in dir
+ * @param max_bytes  stop writing after this many bytes, 0 for no limit
+ * @return NULL if the file can't be created
+ */
+capture_t *capture_new(const char *dir, guint64 max_bytes);
+
+/* flush and close the file */
+void capture_free(capture_t *cap);
+
+/* the client request in con->client->recv_queue, the first one also records the session state */
+void capture_command(capture_t *cap, struct network_mysqld_con *con);
+
+/* the response of the captured request has been sent */
+void capture_response(capture_t *cap, struct network_mysqld_con *con);
+
+void capture_close(capture_t *cap, struct network_mysqld_con *con);
+
+const char *capture_filename(capture_t *cap);
+guint64 capture_records(capture_t *cap);
+guint64 capture_bytes(capture_t *cap);
+gboolean capture_is_full(capture_t *cap);
+
+/**
+ * read the next record
+ * @param buf  payload of the record
+ * @return 1 on success, 0 at end of file, -1 if the file is corrupt
+ */
+int capture_read_record(FILE *fp, guint8 *type, guint32 *conn_id, guint64 *ts_us, GString *buf);
+
+/* check the file header, @param start_us the capture start time */
+gboolean capture_read_header(FILE *fp, guint64 *start_us);
+
+#endif /* _CETUS_CAPTURE_H_ */
@@ -0,0 +1,772 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#include "cetus-ddl-job.h"
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <mysql.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cetus-users.h"
+#include "cetus-util.h"
+#include "chassis-timings.h"
+#include "glib-ext.h"
+#include "network-backend.h"
+#include "network-mysqld.h"
+
+#define DDL_JOB_MAX_FINISHED 32     /* finished jobs kept for display */
+#define DDL_JOB_THROTTLE_USEC G_USEC_PER_SEC
+#define DDL_JOB_STOP_TIMEOUT_USEC (10 * G_USEC_PER_SEC)
+
+typedef enum {
+    DDL_SHARD_PENDING,
+    DDL_SHARD_WAITING,          /* throttled by slave delay */
+    DDL_SHARD_RUNNING,
+    DDL_SHARD_DONE,
+    DDL_SHARD_FAILED,
+    DDL_SHARD_CANCELLED,
+} ddl_shard_state_t;
+
+static const char *ddl_shard_state_names[] = {
+    "pending",
+    "waiting",
+    "running",
+    "done",
+    "failed",
+    "cancelled",
+};
+
+struct ddl_shard_t {
+    GString *group;
+    char *addr;                 /* master of the group when submitted or retried */
+    ddl_shard_state_t state;
+    gint64 start_time;          /* monotonic usec */
+    gint64 end_time;
+    GString *error;
+    unsigned long thread_id;    /* connection id on the master while running, 0 otherwise */
+};
+
+struct ddl_job_t {
+    guint id;
+    char *sql;
+    char *db;
+    char *user;
+    char *passwd;
+    guint parallel;
+    gint max_lag_msec;
+    gint lag_msec;              /* slave delay of the groups, taken on the main loop */
+    GPtrArray *shards;          /* GPtrArray<ddl_shard_t *> */
+    guint workers;              /* running worker threads */
+};
+
+static struct {
+    chassis *chas;
+    GMutex *mutex;
+    GCond *cond;
+    gboolean stopping;
+    GQueue *jobs;               /* GQueue<ddl_job_t *>, oldest first */
+    guint next_id;
+    guint workers;
+    struct event lag_timer;     /* refreshes lag_msec of throttled jobs */
+    gboolean lag_timer_armed;
+} ddl_service;
+
+static void
+ddl_shard_free(struct ddl_shard_t *shard)
+{
+    g_string_free(shard->group, TRUE);
+    g_free(shard->addr);
+    g_string_free(shard->error, TRUE);
+    g_free(shard);
+}
+
+static void
+ddl_job_free(struct ddl_job_t *job)
+{
+    g_free(job->sql);
+    g_free(job->db);
+    g_free(job->user);
+    g_free(job->passwd);
+    g_ptr_array_free(job->shards, TRUE);
+    g_free(job);
+}
+
+static void
+ddl_lock(void)
+{
+    g_mutex_lock(ddl_service.mutex);
+}
+
+static void
+ddl_unlock(void)
+{
+    g_mutex_unlock(ddl_service.mutex);
+}
+
+static void
+ddl_wait_until(gint64 deadline)
+{
+#if !GLIB_CHECK_VERSION(2, 32, 0)
+    gint64 usec = deadline - g_get_monotonic_time();
+    if (usec <= 0) {
+        return;
+    }
+    GTimeVal tv;
+    g_get_current_time(&tv);
+    g_time_val_add(&tv, usec);
+    g_cond_timed_wait(ddl_service.cond, ddl_service.mutex, &tv);
+#else
+    g_cond_wait_until(ddl_service.cond, ddl_service.mutex, deadline);
+#endif
+}
+
+static void
+ddl_service_init(chassis *chas)
+{
+    ddl_service.chas = chas;
+    if (ddl_service.mutex) {
+        return;
+    }
+#if !GLIB_CHECK_VERSION(2, 32, 0)
+    ddl_service.mutex = g_mutex_new();
+    ddl_service.cond = g_cond_new();
+#else
+    ddl_service.mutex = g_new0(GMutex, 1);
+    g_mutex_init(ddl_service.mutex);
+    ddl_service.cond = g_new0(GCond, 1);
+    g_cond_init(ddl_service.cond);
+#endif
+    ddl_service.jobs = g_queue_new();
+    ddl_service.next_id = 1;
+}
+
+static struct ddl_job_t *
+ddl_job_lookup(guint job_id)
+{
+    GList *l;
+    for (l = ddl_service.jobs->head; l; l = l->next) {
+        struct ddl_job_t *job = l->data;
+        if (job->id == job_id) {
+            return job;
+        }
+    }
+    return NULL;
+}
+
+static gboolean
+ddl_job_finished(struct ddl_job_t *job)
+{
+    if (job->workers > 0) {
+        return FALSE;
+    }
+    int i;
+    for (i = 0; i < job->shards->len; ++i) {
+        struct ddl_shard_t *shard = g_ptr_array_index(job->shards, i);
+        if (shard->state == DDL_SHARD_PENDING) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+/* must be locked */
+static void
+ddl_job_prune(void)
+{
+    guint finished = 0;
+    GList *l;
+    for (l = ddl_service.jobs->head; l; l = l->next) {
+        if (ddl_job_finished(l->data)) {
+            finished++;
+        }
+    }
+    l = ddl_service.jobs->head;
+    while (l && finished > DDL_JOB_MAX_FINISHED) {
+        GList *next = l->next;
+        struct ddl_job_t *job = l->data;
+        if (ddl_job_finished(job)) {
+            g_queue_delete_link(ddl_service.jobs, l);
+            ddl_job_free(job);
+            finished--;
+        }
+        l = next;
+    }
+}
+
+/*
+ * largest delay among slaves of the job's groups, as measured by the monitor,
+ * main thread only: the admin plugin changes the backends there without a lock
+ */
+static gint
+ddl_job_max_lag(struct ddl_job_t *job)
+{
+    network_backends_t *bs = ddl_service.chas->priv->backends;
+    gint max_lag = 0;
+    int i, j;
+    for (i = 0; i < job->shards->len; ++i) {
+        struct ddl_shard_t *shard = g_ptr_array_index(job->shards, i);
+        network_group_t *group = network_backends_get_group(bs, shard->group);
+        if (!group) {
+            continue;
+        }
+        for (j = 0; j < group->nslaves; ++j) {
+            network_backend_t *backend = group->slaves[j];
+            if (backend->state == BACKEND_STATE_DELETED || backend->state == BACKEND_STATE_MAINTAINING) {
+                continue;
+            }
+            max_lag = MAX(max_lag, backend->slave_delay_msec);
+        }
+    }
+    return max_lag;
+}
+
+/* must be locked, @return FALSE if stopped or cancelled while waiting */
+static gboolean
+ddl_job_throttle(struct ddl_job_t *job, struct ddl_shard_t *shard)
+{
+    if (job->max_lag_msec <= 0) {
+        return !ddl_service.stopping;
+    }
+    while (!ddl_service.stopping && shard->state != DDL_SHARD_CANCELLED) {
+        gint lag = job->lag_msec;
+        if (lag <= job->max_lag_msec) {
+            return TRUE;
+        }
+        if (shard->state != DDL_SHARD_WAITING) {
+            g_message("ddl job %u: slave delay %d ms, hold group %s", job->id, lag, shard->group->str);
+            shard->state = DDL_SHARD_WAITING;
+        }
+        ddl_wait_until(g_get_monotonic_time() + DDL_JOB_THROTTLE_USEC);
+    }
+    return FALSE;
+}
+
+static void
+ddl_lag_timer_add(void)
+{
+    struct timeval timeout = { DDL_JOB_THROTTLE_USEC / G_USEC_PER_SEC, 0 };
+
+    /* EV_PERSIST not work for libevent1.4, re-activate timer each time */
+    chassis_event_add_with_timeout(ddl_service.chas, &ddl_service.lag_timer, &timeout);
+    ddl_service.lag_timer_armed = TRUE;
+}
+
+/* snapshot the slave delay for the workers of throttled jobs */
+static void
+ddl_lag_timer_handler(int G_GNUC_UNUSED fd, short G_GNUC_UNUSED what, void G_GNUC_UNUSED *arg)
+{
+    gboolean throttled = FALSE;
+    GList *l;
+
+    ddl_lock();
+    ddl_service.lag_timer_armed = FALSE;
+    for (l = ddl_service.jobs->head; l; l = l->next) {
+        struct ddl_job_t *job = l->data;
+        if (job->max_lag_msec > 0 && job->workers > 0) {
+            job->lag_msec = ddl_job_max_lag(job);
+            throttled = TRUE;
+        }
+    }
+    if (throttled && !ddl_service.stopping) {
+        g_cond_broadcast(ddl_service.cond);
+        ddl_lag_timer_add();
+    }
+    ddl_unlock();
+}
+
+/* must be locked, main thread */
+static void
+ddl_lag_timer_start(struct ddl_job_t *job)
+{
+    if (job->max_lag_msec <= 0) {
+        return;
+    }
+    job->lag_msec = ddl_job_max_lag(job);
+    if (!ddl_service.lag_timer_armed) {
+        evtimer_set(&ddl_service.lag_timer, ddl_lag_timer_handler, NULL);
+        ddl_lag_timer_add();
+    }
+}
+
+static gboolean
+ddl_run_statement(struct ddl_job_t *job, struct ddl_shard_t *shard, const char *addr, GString *error)
+{
+    MYSQL *conn = mysql_init(NULL);
+    if (!conn) {
+        g_string_assign(error, "mysql_init failed");
+        return FALSE;
+    }
+    /* no read timeout, an ALTER might take hours */
+    unsigned int timeout = 2 * SECONDS;
+    mysql_options(conn, MYSQL_OPT_CONNECT_TIMEOUT, &timeout);
+
+    char **ip_port = g_strsplit(addr, ":", -1);
+    int port = ip_port[1] ? atoi(ip_port[1]) : 3306;
+    gboolean ok = FALSE;
+    if (mysql_real_connect(conn, ip_port[0], job->user, job->passwd, job->db, port, NULL, 0) == NULL) {
+        g_string_printf(error, "connect %s: %s", addr, mysql_error(conn));
+    } else {
+        /* stop kills the statement by this id */
+        ddl_lock();
+        gboolean stopping = ddl_service.stopping;
+        shard->thread_id = stopping ? 0 : mysql_thread_id(conn);
+        ddl_unlock();
+
+        if (stopping) {
+            g_string_assign(error, "stopped");
+        } else if (mysql_real_query(conn, L(job->sql)) != 0) {
+            g_string_printf(error, "%u: %s", mysql_errno(conn), mysql_error(conn));
+        } else {
+            MYSQL_RES *res = mysql_store_result(conn);
+            if (res) {
+                mysql_free_result(res);
+            }
+            ok = TRUE;
+        }
+
+        ddl_lock();
+        shard->thread_id = 0;
+        ddl_unlock();
+    }
+    g_strfreev(ip_port);
+    mysql_close(conn);
+    return ok;
+}
+
+static void *
+ddl_job_worker(void *data)
+{
+    struct ddl_job_t *job = data;
+
+    ddl_lock();
+    while (!ddl_service.stopping) {
+        struct ddl_shard_t *shard = NULL;
+        int i;
+        for (i = 0; i < job->shards->len; ++i) {
+            struct ddl_shard_t *s = g_ptr_array_index(job->shards, i);
+            if (s->state == DDL_SHARD_PENDING) {
+                shard = s;
+                break;
+            }
+        }
+        if (!shard) {
+            break;
+        }
+        if (!ddl_job_throttle(job, shard)) {
+            shard->state = DDL_SHARD_CANCELLED;
+            break;
+        }
+        shard->state = DDL_SHARD_RUNNING;
+        shard->start_time = g_get_monotonic_time();
+        char *addr = g_strdup(shard->addr);
+        ddl_unlock();
+
+        g_message("ddl job %u: start on group %s (%s)", job->id, shard->group->str, addr);
+        GString *error = g_string_new(NULL);
+        gboolean ok = ddl_run_statement(job, shard, addr, error);
+        g_free(addr);
+
+        ddl_lock();
+        shard->end_time = g_get_monotonic_time();
+        shard->state = ok ? DDL_SHARD_DONE : DDL_SHARD_FAILED;
+        g_string_assign(shard->error, error->str);
+        if (ok) {
+            g_message("ddl job %u: group %s done in %.3f sec", job->id, shard->group->str,
+                      (shard->end_time - shard->start_time) / (double)G_USEC_PER_SEC);
+        } else {
+            g_critical("ddl job %u: group %s failed, %s", job->id, shard->group->str, error->str);
+        }
+        g_string_free(error, TRUE);
+    }
+    job->workers--;
+    ddl_service.workers--;
+    g_cond_broadcast(ddl_service.cond);
+    ddl_unlock();
+    mysql_thread_end();
+    return NULL;
+}
+
+/* must be locked, workers are detached, stop waits on the worker count */
+static void
+ddl_job_spawn_workers(struct ddl_job_t *job)
+{
+    guint pending = 0;
+    int i;
+    for (i = 0; i < job->shards->len; ++i) {
+        struct ddl_shard_t *shard = g_ptr_array_index(job->shards, i);
+        if (shard->state == DDL_SHARD_PENDING) {
+            pending++;
+        }
+    }
+    guint wanted = MIN(job->parallel, pending);
+    while (job->workers < wanted) {
+#if !GLIB_CHECK_VERSION(2, 32, 0)
+        GError *error = NULL;
+        GThread *thread = g_thread_create(ddl_job_worker, job, FALSE, &error);
+        if (thread == NULL) {
+            g_critical("Create thread error: %s", error ? error->message : "");
+            if (error)
+                g_error_free(error);
+            break;
+        }
+#else
+        GThread *thread = g_thread_new("ddl-worker", ddl_job_worker, job);
+        if (thread == NULL) {
+            g_critical("Create thread error.");
+            break;
+        }
+        g_thread_unref(thread);
+#endif
+        job->workers++;
+        ddl_service.workers++;
+    }
+}
+
+static struct ddl_shard_t *
+ddl_shard_new(network_group_t *group)
+{
+    struct ddl_shard_t *shard = g_new0(struct ddl_shard_t, 1);
+    shard->group = g_string_new(group->name->str);
+    shard->addr = g_strdup(group->master->addr->name->str);
+    shard->state = DDL_SHARD_PENDING;
+    shard->error = g_string_new(NULL);
+    return shard;
+}
+
+/* the master might have changed since submit, e.g. after a failover */
+static gboolean
+ddl_shard_resolve_master(struct ddl_shard_t *shard, network_backends_t *bs)
+{
+    network_group_t *group = network_backends_get_group(bs, shard->group);
+    if (!group || !group->master) {
+        g_string_printf(shard->error, "group %s not found or has no master", shard->group->str);
+        return FALSE;
+    }
+    if (strcmp(shard->addr, group->master->addr->name->str) != 0) {
+        g_message("ddl job: group %s master changed from %s to %s", shard->group->str,
+                  shard->addr, group->master->addr->name->str);
+        g_free(shard->addr);
+        shard->addr = g_strdup(group->master->addr->name->str);
+    }
+    return TRUE;
+}
+
+static gboolean
+ddl_job_add_shards(struct ddl_job_t *job, network_backends_t *bs, char **groups, GString *err)
+{
+    int i;
+    if (!groups) {
+        for (i = 0; i < bs->groups->len; ++i) {
+            network_group_t *group = g_ptr_array_index(bs->groups, i);
+            if (!group->master) {
+                g_string_printf(err, "group %s has no master", group->name->str);
+                return FALSE;
+            }
+            g_ptr_array_add(job->shards, ddl_shard_new(group));
+        }
+        return TRUE;
+    }
+    for (i = 0; groups[i]; ++i) {
+        GString *name = g_string_new(groups[i]);
+        network_group_t *group = network_backends_get_group(bs, name);
+        g_string_free(name, TRUE);
+        if (!group || !group->master) {
+            g_string_printf(err, "group %s not found or has no master", groups[i]);
+            return FALSE;
+        }
+        g_ptr_array_add(job->shards, ddl_shard_new(group));
+    }
+    return TRUE;
+}
+
+guint
+cetus_ddl_job_submit(chassis *chas, const ddl_job_options_t *opts, GString *err)
+{
+    if (chas->disable_threads) {
+        g_string_assign(err, "ddl jobs need threads, disable-threads is set");
+        return 0;
+    }
+    if (!chas->default_username) {
+        g_string_assign(err, "default-username not set");
+        return 0;
+    }
+    if (opts->max_lag_msec > 0 && !chas->check_slave_delay) {
+        g_string_assign(err, "max_lag needs check-slave-delay");
+        return 0;
+    }
+    GString *passwd = g_string_new(NULL);
+    cetus_users_get_server_pwd(chas->priv->users, chas->default_username, passwd);
+    if (passwd->len == 0) {
+        g_string_printf(err, "no password for %s", chas->default_username);
+        g_string_free(passwd, TRUE);
+        return 0;
+    }
+
+    struct ddl_job_t *job = g_new0(struct ddl_job_t, 1);
+    job->sql = g_strdup(opts->sql);
+    job->db = opts->db ? g_strdup(opts->db) : NULL;
+    job->user = g_strdup(chas->default_username);
+    job->passwd = g_string_free(passwd, FALSE);
+    job->parallel = opts->parallel > 0 ? MIN(opts->parallel, DDL_JOB_MAX_PARALLEL) : DDL_JOB_DEFAULT_PARALLEL;
+    job->max_lag_msec = opts->max_lag_msec;
+    job->shards = g_ptr_array_new_with_free_func((GDestroyNotify) ddl_shard_free);
+    if (!ddl_job_add_shards(job, chas->priv->backends, opts->groups, err)) {
+        ddl_job_free(job);
+        return 0;
+    }
+    if (job->shards->len == 0) {
+        g_string_assign(err, "no backend group");
+        ddl_job_free(job);
+        return 0;
+    }
+
+    ddl_service_init(chas);
+    ddl_lock();
+    job->id = ddl_service.next_id++;
+    g_queue_push_tail(ddl_service.jobs, job);
+    ddl_job_prune();
+    ddl_lag_timer_start(job);
+    ddl_job_spawn_workers(job);
+    guint job_id = job->id;
+    g_message("ddl job %u: %u groups, parallel %u, sql: %s", job_id, job->shards->len, job->parallel, job->sql);
+    ddl_unlock();
+    return job_id;
+}
+
+gboolean
+cetus_ddl_job_retry(guint job_id, GString *err)
+{
+    if (!ddl_service.mutex) {
+        g_string_printf(err, "ddl job %u not found", job_id);
+        return FALSE;
+    }
+    ddl_lock();
+    struct ddl_job_t *job = ddl_job_lookup(job_id);
+    if (!job) {
+        g_string_printf(err, "ddl job %u not found", job_id);
+        ddl_unlock();
+        return FALSE;
+    }
+    network_backends_t *bs = ddl_service.chas->priv->backends;
+    guint retried = 0;
+    int i;
+    for (i = 0; i < job->shards->len; ++i) {
+        struct ddl_shard_t *shard = g_ptr_array_index(job->shards, i);
+        if (shard->state == DDL_SHARD_FAILED || shard->state == DDL_SHARD_CANCELLED) {
+            if (!ddl_shard_resolve_master(shard, bs)) {
+                shard->state = DDL_SHARD_FAILED;
+                continue;
+            }
+            shard->state = DDL_SHARD_PENDING;
+            shard->start_time = shard->end_time = 0;
+            g_string_truncate(shard->error, 0);
+            retried++;
+        } else if (shard->state == DDL_SHARD_PENDING) {
+            retried++;
+        }
+    }
+    if (retried == 0) {
+        g_string_printf(err, "ddl job %u has nothing to retry", job_id);
+        ddl_unlock();
+        return FALSE;
+    }
+    ddl_lag_timer_start(job);
+    ddl_job_spawn_workers(job);
+    g_message("ddl job %u: retry %u groups", job_id, retried);
+    ddl_unlock();
+    return TRUE;
+}
+
+gboolean
+cetus_ddl_job_cancel(guint job_id, GString *err)
+{
+    if (!ddl_service.mutex) {
+        g_string_printf(err, "ddl job %u not found", job_id);
+        return FALSE;
+    }
+    ddl_lock();
+    struct ddl_job_t *job = ddl_job_lookup(job_id);
+    if (!job) {
+        g_string_printf(err, "ddl job %u not found", job_id);
+        ddl_unlock();
+        return FALSE;
+    }
+    int i;
+    for (i = 0; i < job->shards->len; ++i) {
+        struct ddl_shard_t *shard = g_ptr_array_index(job->shards, i);
+        if (shard->state == DDL_SHARD_PENDING || shard->state == DDL_SHARD_WAITING) {
+            shard->state = DDL_SHARD_CANCELLED;
+        }
+    }
+    /* wake workers held by slave delay */
+    g_cond_broadcast(ddl_service.cond);
+    ddl_unlock();
+    return TRUE;
+}
+
+static void
+ddl_shard_status_free(ddl_shard_status_t *status)
+{
+    g_free(status->group);
+    g_free(status->error);
+    g_free(status->sql);
+    g_free(status);
+}
+
+GPtrArray *
+cetus_ddl_job_status(void)
+{
+    GPtrArray *rows = g_ptr_array_new_with_free_func((GDestroyNotify) ddl_shard_status_free);
+    if (!ddl_service.mutex) {
+        return rows;
+    }
+    gint64 now = g_get_monotonic_time();
+    ddl_lock();
+    GList *l;
+    for (l = ddl_service.jobs->head; l; l = l->next) {
+        struct ddl_job_t *job = l->data;
+        int i;
+        for (i = 0; i < job->shards->len; ++i) {
+            struct ddl_shard_t *shard = g_ptr_array_index(job->shards, i);
+            ddl_shard_status_t *status = g_new0(ddl_shard_status_t, 1);
+            status->job_id = job->id;
+            status->group = g_strdup(shard->group->str);
+            status->state = ddl_shard_state_names[shard->state];
+            if (shard->start_time == 0) {
+                status->elapsed_msec = 0;
+            } else if (shard->end_time == 0) {
+                status->elapsed_msec = (now - shard->start_time) / 1000;
+            } else {
+                status->elapsed_msec = (shard->end_time - shard->start_time) / 1000;
+            }
+            status->error = g_strdup(shard->error->str);
+            status->sql = g_strdup(job->sql);
+            g_ptr_array_add(rows, status);
+        }
+    }
+    ddl_unlock();
+    return rows;
+}
+
+/* KILL QUERY of a running statement, on a connection of its own */
+static void
+ddl_kill_query(const char *user, const char *passwd, const char *addr, unsigned long thread_id)
+{
+    MYSQL *conn = mysql_init(NULL);
+    if (!conn) {
+        return;
+    }
+    unsigned int timeout = 2 * SECONDS;
+    mysql_options(conn, MYSQL_OPT_CONNECT_TIMEOUT, &timeout);
+    mysql_options(conn, MYSQL_OPT_READ_TIMEOUT, &timeout);
+
+    char **ip_port = g_strsplit(addr, ":", -1);
+    int port = ip_port[1] ? atoi(ip_port[1]) : 3306;
+    if (mysql_real_connect(conn, ip_port[0], user, passwd, NULL, port, NULL, 0) == NULL) {
+        g_warning("ddl job: connect %s to kill %lu failed: %s", addr, thread_id, mysql_error(conn));
+    } else {
+        char sql[64];
+        snprintf(sql, sizeof(sql), "KILL QUERY %lu", thread_id);
+        if (mysql_real_query(conn, L(sql)) != 0) {
+            g_warning("ddl job: %s on %s failed: %s", sql, addr, mysql_error(conn));
+        }
+    }
+    g_strfreev(ip_port);
+    mysql_close(conn);
+}
+
+void
+cetus_ddl_job_stop(void)
+{
+    if (!ddl_service.mutex) {
+        return;
+    }
+    ddl_lock();
+    ddl_service.stopping = TRUE;
+    if (ddl_service.lag_timer_armed) {
+        evtimer_del(&ddl_service.lag_timer);
+        ddl_service.lag_timer_armed = FALSE;
+    }
+    g_cond_broadcast(ddl_service.cond);
+
+    /* an ALTER may run for hours, don't wait for it */
+    GPtrArray *kills = g_ptr_array_new_with_free_func(g_free);
+    GList *l;
+    for (l = ddl_service.jobs->head; l; l = l->next) {
+        struct ddl_job_t *job = l->data;
+        int i;
+        for (i = 0; i < job->shards->len; ++i) {
+            struct ddl_shard_t *shard = g_ptr_array_index(job->shards, i);
+            if (shard->thread_id != 0) {
+                g_ptr_array_add(kills, g_strdup(job->user));
+                g_ptr_array_add(kills, g_strdup(job->passwd));
+                g_ptr_array_add(kills, g_strdup(shard->addr));
+                g_ptr_array_add(kills, g_strdup_printf("%lu", shard->thread_id));
+                g_message("ddl job %u: kill the statement on group %s", job->id, shard->group->str);
+            }
+        }
+    }
+    ddl_unlock();
+
+    guint i;
+    for (i = 0; i + 3 < kills->len; i += 4) {
+        ddl_kill_query(g_ptr_array_index(kills, i), g_ptr_array_index(kills, i + 1),
+                       g_ptr_array_index(kills, i + 2), strtoul(g_ptr_array_index(kills, i + 3), NULL, 10));
+    }
+    g_ptr_array_free(kills, TRUE);
+
+    ddl_lock();
+    if (ddl_service.workers > 0) {
+        g_message("Waiting for %u ddl workers to finish running statements ...", ddl_service.workers);
+    }
+    gint64 deadline = g_get_monotonic_time() + DDL_JOB_STOP_TIMEOUT_USEC;
+    while (ddl_service.workers > 0 && g_get_monotonic_time() < deadline) {
+        ddl_wait_until(MIN(deadline, g_get_monotonic_time() + G_USEC_PER_SEC));
+    }
+    if (ddl_service.workers > 0) {
+        /* they still use the jobs, leave them to the process exit */
+        g_warning("%u ddl workers still running, not waiting any longer", ddl_service.workers);
+        ddl_unlock();
+        return;
+    }
+    ddl_unlock();
+
+    struct ddl_job_t *job;
+    while ((job = g_queue_pop_head(ddl_service.jobs))) {
+        ddl_job_free(job);
+    }
+    g_queue_free(ddl_service.jobs);
+#if !GLIB_CHECK_VERSION(2, 32, 0)
+    g_mutex_free(ddl_service.mutex);
+    g_cond_free(ddl_service.cond);
+#else
+    g_mutex_clear(ddl_service.mutex);
+    g_free(ddl_service.mutex);
+    g_cond_clear(ddl_service.cond);
+    g_free(ddl_service.cond);
+#endif
+    ddl_service.mutex = NULL;
+    ddl_service.cond = NULL;
+}
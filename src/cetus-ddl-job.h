@@ -0,0 +1,74 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#ifndef _CETUS_DDL_JOB_H_
+#define _CETUS_DDL_JOB_H_
+
+#include <glib.h>
+#include "chassis-mainloop.h"
+
+#define DDL_JOB_DEFAULT_PARALLEL 4
+#define DDL_JOB_MAX_PARALLEL 64
+
+/**
+ * DDL jobs run one statement on the master of every backend group,
+ * each job owns up to `parallel` worker threads with their own mysql
+ * connections, so a long ALTER never blocks a client or the event loop.
+ * Failed or cancelled shards stay in the job and can be retried.
+ */
+
+typedef struct ddl_job_options_t {
+    const char *sql;
+    const char *db;             /* default database, might be NULL */
+    char **groups;              /* NULL-terminated, NULL for all groups */
+    guint parallel;
+    gint max_lag_msec;          /* wait while any slave lags more, <= 0 disables */
+} ddl_job_options_t;
+
+/* one row of `select * from ddl_jobs` */
+typedef struct ddl_shard_status_t {
+    guint job_id;
+    char *group;
+    const char *state;
+    gint64 elapsed_msec;
+    char *error;
+    char *sql;
+} ddl_shard_status_t;
+
+/**
+ * @return id of the new job, 0 on error with reason in err
+ */
+guint cetus_ddl_job_submit(chassis *chas, const ddl_job_options_t *opts, GString *err);
+
+/* run failed and cancelled shards of the job again, on the current master of each group */
+gboolean cetus_ddl_job_retry(guint job_id, GString *err);
+
+/* pending and throttled shards are cancelled, running statements are left to finish */
+gboolean cetus_ddl_job_cancel(guint job_id, GString *err);
+
+/**
+ * @return GPtrArray<ddl_shard_status_t *>, free with g_ptr_array_free(arr, TRUE)
+ */
+GPtrArray *cetus_ddl_job_status(void);
+
+/* wait for running statements, called on shutdown */
+void cetus_ddl_job_stop(void);
+
+#endif /* _CETUS_DDL_JOB_H_ */
@@ -33,6 +33,7 @@ enum {
     ER_CETUS_NOT_SUPPORTED,
     ER_CETUS_SINGLE_NODE_FAIL,
     ER_CETUS_NO_GROUP,
+    ER_CETUS_SEQUENCE,
 };
 
 #endif /*_CETUS_ERROR_H_*/
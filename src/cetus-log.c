@@ -166,6 +166,19 @@ tc_log_end(void)
     log_fd = -1;
 }
 
+int
+tc_log_switch(const char *file)
+{
+    tc_log_end();
+    return tc_log_init(file);
+}
+
+const char *
+tc_log_file(void)
+{
+    return log_fd != -1 ? file_name_prefix : NULL;
+}
+
 static int
 tc_update_time()
 {
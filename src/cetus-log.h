@@ -38,6 +38,10 @@
 int tc_log_init(const char *);
 int tc_get_log_hour();
 void tc_log_end(void);
+/* continue in file, which must stay valid, returns the fd or -1 */
+int tc_log_switch(const char *file);
+/* prefix of the log files, NULL if the log is not open */
+const char *tc_log_file(void);
 
 void tc_log_info(int level, int err, const char *fmt, ...);
 
@@ -0,0 +1,220 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#include "cetus-memory.h"
+
+#include "network-mysqld-packet.h"
+#include "resultset_merge.h"
+#include "server-session.h"
+#include "sharding-query-plan.h"
+
+/* GString, list node and allocator headers of one buffered packet */
+#define PACKET_OVERHEAD (sizeof(GString) + sizeof(GList) + 4 * sizeof(void *))
+
+memory_stats_t *
+memory_stats_new(void)
+{
+    memory_stats_t *stats = g_new0(memory_stats_t, 1);
+    stats->users = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    return stats;
+}
+
+void
+memory_stats_free(memory_stats_t *stats)
+{
+    if (!stats)
+        return;
+    g_hash_table_destroy(stats->users);
+    g_free(stats);
+}
+
+static gsize
+string_memory(const GString *s)
+{
+    return s ? sizeof(GString) + s->allocated_len : 0;
+}
+
+static gsize
+queue_memory(network_queue *queue)
+{
+    if (!queue) {
+        return 0;
+    }
+
+    return sizeof(network_queue) + sizeof(GQueue) + queue->len + queue->chunks->length * PACKET_OVERHEAD;
+}
+
+static gsize
+address_memory(network_address *addr)
+{
+    return addr ? sizeof(network_address) + string_memory(addr->name) : 0;
+}
+
+static gsize
+socket_memory(network_socket *sock)
+{
+    if (!sock) {
+        return 0;
+    }
+
+    return sizeof(network_socket) + queue_memory(sock->recv_queue) + queue_memory(sock->recv_queue_raw)
+        + queue_memory(sock->recv_queue_uncompress_raw) + queue_memory(sock->send_queue)
+        + queue_memory(sock->cache_queue) + address_memory(sock->src) + address_memory(sock->dst)
+        + string_memory(sock->default_db) + string_memory(sock->username);
+}
+
+gsize
+network_mysqld_con_memory(network_mysqld_con *con)
+{
+    gsize usage = sizeof(network_mysqld_con) + socket_memory(con->client);
+    gboolean server_counted = FALSE;
+    guint i;
+
+    if (con->servers) {
+        for (i = 0; i < con->servers->len; i++) {
+            network_socket *sock;
+            if (con->multiple_server_mode) {
+                /* rw-splitting keeps plain sockets here */
+                sock = g_ptr_array_index(con->servers, i);
+            } else {
+                server_session_t *ss = g_ptr_array_index(con->servers, i);
+                sock = ss->server;
+                usage += sizeof(server_session_t);
+            }
+            usage += socket_memory(sock);
+            if (sock == con->server) {
+                server_counted = TRUE;
+            }
+        }
+    }
+    if (!server_counted) {
+        usage += socket_memory(con->server);
+    }
+
+    usage += string_memory(con->orig_sql) + string_memory(con->modified_sql);
+
+    merge_parameters_t *data = con->data;
+    if (data) {
+        heap_type *heap = data->heap;
+        usage += sizeof(merge_parameters_t) + sizeof(heap_type);
+        if (heap) {
+            usage += heap->len * (sizeof(heap_element) + sizeof(GList *));
+        }
+    }
+
+    sharding_plan_t *plan = con->sharding_plan;
+    if (plan) {
+        GList *l;
+        usage += sizeof(sharding_plan_t);
+        for (l = plan->sql_list; l; l = l->next) {
+            GString *sql = l->data;
+            usage += sizeof(GList) + sizeof(GString) + sql->allocated_len;
+        }
+        if (plan->groups) {
+            usage += plan->groups->len * (sizeof(gpointer) + sizeof(GString));
+        }
+    }
+
+    return usage;
+}
+
+static void
+reset_user(gpointer key, gpointer value, gpointer user_data)
+{
+    memory_user_t *user = value;
+    user->current = 0;
+    user->conns = 0;
+}
+
+network_mysqld_con *
+memory_stats_sample(chassis *srv)
+{
+    memory_stats_t *stats = srv->mem_stats;
+    GPtrArray *cons = srv->priv->cons;
+    network_mysqld_con *largest = NULL;
+    gsize largest_usage = 0;
+    guint i;
+
+    g_hash_table_foreach(stats->users, reset_user, NULL);
+    stats->total = 0;
+    stats->conns = 0;
+    stats->idle_total = 0;
+    stats->idle_conns = 0;
+
+    for (i = 0; i < cons->len; i++) {
+        network_mysqld_con *con = g_ptr_array_index(cons, i);
+
+        /* admin connections have no plugin state */
+        if (!con->client || !con->plugin_con_state) {
+            continue;
+        }
+
+        gsize usage = network_mysqld_con_memory(con);
+        if (usage > con->mem_peak) {
+            con->mem_peak = usage;
+        }
+        stats->total += usage;
+        stats->conns++;
+        if (con->state == ST_READ_QUERY) {
+            stats->idle_total += usage;
+            stats->idle_conns++;
+        }
+
+        if (con->client->response) {
+            const char *name = con->client->response->username->str;
+            memory_user_t *user = g_hash_table_lookup(stats->users, name);
+            if (!user) {
+                user = g_new0(memory_user_t, 1);
+                g_hash_table_insert(stats->users, g_strdup(name), user);
+            }
+            user->current += usage;
+            user->conns++;
+            if (user->current > user->peak) {
+                user->peak = user->current;
+            }
+        }
+
+        if (usage > largest_usage) {
+            largest_usage = usage;
+            largest = con;
+        }
+    }
+
+    if (stats->total > stats->peak) {
+        stats->peak = stats->total;
+    }
+
+    return largest;
+}
+
+void
+memory_kill_connection(chassis *srv, network_mysqld_con *con, gsize usage)
+{
+    g_warning("%s: memory of client connections %llu over %llu, close the largest, %llu bytes, user:%s, src:%s, sql:%s",
+              G_STRLOC, (unsigned long long)srv->mem_stats->total, (unsigned long long)srv->mem_kill_threshold,
+              (unsigned long long)usage,
+              con->client->response ? con->client->response->username->str : "",
+              con->client->src->name->str, con->orig_sql->len ? con->orig_sql->str : "");
+
+    srv->mem_stats->killed++;
+    con->prev_state = con->state;
+    con->state = ST_ERROR;
+    network_mysqld_con_handle(-1, 0, con);
+}
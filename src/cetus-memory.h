@@ -0,0 +1,64 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#ifndef _CETUS_MEMORY_H_
+#define _CETUS_MEMORY_H_
+
+#include <glib.h>
+
+#include "network-mysqld.h"
+
+/**
+ * Memory held by client connections: their socket queues, merge state and
+ * sharding plan. The figures are estimates, every buffered packet is
+ * counted with a fixed overhead and allocations outside these structures
+ * are not seen.
+ */
+typedef struct memory_user_t {
+    guint64 current;
+    guint64 peak;
+    guint conns;
+} memory_user_t;
+
+typedef struct memory_stats_t {
+    guint64 total;              /* all client connections at the last sample */
+    guint64 peak;
+    guint conns;
+    guint64 idle_total;         /* the part of them waiting for the next command */
+    guint idle_conns;
+    GHashTable *users;          /* user name -> memory_user_t */
+    guint64 killed;             /* connections closed by memory-kill-threshold */
+} memory_stats_t;
+
+memory_stats_t *memory_stats_new(void);
+void memory_stats_free(memory_stats_t *stats);
+
+gsize network_mysqld_con_memory(network_mysqld_con *con);
+
+/**
+ * refresh the totals and peaks of srv->mem_stats
+ * @return the client connection holding most memory, NULL if there is none
+ */
+network_mysqld_con *memory_stats_sample(chassis *srv);
+
+/* close the connection, the client sees it as a lost connection */
+void memory_kill_connection(chassis *srv, network_mysqld_con *con, gsize usage);
+
+#endif /* _CETUS_MEMORY_H_ */
@@ -142,7 +142,8 @@ check_backend_alive(int fd, short what, void *arg)
         if (backend->state == BACKEND_STATE_DELETED || backend->state == BACKEND_STATE_MAINTAINING)
             continue;
 
-        char *backend_addr = backend->addr->name->str;
+        char backend_addr[BACKEND_ADDR_NAME_LEN];
+        network_backend_addr_name(backend, backend_addr, sizeof(backend_addr));
         int check_count = 0;
         MYSQL *conn = NULL;
         while (++check_count <= CHECK_ALIVE_TIMES) {
@@ -204,7 +205,8 @@ update_master_timestamp(int fd, short what, void *arg)
                      " VALUES ('%s', '%s') ON DUPLICATE KEY UPDATE p_ts='%s'",
                      HEARTBEAT_DB, monitor->config_id, cur_time_str, cur_time_str);
 
-            char *backend_addr = backend->addr->name->str;
+            char backend_addr[BACKEND_ADDR_NAME_LEN];
+            network_backend_addr_name(backend, backend_addr, sizeof(backend_addr));
             MYSQL *conn = get_mysql_connection(monitor, backend_addr);
             if (conn == NULL) {
                 g_critical("Could not connect to Backend %s.", backend_addr);
@@ -248,7 +250,8 @@ check_slave_timestamp(int fd, short what, void *arg)
             backend->state == BACKEND_STATE_MAINTAINING)
             continue;
 
-        char *backend_addr = backend->addr->name->str;
+        char backend_addr[BACKEND_ADDR_NAME_LEN];
+        network_backend_addr_name(backend, backend_addr, sizeof(backend_addr));
         MYSQL *conn = get_mysql_connection(monitor, backend_addr);
         if (conn == NULL) {
             g_critical("Connection error when read delay from RO backend: %s", backend_addr);
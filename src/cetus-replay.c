@@ -0,0 +1,793 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+/*
+ * cetus-replay: replay a client traffic capture against a Cetus
+ *
+ * Every captured connection is replayed on its own client connection, from
+ * the session state it had when the capture saw it first, with its commands
+ * sent at the captured times scaled by --speed (0 sends them back to back).
+ * Latencies are compared per statement digest, the statement with literals
+ * replaced by '?':
+ *
+ *   mysql> capture start;            -- on the admin port, needs capture-dir
+ *   mysql> capture stop;
+ *   cetus-replay -f cetus-1234-20181010-101010.cap --target=127.0.0.1:6001 -p xx --speed=2
+ *
+ * the captured latency is measured inside Cetus from the request read to the
+ * response written, the replayed one from the client, so they include the
+ * network round trip and compare best between two replays
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+#include <mysql.h>
+#include <errmsg.h>
+
+#include "cetus-capture.h"
+
+#define DIGEST_MAX_LEN 1024
+
+typedef struct replay_event_t {
+    guint64 ts_us;
+    guint8 command;
+    GString *arg;               /* without the command byte */
+    const char *digest;         /* interned */
+    gint64 orig_latency;        /* -1 if the response was not captured */
+} replay_event_t;
+
+typedef struct replay_stat_t {
+    const char *digest;
+    guint64 count;
+    guint64 errors;
+    GArray *orig;               /* GArray<gint64>, us */
+    GArray *replay;
+} replay_stat_t;
+
+typedef struct replay_conn_t {
+    guint32 id;
+    GString *user;
+    GString *db;
+    GString *charset;
+    guint8 flags;
+    guint64 open_ts;
+    GPtrArray *events;          /* GPtrArray<replay_event_t *> */
+    replay_event_t *last;       /* waiting for its response record */
+
+    GThread *thread;
+    MYSQL *mysql;
+    GHashTable *stats;          /* digest -> replay_stat_t */
+    guint64 executed;
+    guint64 skipped;
+    guint64 errors;
+    gint64 max_lag;             /* us behind the schedule */
+} replay_conn_t;
+
+static gchar *opt_file = NULL;
+static gchar *opt_target = NULL;
+static gchar *opt_user = NULL;
+static gchar *opt_password = "";
+static gdouble opt_speed = 1.0;
+static gint opt_top = 20;
+static gchar *opt_report = NULL;
+
+static char *target_host = NULL;
+static guint target_port = 3306;
+
+static GHashTable *digests = NULL;  /* interned digest strings */
+static gint64 replay_start = 0;
+static guint64 capture_base = 0;
+
+static void
+digest_put_placeholder(GString *out)
+{
+    /* IN (?, ?, ?) comes out as IN (?+) whatever the count */
+    if (g_str_has_suffix(out->str, "?, ") || g_str_has_suffix(out->str, "?+, ")) {
+        g_string_truncate(out, out->len - 2);
+        if (out->str[out->len - 1] != '+')
+            g_string_append_c(out, '+');
+        return;
+    }
+    g_string_append_c(out, '?');
+}
+
+/* VALUES (?+), (?+), (?+) comes out as VALUES (?+) */
+static void
+digest_close_group(GString *out)
+{
+    const char *open = strrchr(out->str, '(');
+    gsize group, start;
+
+    if (!open) {
+        g_string_append_c(out, ')');
+        return;
+    }
+    start = open - out->str;
+    g_string_append_c(out, ')');
+    group = out->len - start;
+    if (start >= group + 2 && memcmp(out->str + start - 2, ", ", 2) == 0
+        && memcmp(out->str + start - 2 - group, out->str + start, group) == 0) {
+        g_string_truncate(out, start - 2);
+    }
+}
+
+/* normalized statement: literals to '?', no comments, single spaces, lower case outside quotes */
+static void
+digest_sql(GString *out, const char *sql, gsize len)
+{
+    const char *p = sql, *end = sql + len;
+    gboolean space = FALSE;
+
+    g_string_truncate(out, 0);
+    while (p < end && out->len < DIGEST_MAX_LEN) {
+        char c = *p;
+
+        if (g_ascii_isspace(c)) {
+            space = TRUE;
+            p++;
+            continue;
+        }
+        if (c == '/' && p + 1 < end && p[1] == '*') {
+            const char *close = g_strstr_len(p + 2, end - p - 2, "*/");
+            p = close ? close + 2 : end;
+            space = TRUE;
+            continue;
+        }
+        if (c == '#' || (c == '-' && p + 2 < end && p[1] == '-' && g_ascii_isspace(p[2]))) {
+            while (p < end && *p != '\n')
+                p++;
+            space = TRUE;
+            continue;
+        }
+        if (space && out->len > 0 && c != ',' && c != ')')
+            g_string_append_c(out, ' ');
+        space = FALSE;
+
+        if (c == '\'' || c == '"') {
+            for (p++; p < end; p++) {
+                if (*p == '\\' && p + 1 < end) {
+                    p++;
+                } else if (*p == c) {
+                    if (p + 1 < end && p[1] == c) {
+                        p++;
+                    } else {
+                        break;
+                    }
+                }
+            }
+            p++;
+            digest_put_placeholder(out);
+        } else if (c == '`') {
+            const char *close = memchr(p + 1, '`', end - p - 1);
+            const char *stop = close ? close + 1 : end;
+            g_string_append_len(out, p, stop - p);
+            p = stop;
+        } else if (g_ascii_isdigit(c) || (c == '.' && p + 1 < end && g_ascii_isdigit(p[1]))) {
+            while (p < end && (g_ascii_isalnum(*p) || *p == '.'))
+                p++;
+            digest_put_placeholder(out);
+        } else if (g_ascii_isalpha(c) || c == '_' || c == '$' || (guchar)c >= 0x80) {
+            while (p < end && (g_ascii_isalnum(*p) || *p == '_' || *p == '$' || (guchar)*p >= 0x80)) {
+                g_string_append_c(out, g_ascii_tolower(*p));
+                p++;
+            }
+        } else if (c == ')') {
+            digest_close_group(out);
+            p++;
+        } else {
+            g_string_append_c(out, c);
+            if (c == ',')
+                space = TRUE;
+            p++;
+        }
+    }
+}
+
+static const char *
+digest_intern(const char *digest)
+{
+    char *s = g_hash_table_lookup(digests, digest);
+    if (!s) {
+        s = g_strdup(digest);
+        g_hash_table_insert(digests, s, s);
+    }
+    return s;
+}
+
+static const char *
+command_digest(GString *buf, guint8 command, const GString *arg)
+{
+    switch (command) {
+    case COM_QUERY:
+        digest_sql(buf, arg->str, arg->len);
+        return digest_intern(buf->str);
+    case COM_INIT_DB:
+        return digest_intern("use ?");
+    case COM_PING:
+        return digest_intern("ping");
+    default:
+        g_string_printf(buf, "command %d", command);
+        return digest_intern(buf->str);
+    }
+}
+
+static guint64
+get_varint(const GString *buf, gsize *pos)
+{
+    guint64 v = 0;
+    int shift;
+
+    for (shift = 0; *pos < buf->len && shift < 64; shift += 7) {
+        guchar c = buf->str[(*pos)++];
+        v |= (guint64)(c & 0x7f) << shift;
+        if (!(c & 0x80))
+            break;
+    }
+    return v;
+}
+
+static GString *
+get_str(const GString *buf, gsize *pos)
+{
+    guint64 len = get_varint(buf, pos);
+
+    len = MIN(len, buf->len - *pos);
+    *pos += len;
+    return g_string_new_len(buf->str + *pos - len, len);
+}
+
+static replay_conn_t *
+replay_conn_new(guint32 id, guint64 ts)
+{
+    replay_conn_t *c = g_new0(replay_conn_t, 1);
+    c->id = id;
+    c->open_ts = ts;
+    c->events = g_ptr_array_new();
+    c->stats = g_hash_table_new(g_direct_hash, g_direct_equal);
+    return c;
+}
+
+/* @return the connections in the order they were opened */
+static GPtrArray *
+load_capture(const char *filename)
+{
+    FILE *fp = fopen(filename, "rb");
+    GHashTable *by_id;
+    GPtrArray *conns;
+    GString *buf, *digest;
+    guint64 start_us, ts;
+    guint32 id;
+    guint8 type;
+    gboolean first = TRUE;
+    int rv;
+
+    if (!fp) {
+        fprintf(stderr, "can't open %s\n", filename);
+        return NULL;
+    }
+    if (!capture_read_header(fp, &start_us)) {
+        fprintf(stderr, "%s is not a capture file\n", filename);
+        fclose(fp);
+        return NULL;
+    }
+
+    by_id = g_hash_table_new(g_direct_hash, g_direct_equal);
+    conns = g_ptr_array_new();
+    buf = g_string_sized_new(1024);
+    digest = g_string_sized_new(1024);
+
+    while ((rv = capture_read_record(fp, &type, &id, &ts, buf)) > 0) {
+        replay_conn_t *c = g_hash_table_lookup(by_id, GUINT_TO_POINTER(id));
+        gsize pos = 0;
+
+        if (first) {
+            capture_base = ts;
+            first = FALSE;
+        }
+        if (!c && type != CAPTURE_CLOSE) {
+            c = replay_conn_new(id, ts);
+            g_hash_table_insert(by_id, GUINT_TO_POINTER(id), c);
+            g_ptr_array_add(conns, c);
+        }
+
+        switch (type) {
+        case CAPTURE_OPEN:
+            c->user = get_str(buf, &pos);
+            c->db = get_str(buf, &pos);
+            c->charset = get_str(buf, &pos);
+            c->flags = pos < buf->len ? (guint8)buf->str[pos] : CAPTURE_FLAG_AUTOCOMMIT;
+            break;
+        case CAPTURE_COMMAND:
+            if (buf->len > 0) {
+                replay_event_t *ev = g_new0(replay_event_t, 1);
+                ev->ts_us = ts;
+                ev->command = buf->str[0];
+                ev->arg = g_string_new_len(buf->str + 1, buf->len - 1);
+                ev->digest = command_digest(digest, ev->command, ev->arg);
+                ev->orig_latency = -1;
+                g_ptr_array_add(c->events, ev);
+                c->last = ev;
+            }
+            break;
+        case CAPTURE_RESPONSE:
+            if (c->last) {
+                c->last->orig_latency = get_varint(buf, &pos);
+                c->last = NULL;
+            }
+            break;
+        case CAPTURE_CLOSE:
+            g_hash_table_remove(by_id, GUINT_TO_POINTER(id));   /* ids are not reused, but be safe */
+            break;
+        default:
+            break;              /* newer record types */
+        }
+    }
+    if (rv < 0)
+        fprintf(stderr, "%s is truncated, replaying what was read\n", filename);
+
+    g_string_free(buf, TRUE);
+    g_string_free(digest, TRUE);
+    g_hash_table_destroy(by_id);
+    fclose(fp);
+    return conns;
+}
+
+/* sleep until the captured time ts, scaled by the speed */
+static gint64
+replay_wait(guint64 ts)
+{
+    gint64 due, now;
+
+    if (opt_speed <= 0)
+        return 0;
+    due = replay_start + (gint64)((ts - capture_base) / opt_speed);
+    now = g_get_monotonic_time();
+    if (due > now) {
+        g_usleep(due - now);
+        return 0;
+    }
+    return now - due;
+}
+
+static MYSQL *
+replay_connect(replay_conn_t *c)
+{
+    MYSQL *mysql = mysql_init(NULL);
+    unsigned int timeout = 5;
+    const char *user = opt_user ? opt_user : (c->user && c->user->len ? c->user->str : "root");
+    const char *db = c->db && c->db->len ? c->db->str : NULL;
+
+    if (mysql == NULL)
+        return NULL;
+    mysql_options(mysql, MYSQL_OPT_CONNECT_TIMEOUT, &timeout);
+    if (c->charset && c->charset->len)
+        mysql_options(mysql, MYSQL_SET_CHARSET_NAME, c->charset->str);
+    if (!mysql_real_connect(mysql, target_host, user, opt_password, db, target_port, NULL,
+                            CLIENT_MULTI_STATEMENTS | CLIENT_MULTI_RESULTS)) {
+        g_warning("%s: conn %u: connect %s:%u failed: %s", G_STRLOC, c->id, target_host, target_port,
+                  mysql_error(mysql));
+        mysql_close(mysql);
+        return NULL;
+    }
+    if (!(c->flags & CAPTURE_FLAG_AUTOCOMMIT))
+        mysql_autocommit(mysql, 0);
+    return mysql;
+}
+
+static int
+replay_query(MYSQL *mysql, const GString *sql)
+{
+    MYSQL_RES *res;
+
+    if (mysql_real_query(mysql, sql->str, sql->len) != 0)
+        return -1;
+    do {
+        res = mysql_store_result(mysql);
+        if (res) {
+            mysql_free_result(res);
+        } else if (mysql_field_count(mysql) != 0) {
+            return -1;
+        }
+    } while (mysql_next_result(mysql) == 0);
+
+    return mysql_errno(mysql) ? -1 : 0;
+}
+
+static void
+replay_record(replay_conn_t *c, replay_event_t *ev, gint64 latency, gboolean failed)
+{
+    replay_stat_t *st = g_hash_table_lookup(c->stats, ev->digest);
+
+    if (!st) {
+        st = g_new0(replay_stat_t, 1);
+        st->digest = ev->digest;
+        st->orig = g_array_new(FALSE, FALSE, sizeof(gint64));
+        st->replay = g_array_new(FALSE, FALSE, sizeof(gint64));
+        g_hash_table_insert(c->stats, (gpointer)ev->digest, st);
+    }
+    st->count++;
+    if (failed) {
+        st->errors++;
+        return;
+    }
+    if (ev->orig_latency >= 0)
+        g_array_append_val(st->orig, ev->orig_latency);
+    g_array_append_val(st->replay, latency);
+}
+
+static void *
+replay_conn_main(void *arg)
+{
+    replay_conn_t *c = arg;
+    guint i;
+
+    mysql_thread_init();
+    c->mysql = replay_connect(c);
+
+    for (i = 0; i < c->events->len; i++) {
+        replay_event_t *ev = g_ptr_array_index(c->events, i);
+        gint64 lag, start;
+        int rv;
+
+        lag = replay_wait(ev->ts_us);
+        c->max_lag = MAX(c->max_lag, lag);
+
+        if (ev->command == COM_QUIT)
+            break;
+        if (c->mysql == NULL && (c->mysql = replay_connect(c)) == NULL) {
+            c->errors++;
+            continue;
+        }
+
+        start = g_get_monotonic_time();
+        switch (ev->command) {
+        case COM_QUERY:
+            rv = replay_query(c->mysql, ev->arg);
+            break;
+        case COM_INIT_DB:
+            rv = mysql_select_db(c->mysql, ev->arg->str);
+            break;
+        case COM_PING:
+            rv = mysql_ping(c->mysql);
+            break;
+        default:
+            /* prepared statements and user changes can't be replayed with the ids and passwords of the capture */
+            c->skipped++;
+            continue;
+        }
+        c->executed++;
+        replay_record(c, ev, g_get_monotonic_time() - start, rv != 0);
+        if (rv != 0) {
+            c->errors++;
+            if (c->errors <= 3)
+                g_warning("%s: conn %u: %s", G_STRLOC, c->id, mysql_error(c->mysql));
+            if (mysql_errno(c->mysql) == CR_SERVER_GONE_ERROR || mysql_errno(c->mysql) == CR_SERVER_LOST) {
+                mysql_close(c->mysql);
+                c->mysql = NULL;
+            }
+        }
+    }
+    if (c->mysql) {
+        mysql_close(c->mysql);
+        c->mysql = NULL;
+    }
+    mysql_thread_end();
+    return NULL;
+}
+
+static GThread *
+replay_thread_new(const char *name, GThreadFunc func, gpointer data)
+{
+    GThread *thread;
+#if !GLIB_CHECK_VERSION(2, 32, 0)
+    GError *error = NULL;
+    thread = g_thread_create(func, data, TRUE, &error);
+    if (thread == NULL && error != NULL) {
+        g_critical("Create thread error: %s", error->message);
+        g_clear_error(&error);
+    }
+#else
+    thread = g_thread_new(name, func, data);
+    if (thread == NULL) {
+        g_critical("Create thread error.");
+    }
+#endif
+    return thread;
+}
+
+static gint
+cmp_gint64(gconstpointer a, gconstpointer b)
+{
+    gint64 x = *(const gint64 *)a, y = *(const gint64 *)b;
+    return x < y ? -1 : (x > y);
+}
+
+static double
+stat_avg(GArray *a)
+{
+    gint64 sum = 0;
+    guint i;
+
+    for (i = 0; i < a->len; i++)
+        sum += g_array_index(a, gint64, i);
+    return a->len ? (double)sum / a->len : 0;
+}
+
+/* @param a sorted */
+static gint64
+stat_percentile(GArray *a, double pct)
+{
+    guint i;
+
+    if (a->len == 0)
+        return 0;
+    i = (guint)(pct / 100 * (a->len - 1) + 0.5);
+    return g_array_index(a, gint64, MIN(i, a->len - 1));
+}
+
+static gint
+cmp_stat_total(gconstpointer a, gconstpointer b)
+{
+    const replay_stat_t *x = *(replay_stat_t *const *)a, *y = *(replay_stat_t *const *)b;
+    double tx = stat_avg(x->replay) * x->replay->len, ty = stat_avg(y->replay) * y->replay->len;
+    return tx > ty ? -1 : (tx < ty);
+}
+
+/* merge the per connection stats, sorted by replayed time spent */
+static GPtrArray *
+replay_merge_stats(GPtrArray *conns)
+{
+    GHashTable *merged = g_hash_table_new(g_direct_hash, g_direct_equal);
+    GPtrArray *all = g_ptr_array_new();
+    GHashTableIter iter;
+    replay_stat_t *st;
+    guint i;
+
+    for (i = 0; i < conns->len; i++) {
+        replay_conn_t *c = g_ptr_array_index(conns, i);
+
+        g_hash_table_iter_init(&iter, c->stats);
+        while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&st)) {
+            replay_stat_t *to = g_hash_table_lookup(merged, st->digest);
+            if (!to) {
+                g_hash_table_insert(merged, (gpointer)st->digest, st);
+                g_ptr_array_add(all, st);
+                continue;
+            }
+            to->count += st->count;
+            to->errors += st->errors;
+            g_array_append_vals(to->orig, st->orig->data, st->orig->len);
+            g_array_append_vals(to->replay, st->replay->data, st->replay->len);
+            g_array_free(st->orig, TRUE);
+            g_array_free(st->replay, TRUE);
+            g_free(st);
+        }
+        g_hash_table_destroy(c->stats);
+        c->stats = NULL;
+    }
+    g_hash_table_destroy(merged);
+
+    for (i = 0; i < all->len; i++) {
+        st = g_ptr_array_index(all, i);
+        g_array_sort(st->orig, cmp_gint64);
+        g_array_sort(st->replay, cmp_gint64);
+    }
+    g_ptr_array_sort(all, cmp_stat_total);
+    return all;
+}
+
+static void
+json_put_string(FILE *out, const char *s)
+{
+    fputc('"', out);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') {
+            fprintf(out, "\\%c", *s);
+        } else if ((guchar)*s < 0x20) {
+            fprintf(out, "\\u%04x", *s);
+        } else {
+            fputc(*s, out);
+        }
+    }
+    fputc('"', out);
+}
+
+static void
+replay_report(GPtrArray *conns, GPtrArray *stats, double elapsed, double captured)
+{
+    guint64 executed = 0, skipped = 0, errors = 0;
+    gint64 max_lag = 0;
+    guint i;
+    FILE *f;
+
+    for (i = 0; i < conns->len; i++) {
+        replay_conn_t *c = g_ptr_array_index(conns, i);
+        executed += c->executed;
+        skipped += c->skipped;
+        errors += c->errors;
+        max_lag = MAX(max_lag, c->max_lag);
+    }
+
+    printf("connections: %u, commands: %" G_GUINT64_FORMAT ", skipped: %" G_GUINT64_FORMAT
+           ", errors: %" G_GUINT64_FORMAT "\n", conns->len, executed, skipped, errors);
+    printf("captured: %.3fs, replayed: %.3fs, max lag behind schedule: %.3fs\n\n",
+           captured, elapsed, max_lag / 1000000.0);
+    printf("%10s %10s %10s %8s %10s %10s  %s\n", "count", "orig_avg", "replay_avg", "delta", "orig_p99",
+           "replay_p99", "digest (latency in us)");
+    for (i = 0; i < stats->len && (opt_top <= 0 || i < (guint)opt_top); i++) {
+        replay_stat_t *st = g_ptr_array_index(stats, i);
+        double orig = stat_avg(st->orig), replay = stat_avg(st->replay);
+
+        printf("%10" G_GUINT64_FORMAT " %10.0f %10.0f %7.1f%% %10" G_GINT64_FORMAT " %10" G_GINT64_FORMAT "  %.100s\n",
+               st->count, orig, replay, orig > 0 ? (replay - orig) * 100 / orig : 0.0,
+               stat_percentile(st->orig, 99), stat_percentile(st->replay, 99), st->digest);
+    }
+
+    if (!opt_report)
+        return;
+    f = fopen(opt_report, "w");
+    if (!f) {
+        fprintf(stderr, "can't open %s\n", opt_report);
+        return;
+    }
+    fprintf(f, "{\"connections\": %u, \"commands\": %" G_GUINT64_FORMAT ", \"skipped\": %" G_GUINT64_FORMAT
+            ", \"errors\": %" G_GUINT64_FORMAT ", \"captured_sec\": %.3f, \"replayed_sec\": %.3f,\n \"digests\": [",
+            conns->len, executed, skipped, errors, captured, elapsed);
+    for (i = 0; i < stats->len; i++) {
+        replay_stat_t *st = g_ptr_array_index(stats, i);
+
+        fprintf(f, "%s\n  {\"digest\": ", i ? "," : "");
+        json_put_string(f, st->digest);
+        fprintf(f, ", \"count\": %" G_GUINT64_FORMAT ", \"errors\": %" G_GUINT64_FORMAT
+                ", \"orig_avg\": %.1f, \"replay_avg\": %.1f, \"orig_p99\": %" G_GINT64_FORMAT
+                ", \"replay_p99\": %" G_GINT64_FORMAT "}",
+                st->count, st->errors, stat_avg(st->orig), stat_avg(st->replay),
+                stat_percentile(st->orig, 99), stat_percentile(st->replay, 99));
+    }
+    fprintf(f, "]}\n");
+    fclose(f);
+}
+
+static GOptionEntry replay_entries[] = {
+    {"file", 'f', 0, G_OPTION_ARG_FILENAME, &opt_file, "capture file written by cetus", "<file>"},
+    {"target", 0, 0, G_OPTION_ARG_STRING, &opt_target, "address of the Cetus to replay against", "<host:port>"},
+    {"user", 'u', 0, G_OPTION_ARG_STRING, &opt_user, "user of all connections (default: the captured ones)",
+     "<user>"},
+    {"password", 'p', 0, G_OPTION_ARG_STRING, &opt_password, "password", "<password>"},
+    {"speed", 's', 0, G_OPTION_ARG_DOUBLE, &opt_speed, "times the captured speed, 0 for as fast as possible"
+     " (default: 1)", "<n>"},
+    {"top", 0, 0, G_OPTION_ARG_INT, &opt_top, "digests to print, 0 for all (default: 20)", "<n>"},
+    {"report", 'o', 0, G_OPTION_ARG_FILENAME, &opt_report, "write all digests as JSON to this file", "<file>"},
+    {NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL}
+};
+
+static gboolean
+parse_host_port(const char *addr, char **host, guint *port)
+{
+    const char *colon = strrchr(addr, ':');
+    if (!colon || colon == addr || colon[1] == '\0')
+        return FALSE;
+    *host = g_strndup(addr, colon - addr);
+    *port = atoi(colon + 1);
+    return *port > 0 && *port < 65536;
+}
+
+int
+main(int argc, char **argv)
+{
+    GOptionContext *context;
+    GError *gerr = NULL;
+    GPtrArray *conns, *stats;
+    guint64 capture_end = 0;
+    gint64 end;
+    guint i, j, started;
+
+#if !GLIB_CHECK_VERSION(2, 32, 0)
+    g_thread_init(NULL);
+#endif
+    signal(SIGPIPE, SIG_IGN);
+
+    context = g_option_context_new("- replay a client traffic capture against cetus");
+    g_option_context_add_main_entries(context, replay_entries, NULL);
+    if (!g_option_context_parse(context, &argc, &argv, &gerr)) {
+        fprintf(stderr, "%s\n", gerr->message);
+        g_clear_error(&gerr);
+        g_option_context_free(context);
+        return 1;
+    }
+    g_option_context_free(context);
+
+    if (!opt_file || !opt_target || !parse_host_port(opt_target, &target_host, &target_port)) {
+        fprintf(stderr, "need --file=<capture> and --target=<host:port>\n");
+        return 1;
+    }
+    if (opt_speed < 0) {
+        fprintf(stderr, "invalid option value\n");
+        return 1;
+    }
+
+    digests = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    conns = load_capture(opt_file);
+    if (!conns)
+        return 1;
+    for (i = 0; i < conns->len; i++) {
+        replay_conn_t *c = g_ptr_array_index(conns, i);
+        if (c->events->len > 0) {
+            replay_event_t *ev = g_ptr_array_index(c->events, c->events->len - 1);
+            capture_end = MAX(capture_end, ev->ts_us);
+        }
+    }
+
+    mysql_library_init(0, NULL, NULL);
+
+    /* connections start at their captured time, each replays its own commands */
+    replay_start = g_get_monotonic_time();
+    for (started = 0; started < conns->len; started++) {
+        replay_conn_t *c = g_ptr_array_index(conns, started);
+
+        replay_wait(c->open_ts);
+        c->thread = replay_thread_new("replay-conn", replay_conn_main, c);
+        if (!c->thread) {
+            fprintf(stderr, "only %u of %u connections replayed\n", started, conns->len);
+            break;
+        }
+    }
+    for (i = 0; i < started; i++) {
+        replay_conn_t *c = g_ptr_array_index(conns, i);
+        g_thread_join(c->thread);
+    }
+    end = g_get_monotonic_time();
+
+    stats = replay_merge_stats(conns);
+    replay_report(conns, stats, (end - replay_start) / 1000000.0, (capture_end - capture_base) / 1000000.0);
+
+    for (i = 0; i < stats->len; i++) {
+        replay_stat_t *st = g_ptr_array_index(stats, i);
+        g_array_free(st->orig, TRUE);
+        g_array_free(st->replay, TRUE);
+        g_free(st);
+    }
+    g_ptr_array_free(stats, TRUE);
+    for (i = 0; i < conns->len; i++) {
+        replay_conn_t *c = g_ptr_array_index(conns, i);
+        for (j = 0; j < c->events->len; j++) {
+            replay_event_t *ev = g_ptr_array_index(c->events, j);
+            g_string_free(ev->arg, TRUE);
+            g_free(ev);
+        }
+        g_ptr_array_free(c->events, TRUE);
+        if (c->user)
+            g_string_free(c->user, TRUE);
+        if (c->db)
+            g_string_free(c->db, TRUE);
+        if (c->charset)
+            g_string_free(c->charset, TRUE);
+        g_free(c);
+    }
+    g_ptr_array_free(conns, TRUE);
+    g_hash_table_destroy(digests);
+    mysql_library_end();
+    g_free(target_host);
+    return 0;
+}
@@ -0,0 +1,281 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#include "cetus-resolver.h"
+
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "cetus-util.h"
+#include "chassis-event.h"
+#include "glib-ext.h"
+#include "network-address.h"
+#include "network-backend.h"
+#include "network-mysqld.h"
+
+#define RESOLVER_TICK_SEC 1
+
+typedef struct resolver_entry_t {
+    gint64 expires;
+    gboolean pending;           /* queued to or being resolved by the thread */
+    gboolean failed;            /* last lookup failed, logged once */
+} resolver_entry_t;
+
+typedef struct resolver_result_t {
+    char *address;              /* as configured, host:port */
+    network_address *addr;      /* NULL if the lookup failed */
+} resolver_result_t;
+
+static struct resolver_service_t {
+    chassis *chas;
+    gint64 ttl_usec;
+    struct event timer;
+    gboolean started;
+    GHashTable *entries;        /* address -> resolver_entry_t, main thread only */
+    GAsyncQueue *jobs;          /* char *address, resolver_stop to quit */
+    GAsyncQueue *results;       /* resolver_result_t */
+    GThread *thread;
+} resolver;
+
+static char resolver_stop_job[] = "";
+
+/* unix sockets and literal IPs need no lookup */
+static gboolean
+address_is_hostname(const char *address)
+{
+    char host[256];
+    const char *end;
+    unsigned char buf[sizeof(struct in6_addr)];
+
+    if (address[0] == '/' || address[0] == '\0') {
+        return FALSE;
+    }
+    if (address[0] == '[') {
+        return FALSE;
+    }
+    end = strchr(address, ':');
+    gsize len = end ? (gsize)(end - address) : strlen(address);
+    if (len == 0 || len >= sizeof(host)) {
+        return FALSE;
+    }
+    memcpy(host, address, len);
+    host[len] = '\0';
+
+    return inet_pton(AF_INET, host, buf) != 1 && inet_pton(AF_INET6, host, buf) != 1;
+}
+
+static resolver_result_t *
+resolve_address(const char *address)
+{
+    resolver_result_t *result = g_new0(resolver_result_t, 1);
+    result->address = g_strdup(address);
+    result->addr = network_address_new();
+    if (network_address_set_address(result->addr, address) != 0) {
+        network_address_free(result->addr);
+        result->addr = NULL;
+    }
+    return result;
+}
+
+static void
+resolver_result_free(resolver_result_t *result)
+{
+    if (result->addr) {
+        network_address_free(result->addr);
+    }
+    g_free(result->address);
+    g_free(result);
+}
+
+static gpointer
+resolver_mainloop(gpointer data)
+{
+    for (;;) {
+        char *address = g_async_queue_pop(resolver.jobs);
+        if (address == resolver_stop_job) {
+            break;
+        }
+        g_async_queue_push(resolver.results, resolve_address(address));
+        g_free(address);
+    }
+    g_debug("exiting resolver loop");
+    return NULL;
+}
+
+static void
+resolver_apply(resolver_result_t *result, gint64 now)
+{
+    network_backends_t *bs = resolver.chas->priv->backends;
+    resolver_entry_t *entry = g_hash_table_lookup(resolver.entries, result->address);
+    guint i;
+
+    if (entry) {
+        entry->pending = FALSE;
+        entry->expires = now + resolver.ttl_usec;
+        if (!result->addr) {
+            if (!entry->failed) {
+                g_warning("%s:resolve %s failed, keep the last address", G_STRLOC, result->address);
+            }
+            entry->failed = TRUE;
+            return;
+        }
+        entry->failed = FALSE;
+    }
+    if (!result->addr) {
+        return;
+    }
+
+    for (i = 0; i < network_backends_count(bs); i++) {
+        network_backend_t *backend = network_backends_get(bs, i);
+        if (strcmp(backend->address->str, result->address) != 0
+            || strleq(S(backend->addr->name), S(result->addr->name))) {
+            continue;
+        }
+
+        g_message("%s:backend %s moved from %s to %s", G_STRLOC, result->address,
+                  backend->addr->name->str, result->addr->name->str);
+
+        /* the monitor thread reads backend->addr */
+        network_backend_set_addr(backend, result->addr);
+    }
+}
+
+static void
+resolver_tick(int fd, short what, void *arg)
+{
+    network_backends_t *bs = resolver.chas->priv->backends;
+    gint64 now = g_get_monotonic_time();
+    resolver_result_t *result;
+    GHashTableIter iter;
+    gpointer key, value;
+    guint i;
+
+    while ((result = g_async_queue_try_pop(resolver.results)) != NULL) {
+        resolver_apply(result, now);
+        resolver_result_free(result);
+    }
+
+    /* backends may be added through the admin port */
+    for (i = 0; i < network_backends_count(bs); i++) {
+        network_backend_t *backend = network_backends_get(bs, i);
+        if (backend->state == BACKEND_STATE_DELETED || !address_is_hostname(backend->address->str)) {
+            continue;
+        }
+        if (!g_hash_table_lookup(resolver.entries, backend->address->str)) {
+            resolver_entry_t *entry = g_new0(resolver_entry_t, 1);
+            entry->expires = now + resolver.ttl_usec;
+            g_hash_table_insert(resolver.entries, g_strdup(backend->address->str), entry);
+        }
+    }
+
+    g_hash_table_iter_init(&iter, resolver.entries);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        resolver_entry_t *entry = value;
+        if (entry->pending || now < entry->expires) {
+            continue;
+        }
+        if (resolver.thread) {
+            entry->pending = TRUE;
+            g_async_queue_push(resolver.jobs, g_strdup(key));
+        } else {
+            /* no threads, at least block once per ttl instead of per connection */
+            result = resolve_address(key);
+            resolver_apply(result, now);
+            resolver_result_free(result);
+        }
+    }
+
+    struct timeval timeout = { RESOLVER_TICK_SEC, 0 };
+    /* EV_PERSIST not work for libevent1.4, re-activate timer each time */
+    chassis_event_add_with_timeout(resolver.chas, &resolver.timer, &timeout);
+}
+
+void
+cetus_resolver_start(chassis *chas)
+{
+    int ttl = chas->dns_cache_ttl;
+
+    if (ttl <= 0 && chas->disable_dns_cache) {
+        ttl = 1;
+    }
+    if (ttl <= 0 || resolver.started) {
+        return;
+    }
+
+    resolver.chas = chas;
+    resolver.ttl_usec = (gint64)ttl * G_USEC_PER_SEC;
+    resolver.entries = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    resolver.jobs = g_async_queue_new();
+    resolver.results = g_async_queue_new();
+
+    if (chas->disable_threads) {
+        g_message("resolver thread is disabled, resolve in place");
+    } else {
+#if !GLIB_CHECK_VERSION(2, 32, 0)
+        GError *error = NULL;
+        resolver.thread = g_thread_create(resolver_mainloop, NULL, TRUE, &error);
+        if (resolver.thread == NULL && error != NULL) {
+            g_critical("Create thread error: %s", error->message);
+            g_error_free(error);
+        }
+#else
+        resolver.thread = g_thread_new("resolver-thread", resolver_mainloop, NULL);
+        if (resolver.thread == NULL) {
+            g_critical("Create thread error.");
+        }
+#endif
+    }
+
+    evtimer_set(&resolver.timer, resolver_tick, NULL);
+    struct timeval timeout = { RESOLVER_TICK_SEC, 0 };
+    chassis_event_add_with_timeout(chas, &resolver.timer, &timeout);
+    resolver.started = TRUE;
+    g_message("%s:resolve backend host names every %d seconds", G_STRLOC, ttl);
+}
+
+void
+cetus_resolver_stop(void)
+{
+    resolver_result_t *result;
+
+    if (!resolver.started) {
+        return;
+    }
+    evtimer_del(&resolver.timer);
+
+    if (resolver.thread) {
+        g_async_queue_push(resolver.jobs, resolver_stop_job);
+        g_thread_join(resolver.thread);
+        resolver.thread = NULL;
+        g_message("Resolver thread stopped");
+    }
+
+    char *address;
+    while ((address = g_async_queue_try_pop(resolver.jobs)) != NULL) {
+        g_free(address);
+    }
+    while ((result = g_async_queue_try_pop(resolver.results)) != NULL) {
+        resolver_result_free(result);
+    }
+    g_async_queue_unref(resolver.jobs);
+    g_async_queue_unref(resolver.results);
+    g_hash_table_destroy(resolver.entries);
+    resolver.started = FALSE;
+}
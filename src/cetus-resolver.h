@@ -0,0 +1,39 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#ifndef _CETUS_RESOLVER_H_
+#define _CETUS_RESOLVER_H_
+
+#include "chassis-mainloop.h"
+
+/**
+ * Background resolution of backends given by host name.
+ *
+ * A resolver thread looks the names up again every dns-cache-ttl seconds,
+ * the main loop swaps the new address into the backend so connections
+ * never wait for getaddrinfo(). Backends given by IP are left alone.
+ */
+
+/* call after the backends are added, the event base must exist */
+void cetus_resolver_start(chassis *chas);
+
+void cetus_resolver_stop(void);
+
+#endif /* _CETUS_RESOLVER_H_ */
@@ -0,0 +1,266 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#include "cetus-row-cache.h"
+
+#include "cetus-util.h"
+
+/* bookkeeping counted for every entry besides its packets */
+#define ROW_ENTRY_OVERHEAD 128
+
+struct row_table_t {
+    gchar *name;
+    guint64 epoch;              /* bumped by every invalidation */
+    GHashTable *keys;           /* key value -> struct row_key_t */
+};
+
+struct row_key_t {
+    gchar *key;
+    struct row_table_t *table;
+    GList *entries;             /* GList<struct row_entry_t *> */
+};
+
+struct row_entry_t {
+    gchar *lookup;
+    struct row_key_t *owner;
+    network_queue *packets;
+    gsize bytes;
+    gint64 expire_us;
+    GList *lru;                 /* link in row_cache_t.lru */
+};
+
+struct row_cache_t {
+    gsize max_bytes;
+    gsize used_bytes;
+    gint64 ttl_us;
+    GHashTable *entries;        /* lookup -> struct row_entry_t */
+    GHashTable *tables;         /* db.table -> struct row_table_t, never removed to keep epochs */
+    GQueue *lru;                /* head is the least recently used */
+};
+
+static void
+row_key_free(gpointer p)
+{
+    struct row_key_t *k = p;
+    g_list_free(k->entries);
+    g_free(k->key);
+    g_free(k);
+}
+
+static void
+row_table_free(gpointer p)
+{
+    struct row_table_t *t = p;
+    g_hash_table_destroy(t->keys);
+    g_free(t->name);
+    g_free(t);
+}
+
+static struct row_table_t *
+row_cache_get_table(row_cache_t *cache, const char *name)
+{
+    struct row_table_t *t = g_hash_table_lookup(cache->tables, name);
+    if (!t) {
+        t = g_new0(struct row_table_t, 1);
+        t->name = g_strdup(name);
+        t->keys = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, row_key_free);
+        g_hash_table_insert(cache->tables, t->name, t);
+    }
+    return t;
+}
+
+static void
+row_cache_drop(row_cache_t *cache, struct row_entry_t *e)
+{
+    struct row_key_t *k = e->owner;
+    k->entries = g_list_remove(k->entries, e);
+    if (!k->entries) {
+        g_hash_table_remove(k->table->keys, k->key);
+    }
+    g_queue_delete_link(cache->lru, e->lru);
+    g_hash_table_remove(cache->entries, e->lookup);
+    cache->used_bytes -= e->bytes;
+
+    network_queue_free(e->packets);
+    g_free(e->lookup);
+    g_free(e);
+}
+
+row_cache_t *
+row_cache_new(gsize max_bytes, int ttl_ms)
+{
+    row_cache_t *cache = g_new0(row_cache_t, 1);
+    cache->max_bytes = max_bytes;
+    cache->ttl_us = (gint64)ttl_ms * 1000;
+    cache->entries = g_hash_table_new(g_str_hash, g_str_equal);
+    cache->tables = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, row_table_free);
+    cache->lru = g_queue_new();
+    return cache;
+}
+
+void
+row_cache_free(row_cache_t *cache)
+{
+    if (!cache) {
+        return;
+    }
+    while (!g_queue_is_empty(cache->lru)) {
+        row_cache_drop(cache, g_queue_peek_head(cache->lru));
+    }
+    g_queue_free(cache->lru);
+    g_hash_table_destroy(cache->entries);
+    g_hash_table_destroy(cache->tables);
+    g_free(cache);
+}
+
+row_cache_ref_t *
+row_cache_ref_new(const char *table)
+{
+    row_cache_ref_t *ref = g_new0(row_cache_ref_t, 1);
+    ref->table = g_string_new(table);
+    ref->keys = g_ptr_array_new_with_free_func(g_free);
+    ref->lookup = g_string_new(NULL);
+    return ref;
+}
+
+void
+row_cache_ref_add_key(row_cache_ref_t *ref, const char *key)
+{
+    g_ptr_array_add(ref->keys, g_strdup(key));
+}
+
+void
+row_cache_ref_free(row_cache_ref_t *ref)
+{
+    g_string_free(ref->table, TRUE);
+    g_ptr_array_free(ref->keys, TRUE);
+    g_string_free(ref->lookup, TRUE);
+    g_free(ref);
+}
+
+gboolean
+row_cache_lookup(row_cache_t *cache, row_cache_ref_t *ref, network_queue *out)
+{
+    struct row_entry_t *e = g_hash_table_lookup(cache->entries, ref->lookup->str);
+    if (e && e->expire_us <= g_get_monotonic_time()) {
+        row_cache_drop(cache, e);
+        e = NULL;
+    }
+    if (!e) {
+        ref->epoch = row_cache_get_table(cache, ref->table->str)->epoch;
+        return FALSE;
+    }
+
+    g_queue_unlink(cache->lru, e->lru);
+    g_queue_push_tail_link(cache->lru, e->lru);
+
+    GList *l;
+    for (l = e->packets->chunks->head; l; l = l->next) {
+        GString *packet = l->data;
+        network_queue_append(out, g_string_new_len(S(packet)));
+    }
+    g_debug("%s: row cache hit for %s", G_STRLOC, ref->lookup->str);
+    return TRUE;
+}
+
+void
+row_cache_store(row_cache_t *cache, row_cache_ref_t *ref, network_queue *packets)
+{
+    struct row_table_t *t = row_cache_get_table(cache, ref->table->str);
+    gsize bytes = packets->len + ref->lookup->len + ROW_ENTRY_OVERHEAD;
+    if (t->epoch != ref->epoch || bytes > cache->max_bytes || ref->keys->len != 1) {
+        network_queue_free(packets);
+        return;
+    }
+
+    struct row_entry_t *e = g_hash_table_lookup(cache->entries, ref->lookup->str);
+    if (e) {
+        row_cache_drop(cache, e);
+    }
+    while (cache->used_bytes + bytes > cache->max_bytes) {
+        row_cache_drop(cache, g_queue_peek_head(cache->lru));
+    }
+
+    const char *key = g_ptr_array_index(ref->keys, 0);
+    struct row_key_t *k = g_hash_table_lookup(t->keys, key);
+    if (!k) {
+        k = g_new0(struct row_key_t, 1);
+        k->key = g_strdup(key);
+        k->table = t;
+        g_hash_table_insert(t->keys, k->key, k);
+    }
+
+    e = g_new0(struct row_entry_t, 1);
+    e->lookup = g_strdup(ref->lookup->str);
+    e->owner = k;
+    e->packets = packets;
+    e->bytes = bytes;
+    e->expire_us = g_get_monotonic_time() + cache->ttl_us;
+    g_queue_push_tail(cache->lru, e);
+    e->lru = g_queue_peek_tail_link(cache->lru);
+    k->entries = g_list_prepend(k->entries, e);
+    g_hash_table_insert(cache->entries, e->lookup, e);
+    cache->used_bytes += bytes;
+}
+
+void
+row_cache_invalidate(row_cache_t *cache, row_cache_ref_t *ref)
+{
+    GHashTableIter iter;
+    gpointer value;
+    if (ref->table->len == 0) { /* all tables */
+        g_hash_table_iter_init(&iter, cache->tables);
+        while (g_hash_table_iter_next(&iter, NULL, &value)) {
+            ((struct row_table_t *)value)->epoch++;
+        }
+        while (!g_queue_is_empty(cache->lru)) {
+            row_cache_drop(cache, g_queue_peek_head(cache->lru));
+        }
+        return;
+    }
+
+    struct row_table_t *t = row_cache_get_table(cache, ref->table->str);
+    t->epoch++;                 /* results being read now might be stale */
+
+    int i;
+    if (ref->keys->len > 0) {
+        for (i = 0; i < ref->keys->len; ++i) {
+            struct row_key_t *k;
+            while ((k = g_hash_table_lookup(t->keys, g_ptr_array_index(ref->keys, i)))) {
+                row_cache_drop(cache, k->entries->data);
+            }
+        }
+        return;
+    }
+
+    GPtrArray *victims = g_ptr_array_new();
+    g_hash_table_iter_init(&iter, t->keys);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        struct row_key_t *k = value;
+        GList *l;
+        for (l = k->entries; l; l = l->next) {
+            g_ptr_array_add(victims, l->data);
+        }
+    }
+    for (i = 0; i < victims->len; ++i) {
+        row_cache_drop(cache, g_ptr_array_index(victims, i));
+    }
+    g_ptr_array_free(victims, TRUE);
+}
@@ -0,0 +1,69 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#ifndef _CETUS_ROW_CACHE_H_
+#define _CETUS_ROW_CACHE_H_
+
+#include <glib.h>
+#include "network-queue.h"
+
+/**
+ * Result cache for point lookups on sharding tables, that is SELECTs routed
+ * to a single partition by an equation on the sharding key.
+ * Entries are indexed by (table, key value) so that writes routed to the same
+ * key drop them, all entries share one memory budget with LRU eviction.
+ */
+typedef struct row_cache_t row_cache_t;
+
+/* identifies the cached result of one statement */
+typedef struct row_cache_ref_t {
+    GString *table;             /* db.table, empty for all tables */
+    GPtrArray *keys;            /* GPtrArray<gchar *>, normalized sharding key values */
+    GString *lookup;            /* user, statement shape and key literal */
+    guint64 epoch;              /* table epoch when the lookup missed */
+    gboolean is_write;          /* no keys means the whole table is written */
+} row_cache_ref_t;
+
+row_cache_t *row_cache_new(gsize max_bytes, int ttl_ms);
+
+void row_cache_free(row_cache_t *cache);
+
+row_cache_ref_t *row_cache_ref_new(const char *table);
+
+void row_cache_ref_add_key(row_cache_ref_t *ref, const char *key);
+
+void row_cache_ref_free(row_cache_ref_t *ref);
+
+/**
+ * append copies of the cached packets to out
+ * @return FALSE on miss, ref->epoch is set for a later row_cache_store()
+ */
+gboolean row_cache_lookup(row_cache_t *cache, row_cache_ref_t *ref, network_queue *out);
+
+/**
+ * cache the response, dropped if the table was written since the lookup
+ * @param packets taken over by the cache
+ */
+void row_cache_store(row_cache_t *cache, row_cache_ref_t *ref, network_queue *packets);
+
+/* drop entries of the written keys, called both when the write is sent and when it is done */
+void row_cache_invalidate(row_cache_t *cache, row_cache_ref_t *ref);
+
+#endif /* _CETUS_ROW_CACHE_H_ */
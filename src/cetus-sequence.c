@@ -0,0 +1,540 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+
+#include "cetus-sequence.h"
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <mysql.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cetus-users.h"
+#include "cetus-util.h"
+#include "chassis-event.h"
+#include "chassis-timings.h"
+#include "glib-ext.h"
+#include "network-backend.h"
+#include "network-mysqld.h"
+
+#define SEQUENCE_IDLE_USEC G_USEC_PER_SEC
+
+struct sequence_block_t {
+    guint64 start;
+    guint64 cur;                /* next id to hand out */
+    guint64 end;                /* exclusive */
+};
+
+struct sequence_t {
+    char *name;
+    GQueue *blocks;             /* GQueue<sequence_block_t *> */
+    guint64 available;
+    gboolean leasing;           /* a lease is queued or running */
+    gboolean lease_failed;      /* last lease failed, fail the next drained query */
+    guint lease_size;
+};
+
+static struct {
+    chassis *chas;
+    GThread *thread;
+    GMutex *mutex;
+    GCond *cond;
+    gboolean stopping;
+
+    GHashTable *sequences;      /* name -> sequence_t */
+    GQueue *requests;           /* sequence_t waiting for lease */
+
+    GString *group;             /* backing storage, empty if not configured */
+    GString *table;
+    guint block_size;
+
+    GString *db_passwd;
+    GString *conn_addr;
+    MYSQL *conn;
+
+    /* lease completion, written by the sequence thread, read by the event loop */
+    int notify_fds[2];
+    struct event notify_event;
+    GList *parked;              /* GList<network_mysqld_con *>, event loop only */
+} seq_service;
+
+static void
+sequence_free(struct sequence_t *seq)
+{
+    g_free(seq->name);
+    struct sequence_block_t *block;
+    while ((block = g_queue_pop_head(seq->blocks))) {
+        g_free(block);
+    }
+    g_queue_free(seq->blocks);
+    g_free(seq);
+}
+
+static void
+sequence_lock(void)
+{
+    g_mutex_lock(seq_service.mutex);
+}
+
+static void
+sequence_unlock(void)
+{
+    g_mutex_unlock(seq_service.mutex);
+}
+
+/* @return FALSE on timeout */
+static gboolean
+sequence_wait_until(gint64 deadline)
+{
+#if !GLIB_CHECK_VERSION(2, 32, 0)
+    gint64 usec = deadline - g_get_monotonic_time();
+    if (usec <= 0) {
+        return FALSE;
+    }
+    GTimeVal tv;
+    g_get_current_time(&tv);
+    g_time_val_add(&tv, usec);
+    return g_cond_timed_wait(seq_service.cond, seq_service.mutex, &tv);
+#else
+    return g_cond_wait_until(seq_service.cond, seq_service.mutex, deadline);
+#endif
+}
+
+static void
+sequence_service_init(void)
+{
+    if (seq_service.mutex) {
+        return;
+    }
+#if !GLIB_CHECK_VERSION(2, 32, 0)
+    seq_service.mutex = g_mutex_new();
+    seq_service.cond = g_cond_new();
+#else
+    seq_service.mutex = g_new0(GMutex, 1);
+    g_mutex_init(seq_service.mutex);
+    seq_service.cond = g_new0(GCond, 1);
+    g_cond_init(seq_service.cond);
+#endif
+    seq_service.sequences = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, (GDestroyNotify) sequence_free);
+    seq_service.requests = g_queue_new();
+    seq_service.group = g_string_new(NULL);
+    seq_service.table = g_string_new(NULL);
+    seq_service.block_size = SEQUENCE_DEFAULT_BLOCK_SIZE;
+    seq_service.db_passwd = g_string_new(NULL);
+    seq_service.conn_addr = g_string_new(NULL);
+    seq_service.notify_fds[0] = -1;
+    seq_service.notify_fds[1] = -1;
+}
+
+void
+cetus_sequence_configure(const char *group, const char *table, guint block_size)
+{
+    sequence_service_init();
+    sequence_lock();
+    g_string_assign(seq_service.group, group ? group : "");
+    g_string_assign(seq_service.table, table ? table : "");
+    seq_service.block_size = block_size > 0 ? block_size : SEQUENCE_DEFAULT_BLOCK_SIZE;
+    sequence_unlock();
+    if (group) {
+        g_message("sequences are stored in %s on group %s, block size %u", table, group, block_size);
+    }
+}
+
+gboolean
+cetus_sequence_enabled(void)
+{
+    return seq_service.mutex && seq_service.group->len > 0;
+}
+
+static void
+mysql_conn_close(void)
+{
+    if (seq_service.conn) {
+        mysql_close(seq_service.conn);
+        seq_service.conn = NULL;
+    }
+}
+
+/* connection to master of the backing group, used by one thread at a time */
+static MYSQL *
+sequence_get_connection(const char *group_name)
+{
+    chassis *chas = seq_service.chas;
+    if (!chas || !chas->default_username) {
+        return NULL;
+    }
+    GString *name = g_string_new(group_name);
+    network_group_t *group = network_backends_get_group(chas->priv->backends, name);
+    g_string_free(name, TRUE);
+    if (!group || !group->master) {
+        g_warning("sequence group %s has no master", group_name);
+        return NULL;
+    }
+    char *addr = group->master->addr->name->str;
+    if (seq_service.conn) {
+        if (strcmp(seq_service.conn_addr->str, addr) == 0 && mysql_ping(seq_service.conn) == 0) {
+            return seq_service.conn;
+        }
+        mysql_conn_close();
+    }
+
+    if (seq_service.db_passwd->len == 0) {
+        cetus_users_get_server_pwd(chas->priv->users, chas->default_username, seq_service.db_passwd);
+    }
+    MYSQL *conn = mysql_init(NULL);
+    if (!conn)
+        return NULL;
+
+    unsigned int timeout = 2 * SECONDS;
+    mysql_options(conn, MYSQL_OPT_CONNECT_TIMEOUT, &timeout);
+    mysql_options(conn, MYSQL_OPT_READ_TIMEOUT, &timeout);
+    mysql_options(conn, MYSQL_OPT_WRITE_TIMEOUT, &timeout);
+
+    char **ip_port = g_strsplit(addr, ":", -1);
+    int port = ip_port[1] ? atoi(ip_port[1]) : 3306;
+    if (mysql_real_connect(conn, ip_port[0], chas->default_username, seq_service.db_passwd->str,
+                           NULL, port, NULL, 0) == NULL) {
+        g_critical("sequence cannot connect to backend: %s@%s, %s", chas->default_username, addr, mysql_error(conn));
+        mysql_close(conn);
+        g_strfreev(ip_port);
+        return NULL;
+    }
+    g_strfreev(ip_port);
+    g_string_assign(seq_service.conn_addr, addr);
+    seq_service.conn = conn;
+    g_message("sequence connected to backend: %s", addr);
+    return conn;
+}
+
+/**
+ * lease [*start, *start + size) in one statement, the row is created on first use,
+ * LAST_INSERT_ID(expr) makes the new value visible to this session only
+ */
+static gboolean
+sequence_lease(const char *group, const char *table, const char *name, guint size, guint64 *start)
+{
+    MYSQL *conn = sequence_get_connection(group);
+    if (!conn) {
+        return FALSE;
+    }
+    size_t name_len = strlen(name);
+    char *escaped = g_malloc(name_len * 2 + 1);
+    mysql_real_escape_string(conn, escaped, name, name_len);
+    char *sql = g_strdup_printf("INSERT INTO %s (name, next_id) VALUES ('%s', %u)"
+                                " ON DUPLICATE KEY UPDATE next_id = LAST_INSERT_ID(next_id + %u)",
+                                table, escaped, size + 1, size);
+    g_free(escaped);
+
+    gboolean ok = FALSE;
+    if (mysql_real_query(conn, L(sql)) != 0) {
+        g_critical("sequence %s lease error: %d, %s", name, mysql_errno(conn), mysql_error(conn));
+        mysql_conn_close();
+    } else if (mysql_affected_rows(conn) == 1) {    /* new sequence */
+        *start = 1;
+        ok = TRUE;
+    } else {
+        *start = mysql_insert_id(conn) - size;
+        ok = TRUE;
+    }
+    g_free(sql);
+    return ok;
+}
+
+static void
+sequence_add_block(struct sequence_t *seq, guint64 start, guint size)
+{
+    struct sequence_block_t *block = g_new0(struct sequence_block_t, 1);
+    block->start = start;
+    block->cur = start;
+    block->end = start + size;
+    g_queue_push_tail(seq->blocks, block);
+    seq->available += size;
+    g_debug("%s: sequence %s leased [%llu, %llu)", G_STRLOC, seq->name,
+            (unsigned long long)block->start, (unsigned long long)block->end);
+}
+
+static void
+sequence_take(struct sequence_t *seq, guint count, guint64 *ids)
+{
+    guint i = 0;
+    while (i < count) {
+        struct sequence_block_t *block = g_queue_peek_head(seq->blocks);
+        ids[i++] = block->cur++;
+        if (block->cur == block->end) {
+            g_free(g_queue_pop_head(seq->blocks));
+        }
+    }
+    seq->available -= count;
+}
+
+/* must be locked */
+static void
+sequence_request_lease(struct sequence_t *seq, guint size)
+{
+    if (seq->leasing) {
+        return;
+    }
+    seq->leasing = TRUE;
+    seq->lease_size = size;
+    g_queue_push_tail(seq_service.requests, seq);
+    g_cond_broadcast(seq_service.cond);
+}
+
+/* prefetch next block when the last block is half consumed */
+static gboolean
+sequence_need_prefetch(struct sequence_t *seq)
+{
+    if (seq->leasing || seq->blocks->length > 1) {
+        return FALSE;
+    }
+    struct sequence_block_t *block = g_queue_peek_head(seq->blocks);
+    return !block || (block->cur - block->start) * 2 >= block->end - block->start;
+}
+
+/* must be locked */
+static struct sequence_t *
+sequence_get(const char *name)
+{
+    struct sequence_t *seq = g_hash_table_lookup(seq_service.sequences, name);
+    if (!seq) {
+        seq = g_new0(struct sequence_t, 1);
+        seq->name = g_strdup(name);
+        seq->blocks = g_queue_new();
+        g_hash_table_insert(seq_service.sequences, seq->name, seq);
+    }
+    return seq;
+}
+
+int
+cetus_sequence_next(const char *name, guint count, guint64 *ids)
+{
+    if (!cetus_sequence_enabled() || count == 0) {
+        return SEQUENCE_ERROR;
+    }
+    if (!seq_service.thread) {
+        g_warning("%s: sequence %s unavailable, no sequence thread", G_STRLOC, name);
+        return SEQUENCE_ERROR;
+    }
+    int rc = SEQUENCE_OK;
+    sequence_lock();
+    struct sequence_t *seq = sequence_get(name);
+    if (seq->available >= count) {
+        sequence_take(seq, count, ids);
+    } else if (seq->lease_failed && !seq->leasing) {
+        /* don't park queries on a broken backend, the next one tries again */
+        seq->lease_failed = FALSE;
+        rc = SEQUENCE_ERROR;
+    } else {
+        g_debug("%s: sequence %s drained, park for lease", G_STRLOC, name);
+        sequence_request_lease(seq, MAX(seq_service.block_size, count - seq->available));
+        rc = SEQUENCE_PENDING;
+    }
+    if (sequence_need_prefetch(seq)) {
+        sequence_request_lease(seq, seq_service.block_size);
+    }
+    sequence_unlock();
+    return rc;
+}
+
+void
+cetus_sequence_prefetch(const char *name)
+{
+    if (!cetus_sequence_enabled()) {
+        return;
+    }
+    sequence_lock();
+    struct sequence_t *seq = sequence_get(name);
+    if (seq->available == 0) {
+        sequence_request_lease(seq, seq_service.block_size);
+    }
+    sequence_unlock();
+}
+
+void
+cetus_sequence_park(network_mysqld_con *con)
+{
+    seq_service.parked = g_list_prepend(seq_service.parked, con);
+}
+
+gboolean
+cetus_sequence_unpark(network_mysqld_con *con)
+{
+    GList *l = g_list_find(seq_service.parked, con);
+    if (!l) {
+        return FALSE;
+    }
+    seq_service.parked = g_list_delete_link(seq_service.parked, l);
+    return TRUE;
+}
+
+/* event loop side of a lease completion, every parked query tries again */
+static void
+sequence_lease_done(int fd, short G_GNUC_UNUSED what, void G_GNUC_UNUSED *arg)
+{
+    char buf[64];
+    while (read(fd, buf, sizeof(buf)) > 0) {
+    }
+    GList *parked = seq_service.parked;
+    seq_service.parked = NULL;
+    GList *l;
+    for (l = parked; l; l = l->next) {
+        network_mysqld_con *con = l->data;
+        event_active(&con->client->event, EV_TIMEOUT, 1);
+    }
+    g_list_free(parked);
+}
+
+static void
+sequence_notify(void)
+{
+    char c = 0;
+    if (write(seq_service.notify_fds[1], &c, 1) < 0 && errno != EAGAIN) {
+        g_warning("%s: sequence notify failed: %s", G_STRLOC, g_strerror(errno));
+    }
+}
+
+static void *
+cetus_sequence_mainloop(void *data)
+{
+    sequence_lock();
+    while (!seq_service.stopping) {
+        struct sequence_t *seq = g_queue_pop_head(seq_service.requests);
+        if (!seq) {
+            sequence_wait_until(g_get_monotonic_time() + SEQUENCE_IDLE_USEC);
+            continue;
+        }
+        char *name = g_strdup(seq->name);
+        char *group = g_strdup(seq_service.group->str);
+        char *table = g_strdup(seq_service.table->str);
+        guint size = seq->lease_size;
+        sequence_unlock();
+
+        guint64 start = 0;
+        gboolean ok = sequence_lease(group, table, name, size, &start);
+
+        sequence_lock();
+        seq = g_hash_table_lookup(seq_service.sequences, name);
+        if (seq) {
+            if (ok) {
+                sequence_add_block(seq, start, size);
+            }
+            seq->lease_failed = !ok;
+            seq->leasing = FALSE;
+        }
+        sequence_notify();
+        g_free(name);
+        g_free(group);
+        g_free(table);
+    }
+    sequence_unlock();
+
+    mysql_conn_close();
+    mysql_thread_end();
+    g_debug("exiting sequence loop");
+    return NULL;
+}
+
+void
+cetus_sequence_start_thread(chassis *chas)
+{
+    sequence_service_init();
+    seq_service.chas = chas;
+    if (chas->disable_threads) {
+        g_message("sequence thread is disabled, sequences are unavailable");
+        return;
+    }
+
+    g_assert(seq_service.thread == 0);
+
+    if (pipe(seq_service.notify_fds) != 0) {
+        g_critical("%s: sequence pipe failed: %s", G_STRLOC, g_strerror(errno));
+        seq_service.notify_fds[0] = seq_service.notify_fds[1] = -1;
+        return;
+    }
+    fcntl(seq_service.notify_fds[0], F_SETFL, O_NONBLOCK);
+    fcntl(seq_service.notify_fds[1], F_SETFL, O_NONBLOCK);
+    event_set(&seq_service.notify_event, seq_service.notify_fds[0], EV_READ | EV_PERSIST, sequence_lease_done, NULL);
+    chassis_event_add(chas, &seq_service.notify_event);
+
+    GThread *new_thread = NULL;
+#if !GLIB_CHECK_VERSION(2, 32, 0)
+    GError *error = NULL;
+    new_thread = g_thread_create(cetus_sequence_mainloop, NULL, TRUE, &error);
+    if (new_thread == NULL && error != NULL) {
+        g_critical("Create thread error: %s", error->message);
+    }
+#else
+    new_thread = g_thread_new("sequence-thread", cetus_sequence_mainloop, NULL);
+    if (new_thread == NULL) {
+        g_critical("Create thread error.");
+    }
+#endif
+
+    seq_service.thread = new_thread;
+    g_message("sequence thread started");
+}
+
+void
+cetus_sequence_stop_thread(void)
+{
+    if (!seq_service.mutex) {
+        return;
+    }
+    if (seq_service.thread) {
+        sequence_lock();
+        seq_service.stopping = TRUE;
+        g_cond_broadcast(seq_service.cond);
+        sequence_unlock();
+        g_thread_join(seq_service.thread);
+        seq_service.thread = NULL;
+        g_message("Sequence thread stopped");
+    } else {
+        mysql_conn_close();
+    }
+    if (seq_service.notify_fds[0] >= 0) {
+        event_del(&seq_service.notify_event);
+        close(seq_service.notify_fds[0]);
+        close(seq_service.notify_fds[1]);
+    }
+    g_list_free(seq_service.parked);
+    g_queue_free(seq_service.requests);
+    g_hash_table_destroy(seq_service.sequences);
+    g_string_free(seq_service.group, TRUE);
+    g_string_free(seq_service.table, TRUE);
+    g_string_free(seq_service.db_passwd, TRUE);
+    g_string_free(seq_service.conn_addr, TRUE);
+#if !GLIB_CHECK_VERSION(2, 32, 0)
+    g_mutex_free(seq_service.mutex);
+    g_cond_free(seq_service.cond);
+#else
+    g_mutex_clear(seq_service.mutex);
+    g_free(seq_service.mutex);
+    g_cond_clear(seq_service.cond);
+    g_free(seq_service.cond);
+#endif
+    memset(&seq_service, 0, sizeof(seq_service));
+}
@@ -0,0 +1,78 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+
+#ifndef _CETUS_SEQUENCE_H_
+#define _CETUS_SEQUENCE_H_
+
+#include <glib.h>
+#include "chassis-mainloop.h"
+
+#define SEQUENCE_DEFAULT_BLOCK_SIZE 1000
+#define SEQUENCE_MAX_FETCH 10000    /* max k of NEXTVAL(seq, k) */
+
+/**
+ * Named sequences backed by a table on one backend group:
+ *   CREATE TABLE <table> (
+ *     `name` varchar(64) NOT NULL PRIMARY KEY,
+ *     `next_id` bigint unsigned NOT NULL
+ *   ) ENGINE = InnoDB;
+ * every proxy leases blocks of ids from the table in the sequence thread,
+ * a block is prefetched when the current one is half consumed. The event
+ * loop never waits for a lease: a query that finds the sequence drained is
+ * parked and resumed when the lease completes.
+ */
+
+#define SEQUENCE_PARK_SEC 5     /* max time a query is parked for a lease */
+
+enum sequence_result_t {
+    SEQUENCE_OK,
+    SEQUENCE_PENDING,           /* lease requested, park the query and retry */
+    SEQUENCE_ERROR,
+};
+
+struct network_mysqld_con;
+
+/* set backing storage, group NULL disables the sequences */
+void cetus_sequence_configure(const char *group, const char *table, guint block_size);
+
+gboolean cetus_sequence_enabled(void);
+
+/**
+ * get count ids of sequence name, ids might not be contiguous, never blocks
+ * @return SEQUENCE_OK with ids filled, SEQUENCE_PENDING if a lease is running,
+ *         SEQUENCE_ERROR if the last lease failed or no sequence thread
+ */
+int cetus_sequence_next(const char *name, guint count, guint64 *ids);
+
+/* lease the first block ahead of demand */
+void cetus_sequence_prefetch(const char *name);
+
+/* resume con with an EV_TIMEOUT on its client event when a lease completes */
+void cetus_sequence_park(struct network_mysqld_con *con);
+
+/* @return TRUE if con was still parked, i.e. not resumed by a lease */
+gboolean cetus_sequence_unpark(struct network_mysqld_con *con);
+
+void cetus_sequence_start_thread(chassis *chas);
+
+void cetus_sequence_stop_thread(void);
+
+#endif /* _CETUS_SEQUENCE_H_ */
@@ -0,0 +1,233 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#include "cetus-spill.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "network-mysqld-proto.h"
+
+/* bytes mapped at a time, also the step the file grows by */
+#define SPILL_WINDOW_SIZE (4 * 1024 * 1024)
+
+typedef struct {
+    char *addr;
+    guint64 base;               /* file offset of addr */
+} spill_window_t;
+
+struct spill_file_t {
+    int fd;
+    guint64 file_size;
+    guint64 write_off;
+    guint64 read_off;
+    spill_window_t wwin;
+    spill_window_t rwin;
+};
+
+spill_file_t *
+spill_file_new(const char *dir)
+{
+    const char *tmp_dir = dir ? dir : g_get_tmp_dir();
+    gchar *path = g_build_filename(tmp_dir, "cetus-spill-XXXXXX", NULL);
+    int fd = g_mkstemp(path);
+    if (fd == -1) {
+        g_warning("%s: create spill file in %s failed: %s", G_STRLOC, tmp_dir, g_strerror(errno));
+        g_free(path);
+        return NULL;
+    }
+    unlink(path);
+    g_free(path);
+
+    spill_file_t *spill = g_new0(spill_file_t, 1);
+    spill->fd = fd;
+    return spill;
+}
+
+static void
+spill_window_unmap(spill_window_t *win)
+{
+    if (win->addr) {
+        munmap(win->addr, SPILL_WINDOW_SIZE);
+        win->addr = NULL;
+    }
+}
+
+void
+spill_file_free(spill_file_t *spill)
+{
+    if (!spill)
+        return;
+    spill_window_unmap(&spill->wwin);
+    spill_window_unmap(&spill->rwin);
+    close(spill->fd);
+    g_free(spill);
+}
+
+/* map the window holding off, the file must already cover it */
+static char *
+spill_window_at(spill_file_t *spill, spill_window_t *win, guint64 off, int prot)
+{
+    guint64 base = off - off % SPILL_WINDOW_SIZE;
+
+    if (!win->addr || win->base != base) {
+        spill_window_unmap(win);
+        void *addr = mmap(NULL, SPILL_WINDOW_SIZE, prot, MAP_SHARED, spill->fd, base);
+        if (addr == MAP_FAILED) {
+            g_warning("%s: mmap spill file failed: %s", G_STRLOC, g_strerror(errno));
+            return NULL;
+        }
+        win->addr = addr;
+        win->base = base;
+        if (win == &spill->rwin && base > 0) {
+            /* the reader never goes back, drop what it has passed from the page cache */
+            posix_fadvise(spill->fd, 0, base, POSIX_FADV_DONTNEED);
+        }
+    }
+
+    return win->addr + (off - base);
+}
+
+static gboolean
+spill_put(spill_file_t *spill, const void *data, gsize len)
+{
+    const char *src = data;
+
+    while (len > 0) {
+        if (spill->write_off == spill->file_size) {
+            /* allocate the blocks now, a full disk would be SIGBUS through the mapping */
+            int err = posix_fallocate(spill->fd, spill->file_size, SPILL_WINDOW_SIZE);
+            if (err != 0) {
+                g_warning("%s: grow spill file failed: %s", G_STRLOC, g_strerror(err));
+                return FALSE;
+            }
+            spill->file_size += SPILL_WINDOW_SIZE;
+        }
+
+        char *dst = spill_window_at(spill, &spill->wwin, spill->write_off, PROT_READ | PROT_WRITE);
+        if (!dst) {
+            return FALSE;
+        }
+        gsize n = MIN(len, SPILL_WINDOW_SIZE - spill->write_off % SPILL_WINDOW_SIZE);
+        memcpy(dst, src, n);
+        spill->write_off += n;
+        src += n;
+        len -= n;
+    }
+
+    return TRUE;
+}
+
+static gboolean
+spill_get(spill_file_t *spill, void *data, gsize len)
+{
+    char *dst = data;
+
+    if (spill->read_off + len > spill->write_off) {
+        return FALSE;
+    }
+
+    while (len > 0) {
+        char *src = spill_window_at(spill, &spill->rwin, spill->read_off, PROT_READ);
+        if (!src) {
+            return FALSE;
+        }
+        gsize n = MIN(len, SPILL_WINDOW_SIZE - spill->read_off % SPILL_WINDOW_SIZE);
+        memcpy(dst, src, n);
+        spill->read_off += n;
+        dst += n;
+        len -= n;
+    }
+
+    return TRUE;
+}
+
+gboolean
+spill_file_write(spill_file_t *spill, const GString *packet)
+{
+    guchar head[11];
+    gsize head_len = 0;
+
+    if (packet->len < NET_HEADER_SIZE) {
+        return FALSE;
+    }
+
+    guint64 v = packet->len - NET_HEADER_SIZE;
+    do {
+        guchar b = v & 0x7f;
+        v >>= 7;
+        head[head_len++] = v ? (b | 0x80) : b;
+    } while (v);
+    head[head_len++] = (guchar)packet->str[3];
+
+    return spill_put(spill, head, head_len) && spill_put(spill, packet->str + NET_HEADER_SIZE, packet->len - NET_HEADER_SIZE);
+}
+
+GString *
+spill_file_read(spill_file_t *spill)
+{
+    guint64 len = 0;
+    int shift = 0;
+    guchar b;
+
+    if (spill->read_off == spill->write_off) {
+        return NULL;
+    }
+
+    do {
+        if (shift > 56 || !spill_get(spill, &b, 1)) {
+            g_critical("%s: corrupt spill record at %llu", G_STRLOC, (unsigned long long)spill->read_off);
+            return NULL;
+        }
+        len |= (guint64)(b & 0x7f) << shift;
+        shift += 7;
+    } while (b & 0x80);
+
+    if (len > PACKET_LEN_MAX || !spill_get(spill, &b, 1)) {
+        g_critical("%s: corrupt spill record at %llu", G_STRLOC, (unsigned long long)spill->read_off);
+        return NULL;
+    }
+
+    GString *packet = g_string_sized_new(len + NET_HEADER_SIZE + 1);
+    packet->str[0] = len & 0xff;
+    packet->str[1] = (len >> 8) & 0xff;
+    packet->str[2] = (len >> 16) & 0xff;
+    packet->str[3] = b;
+    packet->len = NET_HEADER_SIZE + len;
+    packet->str[packet->len] = '\0';
+
+    if (!spill_get(spill, packet->str + NET_HEADER_SIZE, len)) {
+        g_critical("%s: truncated spill record", G_STRLOC);
+        g_string_free(packet, TRUE);
+        return NULL;
+    }
+
+    return packet;
+}
+
+guint64
+spill_file_pending(spill_file_t *spill)
+{
+    return spill->write_off - spill->read_off;
+}
@@ -0,0 +1,52 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#ifndef _CETUS_SPILL_H_
+#define _CETUS_SPILL_H_
+
+#include <glib.h>
+
+/**
+ * Append-only temp file for mysql packets that are buffered too long to be
+ * kept in memory, read back once in the order they were written.
+ *
+ * The file is unlinked right after creation and accessed through a sliding
+ * mmap window, so the pages are file backed and the kernel can write them
+ * out instead of the proxy growing. Packets are stored without their
+ * GString and list overhead:
+ *
+ *   record:  <varint payload len> <u8 packet id> <payload>
+ */
+typedef struct spill_file_t spill_file_t;
+
+/* @return NULL if no temp file can be created in dir */
+spill_file_t *spill_file_new(const char *dir);
+void spill_file_free(spill_file_t *spill);
+
+/* append one packet, header included, FALSE if the disk is full */
+gboolean spill_file_write(spill_file_t *spill, const GString *packet);
+
+/* the next packet with its header rebuilt, NULL if all have been read */
+GString *spill_file_read(spill_file_t *spill);
+
+/* bytes written and not read back yet */
+guint64 spill_file_pending(spill_file_t *spill);
+
+#endif /* _CETUS_SPILL_H_ */
@@ -0,0 +1,124 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#include "cetus-symbol.h"
+
+#include <string.h>
+
+typedef struct symbol_table_t {
+    GHashTable *ids;            /* name -> id + 1, keys are owned by names */
+    GPtrArray *names;           /* id -> name */
+} symbol_table_t;
+
+static symbol_table_t tables[SYMBOL_KINDS];
+
+/* most ids of each kind, within the bits of the socket attr signature */
+static const guint symbol_max_names[SYMBOL_KINDS] = {
+    1 << 8,                     /* SYMBOL_CHARSET */
+    1 << 12,                    /* SYMBOL_SQL_MODE */
+    1 << 16,                    /* SYMBOL_DB */
+};
+
+static symbol_table_t *
+symbol_table(symbol_kind_t kind)
+{
+    symbol_table_t *t = &tables[kind];
+
+    if (t->names == NULL) {
+        t->ids = g_hash_table_new(g_str_hash, g_str_equal);
+        t->names = g_ptr_array_new_with_free_func(g_free);
+        g_ptr_array_add(t->names, g_strdup(""));
+    }
+    return t;
+}
+
+guint32
+symbol_intern(symbol_kind_t kind, const char *str, gsize len)
+{
+    symbol_table_t *t;
+    gchar *name;
+    gpointer id;
+
+    if (str == NULL || len == 0) {
+        return 0;
+    }
+    if (len > SYMBOL_MAX_LEN) {
+        return SYMBOL_OVERFLOW;
+    }
+
+    t = symbol_table(kind);
+    if (str[len] == '\0') {
+        id = g_hash_table_lookup(t->ids, str);
+        if (id) {
+            return GPOINTER_TO_UINT(id) - 1;
+        }
+        if (t->names->len >= symbol_max_names[kind]) {
+            return SYMBOL_OVERFLOW;
+        }
+        name = g_strndup(str, len);
+    } else {
+        name = g_strndup(str, len);
+        id = g_hash_table_lookup(t->ids, name);
+        if (id) {
+            g_free(name);
+            return GPOINTER_TO_UINT(id) - 1;
+        }
+        if (t->names->len >= symbol_max_names[kind]) {
+            g_free(name);
+            return SYMBOL_OVERFLOW;
+        }
+    }
+
+    g_ptr_array_add(t->names, name);
+    g_hash_table_insert(t->ids, name, GUINT_TO_POINTER(t->names->len));
+    return t->names->len - 1;
+}
+
+const char *
+symbol_name(symbol_kind_t kind, guint32 id)
+{
+    symbol_table_t *t = &tables[kind];
+
+    if (t->names == NULL || id >= t->names->len) {
+        return "";
+    }
+    return g_ptr_array_index(t->names, id);
+}
+
+guint
+symbol_count(symbol_kind_t kind)
+{
+    return tables[kind].names ? tables[kind].names->len : 1;
+}
+
+void
+symbol_tables_free(void)
+{
+    int i;
+
+    for (i = 0; i < SYMBOL_KINDS; i++) {
+        if (tables[i].names) {
+            g_hash_table_destroy(tables[i].ids);
+            g_ptr_array_free(tables[i].names, TRUE);
+            tables[i].ids = NULL;
+            tables[i].names = NULL;
+        }
+    }
+}
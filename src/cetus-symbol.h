@@ -0,0 +1,65 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#ifndef _CETUS_SYMBOL_H_
+#define _CETUS_SYMBOL_H_
+
+#include <glib.h>
+
+/**
+ * Symbol tables of session attribute values.
+ *
+ * Every distinct value gets a small integer id, so sockets keep ids and
+ * compare them instead of strings. Id 0 is the empty string. Each kind
+ * has its own table to keep the ids small. Entries are never removed, so
+ * as the values come from clients each table is capped; values that don't
+ * fit get SYMBOL_OVERFLOW and the caller keeps and compares the string.
+ * The tables are only used from the main thread.
+ */
+typedef enum {
+    SYMBOL_CHARSET,
+    SYMBOL_SQL_MODE,
+    SYMBOL_DB,
+    SYMBOL_KINDS
+} symbol_kind_t;
+
+/* not interned, the table is full or the value too long */
+#define SYMBOL_OVERFLOW G_MAXUINT32
+
+/* longest value interned */
+#define SYMBOL_MAX_LEN 256
+
+/**
+ * id of the value, str may be NULL for the empty string
+ *
+ * str[len] must be readable, as it is for GStrings and C strings
+ *
+ * @return SYMBOL_OVERFLOW if the value can't be interned
+ */
+guint32 symbol_intern(symbol_kind_t kind, const char *str, gsize len);
+
+/* the value of the id, never NULL, "" for SYMBOL_OVERFLOW */
+const char *symbol_name(symbol_kind_t kind, guint32 id);
+
+guint symbol_count(symbol_kind_t kind);
+
+void symbol_tables_free(void);
+
+#endif /* _CETUS_SYMBOL_H_ */
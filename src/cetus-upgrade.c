@@ -0,0 +1,525 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#include "cetus-upgrade.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "cetus-log.h"
+#include "chassis-event.h"
+#include "chassis-unix-daemon.h"
+#include "glib-ext.h"
+#include "network-mysqld.h"
+
+#define UPGRADE_READY_TIMEOUT_SEC 60
+#define UPGRADE_DRAIN_TICK_SEC 1
+#define UPGRADE_NAME_LEN 512
+#define UPGRADE_READY 'R'
+
+extern char **environ;
+
+static struct upgrade_service_t {
+    char *exe_path;             /* resolved at startup, the file may be replaced later */
+    char **argv;
+    gboolean started;
+    struct event sigusr2;
+    struct event timer;         /* ready notice in the new process, draining in the old */
+    struct event ready;         /* the old process waits for the new one */
+    GHashTable *inherited;      /* name -> fd, in the new process until it is ready */
+    int channel;                /* socketpair end to the other process */
+    pid_t child;                /* new process not ready yet */
+    gboolean handed_over;
+    gint64 drain_deadline;
+    char *drain_xa_log;         /* XA log while draining, kept until exit */
+} upgrade = {
+    .channel = -1,
+};
+
+void
+cetus_upgrade_save_argv(int argc, char **argv)
+{
+    int i;
+
+    upgrade.argv = g_new0(char *, argc + 1);
+    for (i = 0; i < argc; i++) {
+        upgrade.argv[i] = g_strdup(argv[i]);
+    }
+    upgrade.exe_path = g_file_read_link("/proc/self/exe", NULL);
+    if (upgrade.exe_path == NULL) {
+        upgrade.exe_path = g_strdup(argv[0]);
+    }
+}
+
+/* one message per socket: its name with the fd attached, an empty name ends the list */
+static int
+send_listener(int channel, const char *name, int fd)
+{
+    struct msghdr msg;
+    struct iovec iov;
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = (void *)name;
+    iov.iov_len = strlen(name) + 1;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    if (fd != -1) {
+        struct cmsghdr *cmsg;
+
+        memset(&control, 0, sizeof(control));
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+
+    return sendmsg(channel, &msg, 0) == (ssize_t)iov.iov_len ? 0 : -1;
+}
+
+static ssize_t
+recv_listener(int channel, char *name, size_t size, int *fd)
+{
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    ssize_t len;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = name;
+    iov.iov_len = size - 1;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    do {
+        len = recvmsg(channel, &msg, 0);
+    } while (len < 0 && errno == EINTR);
+    if (len <= 0) {
+        return len;
+    }
+    name[len] = '\0';
+
+    *fd = -1;
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            memcpy(fd, CMSG_DATA(cmsg), sizeof(int));
+        }
+    }
+    return len;
+}
+
+int
+cetus_upgrade_inherit(void)
+{
+    const char *env = g_getenv(CETUS_UPGRADE_FD_ENV);
+    struct timeval timeout = { UPGRADE_READY_TIMEOUT_SEC, 0 };
+    int channel;
+
+    if (env == NULL) {
+        return 0;
+    }
+    channel = atoi(env);
+    g_unsetenv(CETUS_UPGRADE_FD_ENV);
+    if (channel < 3) {
+        g_critical("%s: invalid %s: %s", G_STRLOC, CETUS_UPGRADE_FD_ENV, env);
+        return -1;
+    }
+
+    if (setsockopt(channel, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) != 0) {
+        g_warning("%s: setsockopt(SO_RCVTIMEO) failed: %s (%d)", G_STRLOC, g_strerror(errno), errno);
+    }
+
+    upgrade.inherited = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    for (;;) {
+        char name[UPGRADE_NAME_LEN];
+        int fd = -1;
+        ssize_t len = recv_listener(channel, name, sizeof(name), &fd);
+
+        if (len <= 0) {
+            g_critical("%s: receiving the listen sockets failed: %s (%d)",
+                       G_STRLOC, len ? g_strerror(errno) : "closed", len ? errno : 0);
+            close(channel);
+            return -1;
+        }
+        if (name[0] == '\0') {
+            break;
+        }
+        if (fd == -1) {
+            g_warning("%s: no fd passed with listen socket %s", G_STRLOC, name);
+            continue;
+        }
+        g_hash_table_insert(upgrade.inherited, g_strdup(name), GINT_TO_POINTER(fd));
+        g_message("%s: inherited listen socket %s, fd:%d", G_STRLOC, name, fd);
+    }
+
+    timeout.tv_sec = 0;
+    setsockopt(channel, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    upgrade.channel = channel;
+    return g_hash_table_size(upgrade.inherited);
+}
+
+gboolean
+cetus_upgrade_is_inherited(void)
+{
+    return upgrade.channel != -1 && upgrade.inherited != NULL;
+}
+
+int
+cetus_upgrade_take_listener(const char *name)
+{
+    gpointer value;
+
+    if (upgrade.inherited == NULL || !g_hash_table_lookup_extended(upgrade.inherited, name, NULL, &value)) {
+        return -1;
+    }
+    g_hash_table_remove(upgrade.inherited, name);
+    return GPOINTER_TO_INT(value);
+}
+
+gboolean
+cetus_upgrade_handed_over(void)
+{
+    return upgrade.handed_over;
+}
+
+/* runs once the main loop is up, every plugin has bound its sockets by then */
+static void
+upgrade_ready_notify(int G_GNUC_UNUSED fd, short G_GNUC_UNUSED what, void G_GNUC_UNUSED *arg)
+{
+    char ready = UPGRADE_READY;
+    GHashTableIter iter;
+    gpointer key, value;
+
+    g_hash_table_iter_init(&iter, upgrade.inherited);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        g_message("%s: inherited listen socket %s is not configured anymore, close it", G_STRLOC, (char *)key);
+        close(GPOINTER_TO_INT(value));
+    }
+    g_hash_table_destroy(upgrade.inherited);
+    upgrade.inherited = NULL;
+
+    if (write(upgrade.channel, &ready, 1) != 1) {
+        g_warning("%s: notifying the old process failed: %s (%d)", G_STRLOC, g_strerror(errno), errno);
+    } else {
+        g_message("%s: upgraded process is ready, the old process starts draining", G_STRLOC);
+    }
+    close(upgrade.channel);
+    upgrade.channel = -1;
+}
+
+/* the current environment with CETUS_UPGRADE_FD set, built before fork() */
+static char **
+upgrade_build_env(int channel)
+{
+    GPtrArray *env = g_ptr_array_new();
+    size_t prefix_len = strlen(CETUS_UPGRADE_FD_ENV "=");
+    char **e;
+
+    for (e = environ; *e; e++) {
+        if (strncmp(*e, CETUS_UPGRADE_FD_ENV "=", prefix_len) != 0) {
+            g_ptr_array_add(env, g_strdup(*e));
+        }
+    }
+    g_ptr_array_add(env, g_strdup_printf("%s=%d", CETUS_UPGRADE_FD_ENV, channel));
+    g_ptr_array_add(env, NULL);
+    return (char **)g_ptr_array_free(env, FALSE);
+}
+
+static void
+upgrade_abort(const char *reason)
+{
+    int status;
+
+    g_critical("%s: upgrade aborted, %s", G_STRLOC, reason);
+    if (event_initialized(&upgrade.ready)) {
+        event_del(&upgrade.ready);
+    }
+    if (upgrade.channel != -1) {
+        close(upgrade.channel);
+        upgrade.channel = -1;
+    }
+    if (upgrade.child > 0) {
+        kill(upgrade.child, SIGTERM);
+        waitpid(upgrade.child, &status, WNOHANG);
+        upgrade.child = 0;
+    }
+}
+
+static void
+upgrade_drain(int G_GNUC_UNUSED fd, short G_GNUC_UNUSED what, void *arg)
+{
+    chassis *chas = arg;
+    GPtrArray *idle = g_ptr_array_new();
+    gint64 remaining = upgrade.drain_deadline - g_get_monotonic_time();
+    guint i, n, clients = 0;
+
+    for (i = 0; i < chas->priv->cons->len; i++) {
+        network_mysqld_con *con = g_ptr_array_index(chas->priv->cons, i);
+        if (con->client == NULL) {
+            continue;
+        }
+        clients++;
+        if (con->state == ST_READ_QUERY && !con->is_in_transaction && !con->is_in_sess_context) {
+            g_ptr_array_add(idle, con);
+        }
+    }
+
+    if (clients == 0 || remaining <= 0) {
+        if (clients) {
+            g_warning("%s: %u clients still connected after upgrade-drain-timeout, close them", G_STRLOC, clients);
+        } else {
+            g_message("%s: all clients are gone, the old process exits", G_STRLOC);
+        }
+        g_ptr_array_free(idle, TRUE);
+        chassis_set_shutdown_location(G_STRLOC);
+        return;
+    }
+
+    /* spread the idle clients over the time left, so they don't all reconnect at once */
+    n = idle->len * (UPGRADE_DRAIN_TICK_SEC * G_USEC_PER_SEC) / remaining;
+    n = MIN(MAX(n, 1), idle->len);
+    for (i = 0; i < n; i++) {
+        network_mysqld_con *con = g_ptr_array_index(idle, i);
+        g_debug("%s: close idle client %s for the upgrade", G_STRLOC, con->client->src->name->str);
+        con->prev_state = con->state;
+        con->state = ST_CLOSE_CLIENT;
+        network_mysqld_con_handle(-1, 0, con);
+    }
+    g_ptr_array_free(idle, TRUE);
+
+    struct timeval timeout = { UPGRADE_DRAIN_TICK_SEC, 0 };
+    /* EV_PERSIST not work for libevent1.4, re-activate timer each time */
+    chassis_event_add_with_timeout(chas, &upgrade.timer, &timeout);
+}
+
+static void
+upgrade_hand_over(chassis *chas)
+{
+    GList *l;
+
+    for (l = chas->priv->listen_conns; l; l = l->next) {
+        network_mysqld_con *con = l->data;
+        network_socket *sock = con->server;
+
+        if (sock->event.ev_base) {
+            event_del(&(sock->event));
+        }
+        closesocket(sock->fd);
+        sock->fd = -1;
+        /* the unix socket file belongs to the new process now */
+        sock->dst->can_unlink_socket = FALSE;
+    }
+    g_list_free(chas->priv->listen_conns);
+    chas->priv->listen_conns = NULL;
+
+    /* the angel supervises the new process once we exit */
+    chassis_unix_report_successor(upgrade.child);
+
+    /* the new process writes the XA log now, finish ours in a file of our own */
+    if (tc_log_file() != NULL) {
+        upgrade.drain_xa_log = g_strdup_printf("%s.%d", tc_log_file(), (int)getpid());
+        if (tc_log_switch(upgrade.drain_xa_log) == -1) {
+            g_critical("%s: opening XA log %s failed", G_STRLOC, upgrade.drain_xa_log);
+        } else {
+            g_message("%s: XA log of the draining transactions: %s", G_STRLOC, upgrade.drain_xa_log);
+        }
+    }
+
+    /* busy clients are closed as soon as their transaction ends */
+    chas->maintain_close_mode = 1;
+    upgrade.handed_over = TRUE;
+    upgrade.drain_deadline = g_get_monotonic_time() + (gint64)chas->upgrade_drain_timeout * G_USEC_PER_SEC;
+    g_message("%s: PID=%d took over the listen sockets, draining clients for at most %d seconds",
+              G_STRLOC, upgrade.child, chas->upgrade_drain_timeout);
+    upgrade.child = 0;
+
+    evtimer_set(&upgrade.timer, upgrade_drain, chas);
+    upgrade_drain(-1, 0, chas);
+}
+
+static void
+upgrade_ready_handler(int fd, short what, void *arg)
+{
+    chassis *chas = arg;
+    char ready = 0;
+
+    if (what & EV_TIMEOUT) {
+        upgrade_abort("the new process did not get ready in time");
+        return;
+    }
+    if (read(fd, &ready, 1) != 1 || ready != UPGRADE_READY) {
+        upgrade_abort("the new process quit before it got ready");
+        return;
+    }
+    close(upgrade.channel);
+    upgrade.channel = -1;
+    upgrade_hand_over(chas);
+}
+
+static void
+upgrade_spawn(chassis *chas)
+{
+    int pair[2];
+    char **envp;
+    pid_t pid;
+    GList *l;
+
+    /* SEQPACKET keeps the name/fd messages apart */
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, pair) != 0) {
+        g_critical("%s: socketpair() failed: %s (%d)", G_STRLOC, g_strerror(errno), errno);
+        return;
+    }
+
+    envp = upgrade_build_env(pair[1]);
+    int angel_fd = chassis_unix_angel_fd();
+    pid = fork();
+    if (pid == 0) {
+        /* only async-signal-safe calls from here on */
+        long max_fd = sysconf(_SC_OPEN_MAX);
+        long i;
+
+        for (i = 3; i < max_fd; i++) {
+            if (i != pair[1] && i != angel_fd) {
+                close(i);
+            }
+        }
+        /* survives exec, until the new process installs its own handler */
+        signal(SIGUSR2, SIG_IGN);
+        signal(SIGCHLD, SIG_DFL);
+        execve(upgrade.exe_path, upgrade.argv, envp);
+        _exit(127);
+    }
+    g_strfreev(envp);
+    close(pair[1]);
+
+    if (pid < 0) {
+        g_critical("%s: fork() failed: %s (%d)", G_STRLOC, g_strerror(errno), errno);
+        close(pair[0]);
+        return;
+    }
+    g_message("%s: started %s as PID=%d to take over", G_STRLOC, upgrade.exe_path, pid);
+    upgrade.child = pid;
+    upgrade.channel = pair[0];
+
+    for (l = chas->priv->listen_conns; l; l = l->next) {
+        network_mysqld_con *con = l->data;
+        network_socket *sock = con->server;
+
+        if (send_listener(upgrade.channel, sock->dst->name->str, sock->fd) != 0) {
+            upgrade_abort("sending the listen sockets failed");
+            return;
+        }
+    }
+    if (send_listener(upgrade.channel, "", -1) != 0) {
+        upgrade_abort("sending the listen sockets failed");
+        return;
+    }
+
+    event_set(&upgrade.ready, upgrade.channel, EV_READ, upgrade_ready_handler, chas);
+    struct timeval timeout = { UPGRADE_READY_TIMEOUT_SEC, 0 };
+    chassis_event_add_with_timeout(chas, &upgrade.ready, &timeout);
+}
+
+static void
+upgrade_signal_handler(int G_GNUC_UNUSED fd, short G_GNUC_UNUSED what, void *arg)
+{
+    chassis *chas = arg;
+
+    if (upgrade.child > 0 || upgrade.handed_over || upgrade.inherited != NULL) {
+        g_message("%s: received SIGUSR2, but an upgrade is already in progress", G_STRLOC);
+        return;
+    }
+    if (chassis_is_shutdown()) {
+        return;
+    }
+    g_message("%s: received SIGUSR2, upgrading", G_STRLOC);
+    upgrade_spawn(chas);
+}
+
+void
+cetus_upgrade_init(chassis *chas)
+{
+    if (upgrade.started) {
+        return;
+    }
+    if (chas->workers) {
+        /* the master forwards SIGUSR2 to every worker, they can't all take the port */
+        g_message("%s:upgrade by SIGUSR2 is disabled with worker-processes", G_STRLOC);
+        return;
+    }
+    signal_set(&upgrade.sigusr2, SIGUSR2, upgrade_signal_handler, chas);
+    event_base_set(chas->event_base, &upgrade.sigusr2);
+    if (signal_add(&upgrade.sigusr2, NULL)) {
+        g_critical("%s: signal_add(SIGUSR2) failed", G_STRLOC);
+    }
+
+    if (cetus_upgrade_is_inherited()) {
+        evtimer_set(&upgrade.timer, upgrade_ready_notify, chas);
+        struct timeval timeout = { 0, 0 };
+        chassis_event_add_with_timeout(chas, &upgrade.timer, &timeout);
+    }
+    upgrade.started = TRUE;
+}
+
+void
+cetus_upgrade_stop(void)
+{
+    if (upgrade.started) {
+        signal_del(&upgrade.sigusr2);
+        if (event_initialized(&upgrade.timer)) {
+            evtimer_del(&upgrade.timer);
+        }
+        if (upgrade.child > 0) {
+            upgrade_abort("shutting down");
+        }
+        upgrade.started = FALSE;
+    }
+    if (upgrade.inherited) {
+        g_hash_table_destroy(upgrade.inherited);
+        upgrade.inherited = NULL;
+    }
+    if (upgrade.channel != -1) {
+        close(upgrade.channel);
+        upgrade.channel = -1;
+    }
+    g_strfreev(upgrade.argv);
+    upgrade.argv = NULL;
+    g_free(upgrade.exe_path);
+    upgrade.exe_path = NULL;
+}
@@ -0,0 +1,60 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#ifndef _CETUS_UPGRADE_H_
+#define _CETUS_UPGRADE_H_
+
+#include <glib.h>
+
+#include "chassis-mainloop.h"
+
+/**
+ * Binary upgrade without dropping the listen sockets.
+ *
+ * On SIGUSR2 the running process starts the binary it was started from
+ * (the file may have been replaced meanwhile) with the same arguments and
+ * passes its listen sockets over a unix socket. Once the new process has
+ * loaded its config and is accepting, the old one stops listening, closes
+ * its idle clients a few at a time and exits when the last client is gone
+ * or upgrade-drain-timeout is reached.
+ */
+
+#define CETUS_UPGRADE_FD_ENV "CETUS_UPGRADE_FD"
+
+/* call first thing in main(), before the options consume argv */
+void cetus_upgrade_save_argv(int argc, char **argv);
+
+/* receive the listen sockets if we were started by an upgrade, -1 on error */
+int cetus_upgrade_inherit(void);
+
+gboolean cetus_upgrade_is_inherited(void);
+
+/* the inherited listen socket bound to name, -1 if there is none */
+int cetus_upgrade_take_listener(const char *name);
+
+/* call after the listen sockets are bound, the event base must exist */
+void cetus_upgrade_init(chassis *chas);
+
+/* TRUE once the listen sockets are handed to a new process */
+gboolean cetus_upgrade_handed_over(void);
+
+void cetus_upgrade_stop(void);
+
+#endif /* _CETUS_UPGRADE_H_ */
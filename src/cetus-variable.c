@@ -1,5 +1,6 @@
 #include "cetus-variable.h"
 #include "chassis-mainloop.h"
+#include "chassis-event.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -8,6 +9,7 @@ void
 cetus_variables_init_stats(cetus_variable_t **vars, chassis *chas)
 {
     query_stats_t *stats = &(chas->query_stats);
+    chassis_loop_stats_t *loop = chassis_event_loop_stats();
 
     cetus_variable_t stats_variables[] = {
         {"Com_select", &stats->com_select, VAR_INT64},
@@ -20,6 +22,14 @@ cetus_variables_init_stats(cetus_variable_t **vars, chassis *chas)
         {"Com_delete_shard", &stats->com_delete_shard, VAR_INT64},
         {"Com_select_global", &stats->com_select_global, VAR_INT64},
         {"Com_select_bad_key", &stats->com_select_bad_key, VAR_INT64},
+        {"Loop_lag_p50_us", &loop->lag_p50, VAR_INT64},
+        {"Loop_lag_p99_us", &loop->lag_p99, VAR_INT64},
+        {"Loop_lag_p999_us", &loop->lag_p999, VAR_INT64},
+        {"Loop_lag_max_us", &loop->lag_max, VAR_INT64},
+        {"Loop_callback_p99_us", &loop->callback_p99, VAR_INT64},
+        {"Loop_callback_max_us", &loop->callback_max, VAR_INT64},
+        {"Loop_stalls", &loop->stalls, VAR_INT64},
+        {"Loop_wheel_timers", &loop->wheel_timers, VAR_INT64},
         {NULL, NULL, 0}
     };
     int length = sizeof(stats_variables);
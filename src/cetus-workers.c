@@ -0,0 +1,189 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "cetus-workers.h"
+
+#include <errno.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "chassis-event.h"
+#include "glib-ext.h"
+#include "network-mysqld.h"
+
+#define WORKERS_PUBLISH_SEC 1
+
+static struct workers_service_t {
+    chassis *chas;
+    struct event timer;
+    gboolean started;
+} publisher;
+
+cetus_workers_t *
+cetus_workers_new(int count)
+{
+    cetus_workers_t *workers;
+    int i;
+
+    /* anonymous shared mapping, inherited by every fork() of the master */
+    workers = mmap(NULL, sizeof(*workers), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (workers == MAP_FAILED) {
+        g_critical("%s: mmap() of the worker table failed: %s (%d)", G_STRLOC, g_strerror(errno), errno);
+        return NULL;
+    }
+    memset(workers, 0, sizeof(*workers));
+    workers->count = MIN(count, CETUS_MAX_WORKERS);
+    for (i = 0; i < workers->count; i++) {
+        workers->worker[i].cpu = -1;
+    }
+    return workers;
+}
+
+void
+cetus_workers_free(cetus_workers_t *workers)
+{
+    if (workers) {
+        munmap(workers, sizeof(*workers));
+    }
+}
+
+int
+cetus_workers_set_affinity(int index)
+{
+#ifdef CPU_SET
+    cpu_set_t allowed, mine;
+    int cpu, n = 0, nth;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        g_warning("%s: sched_getaffinity() failed: %s (%d)", G_STRLOC, g_strerror(errno), errno);
+        return -1;
+    }
+    nth = index % CPU_COUNT(&allowed);
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &allowed) && n++ == nth) {
+            break;
+        }
+    }
+    if (cpu == CPU_SETSIZE) {
+        return -1;
+    }
+
+    CPU_ZERO(&mine);
+    CPU_SET(cpu, &mine);
+    if (sched_setaffinity(0, sizeof(mine), &mine) != 0) {
+        g_warning("%s: sched_setaffinity(%d) failed: %s (%d)", G_STRLOC, cpu, g_strerror(errno), errno);
+        return -1;
+    }
+    return cpu;
+#else
+    g_warning("%s: worker-cpu-affinity is not supported on this platform", G_STRLOC);
+    return -1;
+#endif
+}
+
+char *
+cetus_workers_admin_address(const char *address, int index)
+{
+    const char *colon = strrchr(address, ':');
+    char *end;
+    long port;
+
+    if (index == 0 || colon == NULL || address[0] == '/') {
+        return g_strdup(address);
+    }
+    port = strtol(colon + 1, &end, 10);
+    if (*end != '\0' || port <= 0 || port + index > 65535) {
+        return g_strdup(address);
+    }
+    return g_strdup_printf("%.*s:%ld", (int)(colon - address), address, port + index);
+}
+
+static void
+workers_publish(int G_GNUC_UNUSED fd, short G_GNUC_UNUSED what, void *arg)
+{
+    chassis *chas = arg;
+    cetus_worker_stats_t *self = &chas->workers->worker[chas->worker_index];
+    query_stats_t *stats = &(chas->query_stats);
+
+    self->client_conns = chas->priv->cons->len;
+    self->client_query = stats->client_query;
+    self->proxyed_query = stats->proxyed_query;
+    self->xa_count = stats->xa_count;
+    self->updated = time(NULL);
+
+    struct timeval timeout = { WORKERS_PUBLISH_SEC, 0 };
+    /* EV_PERSIST not work for libevent1.4, re-activate timer each time */
+    chassis_event_add_with_timeout(chas, &publisher.timer, &timeout);
+}
+
+void
+cetus_workers_start(chassis *chas)
+{
+    cetus_worker_stats_t *self;
+
+    if (chas->workers == NULL || publisher.started) {
+        return;
+    }
+    self = &chas->workers->worker[chas->worker_index];
+    self->pid = getpid();
+    self->starts++;
+    self->started = time(NULL);
+
+    publisher.chas = chas;
+    evtimer_set(&publisher.timer, workers_publish, chas);
+    workers_publish(-1, 0, chas);
+    publisher.started = TRUE;
+    g_message("%s:worker %d of %d started, pid:%d", G_STRLOC, chas->worker_index, chas->workers->count, self->pid);
+}
+
+void
+cetus_workers_stop(void)
+{
+    if (!publisher.started) {
+        return;
+    }
+    evtimer_del(&publisher.timer);
+    publisher.chas->workers->worker[publisher.chas->worker_index].pid = 0;
+    publisher.started = FALSE;
+}
+
+void
+cetus_workers_query_total(cetus_workers_t *workers, rw_op_t *client_query, rw_op_t *proxyed_query)
+{
+    int i;
+
+    memset(client_query, 0, sizeof(*client_query));
+    memset(proxyed_query, 0, sizeof(*proxyed_query));
+    for (i = 0; i < workers->count; i++) {
+        cetus_worker_stats_t *w = &workers->worker[i];
+        client_query->ro += w->client_query.ro;
+        client_query->rw += w->client_query.rw;
+        proxyed_query->ro += w->proxyed_query.ro;
+        proxyed_query->rw += w->proxyed_query.rw;
+    }
+}
@@ -0,0 +1,74 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#ifndef _CETUS_WORKERS_H_
+#define _CETUS_WORKERS_H_
+
+#include <glib.h>
+
+#include "chassis-mainloop.h"
+
+/**
+ * Prefork mode: a master process supervises worker-processes workers.
+ * Every worker binds the proxy port itself with SO_REUSEPORT so the kernel
+ * spreads new connections, and is restarted alone when it dies.
+ *
+ * The workers publish their counters every second into a table shared by
+ * all of them, which the admin plugin of any worker can show.
+ */
+
+#define CETUS_MAX_WORKERS 64
+
+typedef struct cetus_worker_stats_t {
+    gint pid;                   /* 0 while not running */
+    gint cpu;                   /* -1 if not pinned */
+    guint starts;
+    gint64 started;             /* time_t */
+    gint64 updated;             /* time_t of the last publish */
+    guint64 client_conns;
+    rw_op_t client_query;
+    rw_op_t proxyed_query;
+    guint64 xa_count;
+} cetus_worker_stats_t;
+
+typedef struct cetus_workers_t {
+    int count;
+    cetus_worker_stats_t worker[CETUS_MAX_WORKERS];
+} cetus_workers_t;
+
+/* in the master before forking, NULL on failure */
+cetus_workers_t *cetus_workers_new(int count);
+
+void cetus_workers_free(cetus_workers_t *workers);
+
+/* pin the calling worker to one of the CPUs it may run on, returns the CPU or -1 */
+int cetus_workers_set_affinity(int index);
+
+/* admin listens on its port + index in the other workers */
+char *cetus_workers_admin_address(const char *address, int index);
+
+/* in the worker once the event base exists, publishes until cetus_workers_stop() */
+void cetus_workers_start(chassis *chas);
+
+void cetus_workers_stop(void);
+
+void cetus_workers_query_total(cetus_workers_t *workers, rw_op_t *client_query, rw_op_t *proxyed_query);
+
+#endif /* _CETUS_WORKERS_H_ */
@@ -20,6 +20,7 @@
 
 #include <glib.h>
 #include <errno.h>
+#include <string.h>
 
 #ifdef HAVE_CONFIG_H
 #include "config.h"
@@ -30,6 +31,12 @@
 #endif
 
 #include <sys/socket.h>         /* for SOCK_STREAM and AF_UNIX/AF_INET */
+#include <pthread.h>
+#include <signal.h>
+
+#ifdef HAVE_EXECINFO_H
+#include <execinfo.h>
+#endif
 
 #include <event.h>
 
@@ -74,21 +81,267 @@ chassis_event_add(chassis *chas, struct event *ev)
     chassis_event_add_with_timeout(chas, ev, NULL);
 }
 
+/*
+ * hashed timing wheel for the long timeouts of client and pooled server
+ * connections, at 100k connections each re-arm of a libevent timeout is
+ * a heap operation while they almost never fire
+ */
+#define TIMER_WHEEL_TICK_USEC (100 * 1000)
+#define TIMER_WHEEL_SLOTS 1024  /* about 100 seconds per round */
+#define TIMER_WHEEL_MIN_SEC 1
+
+static struct timer_wheel_t {
+    chassis_timer_t *slots[TIMER_WHEEL_SLOTS];
+    chassis_timer_t *expired;   /* being fired, entries cancelled meanwhile drop out */
+    gint64 last_tick;
+    guint count;
+    struct event tick;
+    struct event_base *base;
+    gboolean ticking;
+} wheel;
+
+static gint64
+timer_wheel_now(void)
+{
+    return g_get_monotonic_time() / TIMER_WHEEL_TICK_USEC;
+}
+
+static void
+timer_link(chassis_timer_t *timer, chassis_timer_t **list)
+{
+    timer->prev = NULL;
+    timer->next = *list;
+    if (*list) {
+        (*list)->prev = timer;
+    }
+    *list = timer;
+    timer->list = list;
+}
+
+static void
+timer_unlink(chassis_timer_t *timer)
+{
+    if (timer->prev) {
+        timer->prev->next = timer->next;
+    } else {
+        *timer->list = timer->next;
+    }
+    if (timer->next) {
+        timer->next->prev = timer->prev;
+    }
+    timer->prev = timer->next = NULL;
+    timer->list = NULL;
+}
+
+static void timer_wheel_tick(int fd, short what, void *arg);
+
+static void
+timer_wheel_schedule(void)
+{
+    struct timeval tv = { 0, TIMER_WHEEL_TICK_USEC };
+
+    evtimer_set(&wheel.tick, timer_wheel_tick, NULL);
+    event_base_set(wheel.base, &wheel.tick);
+    /* EV_PERSIST not work for libevent1.4, re-activate timer each time */
+    evtimer_add(&wheel.tick, &tv);
+    wheel.ticking = TRUE;
+}
+
+static void
+timer_fire(chassis_timer_t *timer)
+{
+    struct event *ev = timer->ev;
+
+    /* the event fired or was deleted since it was armed */
+    if (!event_pending(ev, EV_READ | EV_WRITE, NULL)) {
+        return;
+    }
+    event_callback_fn cb = event_get_callback(ev);
+    void *arg = event_get_callback_arg(ev);
+
+    event_del(ev);
+    cb(event_get_fd(ev), EV_TIMEOUT, arg);
+}
+
+static void
+timer_wheel_tick(int G_GNUC_UNUSED fd, short G_GNUC_UNUSED what, void G_GNUC_UNUSED *arg)
+{
+    gint64 now = timer_wheel_now();
+    gint64 tick = MAX(wheel.last_tick + 1, now - TIMER_WHEEL_SLOTS + 1);
+
+    wheel.ticking = FALSE;
+    for (; tick <= now; tick++) {
+        chassis_timer_t **slot = &wheel.slots[tick % TIMER_WHEEL_SLOTS];
+        chassis_timer_t *timer = *slot;
+
+        while (timer) {
+            chassis_timer_t *next = timer->next;
+            if (timer->expires > now) {
+                /* a later round, or moved by a lazy re-arm */
+                if (timer->expires % TIMER_WHEEL_SLOTS != tick % TIMER_WHEEL_SLOTS) {
+                    timer_unlink(timer);
+                    timer_link(timer, &wheel.slots[timer->expires % TIMER_WHEEL_SLOTS]);
+                }
+            } else {
+                timer_unlink(timer);
+                timer_link(timer, &wheel.expired);
+            }
+            timer = next;
+        }
+    }
+    wheel.last_tick = now;
+
+    /* callbacks may cancel or re-arm any entry, take them one by one */
+    while (wheel.expired) {
+        chassis_timer_t *timer = wheel.expired;
+        timer_unlink(timer);
+        wheel.count--;
+        timer_fire(timer);
+    }
+
+    if (wheel.count > 0 && !wheel.ticking) {
+        timer_wheel_schedule();
+    }
+}
+
+void
+chassis_event_add_with_timer(chassis *chas, struct event *ev, chassis_timer_t *timer, struct timeval *tv)
+{
+    gint64 expires;
+
+    /* short timeouts, pure timers and persistent events stay with libevent */
+    if (tv == NULL || tv->tv_sec < TIMER_WHEEL_MIN_SEC || !(ev->ev_events & (EV_READ | EV_WRITE))
+        || (ev->ev_events & EV_PERSIST)) {
+        chassis_timer_cancel(timer);
+        chassis_event_add_with_timeout(chas, ev, tv);
+        return;
+    }
+
+    chassis_event_add_with_timeout(chas, ev, NULL);
+
+    if (wheel.base == NULL) {
+        wheel.base = chas->event_base;
+        wheel.last_tick = timer_wheel_now();
+    }
+    expires = timer_wheel_now() + ((gint64)tv->tv_sec * G_USEC_PER_SEC + tv->tv_usec) / TIMER_WHEEL_TICK_USEC;
+    timer->ev = ev;
+    if (timer->list && timer->list != &wheel.expired) {
+        if (expires >= timer->expires) {
+            /* moved when its current slot comes up */
+            timer->expires = expires;
+            return;
+        }
+        timer_unlink(timer);
+    } else if (timer->list) {
+        timer_unlink(timer);
+    } else {
+        wheel.count++;
+    }
+    timer->expires = expires;
+    timer_link(timer, &wheel.slots[expires % TIMER_WHEEL_SLOTS]);
+
+    if (!wheel.ticking) {
+        timer_wheel_schedule();
+    }
+}
+
+void
+chassis_timer_cancel(chassis_timer_t *timer)
+{
+    if (timer->list) {
+        timer_unlink(timer);
+        wheel.count--;
+    }
+}
+
 chassis_event_loop_t *
 chassis_event_loop_new()
 {
     return event_base_new();
 }
 
+chassis_event_loop_t *
+chassis_event_loop_new_with_method(const char *method)
+{
+    if (!method || !*method) {
+        return chassis_event_loop_new();
+    }
+#if defined(LIBEVENT_VERSION_NUMBER) && LIBEVENT_VERSION_NUMBER >= 0x02000000
+    const char **methods = event_get_supported_methods();
+    gboolean supported = FALSE;
+    int i;
+
+    for (i = 0; methods && methods[i]; i++) {
+        if (strcmp(methods[i], method) == 0) {
+            supported = TRUE;
+        }
+    }
+    if (!supported) {
+        g_warning("%s:event method %s is not supported by libevent %s, use the default",
+                  G_STRLOC, method, event_get_version());
+        return chassis_event_loop_new();
+    }
+
+    struct event_config *config = event_config_new();
+    for (i = 0; methods[i]; i++) {
+        if (strcmp(methods[i], method) != 0) {
+            event_config_avoid_method(config, methods[i]);
+        }
+    }
+    struct event_base *base = event_base_new_with_config(config);
+    event_config_free(config);
+    if (base) {
+        return base;
+    }
+    g_warning("%s:event method %s failed to initialize, use the default", G_STRLOC, method);
+#else
+    g_warning("%s:libevent %s can't choose the event method, use the default", G_STRLOC, event_get_version());
+#endif
+    return chassis_event_loop_new();
+}
+
+const char *
+chassis_event_loop_method(chassis_event_loop_t *loop)
+{
+    return event_base_get_method(loop);
+}
+
 void
 chassis_event_loop_free(chassis_event_loop_t *event)
 {
+    if (wheel.base == event) {
+        if (wheel.ticking) {
+            evtimer_del(&wheel.tick);
+        }
+        memset(&wheel, 0, sizeof(wheel));
+    }
     event_base_free(event);
 }
 
+/* keeps EVLOOP_ONCE from blocking longer than a second, for the shutdown check */
+static void
+loop_shutdown_tick(int G_GNUC_UNUSED fd, short G_GNUC_UNUSED what, void *arg)
+{
+    struct timeval timeout = { 1, 0 };
+    evtimer_add((struct event *)arg, &timeout);
+}
+
 void *
 chassis_event_loop(chassis_event_loop_t *loop)
 {
+    return chassis_event_loop_with_flush(loop, NULL, NULL);
+}
+
+void *
+chassis_event_loop_with_flush(chassis_event_loop_t *loop, chassis_event_flush_func flush, void *data)
+{
+    struct event tick;
+
+    if (flush) {
+        evtimer_set(&tick, loop_shutdown_tick, &tick);
+        event_base_set(loop, &tick);
+        loop_shutdown_tick(-1, EV_TIMEOUT, &tick);
+    }
 
     /**
      * check once a second if we shall shutdown the proxy
@@ -97,16 +350,25 @@ chassis_event_loop(chassis_event_loop_t *loop)
         struct timeval timeout;
         int r;
 
-        timeout.tv_sec = 1;
-        timeout.tv_usec = 0;
+        if (flush) {
+            /* one pass over the ready events, then the end-of-iteration hook */
+            r = event_base_loop(loop, EVLOOP_ONCE);
+            if (r != -1) {
+                flush(data);
+                continue;
+            }
+        } else {
+            timeout.tv_sec = 1;
+            timeout.tv_usec = 0;
 
-        r = event_base_loopexit(loop, &timeout);
-        if (r == -1) {
-            g_critical("%s: leaving chassis_event_loop early. failed", G_STRLOC);
-            break;
-        }
+            r = event_base_loopexit(loop, &timeout);
+            if (r == -1) {
+                g_critical("%s: leaving chassis_event_loop early. failed", G_STRLOC);
+                break;
+            }
 
-        r = event_base_dispatch(loop);
+            r = event_base_dispatch(loop);
+        }
 
         if (r == -1) {
             if (errno == EINTR)
@@ -117,5 +379,305 @@ chassis_event_loop(chassis_event_loop_t *loop)
         }
     }
 
+    if (flush) {
+        evtimer_del(&tick);
+    }
     return NULL;
 }
+
+#define LOOP_LAG_INTERVAL_USEC (100 * 1000)
+#define LOOP_STATS_WINDOW_USEC (60 * G_USEC_PER_SEC)
+#define LOOP_HIST_BUCKETS 32
+#define LOOP_STACK_DEPTH 32
+#define LOOP_SAMPLE_SIGNAL SIGPROF
+
+typedef struct loop_histogram_t {
+    guint64 buckets[LOOP_HIST_BUCKETS];     /* bucket i counts durations below 2^i usec */
+    guint64 count;
+    guint64 max;
+} loop_histogram_t;
+
+static struct loop_monitor_t {
+    chassis *chas;
+    struct event lag_timer;
+    gboolean started;
+    gint64 window_start;
+    loop_histogram_t lag;
+    loop_histogram_t callback;
+    gint64 stall_usec;
+    int depth;                  /* nested callbacks only count once */
+
+    /* shared with the watchdog thread */
+    const char *volatile name;
+    const char *volatile state;
+    volatile gint64 start;      /* when the running callback began, 0 between callbacks */
+    volatile gint64 idle_since; /* end of the last callback */
+    volatile gint64 lag_expected;   /* when the lag timer should fire next */
+    volatile gint epoch;        /* bumped by every callback and every lag tick */
+    volatile gint running;
+    GThread *watchdog;
+    pthread_t loop_thread;
+    void *frames[LOOP_STACK_DEPTH];
+    volatile gint nframes;      /* -1 until the loop thread has taken the sample */
+} loop_monitor;
+
+static chassis_loop_stats_t loop_stats;
+
+chassis_loop_stats_t *
+chassis_event_loop_stats(void)
+{
+    return &loop_stats;
+}
+
+static void
+loop_histogram_add(loop_histogram_t *hist, gint64 usec)
+{
+    guint64 value = usec > 0 ? usec : 0;
+    int i = 0;
+
+    while (i < LOOP_HIST_BUCKETS - 1 && value >= ((guint64)1 << i)) {
+        i++;
+    }
+    hist->buckets[i]++;
+    hist->count++;
+    if (value > hist->max) {
+        hist->max = value;
+    }
+}
+
+static guint64
+loop_histogram_percentile(const loop_histogram_t *hist, double p)
+{
+    guint64 rank = (guint64)(hist->count * p);
+    guint64 seen = 0;
+    int i;
+
+    if (hist->count == 0) {
+        return 0;
+    }
+    for (i = 0; i < LOOP_HIST_BUCKETS; i++) {
+        seen += hist->buckets[i];
+        if (seen > rank) {
+            return MIN((guint64)1 << i, hist->max);
+        }
+    }
+    return hist->max;
+}
+
+static void
+loop_stats_rotate(gint64 now)
+{
+    loop_stats.lag_p50 = loop_histogram_percentile(&loop_monitor.lag, 0.5);
+    loop_stats.lag_p99 = loop_histogram_percentile(&loop_monitor.lag, 0.99);
+    loop_stats.lag_p999 = loop_histogram_percentile(&loop_monitor.lag, 0.999);
+    loop_stats.lag_max = loop_monitor.lag.max;
+    loop_stats.callback_p99 = loop_histogram_percentile(&loop_monitor.callback, 0.99);
+    loop_stats.callback_max = loop_monitor.callback.max;
+
+    memset(&loop_monitor.lag, 0, sizeof(loop_monitor.lag));
+    memset(&loop_monitor.callback, 0, sizeof(loop_monitor.callback));
+    loop_monitor.window_start = now;
+}
+
+static void
+loop_lag_timer_func(int fd, short what, void *arg)
+{
+    gint64 now = g_get_monotonic_time();
+    struct timeval interval = { 0, LOOP_LAG_INTERVAL_USEC };
+
+    loop_histogram_add(&loop_monitor.lag, now - loop_monitor.lag_expected);
+    if (now - loop_monitor.window_start >= LOOP_STATS_WINDOW_USEC) {
+        loop_stats_rotate(now);
+    }
+
+    loop_stats.wheel_timers = wheel.count;
+    loop_monitor.lag_expected = now + LOOP_LAG_INTERVAL_USEC;
+    g_atomic_int_inc(&loop_monitor.epoch);
+    /* EV_PERSIST not work for libevent1.4, re-activate timer each time */
+    chassis_event_add_with_timeout(loop_monitor.chas, &loop_monitor.lag_timer, &interval);
+}
+
+void
+chassis_event_callback_begin(const char *name)
+{
+    if (loop_monitor.depth++ > 0) {
+        return;
+    }
+    loop_monitor.name = name;
+    loop_monitor.state = NULL;
+    g_atomic_int_inc(&loop_monitor.epoch);
+    loop_monitor.start = g_get_monotonic_time();
+}
+
+void
+chassis_event_callback_state(const char *state)
+{
+    loop_monitor.state = state;
+}
+
+void
+chassis_event_callback_end(void)
+{
+    if (--loop_monitor.depth > 0) {
+        return;
+    }
+
+    gint64 now = g_get_monotonic_time();
+    gint64 used = now - loop_monitor.start;
+    loop_monitor.start = 0;
+    loop_monitor.idle_since = now;
+
+    loop_histogram_add(&loop_monitor.callback, used);
+    if (loop_monitor.stall_usec > 0 && used >= loop_monitor.stall_usec) {
+        loop_stats.stalls++;
+        g_warning("%s:event loop blocked %lld ms by %s in %s", G_STRLOC,
+                  (long long)(used / 1000), loop_monitor.name,
+                  loop_monitor.state ? loop_monitor.state : "-");
+    }
+}
+
+#ifdef HAVE_EXECINFO_H
+/* runs on the loop thread, backtrace() was called once before to load libgcc */
+static void
+loop_sample_handler(int sig)
+{
+    int saved_errno = errno;
+    g_atomic_int_set(&loop_monitor.nframes, backtrace(loop_monitor.frames, LOOP_STACK_DEPTH));
+    errno = saved_errno;
+}
+#endif
+
+static void
+loop_log_stall(const char *name, const char *state, gint64 blocked)
+{
+    GString *stack = g_string_new(NULL);
+#ifdef HAVE_EXECINFO_H
+    int i;
+
+    g_atomic_int_set(&loop_monitor.nframes, -1);
+    if (pthread_kill(loop_monitor.loop_thread, LOOP_SAMPLE_SIGNAL) == 0) {
+        for (i = 0; i < 100 && g_atomic_int_get(&loop_monitor.nframes) < 0; i++) {
+            g_usleep(1000);
+        }
+    }
+
+    int nframes = g_atomic_int_get(&loop_monitor.nframes);
+    if (nframes > 0) {
+        char **symbols = backtrace_symbols(loop_monitor.frames, nframes);
+        /* the first two frames are the signal handler and its trampoline */
+        for (i = 2; symbols && i < nframes; i++) {
+            g_string_append_printf(stack, "\n    #%d %s", i - 2, symbols[i]);
+        }
+        free(symbols);
+    }
+#endif
+    g_warning("%s:event loop blocked for %lld ms by %s in %s, stack:%s", G_STRLOC,
+              (long long)(blocked / 1000), name ? name : "an uninstrumented callback",
+              state ? state : "-", stack->len ? stack->str : " unavailable");
+    g_string_free(stack, TRUE);
+}
+
+static gpointer
+loop_watchdog_func(gpointer data)
+{
+    gint sampled_epoch = -1;
+    gulong interval = MAX(loop_monitor.stall_usec / 4, 10000);
+
+    while (g_atomic_int_get(&loop_monitor.running)) {
+        g_usleep(interval);
+
+        gint epoch = g_atomic_int_get(&loop_monitor.epoch);
+        if (epoch == sampled_epoch) {
+            continue;
+        }
+
+        /* between callbacks the loop is due at the next lag tick */
+        const char *name = NULL;
+        const char *state = NULL;
+        gint64 since = loop_monitor.start;
+        if (since) {
+            name = loop_monitor.name;
+            state = loop_monitor.state;
+        } else {
+            since = MAX(loop_monitor.lag_expected, loop_monitor.idle_since);
+        }
+
+        gint64 blocked = g_get_monotonic_time() - since;
+        if (blocked < loop_monitor.stall_usec) {
+            continue;
+        }
+
+        sampled_epoch = epoch;
+        loop_log_stall(name, state, blocked);
+    }
+    return NULL;
+}
+
+void
+chassis_event_loop_monitor_start(chassis *chas, int stall_msec)
+{
+    struct timeval interval = { 0, LOOP_LAG_INTERVAL_USEC };
+    gint64 now = g_get_monotonic_time();
+
+    loop_monitor.chas = chas;
+    loop_monitor.stall_usec = (gint64)MAX(stall_msec, 0) * 1000;
+    loop_monitor.window_start = now;
+    loop_monitor.idle_since = now;
+    loop_monitor.lag_expected = now + LOOP_LAG_INTERVAL_USEC;
+    loop_monitor.loop_thread = pthread_self();
+
+    evtimer_set(&loop_monitor.lag_timer, loop_lag_timer_func, NULL);
+    chassis_event_add_with_timeout(chas, &loop_monitor.lag_timer, &interval);
+    loop_monitor.started = TRUE;
+
+    if (loop_monitor.stall_usec == 0) {
+        return;
+    }
+    if (chas->disable_threads) {
+        g_message("%s:loop watchdog thread is disabled, stalls are logged without stack", G_STRLOC);
+        return;
+    }
+#ifdef HAVE_EXECINFO_H
+    struct sigaction sa;
+    void *frame;
+
+    backtrace(&frame, 1);
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = loop_sample_handler;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(LOOP_SAMPLE_SIGNAL, &sa, NULL);
+#endif
+
+    g_atomic_int_set(&loop_monitor.running, 1);
+#if !GLIB_CHECK_VERSION(2, 32, 0)
+    GError *error = NULL;
+    loop_monitor.watchdog = g_thread_create(loop_watchdog_func, NULL, TRUE, &error);
+    if (loop_monitor.watchdog == NULL && error != NULL) {
+        g_critical("Create thread error: %s", error->message);
+        g_error_free(error);
+    }
+#else
+    loop_monitor.watchdog = g_thread_new("loop-watchdog", loop_watchdog_func, NULL);
+    if (loop_monitor.watchdog == NULL) {
+        g_critical("Create thread error.");
+    }
+#endif
+}
+
+void
+chassis_event_loop_monitor_stop(void)
+{
+    if (loop_monitor.watchdog) {
+        g_atomic_int_set(&loop_monitor.running, 0);
+        g_thread_join(loop_monitor.watchdog);
+        loop_monitor.watchdog = NULL;
+#ifdef HAVE_EXECINFO_H
+        signal(LOOP_SAMPLE_SIGNAL, SIG_DFL);
+#endif
+    }
+    if (loop_monitor.started) {
+        evtimer_del(&loop_monitor.lag_timer);
+        loop_monitor.started = FALSE;
+    }
+}
@@ -35,11 +35,85 @@
 CHASSIS_API void chassis_event_add(chassis *chas, struct event *ev);
 CHASSIS_API void chassis_event_add_with_timeout(chassis *chas, struct event *ev, struct timeval *tv);
 
+/**
+ * entry of the timing wheel, lives next to the event it times out
+ *
+ * must be zeroed before first use and cancelled before it is freed
+ */
+typedef struct chassis_timer_t {
+    struct chassis_timer_t *prev;
+    struct chassis_timer_t *next;
+    struct chassis_timer_t **list;  /* slot it is linked into, NULL if not armed */
+    struct event *ev;
+    gint64 expires;             /* in wheel ticks */
+} chassis_timer_t;
+
+/**
+ * like chassis_event_add_with_timeout(), but timeouts of a second and more
+ * are kept in a coarse timing wheel instead of libevent's heap: the event
+ * is added without timeout and re-arming only moves the deadline, the
+ * entry is re-slotted when its old slot comes up. On expiry the event is
+ * deleted and its callback called with EV_TIMEOUT.
+ *
+ * every add of ev has to go through here for the entry to stay in sync
+ */
+CHASSIS_API void chassis_event_add_with_timer(chassis *chas, struct event *ev, chassis_timer_t *timer,
+                                              struct timeval *tv);
+CHASSIS_API void chassis_timer_cancel(chassis_timer_t *timer);
+
 typedef struct event_base chassis_event_loop_t;
 
 CHASSIS_API chassis_event_loop_t *chassis_event_loop_new();
+/**
+ * method is a libevent backend such as "epoll" or "poll", NULL or an
+ * unsupported one falls back to the default backend
+ */
+CHASSIS_API chassis_event_loop_t *chassis_event_loop_new_with_method(const char *method);
+CHASSIS_API const char *chassis_event_loop_method(chassis_event_loop_t *e);
 CHASSIS_API void chassis_event_loop_free(chassis_event_loop_t *e);
 CHASSIS_API void chassis_event_set_event_base(chassis_event_loop_t *e, struct event_base *event_base);
 CHASSIS_API void *chassis_event_loop(chassis_event_loop_t *);
 
+typedef void (*chassis_event_flush_func) (void *data);
+
+/**
+ * like chassis_event_loop(), but runs the ready events one iteration at a
+ * time and calls flush after each, so work queued by the callbacks, like
+ * partial writes, is done once per iteration
+ */
+CHASSIS_API void *chassis_event_loop_with_flush(chassis_event_loop_t *, chassis_event_flush_func flush, void *data);
+
+/**
+ * latency of the event loop, in microseconds
+ *
+ * lag is how late a 100ms timer fires, that is how long ready events wait
+ * for the loop. The percentiles cover the last full minute and are
+ * rounded up to a power of two.
+ */
+typedef struct chassis_loop_stats_t {
+    guint64 lag_p50;
+    guint64 lag_p99;
+    guint64 lag_p999;
+    guint64 lag_max;
+    guint64 callback_p99;       /* duration of the instrumented callbacks */
+    guint64 callback_max;
+    guint64 stalls;             /* callbacks over loop-stall-threshold since startup */
+    guint64 wheel_timers;       /* entries in the timing wheel, with ones whose event fired meanwhile */
+} chassis_loop_stats_t;
+
+CHASSIS_API chassis_loop_stats_t *chassis_event_loop_stats(void);
+
+/**
+ * start the lag timer and, unless threads are disabled, a watchdog thread
+ * that logs a backtrace of the loop once a callback runs longer than
+ * stall_msec. stall_msec 0 only keeps the statistics.
+ */
+CHASSIS_API void chassis_event_loop_monitor_start(chassis *chas, int stall_msec);
+CHASSIS_API void chassis_event_loop_monitor_stop(void);
+
+/* bracket a callback of the main loop, state may be updated as it goes */
+CHASSIS_API void chassis_event_callback_begin(const char *name);
+CHASSIS_API void chassis_event_callback_state(const char *state);
+CHASSIS_API void chassis_event_callback_end(void);
+
 #endif
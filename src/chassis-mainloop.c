@@ -46,6 +46,7 @@
 #include "chassis-plugin.h"
 #include "chassis-mainloop.h"
 #include "chassis-event.h"
+#include "chassis-uring.h"
 #include "chassis-log.h"
 #include "chassis-timings.h"
 
@@ -177,6 +178,10 @@ chassis_free(chassis *chas)
         g_free(chas->default_username);
     if (chas->default_hashed_pwd)
         g_free(chas->default_hashed_pwd);
+    g_free(chas->capture_dir);
+    g_free(chas->event_method);
+    g_free(chas->io_engine);
+    g_free(chas->spill_dir);
     if (chas->query_cache_table)
         g_hash_table_destroy(chas->query_cache_table);
     if (chas->cache_index)
@@ -247,6 +252,14 @@ sighup_handler(int G_GNUC_UNUSED fd, short G_GNUC_UNUSED event_type, void *_data
     g_message("re-opened log file after SIGHUP");
 }
 
+static void
+chassis_loop_flush(void *data)
+{
+    chassis *chas = data;
+
+    chas->priv_loop_flush(chas, chas->priv);
+}
+
 /**
  * forward libevent messages to the glib error log
  */
@@ -282,9 +295,18 @@ chassis_mainloop(void *_chas)
     event_set_log_callback(event_log_use_glib);
 
     /* add a event-handler for the "main" events */
-    chassis_event_loop_t *mainloop = chassis_event_loop_new();
+    chassis_event_loop_t *mainloop = chassis_event_loop_new_with_method(chas->event_method);
     chas->event_base = mainloop;
     g_assert(chas->event_base);
+    g_message("event method: %s", chassis_event_loop_method(mainloop));
+
+    /* after the fork of the workers, every process owns its ring */
+    if (chas->io_engine && strcmp(chas->io_engine, "io_uring") == 0) {
+        if (!chassis_uring_init(CHASSIS_URING_ENTRIES)) {
+            g_warning("%s: io_uring is not available, writes go through libevent", G_STRLOC);
+        }
+    }
+    g_message("io engine: %s", chassis_uring_enabled() ? "io_uring" : "libevent");
 
     /* setup all plugins */
     for (i = 0; i < chas->modules->len; i++) {
@@ -366,10 +388,19 @@ chassis_mainloop(void *_chas)
     }
 #endif
 
+    chassis_event_loop_monitor_start(chas, chas->loop_stall_threshold);
+
     /**
      * block until we are asked to shutdown
      */
-    chassis_event_loop(mainloop);
+    if (chas->priv_loop_flush) {
+        chassis_event_loop_with_flush(mainloop, chassis_loop_flush, chas);
+    } else {
+        chassis_event_loop(mainloop);
+    }
+
+    chassis_event_loop_monitor_stop();
+    chassis_uring_free();
 
     signal_del(&ev_sigterm);
     signal_del(&ev_sigint);
@@ -392,7 +423,7 @@ incremental_guid_get_next(struct incremental_guid_state_t *s)
     if (cur_time == s->last_sec) {
         s->seq_id = (s->seq_id + 1) & SEQ_MASK;
         if (s->seq_id == 0) {
-            s->rand_id = (s->rand_id + 1) & 0x3ff;
+            s->rand_id = (s->rand_id + 1) & 0xff;
             g_message("%s:rand id changed:%llu", G_STRLOC, (unsigned long long)s->rand_id);
         }
     } else {
@@ -418,7 +449,8 @@ incremental_guid_init(struct incremental_guid_state_t *s)
         s->worker_id = (int)((rand_r(&seed) / (RAND_MAX + 1.0)) * 64);
     }
 
-    s->rand_id = (int)((rand_r(&seed) / (RAND_MAX + 1.0)) * 1024);
+    /* 8 bits, so that it doesn't reach the worker id above it */
+    s->rand_id = (int)((rand_r(&seed) / (RAND_MAX + 1.0)) * 256);
     s->init_rand_id = s->rand_id;
     s->last_sec = time(0);
     s->seq_id = 0;
@@ -141,6 +141,7 @@ struct chassis {
     unsigned int min_req_time_for_cache;
     int cetus_max_allowed_packet;
     int disable_dns_cache;
+    int dns_cache_ttl;          /* seconds, re-resolve backend host names in the background, 0 disables */
 
     int max_alive_time;
     int max_resp_len;
@@ -160,6 +161,7 @@ struct chassis {
     void (*priv_shutdown) (chassis *chas, chassis_private *priv);
     void (*priv_finally_free_shared) (chassis *chas, chassis_private *priv);
     void (*priv_free) (chassis *chas, chassis_private *priv);
+    void (*priv_loop_flush) (chassis *chas, chassis_private *priv);    /* after each loop iteration */
 
     chassis_log *log;
 
@@ -175,6 +177,29 @@ struct chassis {
     GHashTable *query_cache_table;
     GQueue *cache_index;
     unsigned long long last_cache_purge_time;
+    struct row_cache_t *row_cache;  /* point lookups on sharding tables, NULL if disabled */
+    struct capture_t *capture;  /* client traffic capture, NULL if not capturing */
+    char *capture_dir;
+    guint64 capture_max_size;
+    gint64 merge_high_water;    /* stop reading shards above this much merged output, per connection */
+    gint64 merge_low_water;     /* resume reading shards below this */
+    gint64 merge_budget;        /* merged output of all connections, 0 for no limit */
+    gint64 merge_buffered;      /* merged output waiting for slow clients, all connections */
+    int merge_paused;           /* connections with shard reads paused */
+    gint64 spill_threshold;     /* spill a connection's cross-shard rows above this, 0 disables */
+    gint64 spill_global_threshold;  /* spill once cross-shard rows of all connections exceed this */
+    gint64 spill_max_size;      /* disk bytes for one shard response */
+    char *spill_dir;
+    gint64 spill_resident;      /* cross-shard rows held in memory, all connections */
+    guint64 spill_bytes;        /* bytes spilled since startup */
+    struct memory_stats_t *mem_stats;   /* memory of client connections */
+    guint64 mem_kill_threshold; /* close the largest connection above this, 0 disables */
+    int loop_stall_threshold;   /* msec, log a backtrace of callbacks running longer, 0 disables */
+    char *event_method;         /* libevent backend, NULL for its default */
+    char *io_engine;            /* "io_uring" batches the end of iteration writes, NULL for libevent */
+    int upgrade_drain_timeout;  /* sec, the old process closes the remaining clients after it */
+    struct cetus_workers_t *workers;    /* shared by the prefork workers, NULL with a single process */
+    int worker_index;
     gboolean allow_new_conns;
 };
 
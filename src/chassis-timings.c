@@ -25,6 +25,7 @@
 #include <glib.h>
 #include <time.h>
 #include <math.h>
+#include <string.h>
 
 #include "chassis-timings.h"
 #include "glib-ext.h"
@@ -53,6 +54,107 @@ chassis_epoch_from_string(const char *str, gboolean *ok)
     return 0;
 }
 
+static gint64
+days_from_civil(int y, int m, int d)
+{
+    y -= m <= 2;
+    int era = (y >= 0 ? y : y - 399) / 400;
+    int yoe = y - era * 400;    /* [0, 399] */
+    int doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;   /* [0, 365] */
+    int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;    /* [0, 146096] */
+    return (gint64)era * 146097 + doe - 719468;
+}
+
+gint64
+chassis_civil_to_seconds(int year, int month, int day, int hour, int min, int sec)
+{
+    return days_from_civil(year, month, day) * 86400 + hour * 3600 + min * 60 + sec;
+}
+
+static int
+days_in_month(int year, int month)
+{
+    static const int days[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+    if (month == 2 && (year % 4 == 0 && (year % 100 != 0 || year % 400 == 0)))
+        return 29;
+    return days[month - 1];
+}
+
+static const char *
+parse_digits(const char *p, int min_len, int max_len, int *out)
+{
+    int n = 0, len = 0;
+    while (len < max_len && p[len] >= '0' && p[len] <= '9') {
+        n = n * 10 + (p[len] - '0');
+        len++;
+    }
+    if (len < min_len)
+        return NULL;
+    *out = n;
+    return p + len;
+}
+
+gboolean
+chassis_datetime_parse(const char *str, gint64 *seconds)
+{
+    int year = 0, month = 0, day = 0, hour = 0, min = 0, sec = 0;
+    const char *p = str;
+    if (!p)
+        return FALSE;
+
+    size_t ndigits = strspn(p, "0123456789");
+    if (p[ndigits] == '\0' && (ndigits == 8 || ndigits == 14)) {
+        p = parse_digits(p, 4, 4, &year);
+        p = parse_digits(p, 2, 2, &month);
+        p = parse_digits(p, 2, 2, &day);
+        if (ndigits == 14) {
+            p = parse_digits(p, 2, 2, &hour);
+            p = parse_digits(p, 2, 2, &min);
+            p = parse_digits(p, 2, 2, &sec);
+        }
+    } else {
+        if (!(p = parse_digits(p, 4, 4, &year)) || *p++ != '-')
+            return FALSE;
+        if (!(p = parse_digits(p, 1, 2, &month)) || *p++ != '-')
+            return FALSE;
+        if (!(p = parse_digits(p, 1, 2, &day)))
+            return FALSE;
+        if (*p == ' ' || *p == 'T') {
+            p++;
+            if (!(p = parse_digits(p, 1, 2, &hour)) || *p++ != ':')
+                return FALSE;
+            if (!(p = parse_digits(p, 1, 2, &min)))
+                return FALSE;
+            if (*p == ':') {
+                if (!(p = parse_digits(p + 1, 1, 2, &sec)))
+                    return FALSE;
+                if (*p == '.') {    /* fractional seconds are truncated */
+                    p++;
+                    p += strspn(p, "0123456789");
+                }
+            }
+        }
+        if (*p != '\0')
+            return FALSE;
+    }
+    if (month < 1 || month > 12 || day < 1 || day > days_in_month(year, month)
+        || hour > 23 || min > 59 || sec > 59) {
+        return FALSE;
+    }
+    *seconds = chassis_civil_to_seconds(year, month, day, hour, min, sec);
+    return TRUE;
+}
+
+gint64
+chassis_datetime_now(void)
+{
+    time_t now = time(NULL);
+    struct tm t;
+    if (!localtime_r(&now, &t))
+        return now;
+    return chassis_civil_to_seconds(t.tm_year + 1900, t.tm_mon + 1, t.tm_mday, t.tm_hour, t.tm_min, t.tm_sec);
+}
+
 gboolean
 chassis_timeval_from_double(struct timeval *dst, double t)
 {
@@ -30,6 +30,16 @@
 #define HOURS ( 60 * MINUTES)
 
 CHASSIS_API int chassis_epoch_from_string(const char *str, gboolean *ok);
+
+/**
+ * fixed-format parser for 'YYYY-MM-DD[ HH:MM[:SS[.frac]]]' ('T' also separates
+ * date and time) and the compact 'YYYYMMDD[HHMMSS]', no locale or timezone
+ * involved, the result is the wall clock time counted in seconds from 1970-01-01
+ */
+CHASSIS_API gboolean chassis_datetime_parse(const char *str, gint64 *seconds);
+CHASSIS_API gint64 chassis_civil_to_seconds(int year, int month, int day, int hour, int min, int sec);
+/* current local wall clock time in the unit of chassis_datetime_parse() */
+CHASSIS_API gint64 chassis_datetime_now(void);
 CHASSIS_API gboolean chassis_timeval_from_double(struct timeval *dst, double t);
 void chassis_epoch_to_string(time_t *epoch, char *str, int len);
 
@@ -36,8 +36,12 @@
 #include <unistd.h>
 #endif
 #include <errno.h>
+#include <fcntl.h>
 #include <signal.h>
 #include <sys/wait.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
 
 #include <glib.h>
 
@@ -86,6 +90,47 @@ chassis_unix_signal_forward(int sig)
     kill(0, sig);
 }
 
+/* message on the angel pipe, written at once, smaller than PIPE_BUF */
+struct angel_report_t {
+    pid_t from;
+    pid_t successor;
+};
+
+int
+chassis_unix_angel_fd(void)
+{
+    const char *env = g_getenv(CHASSIS_ANGEL_FD_ENV);
+    int fd = env ? atoi(env) : -1;
+
+    return fd > 2 ? fd : -1;
+}
+
+void
+chassis_unix_report_successor(pid_t successor)
+{
+    struct angel_report_t report = { getpid(), successor };
+    int fd = chassis_unix_angel_fd();
+
+    if (fd == -1) {
+        return;
+    }
+    if (write(fd, &report, sizeof(report)) != sizeof(report)) {
+        g_warning("%s: reporting PID=%d to the angel failed: %s (%d)", G_STRLOC, successor, g_strerror(errno), errno);
+    }
+}
+
+/* the successor the process from reported, 0 if none */
+static pid_t
+angel_read_successor(int fd, GHashTable *successors, pid_t from)
+{
+    struct angel_report_t report;
+
+    while (read(fd, &report, sizeof(report)) == sizeof(report)) {
+        g_hash_table_insert(successors, GINT_TO_POINTER(report.from), GINT_TO_POINTER(report.successor));
+    }
+    return GPOINTER_TO_INT(g_hash_table_lookup(successors, GINT_TO_POINTER(from)));
+}
+
 /**
  * keep the ourself alive 
  *
@@ -97,6 +142,9 @@ chassis_unix_proc_keepalive(int *child_exit_status)
 {
     int nprocs = 0;
     pid_t child_pid = -1;
+    gboolean adopted = FALSE;   /* child_pid was started by an upgrade, not by us */
+    int report_pipe[2] = { -1, -1 };
+    GHashTable *successors = g_hash_table_new(g_direct_hash, g_direct_equal);
 
     /* 
      * we ignore SIGINT and SIGTERM and 
@@ -106,6 +154,25 @@ chassis_unix_proc_keepalive(int *child_exit_status)
      * the child will have to set its own signal handlers for this
      */
 
+#ifdef PR_SET_CHILD_SUBREAPER
+    /* a process started by an upgrade is re-parented to us when the old one exits */
+    if (prctl(PR_SET_CHILD_SUBREAPER, 1, 0, 0, 0) != 0) {
+        g_warning("%s: prctl(PR_SET_CHILD_SUBREAPER) failed: %s (%d)", G_STRLOC, g_strerror(errno), errno);
+    }
+
+    /* the children report the PID of their upgrade here, before they exit */
+    if (pipe(report_pipe) == 0) {
+        char fd_str[16];
+
+        fcntl(report_pipe[0], F_SETFL, O_NONBLOCK);
+        fcntl(report_pipe[0], F_SETFD, FD_CLOEXEC);
+        snprintf(fd_str, sizeof(fd_str), "%d", report_pipe[1]);
+        g_setenv(CHASSIS_ANGEL_FD_ENV, fd_str, TRUE);
+    } else {
+        g_warning("%s: pipe() failed: %s (%d)", G_STRLOC, g_strerror(errno), errno);
+    }
+#endif
+
     for (;;) {
         /* try to start the children */
         while (nprocs < 1) {
@@ -115,12 +182,17 @@ chassis_unix_proc_keepalive(int *child_exit_status)
                 /* child */
 
                 g_debug("%s: we are the child: %d, nprocs:%d", G_STRLOC, getpid(), nprocs);
+                if (report_pipe[0] != -1) {
+                    close(report_pipe[0]);
+                }
+                g_hash_table_destroy(successors);
                 return 0;
             } else if (pid < 0) {
                 /* fork() failed */
 
                 g_critical("%s: fork() failed: %s (%d), nprocs:%d", G_STRLOC, g_strerror(errno), errno, nprocs);
 
+                g_hash_table_destroy(successors);
                 return -1;
             } else {
                 /* we are the angel, let's see what the child did */
@@ -134,6 +206,7 @@ chassis_unix_proc_keepalive(int *child_exit_status)
                 signal(SIGUSR2, chassis_unix_signal_forward);
 
                 child_pid = pid;
+                adopted = FALSE;
                 nprocs++;
             }
         }
@@ -162,6 +235,34 @@ chassis_unix_proc_keepalive(int *child_exit_status)
                         *child_exit_status = WEXITSTATUS(exit_status);
                     }
 
+                    if (WEXITSTATUS(exit_status) == CHASSIS_EXIT_UPGRADED) {
+#ifdef PR_SET_CHILD_SUBREAPER
+                        /* the successor is re-parented to us by now */
+                        pid_t successor = report_pipe[0] != -1 ?
+                            angel_read_successor(report_pipe[0], successors, child_pid) : 0;
+
+                        g_hash_table_remove(successors, GINT_TO_POINTER(child_pid));
+                        if (successor > 0) {
+                            g_message("%s: PID=%d handed over to PID=%d, keep that one alive",
+                                      G_STRLOC, child_pid, successor);
+                            child_pid = successor;
+                            adopted = TRUE;
+                            continue;
+                        }
+                        g_critical("%s: PID=%d handed over to an unknown process, restart", G_STRLOC, child_pid);
+                        nprocs--;
+                        child_pid = -1;
+                        continue;
+#else
+                        /* the new process is not our child, nothing left to watch */
+                        if (child_exit_status) {
+                            *child_exit_status = EXIT_SUCCESS;
+                        }
+                        g_hash_table_destroy(successors);
+                        return 1;
+#endif
+                    }
+
                     if (WEXITSTATUS(exit_status) != EXIT_SUCCESS && WEXITSTATUS(exit_status) != EXIT_FAILURE) {
                         int time_towait = 2;
                         signal(SIGINT, SIG_DFL);
@@ -171,10 +272,9 @@ chassis_unix_proc_keepalive(int *child_exit_status)
                             time_towait = sleep(time_towait);
                         nprocs--;
                         child_pid = -1;
-                    } else {
-                        return 1;
                     }
 
+                    g_hash_table_destroy(successors);
                     return 1;
                 } else if (WIFSIGNALED(exit_status)) {
                     int time_towait = 2;
@@ -204,10 +304,16 @@ chassis_unix_proc_keepalive(int *child_exit_status)
                 }
             } else if (-1 == exit_pid) {
                 /* EINTR is ok, all others bad */
-                if (EINTR != errno) {
+                if (ECHILD == errno && adopted) {
+                    /* the successor died while its predecessor drained, and that one reaped it */
+                    g_critical("%s: PID=%d exited before it was handed to us, restart", G_STRLOC, child_pid);
+                    nprocs--;
+                    child_pid = -1;
+                } else if (EINTR != errno) {
                     /* how can this happen ? */
                     g_critical("%s: wait4(%d, ...) failed: %s (%d)", G_STRLOC, child_pid, g_strerror(errno), errno);
 
+                    g_hash_table_destroy(successors);
                     return -1;
                 }
             } else {
@@ -216,3 +322,119 @@ chassis_unix_proc_keepalive(int *child_exit_status)
         }
     }
 }
+
+/**
+ * keep nworkers children alive, each is restarted on its own
+ *
+ * a worker exiting with EXIT_SUCCESS or EXIT_FAILURE stops the others too
+ *
+ * @return 0 in a worker with *worker set, 1 when all workers stopped, -1 on error
+ */
+int
+chassis_unix_proc_workers(int nworkers, int *worker, int *child_exit_status)
+{
+    pid_t *pids = g_new0(pid_t, nworkers);
+    int alive = 0;
+    gboolean stopping = FALSE;
+    int i;
+
+    signal(SIGINT, chassis_unix_signal_forward);
+    signal(SIGTERM, chassis_unix_signal_forward);
+    signal(SIGHUP, chassis_unix_signal_forward);
+    signal(SIGUSR1, chassis_unix_signal_forward);
+    signal(SIGUSR2, chassis_unix_signal_forward);
+
+    for (;;) {
+        struct rusage rusage;
+        int exit_status;
+        pid_t exit_pid;
+
+        for (i = 0; i < nworkers && !stopping; i++) {
+            pid_t pid;
+
+            if (pids[i] != 0) {
+                continue;
+            }
+            pid = fork();
+            if (pid == 0) {
+                /* the worker sets up its own handlers */
+                signal(SIGINT, SIG_DFL);
+                signal(SIGTERM, SIG_DFL);
+                signal(SIGHUP, SIG_DFL);
+                signal(SIGUSR1, SIG_DFL);
+                signal(SIGUSR2, SIG_DFL);
+                g_free(pids);
+                *worker = i;
+                return 0;
+            } else if (pid < 0) {
+                g_critical("%s: fork() failed: %s (%d)", G_STRLOC, g_strerror(errno), errno);
+                if (alive == 0) {
+                    g_free(pids);
+                    return -1;
+                }
+                break;
+            }
+            g_message("%s: [master] started worker %d, PID=%d", G_STRLOC, i, pid);
+            pids[i] = pid;
+            alive++;
+        }
+
+        if (alive == 0) {
+            g_free(pids);
+            return 1;
+        }
+
+#ifdef HAVE_WAIT4
+        exit_pid = wait4(-1, &exit_status, 0, &rusage);
+#else
+        memset(&rusage, 0, sizeof(rusage));
+        exit_pid = waitpid(-1, &exit_status, 0);
+#endif
+        if (exit_pid == -1) {
+            /* EINTR is ok, all others bad */
+            if (EINTR != errno) {
+                g_critical("%s: wait4(-1, ...) failed: %s (%d)", G_STRLOC, g_strerror(errno), errno);
+                g_free(pids);
+                return -1;
+            }
+            continue;
+        }
+
+        for (i = 0; i < nworkers && pids[i] != exit_pid; i++) ;
+        if (i == nworkers) {
+            continue;
+        }
+        pids[i] = 0;
+        alive--;
+
+        if (WIFEXITED(exit_status)) {
+            g_message("%s: worker %d PID=%d exited with %d (%ld kBytes max)",
+                      G_STRLOC, i, exit_pid, WEXITSTATUS(exit_status), rusage.ru_maxrss / 1024);
+            if (WEXITSTATUS(exit_status) == EXIT_SUCCESS || WEXITSTATUS(exit_status) == EXIT_FAILURE) {
+                if (child_exit_status && !stopping) {
+                    *child_exit_status = WEXITSTATUS(exit_status);
+                }
+                if (!stopping) {
+                    int j;
+                    stopping = TRUE;
+                    for (j = 0; j < nworkers; j++) {
+                        if (pids[j] != 0) {
+                            kill(pids[j], SIGTERM);
+                        }
+                    }
+                }
+                continue;
+            }
+        } else if (WIFSIGNALED(exit_status)) {
+            g_critical("%s: worker %d PID=%d died on signal=%d (%ld kBytes max)",
+                       G_STRLOC, i, exit_pid, WTERMSIG(exit_status), rusage.ru_maxrss / 1024);
+        }
+
+        if (!stopping) {
+            /* to make sure we don't loop as fast as we can, sleep a bit between restarts */
+            int time_towait = 2;
+            while (time_towait > 0)
+                time_towait = sleep(time_towait);
+        }
+    }
+}
@@ -21,7 +21,21 @@
 #ifndef __CHASSIS_UNIX_DAEMON_H__
 #define __CHASSIS_UNIX_DAEMON_H__
 
+/* exit code of a process that handed its listen sockets to an upgraded one */
+#define CHASSIS_EXIT_UPGRADED 64
+
+#include <sys/types.h>
+
+/* write end of the pipe the keepalive angel reads upgrade successors from */
+#define CHASSIS_ANGEL_FD_ENV "CETUS_ANGEL_FD"
+
 int chassis_unix_proc_keepalive(int *child_exit_status);
+
+/* the pipe to the angel, -1 without one, kept open across an upgrade */
+int chassis_unix_angel_fd(void);
+/* tell the angel that successor takes over from this process */
+void chassis_unix_report_successor(pid_t successor);
+int chassis_unix_proc_workers(int nworkers, int *worker, int *child_exit_status);
 void chassis_unix_daemonize(void);
 
 #endif
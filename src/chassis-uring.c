@@ -0,0 +1,294 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#include <glib.h>
+#include <errno.h>
+#include <string.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#include "chassis-uring.h"
+
+#ifdef HAVE_LINUX_IO_URING_H
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+/* IORING_FEAT_CQE_SKIP marks 5.17, where MSG_DONTWAIT sends never go async */
+#if defined(HAVE_LINUX_IO_URING_H) && defined(__NR_io_uring_setup) && defined(IORING_FEAT_CQE_SKIP) \
+    && defined(IO_URING_OP_SUPPORTED)
+#define CHASSIS_URING_SUPPORTED 1
+#endif
+
+#ifdef CHASSIS_URING_SUPPORTED
+
+static struct {
+    int fd;
+    unsigned int entries;
+    unsigned int *sq_head;
+    unsigned int *sq_tail;
+    unsigned int *sq_mask;
+    unsigned int *sq_array;
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;              /* same as sq_ring with IORING_FEAT_SINGLE_MMAP */
+    size_t cq_ring_size;
+    size_t sqes_size;
+} ring = {.fd = -1 };
+
+static gboolean
+uring_probe_sendmsg(int fd)
+{
+    size_t len = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = g_malloc0(len);
+    gboolean ok = FALSE;
+
+    if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) == 0) {
+        ok = probe->last_op >= IORING_OP_SENDMSG && (probe->ops[IORING_OP_SENDMSG].flags & IO_URING_OP_SUPPORTED);
+    }
+    g_free(probe);
+    return ok;
+}
+
+static void
+uring_unmap(void)
+{
+    if (ring.sqes) {
+        munmap(ring.sqes, ring.sqes_size);
+    }
+    if (ring.cq_ring && ring.cq_ring != ring.sq_ring) {
+        munmap(ring.cq_ring, ring.cq_ring_size);
+    }
+    if (ring.sq_ring) {
+        munmap(ring.sq_ring, ring.sq_ring_size);
+    }
+    if (ring.fd != -1) {
+        close(ring.fd);
+    }
+    memset(&ring, 0, sizeof(ring));
+    ring.fd = -1;
+}
+
+gboolean
+chassis_uring_init(unsigned int entries)
+{
+    struct io_uring_params p;
+
+    if (ring.fd != -1) {
+        return TRUE;
+    }
+    memset(&p, 0, sizeof(p));
+    int fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (fd < 0) {
+        g_warning("%s: io_uring_setup failed: %s", G_STRLOC, g_strerror(errno));
+        return FALSE;
+    }
+    ring.fd = fd;
+    if (!(p.features & IORING_FEAT_CQE_SKIP) || !uring_probe_sendmsg(fd)) {
+        g_warning("%s: io_uring of this kernel is too old for the send engine", G_STRLOC);
+        uring_unmap();
+        return FALSE;
+    }
+
+    ring.sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    ring.cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        ring.sq_ring_size = MAX(ring.sq_ring_size, ring.cq_ring_size);
+        ring.cq_ring_size = ring.sq_ring_size;
+    }
+    ring.sq_ring = mmap(NULL, ring.sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        fd, IORING_OFF_SQ_RING);
+    if (ring.sq_ring == MAP_FAILED) {
+        ring.sq_ring = NULL;
+        goto failed;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        ring.cq_ring = ring.sq_ring;
+    } else {
+        ring.cq_ring = mmap(NULL, ring.cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                            fd, IORING_OFF_CQ_RING);
+        if (ring.cq_ring == MAP_FAILED) {
+            ring.cq_ring = NULL;
+            goto failed;
+        }
+    }
+    ring.sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring.sqes = mmap(NULL, ring.sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (ring.sqes == MAP_FAILED) {
+        ring.sqes = NULL;
+        goto failed;
+    }
+
+    char *sq = ring.sq_ring;
+    char *cq = ring.cq_ring;
+    ring.entries = p.sq_entries;
+    ring.sq_head = (unsigned int *)(sq + p.sq_off.head);
+    ring.sq_tail = (unsigned int *)(sq + p.sq_off.tail);
+    ring.sq_mask = (unsigned int *)(sq + p.sq_off.ring_mask);
+    ring.sq_array = (unsigned int *)(sq + p.sq_off.array);
+    ring.cq_head = (unsigned int *)(cq + p.cq_off.head);
+    ring.cq_tail = (unsigned int *)(cq + p.cq_off.tail);
+    ring.cq_mask = (unsigned int *)(cq + p.cq_off.ring_mask);
+    ring.cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return TRUE;
+
+  failed:
+    g_warning("%s: mmap of io_uring failed: %s", G_STRLOC, g_strerror(errno));
+    uring_unmap();
+    return FALSE;
+}
+
+void
+chassis_uring_free(void)
+{
+    if (ring.fd != -1) {
+        uring_unmap();
+    }
+}
+
+gboolean
+chassis_uring_enabled(void)
+{
+    return ring.fd != -1;
+}
+
+static guint
+uring_reap(gssize *results, guint n)
+{
+    unsigned int head = *ring.cq_head;  /* only this thread consumes */
+    unsigned int tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+    guint done = 0;
+
+    for (; head != tail; head++) {
+        struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cq_mask];
+        if (cqe->user_data < n) {
+            results[cqe->user_data] = cqe->res;
+            done++;
+        }
+    }
+    __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+    return done;
+}
+
+/* submit and reap n <= ring.entries sends */
+static gboolean
+uring_sendmsg_round(const int *fds, struct msghdr *msgs, const int *flags, gssize *results, guint n)
+{
+    unsigned int tail = *ring.sq_tail;  /* only this thread produces */
+    unsigned int mask = *ring.sq_mask;
+    guint i;
+
+    for (i = 0; i < n; i++) {
+        results[i] = -EAGAIN;   /* left like this if the ring fails, the data stays queued */
+        unsigned int idx = tail & mask;
+        struct io_uring_sqe *sqe = &ring.sqes[idx];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = fds[i];
+        sqe->addr = (unsigned long)&msgs[i];
+        sqe->len = 1;
+        sqe->msg_flags = MSG_DONTWAIT | MSG_NOSIGNAL | flags[i];
+        sqe->user_data = i;
+        ring.sq_array[idx] = idx;
+        tail++;
+    }
+    __atomic_store_n(ring.sq_tail, tail, __ATOMIC_RELEASE);
+
+    guint done = 0;
+    guint submitted = 0;
+    while (done < n) {
+        int r = syscall(__NR_io_uring_enter, ring.fd, n - submitted, n - done, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (r < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            g_critical("%s: io_uring_enter failed: %s", G_STRLOC, g_strerror(errno));
+            uring_reap(results, n);
+            return FALSE;
+        }
+        submitted += r;
+        done += uring_reap(results, n);
+    }
+    return TRUE;
+}
+
+gboolean
+chassis_uring_sendmsg_batch(const int *fds, struct msghdr *msgs, const int *flags, gssize *results, guint n)
+{
+    guint i, count;
+
+    for (i = 0; i < n; i += count) {
+        if (ring.fd == -1) {
+            results[i] = -EAGAIN;
+            count = 1;
+            continue;
+        }
+        count = MIN(n - i, ring.entries);
+        if (!uring_sendmsg_round(fds + i, msgs + i, flags + i, results + i, count)) {
+            uring_unmap();      /* writev() from now on */
+        }
+    }
+    return ring.fd != -1;
+}
+
+#else
+
+gboolean
+chassis_uring_init(unsigned int G_GNUC_UNUSED entries)
+{
+    g_warning("%s: built without io_uring support", G_STRLOC);
+    return FALSE;
+}
+
+void
+chassis_uring_free(void)
+{
+}
+
+gboolean
+chassis_uring_enabled(void)
+{
+    return FALSE;
+}
+
+gboolean
+chassis_uring_sendmsg_batch(const int G_GNUC_UNUSED *fds, struct msghdr G_GNUC_UNUSED *msgs,
+                            const int G_GNUC_UNUSED *flags, gssize *results, guint n)
+{
+    guint i;
+    for (i = 0; i < n; i++) {
+        results[i] = -EAGAIN;
+    }
+    return FALSE;
+}
+
+#endif
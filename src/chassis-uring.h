@@ -0,0 +1,58 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#ifndef _CHASSIS_URING_H_
+#define _CHASSIS_URING_H_
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <glib.h>
+
+#include "chassis-exports.h"
+
+/**
+ * io_uring engine for the sends of the event loop thread
+ *
+ * The loop stays readiness driven (libevent), the engine only batches the
+ * writes done at the end of a loop iteration into one io_uring_enter().
+ * Sends are submitted with MSG_DONTWAIT so each completes inline with the
+ * same result a sendmsg() would give, nothing stays in flight afterwards.
+ * Needs Linux 5.17 or later, otherwise init fails and writes go through
+ * writev() as before.
+ */
+
+#define CHASSIS_URING_ENTRIES 256
+
+CHASSIS_API gboolean chassis_uring_init(unsigned int entries);
+CHASSIS_API void chassis_uring_free(void);
+CHASSIS_API gboolean chassis_uring_enabled(void);
+
+/**
+ * sendmsg() on n sockets with one system call
+ *
+ * @param flags    added to MSG_DONTWAIT, per socket
+ * @param results  bytes sent, or -errno like sendmsg() would set; -EAGAIN
+ *                 for sends not done because the ring failed
+ * @return FALSE if the engine is off, it is turned off when the ring fails
+ */
+CHASSIS_API gboolean chassis_uring_sendmsg_batch(const int *fds, struct msghdr *msgs, const int *flags,
+                                                 gssize *results, guint n);
+
+#endif /* _CHASSIS_URING_H_ */
@@ -39,6 +39,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <time.h>
 #include <malloc.h>
 
 #include <unistd.h>
@@ -75,7 +76,17 @@
 #include "chassis-unix-daemon.h"
 #include "chassis-frontend.h"
 #include "chassis-options.h"
+#include "cetus-ddl-job.h"
 #include "cetus-monitor.h"
+#include "cetus-row-cache.h"
+#include "cetus-capture.h"
+#include "cetus-memory.h"
+#include "cetus-resolver.h"
+#include "cetus-upgrade.h"
+#include "cetus-workers.h"
+#include "cetus-symbol.h"
+#include "cetus-sequence.h"
+#include "cetus-util.h"
 
 #define GETTEXT_PACKAGE "cetus"
 
@@ -108,13 +119,31 @@ struct chassis_frontend_t {
     int cetus_max_allowed_packet;
     int default_query_cache_timeout;
     int query_cache_enabled;
+    int row_cache_size;
+    int row_cache_timeout;
+    int capture_max_size;
+    int capture_enabled;
+    int merge_high_water;
+    int merge_low_water;
+    int merge_budget;
+    int spill_threshold;
+    int spill_global_threshold;
+    int spill_max_size;
+    int mem_kill_threshold;
+    int loop_stall_threshold;
+    char *event_method;
+    char *io_engine;
     int disable_dns_cache;
+    int dns_cache_ttl;
+    int upgrade_drain_timeout;
     double slave_delay_down_threshold_sec;
     double slave_delay_recover_threshold_sec;
 
     guint invoke_dbg_on_crash;
     /* the --keepalive option isn't available on Unix */
     guint auto_restart;
+    int worker_processes;
+    int worker_cpu_affinity;
     gint max_files_number;
 
     gchar *user;
@@ -141,6 +170,8 @@ struct chassis_frontend_t {
     char *default_db;
 
     char *remote_config_url;
+    char *capture_dir;
+    char *spill_dir;
 };
 
 /**
@@ -167,9 +198,15 @@ chassis_frontend_new(void)
 
     frontend->slave_delay_down_threshold_sec = 60.0;
     frontend->default_query_cache_timeout = 100;
+    frontend->row_cache_timeout = 1000;
+    frontend->capture_max_size = 1024;
+    frontend->merge_high_water = 4096;
+    frontend->merge_low_water = 1024;
+    frontend->spill_max_size = 4096;
     frontend->long_query_time = MAX_QUERY_TIME;
     frontend->cetus_max_allowed_packet = MAX_ALLOWED_PACKET_DEFAULT;
     frontend->disable_dns_cache = 0;
+    frontend->upgrade_drain_timeout = 300;
     return frontend;
 }
 
@@ -203,6 +240,10 @@ chassis_frontend_free(struct chassis_frontend_t *frontend)
     }
 
     g_free(frontend->remote_config_url);
+    g_free(frontend->capture_dir);
+    g_free(frontend->event_method);
+    g_free(frontend->io_engine);
+    g_free(frontend->spill_dir);
 
     g_slice_free(struct chassis_frontend_t, frontend);
 }
@@ -268,6 +309,16 @@ chassis_frontend_set_chassis_options(struct chassis_frontend_t *frontend, chassi
                         0, 0, OPTION_ARG_NONE, &(frontend->auto_restart),
                         "Try to restart the proxy if it crashed", NULL);
 
+    chassis_options_add(opts,
+                        "worker-processes",
+                        0, 0, OPTION_ARG_INT, &(frontend->worker_processes),
+                        "Number of worker processes sharing the proxy port, restarted on crash", "<integer>");
+
+    chassis_options_add(opts,
+                        "worker-cpu-affinity",
+                        0, 0, OPTION_ARG_NONE, &(frontend->worker_cpu_affinity),
+                        "Pin each worker process to its own CPU", NULL);
+
     chassis_options_add(opts,
                         "max-open-files",
                         0, 0, OPTION_ARG_INT, &(frontend->max_files_number),
@@ -372,8 +423,92 @@ chassis_frontend_set_chassis_options(struct chassis_frontend_t *frontend, chassi
 
     chassis_options_add(opts, "enable-query-cache", 0, 0, OPTION_ARG_NONE, &(frontend->query_cache_enabled), "", NULL);
 
+    chassis_options_add(opts,
+                        "row-cache-size",
+                        0, 0, OPTION_ARG_INT, &(frontend->row_cache_size),
+                        "Memory in MB for caching point lookups on sharding key, 0 disables", "<integer>");
+
+    chassis_options_add(opts,
+                        "row-cache-timeout",
+                        0, 0, OPTION_ARG_INT, &(frontend->row_cache_timeout),
+                        "row cache timeout in ms", "<integer>");
+
+    chassis_options_add(opts,
+                        "capture-dir",
+                        0, 0, OPTION_ARG_STRING, &(frontend->capture_dir),
+                        "Directory for client traffic captures", "<path>");
+
+    chassis_options_add(opts,
+                        "capture-max-size",
+                        0, 0, OPTION_ARG_INT, &(frontend->capture_max_size),
+                        "Stop a capture after this many MB, 0 for no limit", "<integer>");
+
+    chassis_options_add(opts,
+                        "enable-capture",
+                        0, 0, OPTION_ARG_NONE, &(frontend->capture_enabled),
+                        "Capture client traffic from startup", NULL);
+
     chassis_options_add(opts, "enable-tcp-stream", 0, 0, OPTION_ARG_NONE, &(frontend->is_tcp_stream_enabled), "", NULL);
 
+    chassis_options_add(opts,
+                        "merge-buffer-high-water",
+                        0, 0, OPTION_ARG_INT, &(frontend->merge_high_water),
+                        "Stop reading shards when a client has this many KB of streamed result unread, 0 disables",
+                        "<integer>");
+
+    chassis_options_add(opts,
+                        "merge-buffer-low-water",
+                        0, 0, OPTION_ARG_INT, &(frontend->merge_low_water),
+                        "Resume reading shards when the unread streamed result drops to this many KB", "<integer>");
+
+    chassis_options_add(opts,
+                        "merge-buffer-budget",
+                        0, 0, OPTION_ARG_INT, &(frontend->merge_budget),
+                        "Memory in MB for unread streamed results of all clients, 0 for no limit", "<integer>");
+
+    chassis_options_add(opts,
+                        "merge-spill-dir",
+                        0, 0, OPTION_ARG_STRING, &(frontend->spill_dir),
+                        "Directory for spilled cross-shard rows, the system temp dir by default", "<path>");
+
+    chassis_options_add(opts,
+                        "merge-spill-threshold",
+                        0, 0, OPTION_ARG_INT, &(frontend->spill_threshold),
+                        "Spill cross-shard rows of a connection to disk above this many MB, 0 disables", "<integer>");
+
+    chassis_options_add(opts,
+                        "merge-spill-global-threshold",
+                        0, 0, OPTION_ARG_INT, &(frontend->spill_global_threshold),
+                        "Spill cross-shard rows once all connections hold this many MB, 0 disables", "<integer>");
+
+    chassis_options_add(opts,
+                        "merge-spill-max-size",
+                        0, 0, OPTION_ARG_INT, &(frontend->spill_max_size),
+                        "Fail a shard response after spilling this many MB, 0 for no limit", "<integer>");
+
+    chassis_options_add(opts,
+                        "memory-kill-threshold",
+                        0, 0, OPTION_ARG_INT, &(frontend->mem_kill_threshold),
+                        "Close the connection holding most memory while all connections hold more than this many MB, 0 disables",
+                        "<integer>");
+
+    chassis_options_add(opts,
+                        "loop-stall-threshold",
+                        0, 0, OPTION_ARG_INT, &(frontend->loop_stall_threshold),
+                        "Log a backtrace when the event loop is blocked longer than this many ms, 0 disables",
+                        "<integer>");
+
+    chassis_options_add(opts,
+                        "event-method",
+                        0, 0, OPTION_ARG_STRING, &(frontend->event_method),
+                        "Event notification backend of libevent, such as epoll or poll", "<string>");
+
+    chassis_options_add(opts,
+                        "io-engine",
+                        0, 0, OPTION_ARG_STRING, &(frontend->io_engine),
+                        "Engine of the writes at the end of each loop iteration, libevent (default) or io_uring (experimental)",
+                        "<string>");
+
     chassis_options_add(opts,
                         "log-xa-in-detail",
                         0, 0, OPTION_ARG_NONE, &(frontend->xa_log_detailed), "log xa in detail", NULL);
@@ -381,7 +516,19 @@ chassis_frontend_set_chassis_options(struct chassis_frontend_t *frontend, chassi
     chassis_options_add(opts,
                         "disable-dns-cache",
                         0, 0, OPTION_ARG_NONE, &(frontend->disable_dns_cache),
-                        "Every new connection to backends will resolve domain name", NULL);
+                        "Re-resolve backend domain names every second", NULL);
+
+    chassis_options_add(opts,
+                        "dns-cache-ttl",
+                        0, 0, OPTION_ARG_INT, &(frontend->dns_cache_ttl),
+                        "Re-resolve backend domain names in the background every this many seconds, 0 disables",
+                        "<integer>");
+
+    chassis_options_add(opts,
+                        "upgrade-drain-timeout",
+                        0, 0, OPTION_ARG_INT, &(frontend->upgrade_drain_timeout),
+                        "Seconds the old process keeps serving its clients after an upgrade (SIGUSR2)",
+                        "<integer>");
 
     chassis_options_add(opts,
                         "master-preferred",
@@ -458,6 +605,17 @@ g_query_cache_item_free(gpointer q)
     g_free(item);
 }
 
+/* ids of the guid worker id reserved for each process, a power of 2 */
+static int
+guid_worker_span(int worker_processes)
+{
+    int span = 1;
+    while (span < worker_processes) {
+        span <<= 1;
+    }
+    return span;
+}
+
 /* strdup with 1) default value & 2) NULL check */
 #define DUP_STRING(STR, DEFAULT) \
         (STR) ? g_strdup(STR) : ((DEFAULT) ? g_strdup(DEFAULT) : NULL)
@@ -498,6 +656,11 @@ init_parameters(struct chassis_frontend_t *frontend, chassis *srv)
     if (frontend->worker_id > 0) {
         srv->guid_state.worker_id = frontend->worker_id & 0x3f;
     }
+    if (srv->workers) {
+        /* the low bits of the guid worker id are the worker index, main() checked the alignment */
+        int span = guid_worker_span(srv->workers->count);
+        srv->guid_state.worker_id = (srv->guid_state.worker_id & 0x3f & ~(span - 1)) | srv->worker_index;
+    }
 #undef DUP_STRING
 
     srv->client_found_rows = frontend->set_client_found_rows;
@@ -514,10 +677,50 @@ init_parameters(struct chassis_frontend_t *frontend, chassis *srv)
         srv->query_cache_table = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_query_cache_item_free);
         srv->cache_index = g_queue_new();
     }
+    if (frontend->row_cache_size > 0 && srv->workers) {
+        /* a write through one worker can't invalidate the caches of the others */
+        g_warning("%s:row cache is disabled with worker-processes", G_STRLOC);
+    } else if (frontend->row_cache_size > 0) {
+        srv->row_cache = row_cache_new((gsize)frontend->row_cache_size * MB, MAX(frontend->row_cache_timeout, 1));
+        g_message("%s:row cache enabled, size:%dM, timeout:%dms", G_STRLOC,
+                  frontend->row_cache_size, MAX(frontend->row_cache_timeout, 1));
+    }
+    if (frontend->capture_dir) {
+        char *path = chassis_resolve_path(srv->base_dir, frontend->capture_dir);
+        srv->capture_dir = (path && path != frontend->capture_dir) ? path : g_strdup(frontend->capture_dir);
+        srv->capture_max_size = (guint64)MAX(frontend->capture_max_size, 0) * MB;
+        if (frontend->capture_enabled)
+            srv->capture = capture_new(srv->capture_dir, srv->capture_max_size);
+    } else if (frontend->capture_enabled) {
+        g_warning("%s:enable-capture needs capture-dir, ignored", G_STRLOC);
+    }
     srv->is_tcp_stream_enabled = frontend->is_tcp_stream_enabled;
     if (srv->is_tcp_stream_enabled) {
         g_message("%s:tcp stream enabled", G_STRLOC);
     }
+    srv->merge_high_water = (gint64)MAX(frontend->merge_high_water, 0) * KB;
+    srv->merge_low_water = (gint64)CLAMP(frontend->merge_low_water, 0, MAX(frontend->merge_high_water, 0)) * KB;
+    srv->merge_budget = (gint64)MAX(frontend->merge_budget, 0) * MB;
+    srv->spill_threshold = (gint64)MAX(frontend->spill_threshold, 0) * MB;
+    srv->spill_global_threshold = (gint64)MAX(frontend->spill_global_threshold, 0) * MB;
+    srv->spill_max_size = (gint64)MAX(frontend->spill_max_size, 0) * MB;
+    if (frontend->spill_dir) {
+        char *path = chassis_resolve_path(srv->base_dir, frontend->spill_dir);
+        srv->spill_dir = (path && path != frontend->spill_dir) ? path : g_strdup(frontend->spill_dir);
+    }
+    srv->mem_stats = memory_stats_new();
+    srv->mem_kill_threshold = (guint64)MAX(frontend->mem_kill_threshold, 0) * MB;
+    if (srv->mem_kill_threshold) {
+        g_message("%s:close the largest connection above %dM", G_STRLOC, frontend->mem_kill_threshold);
+    }
+    srv->loop_stall_threshold = MAX(frontend->loop_stall_threshold, 0);
+    srv->event_method = g_strdup(frontend->event_method);
+    if (frontend->io_engine && strcmp(frontend->io_engine, "libevent") != 0
+        && strcmp(frontend->io_engine, "io_uring") != 0) {
+        g_warning("%s: unknown io-engine %s, libevent is used", G_STRLOC, frontend->io_engine);
+    } else {
+        srv->io_engine = g_strdup(frontend->io_engine);
+    }
     srv->disable_threads = frontend->disable_threads;
     srv->is_back_compressed = frontend->is_back_compressed;
     srv->compress_support = frontend->is_client_compress_support;
@@ -525,6 +728,8 @@ init_parameters(struct chassis_frontend_t *frontend, chassis *srv)
     srv->slave_delay_down_threshold_sec = frontend->slave_delay_down_threshold_sec;
     srv->master_preferred = frontend->master_preferred;
     srv->disable_dns_cache = frontend->disable_dns_cache;
+    srv->dns_cache_ttl = frontend->dns_cache_ttl;
+    srv->upgrade_drain_timeout = MAX(frontend->upgrade_drain_timeout, 0);
     if (frontend->slave_delay_recover_threshold_sec > 0) {
         srv->slave_delay_recover_threshold_sec = frontend->slave_delay_recover_threshold_sec;
         if (frontend->slave_delay_recover_threshold_sec > srv->slave_delay_down_threshold_sec) {
@@ -548,6 +753,22 @@ release_resouces_when_exit(struct chassis_frontend_t *frontend, chassis *srv, GE
 {
     if (gerr)
         g_error_free(gerr);
+    if (srv && srv->row_cache) {
+        row_cache_free(srv->row_cache);
+        srv->row_cache = NULL;  /* connections are freed later */
+    }
+    if (srv && srv->capture) {
+        capture_free(srv->capture);
+        srv->capture = NULL;    /* connections are freed later */
+    }
+    if (srv && srv->mem_stats) {
+        memory_stats_free(srv->mem_stats);
+        srv->mem_stats = NULL;
+    }
+    if (srv && srv->workers) {
+        cetus_workers_free(srv->workers);
+        srv->workers = NULL;
+    }
     if (srv)
         chassis_free(srv);
     g_debug("%s: call chassis_options_free", G_STRLOC);
@@ -656,6 +877,10 @@ main_cmdline(int argc, char **argv)
 
     int exit_code = EXIT_SUCCESS;
     const gchar *exit_location = G_STRLOC;
+    int inherited;
+
+    /* the options below consume argv, keep it for the upgrade */
+    cetus_upgrade_save_argv(argc, argv);
 
     /* init module, ... system */
     if (chassis_frontend_init_glib()) {
@@ -871,11 +1096,64 @@ main_cmdline(int argc, char **argv)
 
     signal(SIGPIPE, SIG_IGN);
 
-    if (frontend->daemon_mode) {
+    /* started by an upgrade, already a daemon and watched by the old angel */
+    if (-1 == (inherited = cetus_upgrade_inherit())) {
+        GOTO_EXIT(EXIT_FAILURE);
+    }
+    if (inherited) {
+        g_message("%s: upgraded process, %d listen sockets inherited", G_STRLOC, inherited);
+    }
+
+    if (frontend->daemon_mode && !cetus_upgrade_is_inherited()) {
         chassis_unix_daemonize();
     }
 
-    if (frontend->auto_restart) {
+    if (frontend->worker_processes > 1 && !cetus_upgrade_is_inherited()) {
+        int child_exit_status = EXIT_SUCCESS;   /* forward the exit-status of the workers */
+        int worker = 0;
+        int ret;
+
+        if (frontend->worker_processes > CETUS_MAX_WORKERS) {
+            g_critical("%s: worker-processes can't exceed %d", G_STRLOC, CETUS_MAX_WORKERS);
+            GOTO_EXIT(EXIT_FAILURE);
+        }
+        if (frontend->worker_id > 0) {
+            int span = guid_worker_span(frontend->worker_processes);
+            if (frontend->worker_id % span != 0 || frontend->worker_id + span > 64) {
+                g_critical("%s: with %d worker-processes worker_id must be a multiple of %d below %d",
+                           G_STRLOC, frontend->worker_processes, span, 64 - span + 1);
+                GOTO_EXIT(EXIT_FAILURE);
+            }
+        }
+        if (NULL == (srv->workers = cetus_workers_new(frontend->worker_processes))) {
+            GOTO_EXIT(EXIT_FAILURE);
+        }
+        /* the master's PID, signals sent to it are forwarded to all workers */
+        if (frontend->pid_file) {
+            if (0 != chassis_frontend_write_pidfile(frontend->pid_file, &gerr)) {
+                g_critical("%s", gerr->message);
+                g_clear_error(&gerr);
+
+                GOTO_EXIT(EXIT_FAILURE);
+            }
+        }
+
+        ret = chassis_unix_proc_workers(frontend->worker_processes, &worker, &child_exit_status);
+        if (ret > 0) {
+            /* all workers stopped */
+            exit_code = child_exit_status;
+            goto exit_nicely;
+        } else if (ret < 0) {
+            GOTO_EXIT(EXIT_FAILURE);
+        }
+
+        /* we are a worker, the random state was copied from the master */
+        srv->worker_index = worker;
+        g_random_set_seed((guint32)(getpid() ^ time(NULL)));
+        if (frontend->worker_cpu_affinity) {
+            srv->workers->worker[worker].cpu = cetus_workers_set_affinity(worker);
+        }
+    } else if (frontend->auto_restart && !cetus_upgrade_is_inherited()) {
         int child_exit_status = EXIT_SUCCESS;   /* forward the exit-status of the child */
         int ret = chassis_unix_proc_keepalive(&child_exit_status);
 
@@ -890,7 +1168,7 @@ main_cmdline(int argc, char **argv)
             /* we are the child, go on */
         }
     }
-    if (frontend->pid_file) {
+    if (frontend->pid_file && srv->workers == NULL) {
         if (0 != chassis_frontend_write_pidfile(frontend->pid_file, &gerr)) {
             g_critical("%s", gerr->message);
             g_clear_error(&gerr);
@@ -931,6 +1209,13 @@ main_cmdline(int argc, char **argv)
         frontend->log_xa_filename = new_path;
     }
 
+    if (srv->workers && srv->worker_index > 0) {
+        /* one file per worker, their transactions are independent */
+        char *worker_path = g_strdup_printf("%s.%d", frontend->log_xa_filename, srv->worker_index);
+        g_free(frontend->log_xa_filename);
+        frontend->log_xa_filename = worker_path;
+    }
+
     g_message("XA log file: %s", frontend->log_xa_filename);
 
     if (tc_log_init(frontend->log_xa_filename) == -1) {
@@ -954,6 +1239,9 @@ main_cmdline(int argc, char **argv)
     g_debug("max open file-descriptors = %" G_GINT64_FORMAT, chassis_fdlimit_get());
 
     cetus_monitor_start_thread(srv->priv->monitor, srv);
+#ifndef SIMPLE_PARSER
+    cetus_sequence_start_thread(srv);
+#endif
 
     if (chassis_mainloop(srv)) {
         /* looks like we failed */
@@ -961,7 +1249,18 @@ main_cmdline(int argc, char **argv)
         GOTO_EXIT(EXIT_FAILURE);
     }
 
+    cetus_ddl_job_stop();
+    cetus_resolver_stop();
+    if (cetus_upgrade_handed_over() && frontend->auto_restart) {
+        /* tell the angel not to restart us, the new process serves now */
+        exit_code = CHASSIS_EXIT_UPGRADED;
+    }
+    cetus_upgrade_stop();
+    cetus_workers_stop();
     cetus_monitor_stop_thread(srv->priv->monitor);
+#ifndef SIMPLE_PARSER
+    cetus_sequence_stop_thread();
+#endif
 
   exit_nicely:
     /* necessary to set the shutdown flag, because the monitor will continue
@@ -994,6 +1293,7 @@ main_cmdline(int argc, char **argv)
 #endif
 
     release_resouces_when_exit(frontend, srv, gerr, opts, log);
+    symbol_tables_free();
     if (slow_query_log_fp)
         fclose(slow_query_log_fp);
 
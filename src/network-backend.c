@@ -55,6 +55,12 @@ network_backend_new()
     b->pool = network_connection_pool_new();
     b->uuid = g_string_new(NULL);
     b->addr = network_address_new();
+#if !GLIB_CHECK_VERSION(2, 32, 0)
+    b->addr_mutex = g_mutex_new();
+#else
+    b->addr_mutex = g_new0(GMutex, 1);
+    g_mutex_init(b->addr_mutex);
+#endif
     b->server_group = g_string_new(NULL);
     b->address = g_string_new(NULL);
     b->challenges = g_ptr_array_new();
@@ -72,6 +78,12 @@ network_backend_free(network_backend_t *b)
 
     if (b->addr)
         network_address_free(b->addr);
+#if !GLIB_CHECK_VERSION(2, 32, 0)
+    g_mutex_free(b->addr_mutex);
+#else
+    g_mutex_clear(b->addr_mutex);
+    g_free(b->addr_mutex);
+#endif
     if (b->uuid)
         g_string_free(b->uuid, TRUE);
     if (b->challenges)
@@ -110,6 +122,27 @@ network_backend_init_extra(network_backend_t *b, chassis *chas)
     return 0;
 }
 
+/*
+ * main thread only, e.g. the resolver when the host name moved;
+ * the address is changed in place so that no reader is left with a freed one
+ */
+void
+network_backend_set_addr(network_backend_t *b, network_address *addr)
+{
+    g_mutex_lock(b->addr_mutex);
+    network_address_copy(b->addr, addr);
+    g_mutex_unlock(b->addr_mutex);
+}
+
+/* copy of the address name for threads other than the main one */
+void
+network_backend_addr_name(network_backend_t *b, char *buf, gsize size)
+{
+    g_mutex_lock(b->addr_mutex);
+    g_strlcpy(buf, b->addr->name->str, size);
+    g_mutex_unlock(b->addr_mutex);
+}
+
 int
 network_backend_conns_count(network_backend_t *b)
 {
@@ -64,7 +64,8 @@ typedef struct backend_config {
 } backend_config;
 
 typedef struct {
-    network_address *addr;
+    network_address *addr;      /* changed on the main thread, others read it with addr_mutex */
+    GMutex *addr_mutex;
     GString *server_group;
     GString *address;           /* original address, might be domain name or ip */
 
@@ -91,6 +92,10 @@ NETWORK_API network_backend_t *network_backend_new();
 NETWORK_API void network_backend_free(network_backend_t *b);
 NETWORK_API int network_backend_conns_count(network_backend_t *b);
 NETWORK_API int network_backend_init_extra(network_backend_t *b, chassis *chas);
+NETWORK_API void network_backend_set_addr(network_backend_t *b, network_address *addr);
+/* ip:port or a unix socket path */
+#define BACKEND_ADDR_NAME_LEN 128
+NETWORK_API void network_backend_addr_name(network_backend_t *b, char *buf, gsize size);
 void network_backend_save_challenge(network_backend_t *b, const network_mysqld_auth_challenge *);
 network_mysqld_auth_challenge *network_backend_get_challenge(network_backend_t *b);
 
@@ -109,7 +109,8 @@ network_pool_add_idle_conn(network_connection_pool *pool, chassis *srv, network_
     timeout.tv_sec = surplus_time;
     timeout.tv_usec = 0;
 
-    chassis_event_add_with_timeout(srv, &(server->event), &timeout);
+    /* idle pooled connections almost never time out, keep them off libevent's heap */
+    chassis_event_add_with_timer(srv, &(server->event), &(server->timer), &timeout);
 
     return 0;
 }
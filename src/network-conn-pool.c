@@ -229,7 +229,7 @@ network_connection_pool_get(network_connection_pool *pool, GString *username, in
     event_del(&(sock->event));
 
     g_debug("%s: (get) got socket for user '%s' -> %p, charset:%s", G_STRLOC,
-            username ? username->str : "", sock, sock->charset->str);
+            username ? username->str : "", sock, network_socket_attr(sock, SOCKET_ATTR_CHARSET));
 
     if (sock->is_in_sess_context) {
         g_message("%s: conn is in sess context for user:'%s'", G_STRLOC, username ? username->str : "");
@@ -464,22 +464,16 @@ network_mysqld_proto_get_com_init_db(network_packet *packet,
     case MYSQLD_PACKET_OK:
             /**
              * track the change of the init_db */
-        if (con->server)
-            g_string_truncate(con->server->default_db, 0);
-
         if (udata->db_name && udata->db_name->len) {
-
-            g_string_truncate(con->client->default_db, 0);
+            network_socket_set_attr(con->client, SOCKET_ATTR_DEFAULT_DB, S(udata->db_name));
             if (con->server) {
-                g_string_append_len(con->server->default_db, S(udata->db_name));
+                network_socket_copy_attr(con->server, con->client, SOCKET_ATTR_DEFAULT_DB);
                 g_debug("%s:set server default db:%s for con:%p", G_STRLOC, con->server->default_db->str, con);
             }
-
-            g_string_append_len(con->client->default_db, S(udata->db_name));
             g_debug("%s: COM_INIT_DB set default db success:%s", G_STRLOC, con->client->default_db->str);
         } else {
             if (con->server) {
-                g_string_append_len(con->server->default_db, S(con->client->default_db));
+                network_socket_copy_attr(con->server, con->client, SOCKET_ATTR_DEFAULT_DB);
             }
         }
 
@@ -630,8 +624,7 @@ network_mysqld_proto_get_query_result(network_packet *packet, network_mysqld_con
             g_debug("%s: save username for server, con:%p", G_STRLOC, con);
 
             if (con->client->default_db->len > 0) {
-                g_string_truncate(con->server->default_db, 0);
-                g_string_append(con->server->default_db, con->client->default_db->str);
+                network_socket_copy_attr(con->server, con->client, SOCKET_ATTR_DEFAULT_DB);
                 g_debug("%s:set server default db:%s for con:%p", G_STRLOC, con->server->default_db->str, con);
             }
             is_finished = 1;
@@ -66,6 +66,12 @@
 #include "resultset_merge.h"
 #include "network-conn-pool-wrap.h"
 #include "sharding-query-plan.h"
+#include "sharding-join.h"
+#include "sharding-batch.h"
+#include "cetus-row-cache.h"
+#include "cetus-capture.h"
+#include "cetus-memory.h"
+#include "cetus-sequence.h"
 #include "cetus-util.h"
 #include "server-session.h"
 #include "cetus-users.h"
@@ -102,6 +108,7 @@
 #endif
 
 static void network_mysqld_self_con_handle(int event_fd, short events, void *user_data);
+static void row_cache_end_transaction(network_mysqld_con *con);
 
 /**
  * call the cleanup callback for the current connection
@@ -120,7 +127,7 @@ plugin_call_cleanup(chassis *srv, network_mysqld_con *con)
     if (!con->plugin_con_state && con->proxy_state == ST_PROXY_QUIT)
         return retval;
 
-    func = con->plugins.con_cleanup;
+    func = con->plugins->con_cleanup;
 
     if (!func)
         return retval;
@@ -144,7 +151,7 @@ plugin_call_timeout(chassis *srv, network_mysqld_con *con)
     NETWORK_MYSQLD_PLUGIN_FUNC(func) = NULL;
     network_socket_retval_t retval = NETWORK_SOCKET_ERROR;
 
-    func = con->plugins.con_timeout;
+    func = con->plugins->con_timeout;
 
     if (!func) {
         /* default implementation */
@@ -176,6 +183,7 @@ network_mysqld_priv_init(void)
     priv->backends = network_backends_new();
     priv->users = cetus_users_new();
     priv->monitor = cetus_monitor_new();
+    priv->dirty_cons = g_queue_new();
     return priv;
 }
 
@@ -226,15 +234,75 @@ network_mysqld_priv_free(chassis G_GNUC_UNUSED *chas, chassis_private *priv)
     cetus_users_free(priv->users);
     g_free(priv->stats_variables);
     cetus_monitor_free(priv->monitor);
+    g_queue_free(priv->dirty_cons);
     g_free(priv);
 }
 
+static void
+network_mysqld_con_undefer_write(network_mysqld_con *con)
+{
+    if (con->write_deferred) {
+        g_queue_remove(con->srv->priv->dirty_cons, con);
+        con->write_deferred = 0;
+    }
+}
+
+/* one write per connection for the partial results of the iteration */
+static void
+network_mysqld_priv_loop_flush(chassis G_GNUC_UNUSED *chas, chassis_private *priv)
+{
+    network_mysqld_con *con;
+    GPtrArray *cons;
+    GPtrArray *socks;
+    network_socket_retval_t *rets;
+    guint i;
+
+    if (g_queue_is_empty(priv->dirty_cons)) {
+        return;
+    }
+
+    cons = g_ptr_array_sized_new(priv->dirty_cons->length);
+    socks = g_ptr_array_sized_new(priv->dirty_cons->length);
+    while ((con = g_queue_pop_head(priv->dirty_cons)) != NULL) {
+        con->write_deferred = 0;
+        if (con->client && con->client->send_queue->len > 0 && con->state != ST_ERROR) {
+            g_ptr_array_add(cons, con);
+            g_ptr_array_add(socks, con->client);
+        }
+    }
+
+    /* one system call for all of them when the io_uring engine is on */
+    rets = g_new0(network_socket_retval_t, cons->len);
+    network_socket_write_batch((network_socket **)socks->pdata, socks->len, rets);
+
+    for (i = 0; i < cons->len; i++) {
+        con = g_ptr_array_index(cons, i);
+        switch (rets[i]) {
+        case NETWORK_SOCKET_SUCCESS:
+        case NETWORK_SOCKET_WAIT_FOR_EVENT:
+            break;
+        default:
+            con->prev_state = con->state;
+            con->state = ST_ERROR;
+            break;
+        }
+        if (con->merge_buffered) {
+            resultset_merge_account_output(con);
+        }
+    }
+
+    g_free(rets);
+    g_ptr_array_free(socks, TRUE);
+    g_ptr_array_free(cons, TRUE);
+}
+
 int
 network_mysqld_init(chassis *srv)
 {
     srv->priv_free = network_mysqld_priv_free;
     srv->priv_shutdown = network_mysqld_priv_shutdown;
     srv->priv_finally_free_shared = network_mysqld_priv_finally_free_shared;
+    srv->priv_loop_flush = network_mysqld_priv_loop_flush;
     srv->priv = network_mysqld_priv_init();
 
     cetus_users_read_json(srv->priv->users, srv->config_manager);
@@ -244,6 +312,9 @@ network_mysqld_init(chassis *srv)
     return 0;
 }
 
+/* xid_str of connections that never ran a distributed transaction */
+static char no_xid[1];
+
 /**
  * create a connection 
  *
@@ -252,15 +323,15 @@ network_mysqld_init(chassis *srv)
 network_mysqld_con *
 network_mysqld_con_new()
 {
+    static const network_mysqld_hooks no_hooks;
     network_mysqld_con *con;
 
     con = g_new0(network_mysqld_con, 1);
     con->parse.command = -1;
+    con->plugins = &no_hooks;
+    con->xid_str = no_xid;
 
     con->max_retry_serv_cnt = 72;
-    con->auth_switch_to_method = g_string_new(NULL);
-    con->auth_switch_to_round = 0;
-    con->auth_switch_to_data = g_string_new(NULL);
     con->is_auto_commit = 1;
 
     con->orig_sql = g_string_new(NULL);
@@ -341,6 +412,13 @@ network_mysqld_con_free(network_mysqld_con *con)
         g_warning("%s: servers are not null for con:%p", G_STRLOC, con);
     }
 
+    resultset_merge_cancel_pause(con);
+    if (con->is_wait_sequence) {
+        cetus_sequence_unpark(con);
+    }
+    con->srv->merge_buffered -= con->merge_buffered;
+    con->srv->spill_resident -= con->spill_resident;
+
     if (con->server)
         network_socket_free(con->server);
     if (con->client)
@@ -364,8 +442,26 @@ network_mysqld_con_free(network_mysqld_con *con)
     if (con->sharding_plan) {
         sharding_plan_free(con->sharding_plan);
     }
-    g_string_free(con->auth_switch_to_method, TRUE);
-    g_string_free(con->auth_switch_to_data, TRUE);
+    if (con->bind_join) {
+        sharding_join_free(con->bind_join);
+    }
+    if (con->batch_dml) {
+        sharding_batch_free(con->batch_dml);
+    }
+    if (con->row_cache_ref) {
+        row_cache_ref_free(con->row_cache_ref);
+    }
+    if (con->row_cache_trx_writes) {
+        row_cache_end_transaction(con);
+    }
+    network_mysqld_con_undefer_write(con);
+    if (con->srv->capture) {
+        capture_close(con->srv->capture, con);
+    }
+    if (con->xid_str != no_xid) {
+        g_free(con->xid_str);
+    }
+    g_free(con->last_backends_type);
 
     /* we are still in the conns-array */
 
@@ -379,6 +475,23 @@ network_mysqld_con_free(network_mysqld_con *con)
     g_free(con);
 }
 
+/**
+ * number the next distributed transaction of the connection
+ *
+ * xid_str is only allocated here, most connections never need one
+ */
+void
+network_mysqld_con_make_xid(network_mysqld_con *con)
+{
+    chassis *srv = con->srv;
+
+    if (con->xid_str == no_xid) {
+        con->xid_str = g_malloc(XID_LEN);
+    }
+    con->xa_id = srv->dist_tran_id++;
+    snprintf(con->xid_str, XID_LEN, "'%s_%02d_%llu'", srv->dist_tran_prefix, tc_get_log_hour(), con->xa_id);
+}
+
 static struct timeval
 network_mysqld_con_retry_timeout(network_mysqld_con *con)
 {
@@ -564,6 +677,23 @@ network_mysqld_con_send_ok(network_socket *con)
     return network_mysqld_con_send_ok_full(con, 0, 0, SERVER_STATUS_AUTOCOMMIT, 0);
 }
 
+/**
+ * server status of the client session, for packets made up by proxy
+ */
+guint16
+network_mysqld_con_server_status(network_mysqld_con *con)
+{
+    guint16 status = 0;
+
+    if (con->is_auto_commit) {
+        status |= SERVER_STATUS_AUTOCOMMIT;
+    }
+    if (con->is_in_transaction || con->dist_tran) {
+        status |= SERVER_STATUS_IN_TRANS;
+    }
+    return status;
+}
+
 static int
 network_mysqld_con_send_error_full_all(network_socket *con,
                                        const char *errmsg, gsize errmsg_len, guint errorcode,
@@ -1014,17 +1144,17 @@ plugin_call(chassis *srv, network_mysqld_con *con, int state)
 
     switch (state) {
     case ST_INIT:
-        func = con->plugins.con_init;
+        func = con->plugins->con_init;
 
         if (!func) {
             con->state = ST_CONNECT_SERVER;
         }
         break;
     case ST_CONNECT_SERVER:
-        func = con->plugins.con_connect_server;
+        func = con->plugins->con_connect_server;
         break;
     case ST_SEND_HANDSHAKE:
-        func = con->plugins.con_send_handshake;
+        func = con->plugins->con_send_handshake;
 
         if (!func) {
             con->state = ST_READ_AUTH;
@@ -1032,12 +1162,12 @@ plugin_call(chassis *srv, network_mysqld_con *con, int state)
 
         break;
     case ST_READ_AUTH:
-        func = con->plugins.con_read_auth;
+        func = con->plugins->con_read_auth;
 
         break;
     case ST_SEND_AUTH_RESULT:
         /* called after the auth data is sent to the client */
-        func = con->plugins.con_send_auth_result;
+        func = con->plugins->con_send_auth_result;
 
         if (!func) {
             /*
@@ -1059,6 +1189,7 @@ plugin_call(chassis *srv, network_mysqld_con *con, int state)
                     con->state = ST_READ_QUERY;
                     if (con->is_client_compressed) {
                         con->client->do_compress = 1;
+                        con->client->recv_queue_uncompress_raw = network_queue_new();
                         network_socket_set_send_buffer_size(con->client, COMPRESS_BUF_SIZE);
                     }
                 }
@@ -1077,16 +1208,16 @@ plugin_call(chassis *srv, network_mysqld_con *con, int state)
         }
         break;
     case ST_READ_QUERY:
-        func = con->plugins.con_read_query;
+        func = con->plugins->con_read_query;
         break;
     case ST_GET_SERVER_CONNECTION_LIST:
-        func = con->plugins.con_get_server_conn_list;
+        func = con->plugins->con_get_server_conn_list;
         break;
     case ST_READ_QUERY_RESULT:
-        func = con->plugins.con_read_query_result;
+        func = con->plugins->con_read_query_result;
         break;
     case ST_SEND_QUERY_RESULT:
-        func = con->plugins.con_send_query_result;
+        func = con->plugins->con_send_query_result;
 
         if (!func) {
             if (!con->server_to_be_closed) {
@@ -1270,7 +1401,7 @@ set_conn_attr(network_mysqld_con *con, network_socket *server)
         break;
     case COM_INIT_DB:
         /* TODO: make sure we get OK result packet */
-        g_string_assign(server->default_db, con->client->default_db->str);
+        network_socket_copy_attr(server, con->client, SOCKET_ATTR_DEFAULT_DB);
         break;
     case COM_SET_OPTION:
         break;
@@ -1342,7 +1473,7 @@ shard_set_autocommit(network_mysqld_con *con)
         }
 
         ss->attr_adjusted_now = 0;
-        int len = con->client->charset->len + NET_HEADER_SIZE + 1 + 32;
+        int len = NET_HEADER_SIZE + 1 + 32;
         GString *packet = g_string_sized_new(len);
         packet->len = NET_HEADER_SIZE;
         g_string_append_c(packet, (char)COM_QUERY);
@@ -1436,20 +1567,21 @@ shard_set_charset_consistant(network_mysqld_con *con)
             continue;
         }
 
-        int len = con->client->charset->len + NET_HEADER_SIZE + 1 + 16;
+        const char *charset = network_socket_attr(con->client, SOCKET_ATTR_CHARSET);
+        int len = strlen(charset) + NET_HEADER_SIZE + 1 + 16;
         GString *packet = g_string_sized_new(len);
         packet->len = NET_HEADER_SIZE;
         g_string_append_c(packet, (char)COM_QUERY);
         char *command = "SET NAMES ";
         g_string_append(packet, command);
 
-        if (strcmp(con->client->charset->str, "") == 0) {
+        if (charset[0] == '\0') {
             g_warning("%s: client charset is empty:%s", G_STRLOC, con->client->src->name->str);
             g_string_append(packet, "''");
             network_mysqld_proto_set_packet_len(packet, 1 + strlen(command) + 2);
         } else {
-            g_string_append(packet, con->client->charset->str);
-            network_mysqld_proto_set_packet_len(packet, 1 + strlen(command) + con->client->charset->len);
+            g_string_append(packet, charset);
+            network_mysqld_proto_set_packet_len(packet, 1 + strlen(command) + strlen(charset));
         }
 
         network_mysqld_proto_set_packet_id(packet, 0);
@@ -1457,11 +1589,11 @@ shard_set_charset_consistant(network_mysqld_con *con)
 
         ss->attr_adjusted_now = 1;
         g_debug("%s: adjust default charset for server, clt:%s, srv:%s",
-                G_STRLOC, con->client->charset->str, ss->server->charset->str);
+                G_STRLOC, charset, network_socket_attr(ss->server, SOCKET_ATTR_CHARSET));
         ss->server->parse.qs_state = PARSE_COM_QUERY_INIT;
         con->resp_expected_num++;
 
-        g_string_assign(ss->server->charset, con->client->charset->str);
+        network_socket_copy_names(ss->server, con->client);
     }
     return TRUE;
 }
@@ -1494,7 +1626,7 @@ shard_set_default_db_consistant(network_mysqld_con *con)
         GString *srv_default_db = ss->server->default_db;
 
         if (clt_default_db && clt_default_db->len > 0) {
-            if (!g_string_equal(clt_default_db, srv_default_db)) {
+            if (!network_socket_attr_equal(con->client, ss->server, SOCKET_ATTR_DEFAULT_DB)) {
                 int len = clt_default_db->len + NET_HEADER_SIZE + 1;
                 GString *new_packet = g_string_sized_new(len);
                 new_packet->len = NET_HEADER_SIZE;
@@ -2047,7 +2179,7 @@ normal_result_merge(network_mysqld_con *con)
 #define WAIT_FOR_EVENT(ev_struct, ev_type, timeout) \
     event_set(&(ev_struct->event), ev_struct->fd, ev_type, network_mysqld_con_handle, con); \
     g_debug("%s:call WAIT_FOR_EVENT, ev:%p", G_STRLOC, &(ev_struct->event)); \
-    chassis_event_add_with_timeout(con->srv, &(ev_struct->event), timeout);
+    chassis_event_add_with_timer(con->srv, &(ev_struct->event), &(ev_struct->timer), timeout);
 
 static void
 disp_query_after_consistant_attr(network_mysqld_con *con)
@@ -2059,10 +2191,8 @@ disp_query_after_consistant_attr(network_mysqld_con *con)
     con->is_attr_adjust = 0;
     if (con->dist_tran && !con->dist_tran_xa_start_generated) {
         /* append xa query to send queue */
-        chassis *srv = con->srv;
         con->dist_tran_state = NEXT_ST_XA_QUERY;
-        con->xa_id = srv->dist_tran_id++;
-        snprintf(con->xid_str, XID_LEN, "'%s_%02d_%llu'", srv->dist_tran_prefix, tc_get_log_hour(), con->xa_id);
+        network_mysqld_con_make_xid(con);
 
         con->dist_tran_xa_start_generated = 1;
         con->is_start_trans_buffered = 0;
@@ -2163,6 +2293,14 @@ handle_read_query(network_mysqld_con *con, network_mysqld_con_state_t ostate)
     recv_sock->compressed_packet_id = 1;
     recv_sock->do_strict_compress = 0;
 
+    if (con->client->cache_queue) {  /* left over by an aborted query */
+        network_queue_free(con->client->cache_queue);
+        con->client->cache_queue = NULL;
+    }
+    if (con->row_cache_ref) {
+        row_cache_ref_free(con->row_cache_ref);
+        con->row_cache_ref = NULL;
+    }
     con->client->do_query_cache = 0;
     con->client->query_cache_too_long = 0;
     con->query_cache_judged = 0;
@@ -2170,7 +2308,7 @@ handle_read_query(network_mysqld_con *con, network_mysqld_con_state_t ostate)
 
     gettimeofday(&(con->req_recv_time), NULL);
 
-    if (!con->is_wait_server) {
+    if (!con->is_wait_server && !con->is_wait_sequence) {
         do {
             switch (network_mysqld_read(srv, recv_sock)) {
             case NETWORK_SOCKET_SUCCESS:
@@ -2212,6 +2350,11 @@ handle_read_query(network_mysqld_con *con, network_mysqld_con_state_t ostate)
             GQueue *chunks = recv_sock->recv_queue->chunks;
             last_packet.data = g_queue_peek_tail(chunks);
         } while (last_packet.data->len == (PACKET_LEN_MAX + NET_HEADER_SIZE));
+
+        /* admin connections have no plugin state and are not captured */
+        if (srv->capture && con->plugin_con_state && con->state == ostate) {
+            capture_command(srv->capture, con);
+        }
     } else {
         g_debug("%s:wait server.", G_STRLOC);
     }
@@ -2225,8 +2368,16 @@ handle_read_query(network_mysqld_con *con, network_mysqld_con_state_t ostate)
             handle_query_wait_stats(con);
         }
         con->is_wait_server = 0;
+        con->is_wait_sequence = 0;
         con->retry_serv_cnt = 0;
         break;
+    case NETWORK_SOCKET_WAIT_FOR_EVENT:
+        /* parked by the plugin, a lease completion resumes it before the timeout */
+        con->is_wait_sequence = 1;
+        timeout.tv_sec = SEQUENCE_PARK_SEC;
+        timeout.tv_usec = 0;
+        WAIT_FOR_EVENT(con->client, EV_TIMEOUT, &timeout);
+        return DISP_STOP;
     case NETWORK_SOCKET_ERROR_RETRY:
         if (con->retry_serv_cnt < con->max_retry_serv_cnt) {
             if (con->retry_serv_cnt == 0 || con->retry_serv_cnt == 8) {
@@ -2561,7 +2712,7 @@ shard_read_response(network_mysqld_con *con, server_session_t *ss)
                     }
                 } else {
                     g_message("%s: here, we send_part_content_to_client", G_STRLOC);
-                    send_part_content_to_client(con);
+                    defer_part_content_to_client(con);
                     ss->state = NET_RW_STATE_READ;
                     g_debug("%s:num_read_pending:%d, ss->index:%d for con:%p",
                             G_STRLOC, con->num_read_pending, ss->index, con);
@@ -3034,6 +3185,39 @@ disp_attr(network_mysqld_con *con, int srv_down_count, int *disp_flag)
     return 1;
 }
 
+/**
+ * sharding key of INSERT generated by proxy, report the first generated key
+ * as insert id to client, the same as AUTO_INCREMENT does
+ */
+static void
+set_generated_insert_id(network_mysqld_con *con)
+{
+    sharding_plan_t *plan = con->sharding_plan;
+    if (!plan || plan->generated_insert_id == 0) {
+        return;
+    }
+    GString *packet = g_queue_peek_head(con->client->send_queue->chunks);
+    if (!packet || packet->len <= NET_HEADER_SIZE || packet->str[NET_HEADER_SIZE] != MYSQLD_PACKET_OK) {
+        return;
+    }
+    network_packet p = { packet, NET_HEADER_SIZE };
+    network_mysqld_ok_packet_t ok = { 0 };
+    if (network_mysqld_proto_get_ok_packet(&p, &ok) != 0) {
+        return;
+    }
+    ok.insert_id = plan->generated_insert_id;
+    GString *body = g_string_new(NULL);
+    network_mysqld_proto_append_ok_packet(body, &ok);
+    g_string_append_len(body, packet->str + p.offset, packet->len - p.offset);  /* info message */
+    g_string_truncate(packet, NET_HEADER_SIZE);
+    g_string_append_len(packet, S(body));
+    network_mysqld_proto_set_packet_len(packet, body->len);
+    g_string_free(body, TRUE);
+
+    con->last_insert_id = plan->generated_insert_id;
+    g_debug("%s: set generated insert id:%llu", G_STRLOC, (unsigned long long)con->last_insert_id);
+}
+
 static int
 disp_after_resp(network_mysqld_con *con, int srv_down_count, int srv_response_count, int *disp_flag)
 {
@@ -3052,6 +3236,26 @@ disp_after_resp(network_mysqld_con *con, int srv_down_count, int srv_response_co
         }
     }
 
+    if (con->bind_join && !skip) {
+        if (sharding_join_process_resp(con) == JOIN_RESP_NEXT_PHASE) {
+            remove_mul_server_recv_packets(con);
+            con->state = ST_GET_SERVER_CONNECTION_LIST;
+            *disp_flag = DISP_CONTINUE;
+            return 0;
+        }
+        skip = 1;
+    }
+
+    if (con->batch_dml && !skip) {
+        if (sharding_batch_process_resp(con) == BATCH_RESP_NEXT_PHASE) {
+            remove_mul_server_recv_packets(con);
+            con->state = ST_GET_SERVER_CONNECTION_LIST;
+            *disp_flag = DISP_CONTINUE;
+            return 0;
+        }
+        skip = 1;
+    }
+
     int single_response = 0;
 
     if (!skip) {
@@ -3064,6 +3268,10 @@ disp_after_resp(network_mysqld_con *con, int srv_down_count, int srv_response_co
         disp_single_resp(con);
     }
 
+    if (!skip) {
+        set_generated_insert_id(con);
+    }
+
     remove_mul_server_recv_packets(con);
 
     if (!result_reserve) {
@@ -3150,6 +3358,25 @@ send_part_content_to_client(network_mysqld_con *con)
 
 }
 
+/**
+ * rows relayed or merged while reading the servers are written once at
+ * the end of the loop iteration, not once per server read
+ */
+void
+defer_part_content_to_client(network_mysqld_con *con)
+{
+    chassis_private *priv = con->srv->priv;
+
+    if (!priv || !priv->dirty_cons) {
+        send_part_content_to_client(con);
+        return;
+    }
+    if (!con->write_deferred) {
+        con->write_deferred = 1;
+        g_queue_push_tail(priv->dirty_cons, con);
+    }
+}
+
 static void
 process_service_unavailable(network_mysqld_con *con)
 {
@@ -3185,12 +3412,66 @@ process_service_unavailable(network_mysqld_con *con)
     network_mysqld_queue_reset(con->client);
 }
 
+/**
+ * other sessions might cache rows written by the transaction before it
+ * commits, so its keys are dropped again when it ends
+ */
+static void
+row_cache_end_transaction(network_mysqld_con *con)
+{
+    GPtrArray *writes = con->row_cache_trx_writes;
+    int i;
+    for (i = 0; con->srv->row_cache && i < writes->len; ++i) {
+        row_cache_invalidate(con->srv->row_cache, g_ptr_array_index(writes, i));
+    }
+    g_ptr_array_free(writes, TRUE);
+    con->row_cache_trx_writes = NULL;
+}
+
+/* the response is sent, cache it or drop the keys just written */
+static void
+handle_row_cache(network_mysqld_con *con)
+{
+    row_cache_ref_t *ref = con->row_cache_ref;
+    network_socket *client = con->client;
+
+    if (ref->is_write) {
+        row_cache_invalidate(con->srv->row_cache, ref);
+        if (con->is_in_transaction || !con->is_auto_commit) {
+            if (!con->row_cache_trx_writes) {
+                con->row_cache_trx_writes = g_ptr_array_new_with_free_func((GDestroyNotify)row_cache_ref_free);
+            }
+            g_ptr_array_add(con->row_cache_trx_writes, ref);
+            con->row_cache_ref = NULL;
+            return;
+        }
+    } else if (client->do_query_cache && client->cache_queue) {
+        GString *first = g_queue_peek_head(client->cache_queue->chunks);
+        if (client->query_cache_too_long || con->partially_merged || !first || first->len <= NET_HEADER_SIZE
+            || (guchar)first->str[NET_HEADER_SIZE] == MYSQLD_PACKET_ERR) {
+            network_queue_free(client->cache_queue);
+        } else {
+            row_cache_store(con->srv->row_cache, ref, client->cache_queue);
+        }
+        client->cache_queue = NULL;
+        client->do_query_cache = 0;
+    }
+    row_cache_ref_free(ref);
+    con->row_cache_ref = NULL;
+}
+
 static int
 send_result_to_client(network_mysqld_con *con, network_mysqld_con_state_t ostate)
 {
     chassis *srv = con->srv;
     struct timeval timeout;
 
+    /* the whole result is buffered now, unless streamed */
+    gsize usage = network_mysqld_con_memory(con);
+    if (usage > con->mem_peak) {
+        con->mem_peak = usage;
+    }
+
     /* only for sharding */
     if (con->partially_merged) {
         if (con->servers) {
@@ -3202,6 +3483,9 @@ send_result_to_client(network_mysqld_con *con, network_mysqld_con_state_t ostate
     }
 
     g_debug("%s: send server result to client", G_STRLOC);
+    network_mysqld_con_undefer_write(con);  /* the queued rows go out with this write */
+    /* rows of an unfinished result come right after, spare the small tail segment */
+    con->client->write_more = !con->resultset_is_finished && con->server;
     /**
      * send the query result-set to the client 
      */
@@ -3211,6 +3495,9 @@ send_result_to_client(network_mysqld_con *con, network_mysqld_con_state_t ostate
     case NETWORK_SOCKET_WAIT_FOR_EVENT:
         g_debug("%s: write wait and add event", G_STRLOC);
         timeout = con->write_timeout;
+        if (con->merge_buffered) {
+            resultset_merge_account_output(con);
+        }
 
         WAIT_FOR_EVENT(con->client, EV_WRITE, &timeout);
 
@@ -3228,6 +3515,13 @@ send_result_to_client(network_mysqld_con *con, network_mysqld_con_state_t ostate
         break;
     }
 
+    if (con->merge_buffered) {
+        resultset_merge_account_output(con);
+    }
+    if (con->spill_resident) {
+        resultset_merge_account_spill(con, 0);
+    }
+
     /* if the write failed, don't call the plugin handlers */
     if (con->state != ostate) {
         return DISP_CONTINUE;
@@ -3258,8 +3552,17 @@ send_result_to_client(network_mysqld_con *con, network_mysqld_con_state_t ostate
 
     gettimeofday(&(con->resp_send_time), NULL);
     handle_query_time_stats(con);
+    if (srv->capture) {
+        capture_response(srv->capture, con);
+    }
 
-    if (con->client->do_query_cache) {
+    if (con->row_cache_trx_writes
+        && (con->is_commit_or_rollback || (!con->is_in_transaction && con->is_auto_commit))) {
+        row_cache_end_transaction(con);
+    }
+    if (con->row_cache_ref) {
+        handle_row_cache(con);
+    } else if (con->client->do_query_cache) {
         if (con->client->query_cache_too_long) {
             network_queue_free(con->client->cache_queue);
             con->client->cache_queue = NULL;
@@ -3379,7 +3682,7 @@ normal_read_query_result(network_mysqld_con *con, network_mysqld_con_state_t ost
             }
             if (con->client->send_queue->len > 0) {
                 g_debug("%s: send_part_content_to_client", G_STRLOC);
-                send_part_content_to_client(con);
+                defer_part_content_to_client(con);
             }
             WAIT_FOR_EVENT(con->server, EV_READ, &timeout);
             return DISP_STOP;
@@ -3510,6 +3813,17 @@ process_timeout_event(network_mysqld_con *con)
 {
     if (con->is_wait_server) {
         g_debug("%s:now get a chance to get server connection", G_STRLOC);
+    } else if (con->is_wait_sequence) {
+        if (cetus_sequence_unpark(con)) {
+            /* still parked, no lease completed in time */
+            g_warning("%s: sequence lease timeout, con:%p", G_STRLOC, con);
+            con->is_wait_sequence = 0;
+            network_mysqld_con_send_error_full(con->client, C("(cetus) sequence unavailable, retry later"),
+                                               ER_CETUS_SEQUENCE, "HY000");
+            network_queue_clear(con->client->recv_queue);
+            network_mysqld_queue_reset(con->client);
+            con->state = ST_SEND_QUERY_RESULT;
+        }
     } else {
         /* 
          * if we got a timeout on ST_CONNECT_SERVER 
@@ -3534,14 +3848,17 @@ process_timeout_event(network_mysqld_con *con)
  * @param events       the event that was fired
  * @param user_data    the connection handle
  */
-void
-network_mysqld_con_handle(int event_fd, short events, void *user_data)
+static void
+network_mysqld_con_handle_events(int event_fd, short events, void *user_data)
 {
     network_mysqld_con_state_t ostate;
     network_mysqld_con *con = user_data;
     chassis *srv = con->srv;
     int retval;
 
+    /* the state machine takes over from a paused streamed merge */
+    resultset_merge_cancel_pause(con);
+
     if (events == EV_READ) {
         process_read_event(con, event_fd);
     } else if (events == EV_TIMEOUT) {
@@ -3556,6 +3873,7 @@ network_mysqld_con_handle(int event_fd, short events, void *user_data)
         struct timeval timeout;
 
         ostate = con->state;
+        chassis_event_callback_state(network_mysqld_con_st_name(con->state));
 #if NETWORK_DEBUG_TRACE_STATE_CHANGES
         /*
          * if you need the state-change information without dtrace,
@@ -3853,6 +4171,14 @@ network_mysqld_con_handle(int event_fd, short events, void *user_data)
     return;
 }
 
+void
+network_mysqld_con_handle(int event_fd, short events, void *user_data)
+{
+    chassis_event_callback_begin("network_mysqld_con_handle");
+    network_mysqld_con_handle_events(event_fd, events, user_data);
+    chassis_event_callback_end();
+}
+
 static gboolean
 update_accept_event(network_mysqld_con *con, const int new_flags)
 {
@@ -4099,6 +4425,29 @@ network_mysqld_con_send_current_date(network_socket *con, const char *name)
     return 0;
 }
 
+int
+network_mysqld_con_send_insert_id(network_socket *con, const char *name, guint64 insert_id)
+{
+    GPtrArray *fields = g_ptr_array_new_with_free_func((void *)network_mysqld_proto_fielddef_free);
+    MYSQL_FIELD *field = network_mysqld_proto_fielddef_new();
+    field->name = g_strdup(name);
+    field->type = MYSQL_TYPE_LONGLONG;
+    g_ptr_array_add(fields, field);
+
+    char buffer[32] = { 0 };
+    snprintf(buffer, sizeof(buffer), "%llu", (unsigned long long)insert_id);
+
+    GPtrArray *rows = g_ptr_array_new_with_free_func((void *)network_mysqld_mysql_field_row_free);
+    GPtrArray *row = g_ptr_array_new();
+    g_ptr_array_add(row, buffer);
+    g_ptr_array_add(rows, row);
+
+    network_mysqld_con_send_resultset(con, fields, rows);
+    g_ptr_array_free(fields, TRUE);
+    g_ptr_array_free(rows, TRUE);
+    return 0;
+}
+
 int
 network_mysqld_con_send_cetus_version(network_socket *con)
 {
@@ -4253,6 +4602,7 @@ network_mysqld_self_con_init(chassis *srv)
 
     con->srv = srv;
     con->server = network_socket_new();
+    con->server->username = g_string_new(NULL);
     con->state = ST_ASYNC_CONN;
     con->hashed_pwd = g_string_new(0);
 
@@ -4280,7 +4630,7 @@ network_mysqld_self_con_free(server_connection_state_t *con)
 
 #define ASYNC_WAIT_FOR_EVENT(sock, ev_type, timeout, user_data)         \
 event_set(&(sock->event), sock->fd, ev_type, network_mysqld_self_con_handle, user_data); \
-chassis_event_add_with_timeout(srv, &(sock->event), timeout);
+chassis_event_add_with_timer(srv, &(sock->event), &(sock->timer), timeout);
 
 static int
 process_self_event(server_connection_state_t *con, int events, int event_fd)
@@ -4397,6 +4747,7 @@ process_self_read_auth_result(server_connection_state_t *con)
 #endif
         if (con->srv->is_back_compressed) {
             con->server->do_compress = 1;
+            con->server->recv_queue_uncompress_raw = network_queue_new();
         }
         network_pool_add_idle_conn(con->pool, con->srv, con->server);
         con->server = NULL;     /* tell _self_con_free we succeed */
@@ -4592,10 +4943,7 @@ network_connection_pool_create_conn(network_mysqld_con *con)
             g_message("%s: create %s connection for backend ndx:%d, ptr:%p", G_STRLOC, username, i, backend);
 
             scs->charset_code = con->client->charset_code;
-            if (srv->disable_dns_cache)
-                network_address_set_address(scs->server->dst, backend->address->str);
-            else
-                network_address_copy(scs->server->dst, backend->addr);
+            network_address_copy(scs->server->dst, backend->addr);
 
             scs->pool = backend->pool;
             scs->backend = backend;
@@ -4608,7 +4956,7 @@ network_connection_pool_create_conn(network_mysqld_con *con)
             g_string_append(scs->server->username, username);
 
             if (con->client->default_db && con->client->default_db->len > 0) {
-                g_string_append(scs->server->default_db, con->client->default_db->str);
+                network_socket_copy_attr(scs->server, con->client, SOCKET_ATTR_DEFAULT_DB);
                 g_debug("%s:set server default db:%s for con:%p", G_STRLOC, scs->server->default_db->str, con);
             }
 
@@ -4660,10 +5008,7 @@ network_connection_pool_create_conns(chassis *srv)
         if (backend != NULL) {
             for (j = 0; j < backend->config->mid_conn_pool; j++) {
                 server_connection_state_t *scs = network_mysqld_self_con_init(srv);
-                if (srv->disable_dns_cache)
-                    network_address_set_address(scs->server->dst, backend->address->str);
-                else
-                    network_address_copy(scs->server->dst, backend->addr);
+                network_address_copy(scs->server->dst, backend->addr);
 
                 scs->backend = backend;
                 scs->pool = backend->pool;
@@ -4675,7 +5020,8 @@ network_connection_pool_create_conns(chassis *srv)
                 scs->connect_timeout.tv_usec = 0;
 
                 if (backend->config->default_db && backend->config->default_db->len > 0) {
-                    g_string_append(scs->server->default_db, backend->config->default_db->str);
+                    network_socket_set_attr(scs->server, SOCKET_ATTR_DEFAULT_DB,
+                                            S(backend->config->default_db));
                     g_debug("%s:set server default db:%s for con:%p", G_STRLOC, scs->server->default_db->str, scs);
 
                 }
@@ -62,7 +62,8 @@ typedef enum {
     PROXY_SEND_RESULT,
     PROXY_SEND_INJECTION,
     PROXY_SEND_NONE,
-    PROXY_IGNORE_RESULT       /** for read_query_result */
+    PROXY_IGNORE_RESULT,      /** for read_query_result */
+    PROXY_WAIT_SEQUENCE         /* query parked until a sequence lease completes */
 } network_mysqld_stmt_ret;
 
 typedef struct network_mysqld_con network_mysqld_con;   /* forward declaration */
@@ -471,8 +472,10 @@ struct network_mysqld_con {
      * config is their own chassis_plugin_config (a plugin-private struct)
      * and violating this constraint may lead to a crash.
      * @see chassis_plugin_config
+     *
+     * The table is the plugin's static one, shared by all its connections.
      */
-    network_mysqld_hooks plugins;
+    const network_mysqld_hooks *plugins;
 
     /**
      * A pointer to a plugin-private struct describing configuration parameters.
@@ -504,10 +507,19 @@ struct network_mysqld_con {
     int num_write_pending;
     int num_read_pending;
     unsigned int key;
+    guint32 capture_id;         /* connection id in the traffic capture */
+    guint32 capture_gen;        /* the capture that capture_id belongs to */
+    gint64 merge_buffered;      /* merged output counted in srv->merge_buffered */
+    guint64 paused_servers;     /* bitmap of con->servers to read once the client drained */
+    gint64 spill_resident;      /* shard responses in memory, counted in srv->spill_resident */
+    gsize mem_peak;             /* most memory held at once, see network_mysqld_con_memory() */
 
     mysqld_query_attr_t query_attr;
 
     unsigned int is_wait_server:1;  /* first connect to backend failed, retrying */
+    unsigned int is_wait_sequence:1;    /* parked by the plugin, see cetus_sequence_park() */
+    unsigned int capture_pending:1; /* captured request waiting for its response */
+    unsigned int shard_reads_paused:1;  /* streamed merge waiting for the client to drain */
     unsigned int is_calc_found_rows:1;
     unsigned int login_failed:1;
     unsigned int is_auto_commit:1;
@@ -557,6 +569,7 @@ struct network_mysqld_con {
     unsigned int query_cache_judged:1;
     unsigned int is_client_compressed:1;
     unsigned int is_client_to_be_closed:1;
+    unsigned int write_deferred:1;  /* in chassis_private.dirty_cons */
     unsigned int last_backend_type:2;
     unsigned int all_participate_num:8;
 
@@ -580,11 +593,6 @@ struct network_mysqld_con {
      */
     guint8 auth_result_state;
 
-    /* track the auth-method-switch state */
-    GString *auth_switch_to_method;
-    GString *auth_switch_to_data;
-    guint32 auth_switch_to_round;
-
     /** Flag indicating if we the plugin doesn't need the resultset itself.
      * 
      * If set to TRUE, the plugin needs to see 
@@ -635,10 +643,14 @@ struct network_mysqld_con {
     struct timeval read_timeout;    /* default = 10 min */
     struct timeval write_timeout;   /* default = 10 min */
     struct timeval wait_clt_next_sql;
-    char xid_str[XID_LEN];
-    char last_backends_type[MAX_SERVER_NUM];
+    char *xid_str;              /* XID_LEN bytes, see network_mysqld_con_make_xid() */
+    char *last_backends_type;   /* shard: MAX_SERVER_NUM types of con->servers, NULL until recorded */
 
     struct sharding_plan_t *sharding_plan;
+    struct sharding_join_t *bind_join;  /* cross-shard join in progress */
+    struct sharding_batch_t *batch_dml; /* chunked UPDATE/DELETE in progress */
+    struct row_cache_ref_t *row_cache_ref;  /* point lookup to be cached, or keys being written */
+    GPtrArray *row_cache_trx_writes;    /* GPtrArray<row_cache_ref_t *>, written in the open transaction */
     struct query_queue_t *recent_queries;
     void *data;
 };
@@ -707,6 +719,7 @@ NETWORK_API void network_mysqld_con_free(network_mysqld_con *con);
 NETWORK_API void network_mysqld_con_accept(int event_fd, short events, void *user_data);
 
 NETWORK_API int network_mysqld_con_send_ok(network_socket *con);
+NETWORK_API guint16 network_mysqld_con_server_status(network_mysqld_con *con);
 NETWORK_API int network_mysqld_con_send_ok_full(network_socket *con, guint64 affected_rows,
                                                 guint64 insert_id, guint16 server_status, guint16 warnings);
 NETWORK_API int network_mysqld_con_send_error(network_socket *con, const gchar *errmsg, gsize errmsg_len);
@@ -714,8 +727,10 @@ NETWORK_API int network_mysqld_con_send_error_full(network_socket *con, const ch
                                                    gsize errmsg_len, guint errorcode, const gchar *sqlstate);
 NETWORK_API int network_mysqld_con_send_resultset(network_socket *con, GPtrArray *fields, GPtrArray *rows);
 int network_mysqld_con_send_current_date(network_socket *, const char *);
+int network_mysqld_con_send_insert_id(network_socket *, const char *name, guint64 insert_id);
 int network_mysqld_con_send_cetus_version(network_socket *);
 void network_mysqld_send_xa_start(network_socket *, const char *xid);
+void network_mysqld_con_make_xid(network_mysqld_con *con);
 
 NETWORK_API void network_mysqld_con_reset_command_response_state(network_mysqld_con *con);
 NETWORK_API void network_mysqld_con_reset_query_state(network_mysqld_con *con);
@@ -739,6 +754,7 @@ struct chassis_private {
     struct cetus_users_t *users;
     struct cetus_variable_t *stats_variables;
     struct cetus_monitor_t *monitor;
+    GQueue *dirty_cons;                       /**< partial results to write at the end of the loop iteration */
 };
 
 NETWORK_API network_socket_retval_t
@@ -746,6 +762,7 @@ network_mysqld_read_mul_packets(chassis G_GNUC_UNUSED *chas, network_mysqld_con
                                 network_socket *server, int *is_finished);
 
 NETWORK_API void send_part_content_to_client(network_mysqld_con *con);
+NETWORK_API void defer_part_content_to_client(network_mysqld_con *con);
 NETWORK_API void set_conn_attr(network_mysqld_con *con, network_socket *server);
 NETWORK_API int network_mysqld_init(chassis *srv);
 NETWORK_API void network_mysqld_add_connection(chassis *srv, network_mysqld_con *con, gboolean listen);
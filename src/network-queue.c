@@ -25,15 +25,18 @@
 #include "glib-ext.h"
 #include "network-queue.h"
 #include "network-mysqld-proto.h"
+#include "cetus-spill.h"
 
 network_queue *
 network_queue_new()
 {
     network_queue *queue;
 
-    queue = g_new0(network_queue, 1);
+    /* the GQueue shares the allocation, sockets keep several queues */
+    queue = g_malloc0(sizeof(network_queue) + sizeof(GQueue));
 
-    queue->chunks = g_queue_new();
+    queue->chunks = (GQueue *)(queue + 1);
+    g_queue_init(queue->chunks);
 
     return queue;
 }
@@ -50,7 +53,7 @@ network_queue_free(network_queue *queue)
         g_string_free(packet, TRUE);
     }
 
-    g_queue_free(queue->chunks);
+    spill_file_free(queue->spill);
 
     g_free(queue);
 }
@@ -65,6 +68,10 @@ network_queue_clear(network_queue *queue)
         g_string_free(packet, TRUE);
     }
     queue->len = queue->offset = 0;
+
+    spill_file_free(queue->spill);
+    queue->spill = NULL;
+    queue->spilled = 0;
 }
 
 int
@@ -184,3 +191,80 @@ network_queue_pop_str(network_queue *queue, gsize steal_len, GString *dest)
 
     return dest;
 }
+
+/**
+ * move the chunks after the first keep ones to a spill file
+ *
+ * the spilled packets still follow the chunks left in memory and are
+ * brought back in order by network_queue_unspill(). Once a queue spilled,
+ * packets appended to it have to be spilled too before anyone pages in.
+ *
+ * @return bytes moved, -1 if the spill file could not be written
+ */
+gssize
+network_queue_spill(network_queue *queue, guint keep, const char *dir)
+{
+    gssize moved = 0;
+    GList *chunk;
+
+    if (queue->chunks->length <= keep) {
+        return 0;
+    }
+
+    if (!queue->spill) {
+        queue->spill = spill_file_new(dir);
+        if (!queue->spill) {
+            return -1;
+        }
+    }
+
+    chunk = g_queue_peek_nth_link(queue->chunks, keep);
+    while (chunk) {
+        GList *next = chunk->next;
+        GString *s = chunk->data;
+
+        if (!spill_file_write(queue->spill, s)) {
+            return -1;
+        }
+        moved += s->len;
+        queue->len -= s->len;
+        g_string_free(s, TRUE);
+        g_queue_delete_link(queue->chunks, chunk);
+        chunk = next;
+    }
+    queue->spilled += moved;
+
+    return moved;
+}
+
+/**
+ * append spilled packets to the chunks again, at least one if there are any
+ *
+ * @return number of packets paged in
+ */
+guint
+network_queue_unspill(network_queue *queue, gsize bytes)
+{
+    guint count = 0;
+    gsize loaded = 0;
+    GString *s;
+
+    if (!queue->spill) {
+        return 0;
+    }
+
+    while (loaded < bytes && (s = spill_file_read(queue->spill)) != NULL) {
+        loaded += s->len;
+        queue->len += s->len;
+        g_queue_push_tail(queue->chunks, s);
+        count++;
+    }
+
+    if (spill_file_pending(queue->spill) == 0 || count == 0) {
+        spill_file_free(queue->spill);
+        queue->spill = NULL;
+        queue->spilled = 0;
+    }
+
+    return count;
+}
@@ -31,6 +31,9 @@ typedef struct {
 
     size_t len;                 /* len in all chunks (w/o the offset) */
     size_t offset;              /* offset in the first chunk */
+
+    struct spill_file_t *spill; /* packets that follow the chunks, paged out to disk */
+    size_t spilled;             /* bytes moved to the spill file */
 } network_queue;
 
 NETWORK_API network_queue *network_queue_new(void);
@@ -39,5 +42,7 @@ void network_queue_clear(network_queue *queue);
 NETWORK_API int network_queue_append(network_queue *queue, GString *chunk);
 NETWORK_API GString *network_queue_pop_str(network_queue *queue, gsize steal_len, GString *dest);
 NETWORK_API GString *network_queue_peek_str(network_queue *queue, gsize peek_len, GString *dest);
+NETWORK_API gssize network_queue_spill(network_queue *queue, guint keep, const char *dir);
+NETWORK_API guint network_queue_unspill(network_queue *queue, gsize bytes);
 
 #endif
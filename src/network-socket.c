@@ -77,6 +77,9 @@
 #include "network-mysqld-proto.h"
 #include "network-mysqld-packet.h"
 #include "cetus-util.h"
+#include "cetus-upgrade.h"
+#include "cetus-symbol.h"
+#include "chassis-uring.h"
 #include "network-compress.h"
 #include "glib-ext.h"
 
@@ -90,15 +93,8 @@ network_socket_new()
     s->send_queue = network_queue_new();
     s->recv_queue = network_queue_new();
     s->recv_queue_raw = network_queue_new();
-    s->recv_queue_uncompress_raw = network_queue_new();
 
     s->default_db = g_string_new(NULL);
-    s->username = g_string_new(NULL);
-    s->charset = g_string_new(NULL);
-    s->charset_client = g_string_new(NULL);
-    s->charset_connection = g_string_new(NULL);
-    s->charset_results = g_string_new(NULL);
-    s->sql_mode = g_string_new(NULL);
 
     s->fd = -1;
     s->socket_type = SOCK_STREAM;   /* let's default to TCP */
@@ -114,6 +110,8 @@ network_socket_new()
 void
 network_socket_free(network_socket *s)
 {
+    int i;
+
     if (!s)
         return;
 
@@ -136,6 +134,7 @@ network_socket_free(network_socket *s)
     network_address_free(s->dst);
     network_address_free(s->src);
 
+    chassis_timer_cancel(&(s->timer));
     if (s->event.ev_base) {     /* if .ev_base isn't set, the event never got added */
         g_debug("%s:event del, ev:%p", G_STRLOC, &(s->event));
         event_del(&(s->event));
@@ -146,16 +145,169 @@ network_socket_free(network_socket *s)
     }
 
     g_string_free(s->default_db, TRUE);
-    g_string_free(s->charset_client, TRUE);
-    g_string_free(s->charset_connection, TRUE);
-    g_string_free(s->charset, TRUE);
-    g_string_free(s->charset_results, TRUE);
-    g_string_free(s->username, TRUE);
-    g_string_free(s->sql_mode, TRUE);
+    for (i = 0; i < SOCKET_ATTR_NUM; i++) {
+        g_free(s->attr_str[i]);
+    }
+    if (s->username)
+        g_string_free(s->username, TRUE);
 
     g_free(s);
 }
 
+/*
+ * where each attribute sits in attr_sig, 63 bits. An id too large for its
+ * bits marks the signature inexact and the ids are compared one by one.
+ */
+static const struct {
+    symbol_kind_t kind;
+    int shift;
+    int bits;
+} attr_layout[SOCKET_ATTR_NUM] = {
+    {SYMBOL_CHARSET, 0, 8},
+    {SYMBOL_CHARSET, 8, 8},
+    {SYMBOL_CHARSET, 16, 8},
+    {SYMBOL_CHARSET, 24, 8},
+    {SYMBOL_SQL_MODE, 32, 12},
+    {SYMBOL_DB, 44, 19},
+};
+
+#define ATTR_SIG_INEXACT (G_GUINT64_CONSTANT(1) << 63)
+
+static void
+socket_attr_pack(network_socket *sock)
+{
+    guint64 sig = 0;
+    int i;
+
+    for (i = 0; i < SOCKET_ATTR_NUM; i++) {
+        guint32 id = sock->attr[i];
+        if (id >> attr_layout[i].bits) {
+            sig = ATTR_SIG_INEXACT;
+            break;
+        }
+        sig |= (guint64)id << attr_layout[i].shift;
+    }
+    sock->attr_sig = sig;
+}
+
+/* id is SYMBOL_OVERFLOW with str the value, or an interned id */
+static void
+socket_attr_assign(network_socket *sock, socket_attr_t attr, guint32 id, const char *str, gsize len)
+{
+    gchar *old = sock->attr_str[attr];
+
+    /* str may be old itself */
+    sock->attr_str[attr] = id == SYMBOL_OVERFLOW ? g_strndup(str, len) : NULL;
+    sock->attr[attr] = id;
+    g_free(old);
+}
+
+/**
+ * set a session attribute of the socket, value may be NULL for empty
+ */
+void
+network_socket_set_attr(network_socket *sock, socket_attr_t attr, const char *value, gsize len)
+{
+    socket_attr_assign(sock, attr, symbol_intern(attr_layout[attr].kind, value, len), value, len);
+    if (attr == SOCKET_ATTR_DEFAULT_DB) {
+        g_string_assign_len(sock->default_db, value ? value : "", value ? len : 0);
+    }
+    socket_attr_pack(sock);
+}
+
+/**
+ * what SET NAMES does: the charset and the client, connection and results
+ * charsets all become value
+ */
+void
+network_socket_set_names(network_socket *sock, const char *value, gsize len)
+{
+    guint32 id = symbol_intern(SYMBOL_CHARSET, value, len);
+
+    socket_attr_assign(sock, SOCKET_ATTR_CHARSET, id, value, len);
+    socket_attr_assign(sock, SOCKET_ATTR_CHARSET_CLIENT, id, value, len);
+    socket_attr_assign(sock, SOCKET_ATTR_CHARSET_CONNECTION, id, value, len);
+    socket_attr_assign(sock, SOCKET_ATTR_CHARSET_RESULTS, id, value, len);
+    socket_attr_pack(sock);
+}
+
+/* dst ran SET NAMES with the charset of src */
+void
+network_socket_copy_names(network_socket *dst, const network_socket *src)
+{
+    if (dst == src) {
+        return;
+    }
+
+    guint32 id = src->attr[SOCKET_ATTR_CHARSET];
+    const char *str = src->attr_str[SOCKET_ATTR_CHARSET];
+    gsize len = str ? strlen(str) : 0;
+
+    socket_attr_assign(dst, SOCKET_ATTR_CHARSET, id, str, len);
+    socket_attr_assign(dst, SOCKET_ATTR_CHARSET_CLIENT, id, str, len);
+    socket_attr_assign(dst, SOCKET_ATTR_CHARSET_CONNECTION, id, str, len);
+    socket_attr_assign(dst, SOCKET_ATTR_CHARSET_RESULTS, id, str, len);
+    socket_attr_pack(dst);
+}
+
+void
+network_socket_copy_attr(network_socket *dst, const network_socket *src, socket_attr_t attr)
+{
+    const char *str = src->attr_str[attr];
+
+    socket_attr_assign(dst, attr, src->attr[attr], str, str ? strlen(str) : 0);
+    if (attr == SOCKET_ATTR_DEFAULT_DB) {
+        g_string_assign_len(dst->default_db, S(src->default_db));
+    }
+    socket_attr_pack(dst);
+}
+
+const char *
+network_socket_attr(const network_socket *sock, socket_attr_t attr)
+{
+    if (sock->attr[attr] == SYMBOL_OVERFLOW) {
+        return sock->attr_str[attr];
+    }
+    return symbol_name(attr_layout[attr].kind, sock->attr[attr]);
+}
+
+/**
+ * compare one session attribute of two sockets, by string for the values
+ * the symbol tables had no room for
+ */
+gboolean
+network_socket_attr_equal(const network_socket *a, const network_socket *b, socket_attr_t attr)
+{
+    if (a->attr[attr] != b->attr[attr]) {
+        return FALSE;
+    }
+    if (a->attr[attr] != SYMBOL_OVERFLOW) {
+        return TRUE;
+    }
+    return strcmp(a->attr_str[attr], b->attr_str[attr]) == 0;
+}
+
+/**
+ * compare all session attributes of two sockets
+ */
+gboolean
+network_socket_attrs_equal(const network_socket *a, const network_socket *b)
+{
+    if (a->attr_sig != b->attr_sig) {
+        return FALSE;
+    }
+    if (!(a->attr_sig & ATTR_SIG_INEXACT)) {
+        return TRUE;
+    }
+    int i;
+    for (i = 0; i < SOCKET_ATTR_NUM; i++) {
+        if (!network_socket_attr_equal(a, b, i)) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
 /**
  * portable 'set non-blocking io'
  *
@@ -395,6 +547,17 @@ network_socket_bind(network_socket *con)
         g_return_val_if_fail(con->dst, NETWORK_SOCKET_ERROR);
         g_return_val_if_fail(con->dst->name->len > 0, NETWORK_SOCKET_ERROR);
 
+        if (-1 != (con->fd = cetus_upgrade_take_listener(con->dst->name->str))) {
+            g_message("%s: listen on %s with the socket of the old process", G_STRLOC, con->dst->name->str);
+            /* the old one may have stopped accepting with a 0 backlog */
+            if (-1 == listen(con->fd, 128)) {
+                g_critical("%s: listen(%s, 128) failed: %s (%d)", G_STRLOC, con->dst->name->str, g_strerror(errno), errno);
+                return NETWORK_SOCKET_ERROR;
+            }
+            con->dst->can_unlink_socket = TRUE;
+            return NETWORK_SOCKET_SUCCESS;
+        }
+
         if (-1 == (con->fd = socket(con->dst->addr.common.sa_family, con->socket_type, 0))) {
             g_critical("%s: socket(%s) failed: %s (%d)", G_STRLOC, con->dst->name->str, g_strerror(errno), errno);
             return NETWORK_SOCKET_ERROR;
@@ -415,6 +578,14 @@ network_socket_bind(network_socket *con)
                            G_STRLOC, con->dst->name->str, g_strerror(errno), errno);
                 return NETWORK_SOCKET_ERROR;
             }
+#ifdef SO_REUSEPORT
+            if (con->reuse_port && 0 != setsockopt(con->fd, SOL_SOCKET, SO_REUSEPORT, SETSOCKOPT_OPTVAL_CAST & val,
+                                                   sizeof(val))) {
+                g_critical("%s: setsockopt(%s, SOL_SOCKET, SO_REUSEPORT) failed: %s (%d)",
+                           G_STRLOC, con->dst->name->str, g_strerror(errno), errno);
+                return NETWORK_SOCKET_ERROR;
+            }
+#endif
         }
 
         if (con->dst->addr.common.sa_family == AF_INET6) {
@@ -805,38 +976,17 @@ network_socket_compressed_write(network_socket *con, int send_chunks)
     return NETWORK_SOCKET_SUCCESS;
 }
 
-/**
- * write data to the socket
- *
- */
-static network_socket_retval_t
-network_socket_write_writev(network_socket *con, int send_chunks)
+/* point iov at the first chunks of the send queue, @return number of entries */
+static gint
+network_socket_fill_iov(network_socket *con, int send_chunks, struct iovec *iov, gint max_chunk_count)
 {
-    /* send the whole queue */
     GList *chunk;
-    struct iovec *iov;
     gint chunk_id;
     gint chunk_count;
-    gssize len;
-    int os_errno;
-    gint max_chunk_count;
-
-    if (send_chunks == 0)
-        return NETWORK_SOCKET_SUCCESS;
 
     chunk_count = send_chunks > 0 ? send_chunks : (gint)con->send_queue->chunks->length;
-
-    if (chunk_count == 0)
-        return NETWORK_SOCKET_SUCCESS;
-
-    max_chunk_count = UIO_MAXIOV;
-
     chunk_count = chunk_count > max_chunk_count ? max_chunk_count : chunk_count;
 
-    g_assert_cmpint(chunk_count, >, 0); /* make sure it is never negative */
-
-    iov = g_new0(struct iovec, chunk_count);
-
     for (chunk = con->send_queue->chunks->head, chunk_id = 0;
          chunk && chunk_id < chunk_count; chunk_id++, chunk = chunk->next) {
         GString *s = chunk->data;
@@ -856,14 +1006,14 @@ network_socket_write_writev(network_socket *con, int send_chunks)
         }
     }
 
-    g_debug("%s: network socket:%p, send (src:%s, dst:%s) fd:%d",
-            G_STRLOC, con, con->src->name->str, con->dst->name->str, con->fd);
-
-    len = writev(con->fd, iov, chunk_count);
-    g_debug("%s: tcp write:%d, chunk count:%d", G_STRLOC, (int)len, (int)chunk_count);
-    os_errno = errno;
+    return chunk_id;
+}
 
-    g_free(iov);
+/* drop the chunks of the send queue that len bytes completed */
+static network_socket_retval_t
+network_socket_write_done(network_socket *con, gssize len, int os_errno)
+{
+    GList *chunk;
 
     if (-1 == len) {
         switch (os_errno) {
@@ -876,7 +1026,7 @@ network_socket_write_writev(network_socket *con, int send_chunks)
                 /** remote side closed the connection */
             return NETWORK_SOCKET_ERROR;
         default:
-            g_message("%s: writev(%s, ...) failed: %s", G_STRLOC, con->dst->name->str, g_strerror(errno));
+            g_message("%s: writev(%s, ...) failed: %s", G_STRLOC, con->dst->name->str, g_strerror(os_errno));
             return NETWORK_SOCKET_ERROR;
         }
     } else if (len == 0) {
@@ -930,6 +1080,48 @@ network_socket_write_writev(network_socket *con, int send_chunks)
     return NETWORK_SOCKET_SUCCESS;
 }
 
+/**
+ * write data to the socket
+ *
+ */
+static network_socket_retval_t
+network_socket_write_writev(network_socket *con, int send_chunks)
+{
+    /* send the whole queue */
+    struct iovec iov[UIO_MAXIOV];
+    gint chunk_count;
+    gssize len;
+
+    if (send_chunks == 0)
+        return NETWORK_SOCKET_SUCCESS;
+
+    chunk_count = network_socket_fill_iov(con, send_chunks, iov, UIO_MAXIOV);
+
+    if (chunk_count == 0)
+        return NETWORK_SOCKET_SUCCESS;
+
+    g_debug("%s: network socket:%p, send (src:%s, dst:%s) fd:%d",
+            G_STRLOC, con, con->src->name->str, con->dst->name->str, con->fd);
+
+#ifdef MSG_MORE
+    if (con->write_more) {
+        /* let the kernel hold back the partial last segment until the rest comes */
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = chunk_count;
+        len = sendmsg(con->fd, &msg, MSG_MORE);
+    } else {
+        len = writev(con->fd, iov, chunk_count);
+    }
+#else
+    len = writev(con->fd, iov, chunk_count);
+#endif
+    g_debug("%s: tcp write:%d, chunk count:%d", G_STRLOC, (int)len, (int)chunk_count);
+
+    return network_socket_write_done(con, len, errno);
+}
+
 /**
  * write a content of con->send_queue to the socket
  *
@@ -944,17 +1136,83 @@ network_socket_retval_t
 network_socket_write(network_socket *sock, int send_chunks)
 {
     if (sock->socket_type == SOCK_STREAM) {
+        network_socket_retval_t ret;
         if (sock->do_compress) {
-            return network_socket_compressed_write(sock, send_chunks);
+            ret = network_socket_compressed_write(sock, send_chunks);
         } else {
-            return network_socket_write_writev(sock, send_chunks);
+            ret = network_socket_write_writev(sock, send_chunks);
         }
+        sock->write_more = 0;
+        return ret;
     } else {
         g_critical("%s: udp write is not supported", G_STRLOC);
         return NETWORK_SOCKET_ERROR;
     }
 }
 
+/* sockets of one io_uring batch, and the chunks each may send, 16k of stack */
+#define NETWORK_BATCH_SOCKETS 32
+#define NETWORK_BATCH_IOV 32
+
+/**
+ * write the send queues of several sockets, all sends go to the kernel in
+ * one system call when the io_uring engine is on, otherwise this is
+ * network_socket_write() on each. Only for the event loop thread.
+ */
+void
+network_socket_write_batch(network_socket **socks, guint n, network_socket_retval_t *rets)
+{
+    struct iovec iovs[NETWORK_BATCH_SOCKETS][NETWORK_BATCH_IOV];
+    struct msghdr msgs[NETWORK_BATCH_SOCKETS];
+    int fds[NETWORK_BATCH_SOCKETS];
+    int flags[NETWORK_BATCH_SOCKETS];
+    gssize results[NETWORK_BATCH_SOCKETS];
+    guint index[NETWORK_BATCH_SOCKETS];
+    guint i = 0;
+
+    while (i < n) {
+        guint count = 0;
+        for (; i < n && count < NETWORK_BATCH_SOCKETS; i++) {
+            network_socket *sock = socks[i];
+            rets[i] = NETWORK_SOCKET_SUCCESS;
+            if (!chassis_uring_enabled() || sock->socket_type != SOCK_STREAM || sock->do_compress) {
+                rets[i] = network_socket_write(sock, -1);
+                continue;
+            }
+            gint chunk_count = network_socket_fill_iov(sock, -1, iovs[count], NETWORK_BATCH_IOV);
+            if (chunk_count == 0) {
+                continue;
+            }
+            memset(&msgs[count], 0, sizeof(msgs[count]));
+            msgs[count].msg_iov = iovs[count];
+            msgs[count].msg_iovlen = chunk_count;
+            fds[count] = sock->fd;
+#ifdef MSG_MORE
+            flags[count] = sock->write_more ? MSG_MORE : 0;
+#else
+            flags[count] = 0;
+#endif
+            index[count] = i;
+            count++;
+        }
+        if (count == 0) {
+            continue;
+        }
+
+        chassis_uring_sendmsg_batch(fds, msgs, flags, results, count);
+        guint k;
+        for (k = 0; k < count; k++) {
+            network_socket *sock = socks[index[k]];
+            if (results[k] < 0) {
+                rets[index[k]] = network_socket_write_done(sock, -1, (int)-results[k]);
+            } else {
+                rets[index[k]] = network_socket_write_done(sock, results[k], 0);
+            }
+            sock->write_more = 0;
+        }
+    }
+}
+
 network_socket_retval_t
 network_socket_to_read(network_socket *sock)
 {
@@ -51,6 +51,7 @@
 #include <event.h>
 
 #include "network-address.h"
+#include "chassis-event.h"
 
 typedef enum {
     NETWORK_SOCKET_SUCCESS,
@@ -97,10 +98,22 @@ typedef struct {
     int query_status;
 } server_query_status;
 
+/* session attributes kept in sync between client and server sockets */
+typedef enum {
+    SOCKET_ATTR_CHARSET,
+    SOCKET_ATTR_CHARSET_CLIENT,
+    SOCKET_ATTR_CHARSET_CONNECTION,
+    SOCKET_ATTR_CHARSET_RESULTS,
+    SOCKET_ATTR_SQL_MODE,
+    SOCKET_ATTR_DEFAULT_DB,
+    SOCKET_ATTR_NUM
+} socket_attr_t;
+
 typedef struct {
     int fd;             /**< socket-fd */
     guint32 create_or_update_time;
     struct event event; /**< events for this fd */
+    chassis_timer_t timer; /**< long timeout of event, see chassis_event_add_with_timer() */
 
     network_address *src; /**< getsockname() */
     network_address *dst; /**< getpeername() */
@@ -116,7 +129,7 @@ typedef struct {
 
     network_queue *recv_queue;
     network_queue *recv_queue_raw;
-    network_queue *recv_queue_uncompress_raw;
+    network_queue *recv_queue_uncompress_raw;   /* only with do_compress */
     network_queue *send_queue;
     network_queue *cache_queue;
     GString *last_compressed_packet;
@@ -153,6 +166,8 @@ typedef struct {
     unsigned int do_compress:1;
     unsigned int do_strict_compress:1;
     unsigned int do_query_cache:1;
+    unsigned int reuse_port:1;         /** listen with SO_REUSEPORT, shared by the workers */
+    unsigned int write_more:1;         /** more of the response follows the next write, cleared by it */
 
     guint8 charset_code;
 
@@ -160,18 +175,18 @@ typedef struct {
      * store the default-db of the socket
      *
      * the client might have a different default-db than the server-side due to
-     * statement balancing
+     * statement balancing. Set it by network_socket_set_attr(), which keeps
+     * attr[SOCKET_ATTR_DEFAULT_DB] in sync.
      */
     GString *default_db;     /** default-db of this side of the connection */
-    /* only used for server */
+    /* only used for server, NULL on client sockets */
     GString *username;
     GString *group;
 
-    GString *charset;
-    GString *charset_client;
-    GString *charset_connection;
-    GString *charset_results;
-    GString *sql_mode;
+    /* ids of cetus-symbol.h, read by network_socket_attr() */
+    guint32 attr[SOCKET_ATTR_NUM];
+    gchar *attr_str[SOCKET_ATTR_NUM];   /* the value where attr[] is SYMBOL_OVERFLOW, else NULL */
+    guint64 attr_sig;        /** attr[] packed for one compare, see network_socket_attrs_equal() */
     server_state_data parse;
     server_query_status qstat;
 
@@ -180,6 +195,7 @@ typedef struct {
 NETWORK_API network_socket *network_socket_new(void);
 NETWORK_API void network_socket_free(network_socket *s);
 NETWORK_API network_socket_retval_t network_socket_write(network_socket *con, int send_chunks);
+NETWORK_API void network_socket_write_batch(network_socket **socks, guint n, network_socket_retval_t *rets);
 NETWORK_API network_socket_retval_t network_socket_read(network_socket *con);
 NETWORK_API network_socket_retval_t network_socket_to_read(network_socket *sock);
 NETWORK_API network_socket_retval_t network_socket_set_non_blocking(network_socket *sock);
@@ -189,4 +205,12 @@ NETWORK_API network_socket_retval_t network_socket_bind(network_socket *con);
 NETWORK_API network_socket *network_socket_accept(network_socket *srv, int *reason);
 NETWORK_API network_socket_retval_t network_socket_set_send_buffer_size(network_socket *sock, int size);
 
+NETWORK_API void network_socket_set_attr(network_socket *sock, socket_attr_t attr, const char *value, gsize len);
+NETWORK_API void network_socket_set_names(network_socket *sock, const char *value, gsize len);
+NETWORK_API void network_socket_copy_names(network_socket *dst, const network_socket *src);
+NETWORK_API void network_socket_copy_attr(network_socket *dst, const network_socket *src, socket_attr_t attr);
+NETWORK_API const char *network_socket_attr(const network_socket *sock, socket_attr_t attr);
+NETWORK_API gboolean network_socket_attr_equal(const network_socket *a, const network_socket *b, socket_attr_t attr);
+NETWORK_API gboolean network_socket_attrs_equal(const network_socket *a, const network_socket *b);
+
 #endif
@@ -119,7 +119,7 @@ do_read_auth(network_mysqld_con *con, GHashTable *allow_ip_table, GHashTable *de
 
         con->client->response = auth;
 
-        g_string_assign_len(con->client->default_db, S(auth->database));
+        network_socket_set_attr(con->client, SOCKET_ATTR_DEFAULT_DB, S(auth->database));
         g_debug("%s:1nd round auth and set default db:%s for con:%p", G_STRLOC, con->client->default_db->str, con);
 
     } else {
@@ -175,10 +175,9 @@ do_read_auth(network_mysqld_con *con, GHashTable *allow_ip_table, GHashTable *de
 
     const char *client_charset = charset_get_name(auth->charset);
     recv_sock->charset_code = auth->charset;
-    g_string_assign(recv_sock->charset, client_charset);
-    g_string_assign(recv_sock->charset_client, client_charset);
-    g_string_assign(recv_sock->charset_results, client_charset);
-    g_string_assign(recv_sock->charset_connection, client_charset);
+    if (client_charset) {
+        network_socket_set_names(recv_sock, client_charset, strlen(client_charset));
+    }
 
     cetus_users_t *users = con->srv->priv->users;
     network_mysqld_auth_challenge *challenge = con->client->challenge;
@@ -522,7 +521,7 @@ proxy_put_shard_conn_to_pool(network_mysqld_con *con)
                 g_warning("%s: xa is not over yet", G_STRLOC);
             }
 
-            if (is_put_to_pool_allowed && server->recv_queue->chunks->length > 0) {
+            if (is_put_to_pool_allowed && (server->recv_queue->chunks->length > 0 || server->recv_queue->spill)) {
                 g_message("%s: server recv queue not empty, sql:%s", G_STRLOC, con->orig_sql->str);
                 is_put_to_pool_allowed = 0;
             }
@@ -584,12 +583,7 @@ remove_mul_server_recv_packets(network_mysqld_con *con)
     for (iter = 0; iter < con->servers->len; iter++) {
         server_session_t *ss = g_ptr_array_index(con->servers, iter);
         g_debug("%s: remove packets for server:%p", G_STRLOC, ss->server);
-        GQueue *out = ss->server->recv_queue->chunks;
-        GString *packet = g_queue_pop_head(out);
-        while (packet) {
-            g_string_free(packet, TRUE);
-            packet = g_queue_pop_head(out);
-        }
+        network_queue_clear(ss->server->recv_queue);
         network_mysqld_queue_reset(ss->server);
     }
 }
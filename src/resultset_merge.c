@@ -1731,6 +1731,99 @@ fulfill_condi(char *aggr_value, having_condition_t *hav_condi, result_merge_t *m
     return FALSE;
 }
 
+/* spilled rows paged back in at a time */
+#define SPILL_PAGE_SIZE (256 * 1024)
+
+/*
+ * Spilling: without tcp stream, a cross-shard SELECT buffers every shard
+ * response completely before merging. Once the responses of a connection
+ * hold spill-threshold bytes, or those of all connections hold
+ * spill-global-threshold bytes, the rows read so far go to a spill file,
+ * after the header packets and the first row, and every row read later
+ * follows them. The merge pages the rows back in as it walks the shards.
+ */
+void
+resultset_merge_account_spill(network_mysqld_con *con, gint64 resident)
+{
+    con->srv->spill_resident += resident - con->spill_resident;
+    con->spill_resident = resident;
+}
+
+static gboolean
+merge_spill_eligible(network_mysqld_con *con)
+{
+    shard_plugin_con_t *st = con->plugin_con_state;
+
+    /* multiple_server_mode is the rw-splitting prepared statement case */
+    if (con->multiple_server_mode || con->candidate_tcp_streamed || !con->servers || con->servers->len < 2) {
+        return FALSE;
+    }
+
+    if (con->bind_join || con->batch_dml || !st || !st->sql_context) {
+        return FALSE;
+    }
+
+    return st->sql_context->stmt_type == STMT_SELECT && !st->sql_context->explain;
+}
+
+gboolean
+resultset_merge_spill(network_mysqld_con *con, network_socket *server)
+{
+    chassis *srv = con->srv;
+    network_queue *queue = server->recv_queue;
+    gint64 resident = 0;
+    guint64 field_count = 0;
+    gssize moved;
+    guint i;
+
+    if ((srv->spill_threshold <= 0 && srv->spill_global_threshold <= 0) || !merge_spill_eligible(con)) {
+        return TRUE;
+    }
+
+    for (i = 0; i < con->servers->len; i++) {
+        server_session_t *ss = g_ptr_array_index(con->servers, i);
+        resident += ss->server->resp_len - (gint64)ss->server->recv_queue->spilled;
+    }
+    resultset_merge_account_spill(con, resident);
+
+    /* once spilling, later rows must follow the spilled ones */
+    if (!queue->spill) {
+        if (!(srv->spill_threshold > 0 && resident > srv->spill_threshold)
+            && !(srv->spill_global_threshold > 0 && srv->spill_resident > srv->spill_global_threshold)) {
+            return TRUE;
+        }
+    }
+
+    /* headers and the first row stay, the merge parses them in place */
+    if (!cetus_result_retrieve_field_count(queue->chunks, &field_count) || field_count == 0) {
+        return TRUE;
+    }
+
+    moved = network_queue_spill(queue, field_count + 3, srv->spill_dir);
+    if (moved < 0) {
+        g_warning("%s: spill failed for con:%p", G_STRLOC, con);
+        return FALSE;
+    }
+    if (moved > 0) {
+        g_debug("%s: spilled %lld bytes, server:%p, con:%p", G_STRLOC, (long long)moved, server, con);
+        srv->spill_bytes += moved;
+        resultset_merge_account_spill(con, resident - moved);
+    }
+
+    return srv->spill_max_size <= 0 || (gint64)queue->spilled <= srv->spill_max_size;
+}
+
+/* the packet after link in a shard queue, paging spilled ones back in at the end */
+static GList *
+next_packet(network_queue *queue, GList *link)
+{
+    if (link->next == NULL && queue->spill) {
+        network_queue_unspill(queue, SPILL_PAGE_SIZE);
+    }
+
+    return link->next;
+}
+
 static int
 aggr_by_group(aggr_by_group_para_t *para, GList **candidates, guint *pkt_count, result_merge_t *merged_result)
 {
@@ -1785,7 +1878,7 @@ aggr_by_group(aggr_by_group_para_t *para, GList **candidates, guint *pkt_count,
                     candidate = tmp_list;
                     cand_index = iter;
                 } else if (result == 0) {
-                    candidates[iter] = tmp_list->next;
+                    candidates[iter] = next_packet(recv_queues->pdata[iter], tmp_list);
                     continue;
                 }
             }
@@ -1794,8 +1887,8 @@ aggr_by_group(aggr_by_group_para_t *para, GList **candidates, guint *pkt_count,
         g_debug("candidate:%p", candidate);
         if (off_pos < para->limit->offset) {
             off_pos++;
-            candidates[cand_index] = candidate->next;
-            candidate = candidate->next;
+            candidates[cand_index] = next_packet(recv_queues->pdata[cand_index], candidate);
+            candidate = candidates[cand_index];
             continue;
         } else {
             char aggr_value[MAX_COL_VALUE_LEN] = { 0 };
@@ -1810,10 +1903,10 @@ aggr_by_group(aggr_by_group_para_t *para, GList **candidates, guint *pkt_count,
                 g_string_free((GString *)candidate->data, TRUE);
             }
 
-            candidates[cand_index] = candidate->next;
-            GList *ptr_to_unlink = candidate;
-            candidate = candidate->next;
             network_queue *recv_queue = recv_queues->pdata[cand_index];
+            candidates[cand_index] = next_packet(recv_queue, candidate);
+            GList *ptr_to_unlink = candidate;
+            candidate = candidates[cand_index];
             g_queue_delete_link(recv_queue->chunks, ptr_to_unlink);
         }
     }
@@ -1903,10 +1996,148 @@ heap_adjust(heap_type *heap, int s, int m, int *compare_failed)
     heap->element[s]->refreshed = 1;
 }
 
+/*
+ * Backpressure for streamed merges: the merged rows wait in client->send_queue
+ * until the client reads them. Once a connection holds merge-buffer-high-water
+ * bytes, the shard sockets are left unarmed, so the backends block in their
+ * own send buffers, and are armed again after the client drained below
+ * merge-buffer-low-water. While all connections hold merge-buffer-budget
+ * bytes, only those with more than merge-buffer-low-water waiting pause, the
+ * ones whose clients keep up go on.
+ */
+void
+resultset_merge_account_output(network_mysqld_con *con)
+{
+    gint64 buffered = con->client ? (gint64)con->client->send_queue->len : 0;
+
+    con->srv->merge_buffered += buffered - con->merge_buffered;
+    con->merge_buffered = buffered;
+}
+
+void
+resultset_merge_cancel_pause(network_mysqld_con *con)
+{
+    if (!con->shard_reads_paused) {
+        return;
+    }
+
+    if (con->client) {
+        event_del(&con->client->event);
+    }
+    con->shard_reads_paused = 0;
+    con->paused_servers = 0;
+    con->srv->merge_paused--;
+}
+
+static void merge_resume_handler(int fd, short events, void *user_data);
+
+/* a paused connection always has output pending, it resumes as the client reads */
+static void
+merge_wait_client(network_mysqld_con *con)
+{
+    network_socket *client = con->client;
+
+    event_set(&client->event, client->fd, EV_WRITE, merge_resume_handler, con);
+    chassis_event_add_with_timer(con->srv, &client->event, &client->timer, &con->write_timeout);
+}
+
+static gboolean
+merge_over_high_water(network_mysqld_con *con)
+{
+    chassis *srv = con->srv;
+
+    if (srv->merge_high_water > 0 && con->merge_buffered >= srv->merge_high_water) {
+        return TRUE;
+    }
+
+    /* over budget, pause the connections holding a backlog, not the draining ones */
+    return srv->merge_budget > 0 && srv->merge_buffered >= srv->merge_budget
+        && con->merge_buffered > srv->merge_low_water;
+}
+
+/* returns TRUE if the shard read is deferred until the client drained */
+static gboolean
+merge_pause_shard_reads(network_mysqld_con *con, int ss_index)
+{
+    resultset_merge_account_output(con);
+
+    if (!con->shard_reads_paused) {
+        if (!merge_over_high_water(con)) {
+            return FALSE;
+        }
+        g_debug("%s: pause shard reads, buffered:%lld, all:%lld, con:%p", G_STRLOC,
+                (long long)con->merge_buffered, (long long)con->srv->merge_buffered, con);
+        con->shard_reads_paused = 1;
+        con->paused_servers = 0;
+        con->srv->merge_paused++;
+        merge_wait_client(con);
+    }
+
+    if (ss_index < 0) {
+        con->paused_servers = ~G_GUINT64_CONSTANT(0);
+    } else {
+        con->paused_servers |= G_GUINT64_CONSTANT(1) << ss_index;
+    }
+
+    return TRUE;
+}
+
+static void check_server_sess_wait_for_event(network_mysqld_con *, int, short, struct timeval *);
+
+static void
+merge_resume_handler(int fd, short events, void *user_data)
+{
+    network_mysqld_con *con = user_data;
+    chassis *srv = con->srv;
+    guint64 servers;
+    guint i;
+
+    if (events == EV_TIMEOUT) {
+        g_message("%s: client stopped reading the merged result, con:%p", G_STRLOC, con);
+        con->prev_state = con->state;
+        con->state = ST_ERROR;
+    } else if (con->client->send_queue->len > 0) {
+        send_part_content_to_client(con);
+    }
+
+    if (con->state == ST_ERROR) {
+        resultset_merge_account_output(con);
+        con->shard_reads_paused = 0;
+        con->paused_servers = 0;
+        srv->merge_paused--;
+        network_mysqld_con_handle(-1, 0, con);
+        return;
+    }
+
+    resultset_merge_account_output(con);
+    if (con->merge_buffered > srv->merge_low_water) {
+        merge_wait_client(con);
+        return;
+    }
+
+    g_debug("%s: resume shard reads, buffered:%lld, all:%lld, con:%p", G_STRLOC,
+            (long long)con->merge_buffered, (long long)srv->merge_buffered, con);
+    servers = con->paused_servers;
+    con->shard_reads_paused = 0;
+    con->paused_servers = 0;
+    srv->merge_paused--;
+
+    for (i = 0; i < con->servers->len && i < MAX_SERVER_NUM; i++) {
+        if (servers & (G_GUINT64_CONSTANT(1) << i)) {
+            check_server_sess_wait_for_event(con, i, EV_READ, &con->read_timeout);
+        }
+    }
+}
+
 static void
 check_server_sess_wait_for_event(network_mysqld_con *con, int ss_index, short ev_type, struct timeval *timeout)
 {
     size_t i;
+
+    if (ev_type == EV_READ && merge_pause_shard_reads(con, ss_index)) {
+        return;
+    }
+
     for (i = 0; i < con->servers->len; i++) {
         server_session_t *ss = g_ptr_array_index(con->servers, i);
         if (ss_index >= 0) {
@@ -1925,8 +2156,8 @@ check_server_sess_wait_for_event(network_mysqld_con *con, int ss_index, short ev
             g_debug("%s: ss %d is not read finished, read pending:%d, fd:%d, ss index:%d",
                     G_STRLOC, (int)i, con->num_read_pending, ss->server->fd, ss->index);
             event_set(&(ss->server->event), ss->server->fd, ev_type, server_session_con_handler, ss);
-            chassis_event_add_with_timeout(con->srv, &(ss->server->event), timeout);
-            g_debug("%s: call chassis_event_add_with_timeout", G_STRLOC);
+            chassis_event_add_with_timer(con->srv, &(ss->server->event), &(ss->server->timer), timeout);
+            g_debug("%s: call chassis_event_add_with_timer", G_STRLOC);
             ss->server->is_waiting = 1;
         } else {
             g_debug("%s: ss %d is read finished", G_STRLOC, (int)i);
@@ -1964,11 +2195,11 @@ check_after_limit(network_mysqld_con *con, merge_parameters_t *data, int is_fini
                 break;
             }
 
-            candidates[iter] = candidate->next;
+            network_queue *recv_queue = recv_queues->pdata[iter];
+            candidates[iter] = next_packet(recv_queue, candidate);
             g_debug("%s: free packet addr:%p, iter:%d, pkt_type:%d", G_STRLOC,
                     candidate->data, (int)iter, (int)pkt_type);
             g_string_free((GString *)candidate->data, TRUE);
-            network_queue *recv_queue = recv_queues->pdata[iter];
             g_queue_delete_link(recv_queue->chunks, candidate);
         } while (!is_over);
     }
@@ -2054,13 +2285,13 @@ do_simple_merge(network_mysqld_con *con, merge_parameters_t *data, int is_finish
                 network_queue_append(send_queue, (GString *)candidate->data);
                 if (data->aggr_output_len >= merged_output_size) {
                     g_debug("%s: send_part_content_to_client:%d, iter:%d", G_STRLOC, data->aggr_output_len, (int)iter);
-                    send_part_content_to_client(con);
+                    defer_part_content_to_client(con);
                     data->aggr_output_len = 0;
                 }
                 (*row_cnter)++;
             }
 
-            candidates[iter] = candidate->next;
+            candidates[iter] = next_packet(recv_queue, candidate);
             g_queue_delete_link(recv_queue->chunks, candidate);
             candidate = candidates[iter];
         }
@@ -2081,7 +2312,7 @@ do_simple_merge(network_mysqld_con *con, merge_parameters_t *data, int is_finish
         con->partially_merged = 1;
         g_debug("%s: need more reading for:%p", G_STRLOC, con);
         if (data->aggr_output_len >= merged_output_size) {
-            send_part_content_to_client(con);
+            defer_part_content_to_client(con);
             data->aggr_output_len = 0;
         }
         check_server_sess_wait_for_event(con, -1, EV_READ, &con->read_timeout);
@@ -2171,7 +2402,7 @@ do_sort_merge(network_mysqld_con *con, merge_parameters_t *data, int is_finished
 
             if (data->aggr_output_len >= merged_output_size) {
                 g_debug("%s: send_part_content_to_client:%d", G_STRLOC, data->aggr_output_len);
-                send_part_content_to_client(con);
+                defer_part_content_to_client(con);
                 data->aggr_output_len = 0;
             }
         }
@@ -2180,10 +2411,10 @@ do_sort_merge(network_mysqld_con *con, merge_parameters_t *data, int is_finished
         heap->element[0]->is_err = 0;
         heap->element[0]->refreshed = 0;
         heap->element[0]->is_prior_to = 0;
-        heap->element[0]->record = heap->element[0]->record->next;
-
-        candidates[cand_index] = candidate->next;
         network_queue *recv_queue = recv_queues->pdata[cand_index];
+        candidates[cand_index] = next_packet(recv_queue, candidate);
+        heap->element[0]->record = candidates[cand_index];
+
         g_debug("%s: remove candidate:%p for queue:%p, ss:%d", G_STRLOC, candidate, recv_queue, cand_index);
         g_queue_delete_link(recv_queue->chunks, candidate);
 
@@ -2191,7 +2422,7 @@ do_sort_merge(network_mysqld_con *con, merge_parameters_t *data, int is_finished
             con->partially_merged = 1;
             g_debug("%s: item is nil, index:%d", G_STRLOC, cand_index);
             if (data->aggr_output_len >= merged_output_size) {
-                send_part_content_to_client(con);
+                defer_part_content_to_client(con);
                 g_debug("%s: send_part_content_to_client:%d", G_STRLOC, data->aggr_output_len);
                 data->aggr_output_len = 0;
             }
@@ -89,6 +89,11 @@ typedef struct aggr_by_group_para_s {
 NETWORK_API int callback_merge(network_mysqld_con *, merge_parameters_t *, int);
 NETWORK_API void resultset_merge(network_queue *, GPtrArray *, network_mysqld_con *, uint64_t *, result_merge_t *);
 
+NETWORK_API void resultset_merge_account_output(network_mysqld_con *);
+NETWORK_API void resultset_merge_cancel_pause(network_mysqld_con *);
+NETWORK_API void resultset_merge_account_spill(network_mysqld_con *, gint64);
+NETWORK_API gboolean resultset_merge_spill(network_mysqld_con *, network_socket *);
+
 NETWORK_API gint check_dist_tran_resultset(network_queue *recv_queue, network_mysqld_con *);
 
 #endif
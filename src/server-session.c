@@ -50,7 +50,7 @@ void
 server_sess_wait_for_event(server_session_t *ss, short ev_type, struct timeval *timeout)
 {
     event_set(&(ss->server->event), ss->server->fd, ev_type, server_session_con_handler, ss);
-    chassis_event_add_with_timeout(ss->con->srv, &(ss->server->event), timeout);
+    chassis_event_add_with_timer(ss->con->srv, &(ss->server->event), &(ss->server->timer), timeout);
     ss->server->is_waiting = 1;
 }
 
@@ -278,6 +278,7 @@ process_read_server(network_mysqld_con *con, server_session_t *ss)
 {
     int is_finished = 0;
     int ret = 0;
+    int spill_failed = 0;
 
     network_socket *sock = ss->server;
 
@@ -289,6 +290,12 @@ process_read_server(network_mysqld_con *con, server_session_t *ss)
         con->server_closed = 1;
     } else {
         ret = network_mysqld_read_mul_packets(con->srv, con, sock, &is_finished);
+        if (ret != NETWORK_SOCKET_ERROR && !resultset_merge_spill(con, sock)) {
+            /* the rows can't go to disk, give up like on a response that is too long */
+            spill_failed = 1;
+            is_finished = 0;
+            ret = NETWORK_SOCKET_WAIT_FOR_EVENT;
+        }
     }
 
     switch (ret) {
@@ -314,14 +321,14 @@ process_read_server(network_mysqld_con *con, server_session_t *ss)
 
                     g_debug("%s: send_part_content_to_client", G_STRLOC);
 
-                    send_part_content_to_client(con);
+                    defer_part_content_to_client(con);
                 }
                 server_sess_wait_for_event(ss, EV_READ, &con->read_timeout);
             }
         }
         break;
     case NETWORK_SOCKET_WAIT_FOR_EVENT:
-        if (sock->resp_len > con->srv->max_resp_len) {
+        if (spill_failed || sock->resp_len - (off_t)sock->recv_queue->spilled > con->srv->max_resp_len) {
             ss->state = NET_RW_STATE_FINISHED;
             con->server_to_be_closed = 1;
             con->resp_too_long = 1;
@@ -351,7 +358,7 @@ process_read_server(network_mysqld_con *con, server_session_t *ss)
                         network_mysqld_queue_append_raw(con->client, con->client->send_queue, packet);
                     }
                     g_debug("%s: send_part_content_to_client", G_STRLOC);
-                    send_part_content_to_client(con);
+                    defer_part_content_to_client(con);
                 }
                 server_sess_wait_for_event(ss, EV_READ, &con->read_timeout);
                 return 0;
@@ -393,8 +400,8 @@ process_after_read(network_mysqld_con *con, server_session_t *ss)
     }
 }
 
-void
-server_session_con_handler(int event_fd, short events, void *user_data)
+static void
+server_session_con_handle_events(int event_fd, short events, void *user_data)
 {
     server_session_t *ss = (server_session_t *)user_data;
     network_mysqld_con *con = ss->con;
@@ -457,3 +464,14 @@ server_session_con_handler(int event_fd, short events, void *user_data)
 
     g_debug("%s:server_session_con_handler over for con:%p, ss:%d", G_STRLOC, con, ss->index);
 }
+
+void
+server_session_con_handler(int event_fd, short events, void *user_data)
+{
+    server_session_t *ss = (server_session_t *)user_data;
+
+    chassis_event_callback_begin("server_session_con_handler");
+    chassis_event_callback_state(network_mysqld_con_st_name(ss->con->state));
+    server_session_con_handle_events(event_fd, events, user_data);
+    chassis_event_callback_end();
+}
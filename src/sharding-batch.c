@@ -0,0 +1,347 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#include "sharding-batch.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <mysql.h>
+
+#include "cetus-error.h"
+#include "network-mysqld-packet.h"
+#include "network-mysqld-proto.h"
+#include "sharding-query-plan.h"
+
+sharding_batch_t *
+sharding_batch_new(void)
+{
+    sharding_batch_t *batch = g_new0(sharding_batch_t, 1);
+    batch->seek_sql = g_string_new(NULL);
+    batch->head = g_string_new(NULL);
+    batch->cond = g_string_new(NULL);
+    batch->key = g_string_new(NULL);
+    batch->parallel = BATCH_DEFAULT_PARALLEL;
+    batch->groups = g_array_new(FALSE, TRUE, sizeof(struct batch_group_t));
+    return batch;
+}
+
+void
+sharding_batch_free(sharding_batch_t *batch)
+{
+    if (!batch) {
+        return;
+    }
+    g_string_free(batch->seek_sql, TRUE);
+    g_string_free(batch->head, TRUE);
+    g_string_free(batch->cond, TRUE);
+    g_string_free(batch->key, TRUE);
+    int i;
+    for (i = 0; i < batch->groups->len; ++i) {
+        g_string_free(g_array_index(batch->groups, struct batch_group_t, i).name, TRUE);
+    }
+    g_array_free(batch->groups, TRUE);
+    if (batch->query_packet) {
+        g_string_free(batch->query_packet, TRUE);
+    }
+    g_free(batch);
+}
+
+/* highest key of the next `step` rows, (cond) AND key > last */
+static GString *
+batch_seek_sql(sharding_batch_t *batch, struct batch_group_t *g)
+{
+    GString *sql = g_string_new(batch->seek_sql->str);
+    if (batch->cond->len > 0 || g->started) {
+        g_string_append(sql, " WHERE ");
+    }
+    if (batch->cond->len > 0) {
+        g_string_append_printf(sql, "(%s)", batch->cond->str);
+    }
+    if (batch->cond->len > 0 && g->started) {
+        g_string_append(sql, " AND ");
+    }
+    if (g->started) {
+        g_string_append_printf(sql, "%s > %" G_GINT64_FORMAT, batch->key->str, g->last);
+    }
+    g_string_append_printf(sql, " ORDER BY %s LIMIT %" G_GINT64_FORMAT ") AS batch_keys",
+                           batch->key->str, batch->step);
+    return sql;
+}
+
+static GString *
+batch_exec_sql(sharding_batch_t *batch, struct batch_group_t *g)
+{
+    GString *sql = g_string_new(batch->head->str);
+    if (batch->cond->len > 0) {
+        g_string_append_printf(sql, "(%s) AND ", batch->cond->str);
+    }
+    if (g->started) {
+        g_string_append_printf(sql, "%s > %" G_GINT64_FORMAT " AND ", batch->key->str, g->last);
+    }
+    g_string_append_printf(sql, "%s <= %" G_GINT64_FORMAT, batch->key->str, g->hi);
+    return sql;
+}
+
+GString *
+sharding_batch_add_group(sharding_batch_t *batch, const GString *group)
+{
+    struct batch_group_t g = { 0 };
+    g.name = g_string_new_len(S(group));
+    g.sent = TRUE;
+    g_array_append_val(batch->groups, g);
+    return batch_seek_sql(batch, &g);
+}
+
+static struct batch_group_t *
+batch_get_group(sharding_batch_t *batch, const GString *name)
+{
+    int i;
+    for (i = 0; i < batch->groups->len; ++i) {
+        struct batch_group_t *g = &g_array_index(batch->groups, struct batch_group_t, i);
+        if (g_string_equal(g->name, name)) {
+            return g;
+        }
+    }
+    return NULL;
+}
+
+static gboolean
+batch_parse_int(network_packet *packet, gboolean *is_null, gint64 *value)
+{
+    if (packet->offset >= packet->data->len) {
+        return FALSE;
+    }
+    if ((guint8)packet->data->str[packet->offset] == MYSQLD_PACKET_NULL) {
+        packet->offset++;
+        *is_null = TRUE;
+        return TRUE;
+    }
+    guint64 len;
+    if (network_mysqld_proto_get_lenenc_int(packet, &len) != 0 || packet->offset + len > packet->data->len
+        || len == 0 || len > 20) {
+        return FALSE;
+    }
+    char buf[24];
+    memcpy(buf, packet->data->str + packet->offset, len);
+    buf[len] = '\0';
+    packet->offset += len;
+    char *end = NULL;
+    *value = g_ascii_strtoll(buf, &end, 10);
+    *is_null = FALSE;
+    return *end == '\0';
+}
+
+/**
+ * parse the MAX(key) of a seek
+ * @return 0 on success(*empty if nothing left), 1 if ERR packet met(*err_packet set), -1 if malformed or not integer
+ */
+static int
+batch_parse_bound(GQueue *packets, gboolean *empty, gint64 *bound, GString **err_packet)
+{
+    GList *l = packets->head;
+    if (!l) {
+        return -1;
+    }
+    GString *data = l->data;
+    if (data->len <= NET_HEADER_SIZE) {
+        return -1;
+    }
+    if ((guint8)data->str[NET_HEADER_SIZE] == MYSQLD_PACKET_ERR) {
+        *err_packet = data;
+        return 1;
+    }
+    network_packet packet = { data, NET_HEADER_SIZE };
+    guint64 field_count = 0;
+    if (network_mysqld_proto_get_lenenc_int(&packet, &field_count) != 0 || field_count != 1) {
+        return -1;
+    }
+    int i;
+    for (i = 0, l = l->next; i <= field_count; ++i, l = l->next) {   /* fields and EOF */
+        if (!l) {
+            return -1;
+        }
+    }
+    if (!l) {
+        return -1;
+    }
+    data = l->data;
+    if (data->len <= NET_HEADER_SIZE) {
+        return -1;
+    }
+    if ((guint8)data->str[NET_HEADER_SIZE] == MYSQLD_PACKET_ERR) {
+        *err_packet = data;
+        return 1;
+    }
+    if ((guint8)data->str[NET_HEADER_SIZE] == MYSQLD_PACKET_EOF && data->len - NET_HEADER_SIZE < 9) {
+        *empty = TRUE;
+        return 0;
+    }
+    network_packet row = { data, NET_HEADER_SIZE };
+    if (!batch_parse_int(&row, empty, bound)) {
+        return -1;
+    }
+    return 0;
+}
+
+static void
+batch_send_error(network_mysqld_con *con, const char *msg, int code)
+{
+    network_queue_clear(con->client->send_queue);
+    network_mysqld_con_send_error_full(con->client, msg, strlen(msg), code, "HY000");
+}
+
+static void
+batch_forward_packet(network_mysqld_con *con, GString *packet)
+{
+    network_queue_clear(con->client->send_queue);
+    network_mysqld_queue_append(con->client, con->client->send_queue,
+                                packet->str + NET_HEADER_SIZE, packet->len - NET_HEADER_SIZE);
+}
+
+/* @return FALSE if error is sent to client */
+static gboolean
+batch_process_seek(network_mysqld_con *con, struct batch_group_t *g, GQueue *packets)
+{
+    GString *err_packet = NULL;
+    gboolean empty = FALSE;
+    int rc = batch_parse_bound(packets, &empty, &g->hi, &err_packet);
+    if (rc == 1) {
+        batch_forward_packet(con, err_packet);
+        return FALSE;
+    } else if (rc != 0) {
+        g_warning("%s: batch key not integer, con:%p", G_STRLOC, con);
+        batch_send_error(con, "(cetus) batch key must be an integer column", ER_CETUS_NOT_SUPPORTED);
+        return FALSE;
+    }
+    g->done = empty;
+    g->bounded = !empty;
+    g_debug("%s: batch group %s next bound %" G_GINT64_FORMAT "%s", G_STRLOC,
+            g->name->str, g->hi, empty ? " empty" : "");
+    return TRUE;
+}
+
+/* @return FALSE if error is sent to client */
+static gboolean
+batch_process_exec(network_mysqld_con *con, struct batch_group_t *g, GString *data)
+{
+    sharding_batch_t *batch = con->batch_dml;
+    if ((guint8)data->str[NET_HEADER_SIZE] == MYSQLD_PACKET_ERR) {
+        g_warning("%s: batch failed on group %s after %u batches, %llu rows affected, con:%p",
+                  G_STRLOC, g->name->str, batch->batches, (unsigned long long)batch->affected_rows, con);
+        batch_forward_packet(con, data);
+        return FALSE;
+    }
+    network_packet packet = { data, NET_HEADER_SIZE };
+    network_mysqld_ok_packet_t ok = { 0 };
+    if (network_mysqld_proto_get_ok_packet(&packet, &ok) != 0) {
+        batch_send_error(con, "(cetus) batch got malformed response", ER_CETUS_RESULT_MERGE);
+        return FALSE;
+    }
+    batch->affected_rows += ok.affected_rows;
+    batch->warnings += ok.warnings;
+    batch->batches++;
+
+    g->last = g->hi;
+    g->started = TRUE;
+    g->bounded = FALSE;
+    return TRUE;
+}
+
+/* @return FALSE if error is sent to client */
+static gboolean
+batch_process_round(network_mysqld_con *con)
+{
+    sharding_batch_t *batch = con->batch_dml;
+    int i;
+    for (i = 0; i < con->servers->len; i++) {
+        server_session_t *ss = g_ptr_array_index(con->servers, i);
+        if (!ss->participated || ss->server->unavailable) {
+            continue;
+        }
+        struct batch_group_t *g = batch_get_group(batch, ss->server->group);
+        if (!g || !g->sent) {
+            continue;
+        }
+        g->sent = FALSE;
+        GString *data = g_queue_peek_head(ss->server->recv_queue->chunks);
+        if (!data || data->len <= NET_HEADER_SIZE) {
+            continue;
+        }
+        gboolean ok = g->bounded ? batch_process_exec(con, g, data)
+            : batch_process_seek(con, g, ss->server->recv_queue->chunks);
+        if (!ok) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+/**
+ * plan next round for at most `parallel` unfinished groups,
+ * a seek for the groups without a bound, the batch for the others
+ * @return FALSE if all groups are done
+ */
+static gboolean
+batch_plan_next_round(network_mysqld_con *con)
+{
+    sharding_batch_t *batch = con->batch_dml;
+    sharding_plan_t *plan = sharding_plan_new(con->orig_sql);
+    int i;
+    for (i = 0; i < batch->groups->len && plan->groups->len < batch->parallel; ++i) {
+        struct batch_group_t *g = &g_array_index(batch->groups, struct batch_group_t, i);
+        if (!g->done) {
+            GString *sql = g->bounded ? batch_exec_sql(batch, g) : batch_seek_sql(batch, g);
+            sharding_plan_add_group_sql(plan, g->name, sql);
+            g->sent = TRUE;
+        }
+    }
+    if (plan->groups->len == 0) {
+        sharding_plan_free(plan);
+        return FALSE;
+    }
+    network_mysqld_con_set_sharding_plan(con, plan);
+
+    /* the query packet is consumed when sent, put it back for next round */
+    network_queue_clear(con->client->recv_queue);
+    network_queue_append(con->client->recv_queue, g_string_new_len(S(batch->query_packet)));
+    return TRUE;
+}
+
+int
+sharding_batch_process_resp(network_mysqld_con *con)
+{
+    sharding_batch_t *batch = con->batch_dml;
+    gboolean ok = batch_process_round(con);
+    if (ok && batch_plan_next_round(con)) {
+        return BATCH_RESP_NEXT_PHASE;
+    }
+    if (ok) {
+        g_debug("%s: batch done in %u batches, %llu rows affected, con:%p", G_STRLOC,
+                batch->batches, (unsigned long long)batch->affected_rows, con);
+        network_queue_clear(con->client->send_queue);
+        network_mysqld_con_send_ok_full(con->client, batch->affected_rows, 0,
+                                        network_mysqld_con_server_status(con), MIN(batch->warnings, G_MAXUINT16));
+    }
+    /* the last plan references group names of the batch */
+    network_mysqld_con_set_sharding_plan(con, NULL);
+    sharding_batch_free(batch);
+    con->batch_dml = NULL;
+    return BATCH_RESP_DONE;
+}
@@ -0,0 +1,89 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#ifndef __SHARDING_BATCH_H__
+#define __SHARDING_BATCH_H__
+
+#include "glib-ext.h"
+#include "network-mysqld.h"
+
+#define BATCH_DEFAULT_PARALLEL 4
+
+enum sharding_batch_resp_t {
+    BATCH_RESP_DONE,            /* result or error is in client send queue */
+    BATCH_RESP_NEXT_PHASE,      /* new sharding plan is set, query again */
+};
+
+struct batch_group_t {
+    GString *name;              /* copied, plans of later rounds reference it */
+    gint64 last;                /* highest key of the batches done, if started */
+    gint64 hi;                  /* highest key of the next batch, if bounded */
+    gboolean started;
+    gboolean bounded;
+    gboolean sent;              /* queried in the current round */
+    gboolean done;
+};
+
+typedef struct sharding_batch_t sharding_batch_t;
+
+/**
+ * UPDATE/DELETE run as autocommit batches over an integer key, paged by key
+ * so that sparse keys cost no empty batches; each group alternates between
+ *
+ *   seek: SELECT MAX(key) FROM (SELECT key FROM t WHERE (cond) AND key > last
+ *         ORDER BY key LIMIT step) AS batch_keys, NULL when nothing is left
+ *   exec: <head>(cond) AND key > last AND key <= hi
+ *
+ * at most `parallel` groups each round, after the first seek on every group
+ *
+ * each batch commits on its own, a failed batch leaves earlier batches applied
+ */
+struct sharding_batch_t {
+    GString *seek_sql;          /* seek query up to its condition */
+    GString *head;              /* statement up to the condition, ends with "WHERE " */
+    GString *cond;              /* original WHERE condition, empty if none */
+    GString *key;               /* quoted key column */
+    gint64 step;
+    guint parallel;
+
+    /* runtime state */
+    GArray *groups;             /* GArray<struct batch_group_t> */
+    GString *query_packet;      /* client COM_QUERY, re-queued for each round */
+    guint64 affected_rows;
+    guint warnings;
+    guint batches;
+};
+
+sharding_batch_t *sharding_batch_new(void);
+
+void sharding_batch_free(sharding_batch_t *);
+
+/**
+ * @return the first query of the group, the caller owns it
+ */
+GString *sharding_batch_add_group(sharding_batch_t *, const GString *group);
+
+/**
+ * consume responses of current round from con->servers
+ * @return BATCH_RESP_NEXT_PHASE when con->sharding_plan is replaced for next round
+ */
+int sharding_batch_process_resp(network_mysqld_con *con);
+
+#endif /* __SHARDING_BATCH_H__ */
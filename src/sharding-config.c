@@ -20,12 +20,14 @@
 
 #include "sharding-config.h"
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include "glib-ext.h"
 #include "sys-pedantic.h"
 #include "cJSON.h"
 #include "chassis-timings.h"
+#include "cetus-sequence.h"
 
 static GList *shard_conf_vdbs = NULL;
 
@@ -35,6 +37,39 @@ static GHashTable *shard_conf_vdb_map = NULL;
 
 static GList *shard_conf_single_tables = NULL;
 
+static GList *shard_conf_global_tables = NULL;
+
+enum sharding_interval_unit_t {
+    INTERVAL_DAY,
+    INTERVAL_WEEK,
+    INTERVAL_MONTH,
+    INTERVAL_YEAR
+};
+
+/* the maximum partitions an interval vdb can generate */
+#define MAX_INTERVAL_PARTITIONS 4096
+
+/*
+ * rolling date range partitions, the k-th interval starting from 'start'
+ * goes to groups[k % groups->len]
+ */
+struct sharding_interval_t {
+    enum sharding_interval_unit_t unit;
+    int year, month, day;       /* start date */
+    GPtrArray *groups;          /* GPtrArray<GString *> */
+    int ahead;                  /* number of intervals kept beyond current one */
+    int generated;              /* number of intervals in vdb->partitions */
+};
+
+static void
+sharding_interval_free(struct sharding_interval_t *interval)
+{
+    if (interval) {
+        g_ptr_array_free(interval->groups, TRUE);
+        g_free(interval);
+    }
+}
+
 struct sharding_database_t {
     char *name;
     GHashTable *tables;         /* <char *, const sharding_table_t *> */
@@ -94,6 +129,8 @@ sharding_table_free(gpointer q)
         g_string_free(info->name, TRUE);
     if (NULL != info->pkey)
         g_string_free(info->pkey, TRUE);
+    if (NULL != info->sequence)
+        g_string_free(info->sequence, TRUE);
     g_free(info);
 }
 
@@ -143,6 +180,7 @@ sharding_vdb_free(sharding_vdb_t *vdb)
     g_ptr_array_free(vdb->partitions, TRUE);
 
     g_ptr_array_free(vdb->databases, TRUE);
+    sharding_interval_free(vdb->interval);
     g_free(vdb);
 }
 
@@ -201,6 +239,8 @@ sharding_vdb_add_database(sharding_vdb_t *vdb, const char *name)
     return db;
 }
 
+static gboolean shard_conf_group_contains(GPtrArray *groups, GString *match);
+
 GPtrArray *
 shard_conf_get_all_groups(GPtrArray *visited_groups, const char *db)
 {
@@ -214,7 +254,10 @@ shard_conf_get_all_groups(GPtrArray *visited_groups, const char *db)
         for (i = 0; i < vdb->partitions->len; ++i) {
             sharding_partition_t *part = g_ptr_array_index(vdb->partitions, i);
             GString *gp = part->group_name;
-            g_ptr_array_add(visited_groups, gp);
+            /* one group might hold many ranges */
+            if (!shard_conf_group_contains(visited_groups, gp)) {
+                g_ptr_array_add(visited_groups, gp);
+            }
         }
     } else {
         g_warning(G_STRLOC " fail to get all groups for db: %s", db);
@@ -380,6 +423,22 @@ single_table_free(struct single_table_t *t)
     }
 }
 
+struct global_table_t {         /* global table resides on all groups of a vdb */
+    GString *name;
+    GString *db;
+    int vdb_id;
+};
+
+static void
+global_table_free(struct global_table_t *t)
+{
+    if (t) {
+        g_string_free(t->name, TRUE);
+        g_string_free(t->db, TRUE);
+        g_free(t);
+    }
+}
+
 static void
 shard_conf_set_vdb_list(GList *vdbs)
 {
@@ -410,11 +469,18 @@ shard_conf_set_single_tables(GList *tables)
     shard_conf_single_tables = tables;
 }
 
+static void
+shard_conf_set_global_tables(GList *tables)
+{
+    g_list_free_full(shard_conf_global_tables, (GDestroyNotify) global_table_free);
+    shard_conf_global_tables = tables;
+}
+
 /**
  * setup index & validate configurations
  */
 static gboolean
-shard_conf_try_setup(GList *vdbs, GList *tables, GList *single_tables, int num_groups)
+shard_conf_try_setup(GList *vdbs, GList *tables, GList *single_tables, GList *global_tables, int num_groups)
 {
     if (!vdbs || !tables) {
         g_critical("empty vdb/table list");
@@ -471,10 +537,36 @@ shard_conf_try_setup(GList *vdbs, GList *tables, GList *single_tables, int num_g
             g_hash_table_insert(vdbmap, database->name, vdb);
         }
     }
+
+    /* global table might be in a db without any sharding table */
+    for (l = global_tables; l != NULL; l = l->next) {
+        struct global_table_t *table = l->data;
+        sharding_vdb_t *vdb = shard_vdbs_get_by_id(vdbs, table->vdb_id);
+        if (!vdb) {
+            g_critical(G_STRLOC " global table:%s VDB ID cannot be found: %d", table->name->str, table->vdb_id);
+            g_hash_table_destroy(vdbmap);
+            return FALSE;
+        }
+        struct sharding_database_t *database = sharding_vdb_get_database(vdb, table->db->str);
+        if (database && sharding_database_get_table(database, table->name->str)) {
+            g_critical(G_STRLOC " %s.%s is both sharding and global table", table->db->str, table->name->str);
+            g_hash_table_destroy(vdbmap);
+            return FALSE;
+        }
+        sharding_vdb_t *vdb_res = g_hash_table_lookup(vdbmap, table->db->str);
+        if (vdb_res && vdb_res != vdb) {
+            g_critical(G_STRLOC " same db inside different vdb: %s", table->db->str);
+            g_hash_table_destroy(vdbmap);
+            return FALSE;
+        } else if (!vdb_res) {
+            g_hash_table_insert(vdbmap, table->db->str, vdb);
+        }
+    }
     shard_conf_set_vdb_list(vdbs);
     shard_conf_set_table_list(tables);
     shard_conf_set_vdb_map(vdbmap);
     shard_conf_set_single_tables(single_tables);
+    shard_conf_set_global_tables(global_tables);
     return TRUE;
 }
 
@@ -488,6 +580,38 @@ shard_conf_destroy(void)
     if (shard_conf_vdb_map) {
         g_hash_table_destroy(shard_conf_vdb_map);
     }
+    g_list_free_full(shard_conf_global_tables, (GDestroyNotify) global_table_free);
+}
+
+struct sequence_conf_t {        /* where the sequences are stored */
+    GString *group;
+    GString *table;
+    int block_size;
+};
+
+static void
+sequence_conf_free(struct sequence_conf_t *conf)
+{
+    if (conf) {
+        g_string_free(conf->group, TRUE);
+        g_string_free(conf->table, TRUE);
+        g_free(conf);
+    }
+}
+
+static gboolean
+shard_conf_check_sequences(GList *tables, struct sequence_conf_t *conf)
+{
+    GList *l;
+    for (l = tables; l != NULL; l = l->next) {
+        sharding_table_t *table = l->data;
+        if (table->sequence && !conf) {
+            g_critical(G_STRLOC " table:%s uses sequence %s, but no sequence storage configured",
+                       table->name->str, table->sequence->str);
+            return FALSE;
+        }
+    }
+    return TRUE;
 }
 
 static GHashTable *load_shard_from_json(gchar *json_str);
@@ -502,11 +626,29 @@ shard_conf_load(char *json_str, int num_groups)
     GList *tables = g_hash_table_lookup(ht, "table_list");
     GList *vdbs = g_hash_table_lookup(ht, "vdb_list");
     GList *single_tables = g_hash_table_lookup(ht, "single_tables");
-    gboolean success = shard_conf_try_setup(vdbs, tables, single_tables, num_groups);
-    if (!success) {
+    GList *global_tables = g_hash_table_lookup(ht, "global_tables");
+    struct sequence_conf_t *sequence = g_hash_table_lookup(ht, "sequence");
+    gboolean success = shard_conf_check_sequences(tables, sequence)
+        && shard_conf_try_setup(vdbs, tables, single_tables, global_tables, num_groups);
+    if (success) {
+        if (sequence) {
+            cetus_sequence_configure(sequence->group->str, sequence->table->str, sequence->block_size);
+            GList *l;
+            for (l = tables; l; l = l->next) {
+                sharding_table_t *table = l->data;
+                if (table->sequence) {
+                    cetus_sequence_prefetch(table->sequence->str);
+                }
+            }
+        } else {
+            cetus_sequence_configure(NULL, NULL, 0);
+        }
+    } else {
         g_list_free_full(vdbs, (GDestroyNotify) sharding_vdb_free);
         g_list_free_full(tables, (GDestroyNotify) sharding_table_free);
+        g_list_free_full(global_tables, (GDestroyNotify) global_table_free);
     }
+    sequence_conf_free(sequence);
     g_hash_table_destroy(ht);
     return success;
 }
@@ -554,6 +696,19 @@ shard_conf_get_single_table_distinct_group(GPtrArray *groups, const char *db, co
     return groups;
 }
 
+gboolean
+shard_conf_is_global_table(const char *db, const char *name)
+{
+    GList *l = shard_conf_global_tables;
+    for (; l; l = l->next) {
+        struct global_table_t *t = l->data;
+        if (strcasecmp(t->name->str, name) == 0 && strcasecmp(t->db->str, db) == 0) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
 static int
 sharding_type(const char *str)
 {
@@ -623,9 +778,8 @@ parse_partitions(cJSON *root, const sharding_vdb_t *vdb, GPtrArray *partitions /
             item->vdb = vdb;
             item->group_name = g_string_new(cur->string);
             if (vdb->key_type == SHARD_DATA_TYPE_DATETIME || vdb->key_type == SHARD_DATA_TYPE_DATE) {
-                gboolean ok;
-                int epoch = chassis_epoch_from_string(cur->valuestring, &ok);
-                if (ok)
+                gint64 epoch;
+                if (chassis_datetime_parse(cur->valuestring, &epoch))
                     item->value = (void *)(uint64_t)epoch;
                 else
                     g_warning("Wrong sharding setting <datetime format:%s>", cur->valuestring);
@@ -658,9 +812,8 @@ parse_partitions(cJSON *root, const sharding_vdb_t *vdb, GPtrArray *partitions /
                     item->vdb = vdb;
                     item->group_name = g_string_new(cur->string);
                     if (vdb->key_type == SHARD_DATA_TYPE_DATETIME || vdb->key_type == SHARD_DATA_TYPE_DATE) {
-                        gboolean ok;
-                        int epoch = chassis_epoch_from_string(elem->valuestring, &ok);
-                        if (ok)
+                        gint64 epoch;
+                        if (chassis_datetime_parse(elem->valuestring, &epoch))
                             item->value = (void *)(uint64_t)epoch;
                         else
                             g_warning("Wrong sharding setting <datetime format:%s>", elem->valuestring);
@@ -734,6 +887,145 @@ setup_partitions(GPtrArray *partitions, sharding_vdb_t *vdb)
     }
 }
 
+/* start time of the k-th interval */
+static gint64
+sharding_interval_boundary(struct sharding_interval_t *interval, int k)
+{
+    gint64 start = chassis_civil_to_seconds(interval->year, interval->month, interval->day, 0, 0, 0);
+    int m;
+    switch (interval->unit) {
+    case INTERVAL_DAY:
+        return start + (gint64)k * 86400;
+    case INTERVAL_WEEK:
+        return start + (gint64)k * 7 * 86400;
+    case INTERVAL_MONTH:
+        m = interval->month - 1 + k;
+        return chassis_civil_to_seconds(interval->year + m / 12, m % 12 + 1, interval->day, 0, 0, 0);
+    case INTERVAL_YEAR:
+        return chassis_civil_to_seconds(interval->year + k, interval->month, interval->day, 0, 0, 0);
+    }
+    return start;
+}
+
+/*
+ * append partitions to the interval vdb until the current interval and
+ * 'ahead' more intervals are covered, the partitions remain sorted
+ * @return number of new partitions
+ */
+static int
+sharding_vdb_roll(sharding_vdb_t *vdb, gint64 now)
+{
+    struct sharding_interval_t *interval = vdb->interval;
+    int count = 0;
+    while (interval->generated <= interval->ahead
+           || sharding_interval_boundary(interval, interval->generated - interval->ahead) <= now) {
+        int k = interval->generated;
+        gint64 high = sharding_interval_boundary(interval, k + 1) - 1;
+        if (k >= MAX_INTERVAL_PARTITIONS || high > INT_MAX) {
+            g_critical(G_STRLOC " vdb %d cannot roll more partitions, %d generated", vdb->id, k);
+            break;
+        }
+        sharding_partition_t *item = g_new0(sharding_partition_t, 1);
+        item->vdb = vdb;
+        GString *group = g_ptr_array_index(interval->groups, k % interval->groups->len);
+        item->group_name = g_string_new(group->str);
+        item->low_value = (void *)(int64_t)(sharding_interval_boundary(interval, k) - 1);
+        item->value = (void *)(int64_t)high;
+        g_ptr_array_add(vdb->partitions, item);
+        interval->generated++;
+        count++;
+    }
+    return count;
+}
+
+/* partitions generated so far reach the interval holding now */
+static gboolean
+sharding_interval_covers(struct sharding_interval_t *interval, gint64 now)
+{
+    return interval->generated > 0 && sharding_interval_boundary(interval, interval->generated) > now;
+}
+
+int
+shard_conf_roll_partitions(void)
+{
+    gint64 now = chassis_datetime_now();
+    int count = 0;
+    GList *l;
+    for (l = shard_conf_vdbs; l; l = l->next) {
+        sharding_vdb_t *vdb = l->data;
+        if (vdb->interval) {
+            int n = sharding_vdb_roll(vdb, now);
+            if (n > 0) {
+                g_message("vdb %d rolled %d new partitions, %d in total", vdb->id, n, vdb->partitions->len);
+            }
+            count += n;
+        }
+    }
+    return count;
+}
+
+/*
+ * Parse rolling partitions
+ * example:
+ *   {"unit":"month", "start":"2018-01-01", "groups":["data1","data2"], "ahead":3}
+ */
+static struct sharding_interval_t *
+parse_interval(cJSON *root, const sharding_vdb_t *vdb)
+{
+    if (vdb->method != SHARD_METHOD_RANGE
+        || (vdb->key_type != SHARD_DATA_TYPE_DATE && vdb->key_type != SHARD_DATA_TYPE_DATETIME)) {
+        g_critical("vdb %d: interval only works with range method of date/datetime type", vdb->id);
+        return NULL;
+    }
+    cJSON *unit = cJSON_GetObjectItem(root, "unit");
+    cJSON *start = cJSON_GetObjectItem(root, "start");
+    cJSON *groups = cJSON_GetObjectItem(root, "groups");
+    cJSON *ahead = cJSON_GetObjectItem(root, "ahead");
+    if (!(unit && unit->type == cJSON_String && start && start->type == cJSON_String
+          && groups && groups->type == cJSON_Array && groups->child)) {
+        g_critical("vdb %d: interval needs unit, start and groups", vdb->id);
+        return NULL;
+    }
+    struct sharding_interval_t *interval = g_new0(struct sharding_interval_t, 1);
+    interval->groups = g_ptr_array_new_with_free_func(g_string_true_free);
+    if (strcasecmp(unit->valuestring, "day") == 0) {
+        interval->unit = INTERVAL_DAY;
+    } else if (strcasecmp(unit->valuestring, "week") == 0) {
+        interval->unit = INTERVAL_WEEK;
+    } else if (strcasecmp(unit->valuestring, "month") == 0) {
+        interval->unit = INTERVAL_MONTH;
+    } else if (strcasecmp(unit->valuestring, "year") == 0) {
+        interval->unit = INTERVAL_YEAR;
+    } else {
+        g_critical("vdb %d: wrong interval unit: %s", vdb->id, unit->valuestring);
+        sharding_interval_free(interval);
+        return NULL;
+    }
+    gint64 epoch;
+    if (!chassis_datetime_parse(start->valuestring, &epoch)
+        || sscanf(start->valuestring, "%d-%d-%d", &interval->year, &interval->month, &interval->day) != 3
+        || interval->day > 28) {
+        g_critical("vdb %d: wrong interval start: %s, expect 'YYYY-MM-DD' and day before 29th",
+                   vdb->id, start->valuestring);
+        sharding_interval_free(interval);
+        return NULL;
+    }
+    cJSON *elem = groups->child;
+    for (; elem; elem = elem->next) {
+        if (elem->type != cJSON_String) {
+            g_critical("vdb %d: interval group must be string", vdb->id);
+            sharding_interval_free(interval);
+            return NULL;
+        }
+        g_ptr_array_add(interval->groups, g_string_new(elem->valuestring));
+    }
+    interval->ahead = 1;
+    if (ahead && ahead->type == cJSON_Number && ahead->valueint >= 0) {
+        interval->ahead = ahead->valueint;
+    }
+    return interval;
+}
+
 /**
  * @return GList<sharding_vdb_t *>
  */
@@ -748,10 +1040,15 @@ parse_vdbs(cJSON *vdb_root)
         cJSON *method = cJSON_GetObjectItem(p, "method");
         cJSON *num = cJSON_GetObjectItem(p, "num");
         cJSON *partitions = cJSON_GetObjectItem(p, "partitions");
-        if (!(id && key_type && method && num && partitions)) {
+        cJSON *interval = cJSON_GetObjectItem(p, "interval");
+        if (!(id && key_type && method && num && (partitions || interval))) {
             g_critical("parse vdbs error, neglected");
             continue;
         }
+        if (partitions && interval) {
+            g_critical("parse vdbs error, partitions and interval are exclusive, neglected");
+            continue;
+        }
 
         struct sharding_vdb_t *vdb = sharding_vdb_new();
         if (id->type == cJSON_Number) {
@@ -774,8 +1071,25 @@ parse_vdbs(cJSON *vdb_root)
             g_critical("no match num: %s", num->valuestring);
         }
 
-        parse_partitions(partitions, vdb, vdb->partitions);
-        setup_partitions(vdb->partitions, vdb);
+        if (interval) {
+            vdb->interval = parse_interval(interval, vdb);
+            if (!vdb->interval) {
+                sharding_vdb_free(vdb);
+                continue;
+            }
+            gint64 now = chassis_datetime_now();
+            sharding_vdb_roll(vdb, now);
+            if (!sharding_interval_covers(vdb->interval, now)) {
+                g_critical("vdb %d: interval start %04d-%02d-%02d is too far back, %d partitions can't reach today",
+                           vdb->id, vdb->interval->year, vdb->interval->month, vdb->interval->day,
+                           MAX_INTERVAL_PARTITIONS);
+                sharding_vdb_free(vdb);
+                continue;
+            }
+        } else {
+            parse_partitions(partitions, vdb, vdb->partitions);
+            setup_partitions(vdb->partitions, vdb);
+        }
 
         vdb_list = g_list_append(vdb_list, vdb);
     }
@@ -792,6 +1106,8 @@ parse_tables(cJSON *root)
         cJSON *table_root = cJSON_GetObjectItem(p, "table");
         cJSON *pkey = cJSON_GetObjectItem(p, "pkey");
         cJSON *vdb = cJSON_GetObjectItem(p, "vdb");
+        cJSON *sequence = cJSON_GetObjectItem(p, "sequence");
+        cJSON *auto_increment = cJSON_GetObjectItem(p, "auto_increment");
         if (db && table_root && pkey && vdb) {
             sharding_table_t *table = g_new0(sharding_table_t, 1);
             if (vdb->type == cJSON_String) {
@@ -802,6 +1118,13 @@ parse_tables(cJSON *root)
             table->db = g_string_new(db->valuestring);
             table->name = g_string_new(table_root->valuestring);
             table->pkey = g_string_new(pkey->valuestring);
+            if (sequence && sequence->type == cJSON_String) {
+                table->sequence = g_string_new(sequence->valuestring);
+            } else if (auto_increment && auto_increment->type == cJSON_True) {
+                /* sharding key generated by proxy, from sequence named db.table */
+                table->sequence = g_string_new(NULL);
+                g_string_printf(table->sequence, "%s.%s", db->valuestring, table_root->valuestring);
+            }
 
             tables = g_list_append(tables, table);
         } else {
@@ -835,6 +1158,50 @@ parse_single_tables(cJSON *root)
     return tables;
 }
 
+static GList *
+parse_global_tables(cJSON *root)
+{
+    GList *tables = NULL;
+    cJSON *p = root->child;
+    while (p) {
+        cJSON *name = cJSON_GetObjectItem(p, "table");
+        cJSON *db = cJSON_GetObjectItem(p, "db");
+        cJSON *vdb = cJSON_GetObjectItem(p, "vdb");
+        if (name && db && vdb) {
+            struct global_table_t *table = g_new0(struct global_table_t, 1);
+            if (vdb->type == cJSON_String) {
+                table->vdb_id = atoi(vdb->valuestring);
+            } else if (vdb->type == cJSON_Number) {
+                table->vdb_id = vdb->valueint;
+            }
+            table->db = g_string_new(db->valuestring);
+            table->name = g_string_new(name->valuestring);
+            tables = g_list_append(tables, table);
+        } else {
+            g_critical("global_table parse error");
+        }
+        p = p->next;
+    }
+    return tables;
+}
+
+static struct sequence_conf_t *
+parse_sequence(cJSON *root)
+{
+    cJSON *group = cJSON_GetObjectItem(root, "group");
+    cJSON *table = cJSON_GetObjectItem(root, "table");
+    cJSON *block_size = cJSON_GetObjectItem(root, "block_size");
+    if (!group || !table) {
+        g_critical("sequence parse error");
+        return NULL;
+    }
+    struct sequence_conf_t *conf = g_new0(struct sequence_conf_t, 1);
+    conf->group = g_string_new(group->valuestring);
+    conf->table = g_string_new(table->valuestring);
+    conf->block_size = (block_size && block_size->valueint > 0) ? block_size->valueint : SEQUENCE_DEFAULT_BLOCK_SIZE;
+    return conf;
+}
+
 static GHashTable *
 load_shard_from_json(gchar *json_str)
 {
@@ -865,11 +1232,27 @@ load_shard_from_json(gchar *json_str)
         single_list = parse_single_tables(single_root);
     }
 
+    /* parse global tables */
+    cJSON *global_root = cJSON_GetObjectItem(root, "global_tables");
+    GList *global_list = NULL;
+    if (global_root) {
+        global_list = parse_global_tables(global_root);
+    }
+
+    /* parse sequence storage */
+    cJSON *sequence_root = cJSON_GetObjectItem(root, "sequence");
+    struct sequence_conf_t *sequence = NULL;
+    if (sequence_root) {
+        sequence = parse_sequence(sequence_root);
+    }
+
     cJSON_Delete(root);
 
     GHashTable *shard_hash = g_hash_table_new(g_str_hash, g_str_equal);
     g_hash_table_insert(shard_hash, "table_list", table_list);
     g_hash_table_insert(shard_hash, "vdb_list", vdb_list);
     g_hash_table_insert(shard_hash, "single_tables", single_list);  /* NULLable */
+    g_hash_table_insert(shard_hash, "global_tables", global_list);  /* NULLable */
+    g_hash_table_insert(shard_hash, "sequence", sequence);    /* NULLable */
     return shard_hash;
 }
@@ -66,6 +66,7 @@ struct sharding_vdb_t {
     int logic_shard_num;
     GPtrArray *partitions;      /* GPtrArray<sharding_partition_t *> */
     GPtrArray *databases;       /* GPtrArray<sharding_database_t *> */
+    struct sharding_interval_t *interval;   /* rolling date partitions, NULLable */
 };
 
 struct sharding_table_t {
@@ -79,6 +80,8 @@ struct sharding_table_t {
 
     int vdb_id;
     struct sharding_vdb_t *vdb;
+
+    GString *sequence;          /* fills sharding key if omitted in INSERT, NULLable */
 };
 
 GPtrArray *shard_conf_get_table_groups(GPtrArray *groups, char *db, char *table);
@@ -96,6 +99,9 @@ gboolean shard_conf_is_single_table(const char *db, const char *table);
 
 GPtrArray *shard_conf_get_single_table_distinct_group(GPtrArray *groups, const char *db, const char *table);
 
+/* global table is replicated to every group of its VDB */
+gboolean shard_conf_is_global_table(const char *db, const char *table);
+
 sharding_table_t *shard_conf_get_info(const char *db, const char *table);
 
 /**
@@ -112,6 +118,12 @@ void shard_conf_find_groups(GPtrArray *groups, const char *match, const char *db
 
 gboolean shard_conf_load(char *, int);
 
+/**
+ * generate partitions of interval vdbs, keep them ahead of current time
+ * @return number of new partitions
+ */
+int shard_conf_roll_partitions(void);
+
 void shard_conf_destroy(void);
 
 #endif /* __SHARDING_CONFIG_H__ */
@@ -0,0 +1,624 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+
+#include "sharding-join.h"
+
+#include <string.h>
+#include <mysql.h>
+
+#include "cetus-error.h"
+#include "network-mysqld-proto.h"
+#include "sharding-query-plan.h"
+
+static void
+join_row_free(GPtrArray *row)
+{
+    int i;
+    for (i = 0; i < row->len; ++i) {
+        GString *cell = g_ptr_array_index(row, i);
+        if (cell) {
+            g_string_free(cell, TRUE);
+        }
+    }
+    g_ptr_array_free(row, TRUE);
+}
+
+static void
+join_rows_free(GPtrArray *rows)
+{
+    int i;
+    for (i = 0; i < rows->len; ++i) {
+        join_row_free(g_ptr_array_index(rows, i));
+    }
+    g_ptr_array_free(rows, TRUE);
+}
+
+sharding_join_t *
+sharding_join_new(void)
+{
+    sharding_join_t *join = g_new0(sharding_join_t, 1);
+    join->phase = JOIN_PHASE_DRIVER;
+    join->driver_sql = g_string_new(NULL);
+    join->probe_sql_prefix = g_string_new(NULL);
+    join->out_cols = g_array_new(FALSE, FALSE, sizeof(struct join_out_col_t));
+    join->probe_db = g_string_new(NULL);
+    join->probe_table = g_string_new(NULL);
+    join->probe_groups = g_ptr_array_new();
+    join->max_rows = JOIN_DEFAULT_MAX_ROWS;
+    join->max_bytes = JOIN_DEFAULT_MAX_BYTES;
+    join->driver_fields = g_ptr_array_new_with_free_func(g_string_true_free);
+    join->driver_rows = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify) join_rows_free);
+    return join;
+}
+
+void
+sharding_join_free(sharding_join_t *join)
+{
+    if (!join) {
+        return;
+    }
+    g_string_free(join->driver_sql, TRUE);
+    g_string_free(join->probe_sql_prefix, TRUE);
+    g_array_free(join->out_cols, TRUE);
+    g_string_free(join->probe_db, TRUE);
+    g_string_free(join->probe_table, TRUE);
+    g_ptr_array_free(join->probe_groups, TRUE);
+    if (join->query_packet) {
+        g_string_free(join->query_packet, TRUE);
+    }
+    g_ptr_array_free(join->driver_fields, TRUE);
+    g_hash_table_destroy(join->driver_rows);
+    g_free(join);
+}
+
+GString *
+sharding_join_probe_sql(sharding_join_t *join, const char *keys)
+{
+    GString *sql = g_string_new(join->probe_sql_prefix->str);
+    g_string_append(sql, keys);
+    g_string_append_c(sql, ')');
+    return sql;
+}
+
+static void
+join_append_key(sharding_join_t *join, GString *keys, const char *key)
+{
+    if (keys->len > 0) {
+        g_string_append_c(keys, ',');
+    }
+    gboolean is_num = !join->probe_key_is_str && key[0] != '\0';
+    const char *p;
+    for (p = key; is_num && *p; ++p) {
+        if (!g_ascii_isdigit(*p) && !(p == key && *p == '-')) {
+            is_num = FALSE;
+        }
+    }
+    if (is_num) {
+        g_string_append(keys, key);
+        return;
+    }
+    g_string_append_c(keys, '\'');
+    for (p = key; *p; ++p) {
+        if (*p == '\'' || *p == '\\') {
+            g_string_append_c(keys, '\\');
+        }
+        g_string_append_c(keys, *p);
+    }
+    g_string_append_c(keys, '\'');
+}
+
+/* split a text protocol row into cells, NULL cell for SQL NULL */
+static GPtrArray *
+join_parse_row(GString *data, guint64 field_count, guint64 *size)
+{
+    network_packet packet = { data, NET_HEADER_SIZE };
+    GPtrArray *row = g_ptr_array_sized_new(field_count);
+    guint64 i;
+    for (i = 0; i < field_count; ++i) {
+        if (packet.offset >= packet.data->len) {
+            join_row_free(row);
+            return NULL;
+        }
+        if ((guint8)packet.data->str[packet.offset] == MYSQLD_PACKET_NULL) {
+            packet.offset++;
+            g_ptr_array_add(row, NULL);
+            continue;
+        }
+        guint64 len;
+        if (network_mysqld_proto_get_lenenc_int(&packet, &len) != 0 || packet.offset + len > packet.data->len) {
+            join_row_free(row);
+            return NULL;
+        }
+        g_ptr_array_add(row, g_string_new_len(packet.data->str + packet.offset, len));
+        packet.offset += len;
+        *size += len + sizeof(GString);
+    }
+    return row;
+}
+
+/**
+ * parse resultset of one server
+ * @param fields save the field packets if not NULL, the key field is the last
+ * @return 0 on success, 1 if ERR packet met(*err_packet set), -1 if malformed
+ */
+static int
+join_parse_resultset(GQueue *packets, int ncols, GPtrArray *fields, GPtrArray *rows,
+                     guint64 *size, GString **err_packet)
+{
+    GList *l = packets->head;
+    if (!l) {
+        return -1;
+    }
+    GString *data = l->data;
+    if (data->len <= NET_HEADER_SIZE) {
+        return -1;
+    }
+    if ((guint8)data->str[NET_HEADER_SIZE] == MYSQLD_PACKET_ERR) {
+        *err_packet = data;
+        return 1;
+    }
+    network_packet packet = { data, NET_HEADER_SIZE };
+    guint64 field_count = 0;
+    if (network_mysqld_proto_get_lenenc_int(&packet, &field_count) != 0 || field_count != ncols + 1) {
+        return -1;
+    }
+    guint64 i;
+    for (i = 0, l = l->next; i < field_count; ++i, l = l->next) {
+        if (!l) {
+            return -1;
+        }
+        if (fields) {
+            data = l->data;
+            g_ptr_array_add(fields, g_string_new_len(data->str + NET_HEADER_SIZE, data->len - NET_HEADER_SIZE));
+        }
+    }
+    if (!l) {                   /* EOF of field definitions */
+        return -1;
+    }
+    for (l = l->next; l; l = l->next) {
+        data = l->data;
+        if (data->len <= NET_HEADER_SIZE) {
+            return -1;
+        }
+        guint8 first = data->str[NET_HEADER_SIZE];
+        if (first == MYSQLD_PACKET_ERR) {
+            *err_packet = data;
+            return 1;
+        }
+        if (first == MYSQLD_PACKET_EOF && data->len - NET_HEADER_SIZE < 9) {
+            return 0;
+        }
+        GPtrArray *row = join_parse_row(data, field_count, size);
+        if (!row) {
+            return -1;
+        }
+        g_ptr_array_add(rows, row);
+    }
+    return -1;                  /* missing EOF */
+}
+
+static void
+join_send_error(network_mysqld_con *con, const char *msg, int code)
+{
+    network_queue_clear(con->client->send_queue);
+    network_mysqld_con_send_error_full(con->client, msg, strlen(msg), code, "HY000");
+}
+
+static void
+join_forward_packet(network_mysqld_con *con, GString *packet)
+{
+    network_queue_clear(con->client->send_queue);
+    network_mysqld_queue_append(con->client, con->client->send_queue,
+                                packet->str + NET_HEADER_SIZE, packet->len - NET_HEADER_SIZE);
+}
+
+/**
+ * gather results of every participated server
+ * @return FALSE if error is sent to client
+ */
+static gboolean
+join_collect(network_mysqld_con *con, int ncols, GPtrArray *fields, GPtrArray *rows)
+{
+    sharding_join_t *join = con->bind_join;
+    int i;
+    for (i = 0; i < con->servers->len; i++) {
+        server_session_t *ss = g_ptr_array_index(con->servers, i);
+        if (!ss->participated || ss->server->unavailable) {
+            continue;
+        }
+        GString *err_packet = NULL;
+        guint64 size = 0;
+        int rc = join_parse_resultset(ss->server->recv_queue->chunks, ncols,
+                                      fields->len == 0 ? fields : NULL, rows, &size, &err_packet);
+        join->mem_used += size;
+        if (rc == 1) {
+            join_forward_packet(con, err_packet);
+            return FALSE;
+        } else if (rc != 0) {
+            g_warning("%s: malformed resultset for bind join, con:%p", G_STRLOC, con);
+            join_send_error(con, "(cetus) bind join got malformed resultset", ER_CETUS_RESULT_MERGE);
+            return FALSE;
+        }
+        if (join->mem_used > join->max_bytes) {
+            join_send_error(con, "(cetus) bind join exceeds memory limit", ER_CETUS_LONG_RESP);
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+static void
+join_keys_free(gpointer data)
+{
+    g_string_free(data, TRUE);
+}
+
+enum join_key_kind_t {
+    JOIN_KEY_EXACT,             /* binary string, byte by byte */
+    JOIN_KEY_NUMBER,            /* numeric column, "1.0" equals "1" */
+    JOIN_KEY_STRING,            /* collation unknown, ignore case and trailing spaces */
+};
+
+/* how the probe column compares, from its column definition packet without header */
+static enum join_key_kind_t
+join_key_kind(GString *field)
+{
+    network_packet packet = { field, 0 };
+    guint64 len;
+    guint16 charset = 0;
+    guint8 type = 0;
+    int i, err = 0;
+    for (i = 0; i < 6; ++i) {   /* catalog, db, table, org_table, name, org_name */
+        err = err || network_mysqld_proto_skip_lenenc_str(&packet);
+    }
+    err = err || network_mysqld_proto_get_lenenc_int(&packet, &len);
+    err = err || network_mysqld_proto_get_int16(&packet, &charset);
+    err = err || network_mysqld_proto_skip(&packet, 4);
+    err = err || network_mysqld_proto_get_int8(&packet, &type);
+    if (err) {
+        return JOIN_KEY_STRING;
+    }
+    switch (type) {
+    case MYSQL_TYPE_TINY:
+    case MYSQL_TYPE_SHORT:
+    case MYSQL_TYPE_LONG:
+    case MYSQL_TYPE_LONGLONG:
+    case MYSQL_TYPE_INT24:
+    case MYSQL_TYPE_YEAR:
+    case MYSQL_TYPE_DECIMAL:
+    case MYSQL_TYPE_NEWDECIMAL:
+    case MYSQL_TYPE_FLOAT:
+    case MYSQL_TYPE_DOUBLE:
+        return JOIN_KEY_NUMBER;
+    default:
+        return charset == 63 ? JOIN_KEY_EXACT : JOIN_KEY_STRING;
+    }
+}
+
+/* plain decimal text without sign, leading or trailing zeros, other text is kept */
+static gchar *
+join_number_canonical(const char *str)
+{
+    const char *p = str;
+    gboolean neg = FALSE;
+    if (*p == '-' || *p == '+') {
+        neg = (*p == '-');
+        p++;
+    }
+    const char *int_start = p;
+    while (g_ascii_isdigit(*p)) {
+        p++;
+    }
+    const char *int_end = p;
+    const char *frac_start = p, *frac_end = p;
+    if (*p == '.') {
+        frac_start = ++p;
+        while (g_ascii_isdigit(*p)) {
+            p++;
+        }
+        frac_end = p;
+    }
+    if (*p != '\0' || (int_end == int_start && frac_end == frac_start)) {
+        return g_strdup(str);   /* exponent or not a number */
+    }
+    while (int_end - int_start > 1 && *int_start == '0') {
+        int_start++;
+    }
+    while (frac_end > frac_start && frac_end[-1] == '0') {
+        frac_end--;
+    }
+    GString *out = g_string_new(NULL);
+    if (int_end == int_start) {
+        g_string_append_c(out, '0');
+    } else {
+        g_string_append_len(out, int_start, int_end - int_start);
+    }
+    if (frac_end > frac_start) {
+        g_string_append_c(out, '.');
+        g_string_append_len(out, frac_start, frac_end - frac_start);
+    }
+    if (neg && strcmp(out->str, "0") != 0) {
+        g_string_prepend_c(out, '-');
+    }
+    return g_string_free(out, FALSE);
+}
+
+static gchar *
+join_key_normalize(enum join_key_kind_t kind, const char *key, gsize len)
+{
+    switch (kind) {
+    case JOIN_KEY_NUMBER:
+        return join_number_canonical(key);
+    case JOIN_KEY_STRING:
+        while (len > 0 && key[len - 1] == ' ') {
+            len--;
+        }
+        if (g_utf8_validate(key, len, NULL)) {
+            return g_utf8_casefold(key, len);
+        }
+        return g_ascii_strdown(key, len);
+    default:
+        return g_strndup(key, len);
+    }
+}
+
+static void
+join_buckets_free(gpointer data)
+{
+    g_ptr_array_free(data, TRUE);
+}
+
+/**
+ * index the driver rows the way the probe column compares
+ * @return <normalized key, GPtrArray<driver rows of one raw key>>
+ */
+static GHashTable *
+join_driver_index(sharding_join_t *join, enum join_key_kind_t kind)
+{
+    GHashTable *index = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, join_buckets_free);
+    GHashTableIter iter;
+    gpointer key, rows;
+    g_hash_table_iter_init(&iter, join->driver_rows);
+    while (g_hash_table_iter_next(&iter, &key, &rows)) {
+        gchar *norm = join_key_normalize(kind, key, strlen(key));
+        GPtrArray *buckets = g_hash_table_lookup(index, norm);
+        if (buckets) {
+            g_free(norm);
+        } else {
+            buckets = g_ptr_array_new();
+            g_hash_table_insert(index, norm, buckets);
+        }
+        g_ptr_array_add(buckets, rows);
+    }
+    return index;
+}
+
+static void
+join_append_eof(network_mysqld_con *con, GString *buf)
+{
+    g_string_truncate(buf, 0);
+    g_string_append_c(buf, (char)MYSQLD_PACKET_EOF);
+    network_mysqld_proto_append_int16(buf, 0);  /* warnings */
+    network_mysqld_proto_append_int16(buf, network_mysqld_con_server_status(con));
+    network_mysqld_queue_append(con->client, con->client->send_queue, S(buf));
+}
+
+static int
+join_process_driver(network_mysqld_con *con)
+{
+    sharding_join_t *join = con->bind_join;
+    GPtrArray *rows = g_ptr_array_new();
+    if (!join_collect(con, join->driver_ncols, join->driver_fields, rows)) {
+        g_ptr_array_foreach(rows, (GFunc) join_row_free, NULL);
+        g_ptr_array_free(rows, TRUE);
+        return JOIN_RESP_DONE;
+    }
+    if (rows->len > join->max_rows) {
+        g_ptr_array_foreach(rows, (GFunc) join_row_free, NULL);
+        g_ptr_array_free(rows, TRUE);
+        join_send_error(con, "(cetus) bind join small side exceeds row limit", ER_CETUS_LONG_RESP);
+        return JOIN_RESP_DONE;
+    }
+    join->driver_row_count = rows->len;
+
+    /* hash driver rows by join column, and split the keys by group */
+    GHashTable *group_keys = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, join_keys_free);
+    GPtrArray *groups = g_ptr_array_new();
+    int i;
+    for (i = 0; i < rows->len; ++i) {
+        GPtrArray *row = g_ptr_array_index(rows, i);
+        GString *key = g_ptr_array_index(row, join->driver_ncols);
+        if (!key) {             /* NULL never equals */
+            join_row_free(row);
+            continue;
+        }
+        GPtrArray *same_key_rows = g_hash_table_lookup(join->driver_rows, key->str);
+        if (same_key_rows) {
+            g_ptr_array_add(same_key_rows, row);
+            continue;
+        }
+        same_key_rows = g_ptr_array_new();
+        g_ptr_array_add(same_key_rows, row);
+        g_hash_table_insert(join->driver_rows, g_strdup(key->str), same_key_rows);
+
+        GString *group = join->route_key(join, key->str);
+        if (!group) {
+            continue;
+        }
+        GString *keys = g_hash_table_lookup(group_keys, group);
+        if (!keys) {
+            keys = g_string_new(NULL);
+            g_hash_table_insert(group_keys, group, keys);
+            g_ptr_array_add(groups, group);
+        }
+        join_append_key(join, keys, key->str);
+    }
+    g_ptr_array_free(rows, TRUE);
+
+    sharding_plan_t *plan = sharding_plan_new(con->orig_sql);
+    if (groups->len == 0) {
+        /* no match, still ask one group for the field definitions */
+        g_ptr_array_add(groups, g_ptr_array_index(join->probe_groups, 0));
+        g_hash_table_insert(group_keys, g_ptr_array_index(groups, 0), g_string_new("NULL"));
+    }
+    for (i = 0; i < groups->len; ++i) {
+        GString *group = g_ptr_array_index(groups, i);
+        GString *keys = g_hash_table_lookup(group_keys, group);
+        sharding_plan_add_group_sql(plan, group, sharding_join_probe_sql(join, keys->str));
+    }
+    g_ptr_array_free(groups, TRUE);
+    g_hash_table_destroy(group_keys);
+
+    g_debug("%s: bind join probes %d groups for con:%p", G_STRLOC, plan->groups->len, con);
+    network_mysqld_con_set_sharding_plan(con, plan);
+    join->phase = JOIN_PHASE_PROBE;
+
+    /* the query packet is consumed when sent, put it back for phase 2 */
+    network_queue_clear(con->client->recv_queue);
+    network_queue_append(con->client->recv_queue, g_string_new_len(S(join->query_packet)));
+    return JOIN_RESP_NEXT_PHASE;
+}
+
+static void
+join_append_row(network_mysqld_con *con, GString *buf, GPtrArray *driver_row, GPtrArray *probe_row)
+{
+    sharding_join_t *join = con->bind_join;
+    g_string_truncate(buf, 0);
+    int i;
+    for (i = 0; i < join->out_cols->len; ++i) {
+        struct join_out_col_t *col = &g_array_index(join->out_cols, struct join_out_col_t, i);
+        GPtrArray *row = (col->side == JOIN_SIDE_DRIVER) ? driver_row : probe_row;
+        GString *cell = g_ptr_array_index(row, col->index);
+        if (cell) {
+            network_mysqld_proto_append_lenenc_str_len(buf, cell->str, cell->len);
+        } else {
+            g_string_append_c(buf, (char)MYSQLD_PACKET_NULL);
+        }
+    }
+    network_mysqld_queue_append(con->client, con->client->send_queue, S(buf));
+}
+
+static int
+join_process_probe(network_mysqld_con *con)
+{
+    sharding_join_t *join = con->bind_join;
+    GPtrArray *fields = g_ptr_array_new_with_free_func(g_string_true_free);
+    GPtrArray *rows = g_ptr_array_new();
+    GHashTable *index = NULL;
+    if (!join_collect(con, join->probe_ncols, fields, rows)) {
+        goto out;
+    }
+
+    /* the probe side evaluated "key IN (...)", so match by the probe column's rules */
+    enum join_key_kind_t kind = JOIN_KEY_STRING;
+    if (fields->len > join->probe_ncols) {
+        kind = join_key_kind(g_ptr_array_index(fields, join->probe_ncols));
+    }
+    index = join_driver_index(join, kind);
+
+    network_queue_clear(con->client->send_queue);
+    GString *buf = g_string_new(NULL);
+    network_mysqld_proto_append_lenenc_int(buf, join->out_cols->len);
+    network_mysqld_queue_append(con->client, con->client->send_queue, S(buf));
+
+    int i, j;
+    for (i = 0; i < join->out_cols->len; ++i) {
+        struct join_out_col_t *col = &g_array_index(join->out_cols, struct join_out_col_t, i);
+        GPtrArray *side_fields = (col->side == JOIN_SIDE_DRIVER) ? join->driver_fields : fields;
+        GString *field = col->index < side_fields->len ? g_ptr_array_index(side_fields, col->index) : NULL;
+        if (!field) {
+            /* no driver row at all, field of driver side is unknown */
+            g_string_truncate(buf, 0);
+            network_mysqld_proto_append_lenenc_str(buf, "def");
+            for (j = 0; j < 5; ++j) {
+                network_mysqld_proto_append_lenenc_str(buf, "");
+            }
+            g_string_append_len(buf, "\x0c\x21\x00\x00\x00\x00\x00\xfd\x00\x00\x00\x00\x00", 13);
+            field = buf;
+        }
+        network_mysqld_queue_append(con->client, con->client->send_queue, S(field));
+    }
+    join_append_eof(con, buf);
+
+    guint64 out_size = 0;
+    for (i = 0; i < rows->len; ++i) {
+        GPtrArray *probe_row = g_ptr_array_index(rows, i);
+        GString *key = g_ptr_array_index(probe_row, join->probe_ncols);
+        if (!key) {
+            continue;
+        }
+        gchar *norm = join_key_normalize(kind, key->str, key->len);
+        GPtrArray *buckets = g_hash_table_lookup(index, norm);
+        g_free(norm);
+        /*
+         * every probe row matched some key on the server, a miss means the column
+         * compares in a way not reproduced here, fail rather than drop the row
+         */
+        if (!buckets || (kind == JOIN_KEY_STRING && buckets->len > 1)) {
+            g_string_free(buf, TRUE);
+            join_send_error(con, buckets ? "(cetus) bind join keys differ only in case or trailing spaces"
+                            : "(cetus) bind join can not match join key by its collation", ER_CETUS_NOT_SUPPORTED);
+            goto out;
+        }
+        int b;
+        for (b = 0; b < buckets->len; ++b) {
+            GPtrArray *driver_rows = g_ptr_array_index(buckets, b);
+            for (j = 0; j < driver_rows->len; ++j) {
+                join_append_row(con, buf, g_ptr_array_index(driver_rows, j), probe_row);
+                out_size += buf->len;
+            }
+        }
+        if (join->mem_used + out_size > join->max_bytes) {
+            g_string_free(buf, TRUE);
+            join_send_error(con, "(cetus) bind join exceeds memory limit", ER_CETUS_LONG_RESP);
+            goto out;
+        }
+    }
+
+    join_append_eof(con, buf);
+    g_string_free(buf, TRUE);
+
+  out:
+    if (index) {
+        g_hash_table_destroy(index);
+    }
+    g_ptr_array_foreach(rows, (GFunc) join_row_free, NULL);
+    g_ptr_array_free(rows, TRUE);
+    g_ptr_array_free(fields, TRUE);
+    return JOIN_RESP_DONE;
+}
+
+int
+sharding_join_process_resp(network_mysqld_con *con)
+{
+    sharding_join_t *join = con->bind_join;
+    int rc;
+    if (join->phase == JOIN_PHASE_DRIVER) {
+        rc = join_process_driver(con);
+    } else {
+        rc = join_process_probe(con);
+    }
+    if (rc == JOIN_RESP_DONE) {
+        sharding_join_free(join);
+        con->bind_join = NULL;
+    }
+    return rc;
+}
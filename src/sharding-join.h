@@ -0,0 +1,102 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+
+#ifndef __SHARDING_JOIN_H__
+#define __SHARDING_JOIN_H__
+
+#include "glib-ext.h"
+#include "network-mysqld.h"
+
+#define JOIN_DEFAULT_MAX_ROWS 10000
+#define JOIN_DEFAULT_MAX_BYTES (16 * 1024 * 1024)
+
+enum sharding_join_side_t {
+    JOIN_SIDE_DRIVER = 0,       /* the small side, fetched first */
+    JOIN_SIDE_PROBE = 1,        /* the large side, looked up by join keys */
+};
+
+enum sharding_join_phase_t {
+    JOIN_PHASE_DRIVER = 1,
+    JOIN_PHASE_PROBE,
+};
+
+enum sharding_join_resp_t {
+    JOIN_RESP_DONE,             /* result or error is in client send queue */
+    JOIN_RESP_NEXT_PHASE,       /* new sharding plan is set, query again */
+};
+
+struct join_out_col_t {
+    enum sharding_join_side_t side;
+    int index;                  /* column index in the side's result */
+};
+
+typedef struct sharding_join_t sharding_join_t;
+
+/**
+ * bind join of two sharding tables that are not joined on sharding key
+ *
+ *   phase 1: SELECT driver columns, join column FROM small side WHERE ...
+ *   phase 2: SELECT probe columns, key FROM large side WHERE ... AND key IN (keys of this group)
+ *
+ * the rows are joined inside proxy by hashing the driver side on join column
+ */
+struct sharding_join_t {
+    enum sharding_join_phase_t phase;
+
+    GString *driver_sql;
+    GString *probe_sql_prefix;  /* ends with "IN (", keys and ")" are appended */
+    int driver_ncols;           /* visible columns, the join column follows */
+    int probe_ncols;            /* visible columns, the sharding key follows */
+    GArray *out_cols;           /* GArray<struct join_out_col_t> in select list order */
+
+    GString *probe_db;
+    GString *probe_table;
+    GPtrArray *probe_groups;    /* GPtrArray<GString *> all groups of the large side */
+    gboolean probe_key_is_str;
+
+    /* map a join key to the group holding it, NULL if none */
+    GString *(*route_key) (sharding_join_t *, const char *key);
+
+    guint max_rows;
+    guint64 max_bytes;
+
+    /* runtime state */
+    GString *query_packet;      /* client COM_QUERY, re-queued for phase 2 */
+    GPtrArray *driver_fields;   /* GPtrArray<GString *> field packets without header */
+    GHashTable *driver_rows;    /* <char *key, GPtrArray<row>>, row is GPtrArray<GString *> */
+    guint driver_row_count;
+    guint64 mem_used;
+};
+
+sharding_join_t *sharding_join_new(void);
+
+void sharding_join_free(sharding_join_t *);
+
+/* probe sql for given key list, e.g. "1,2,3" */
+GString *sharding_join_probe_sql(sharding_join_t *, const char *keys);
+
+/**
+ * consume responses of current phase from con->servers
+ * @return JOIN_RESP_NEXT_PHASE when con->sharding_plan is replaced for probe side
+ */
+int sharding_join_process_resp(network_mysqld_con *con);
+
+#endif /* __SHARDING_JOIN_H__ */
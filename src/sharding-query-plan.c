@@ -19,6 +19,7 @@
  $%ENDLICENSE%$ */
 
 #include "sharding-query-plan.h"
+#include "sharding-join.h"
 
 #include <string.h>
 
@@ -45,6 +46,18 @@ sharding_plan_free(sharding_plan_t *plan)
         }
         g_list_free(plan->mapping);
     }
+    if (plan->in_list_mapping) {
+        GList *l = plan->in_list_mapping;
+        for (; l != NULL; l = l->next) {
+            struct _group_sql_pair *pair = l->data;
+            g_string_free((GString *)pair->sql, TRUE);
+            g_free(pair);
+        }
+        g_list_free(plan->in_list_mapping);
+    }
+    if (plan->join) {
+        sharding_join_free(plan->join);
+    }
 
     g_free(plan);
 }
@@ -145,11 +158,78 @@ sharding_plan_get_sql(sharding_plan_t *plan, const GString *group)
     return NULL;
 }
 
+/* replace [offset, offset + len) of sql with keys */
+static GString *
+sql_replace_in_list(const char *sql, gsize offset, gsize len, const GString *keys)
+{
+    GString *new_sql = g_string_sized_new(strlen(sql) - len + keys->len);
+    g_string_append_len(new_sql, sql, offset);
+    g_string_append_len(new_sql, keys->str, keys->len);
+    g_string_append(new_sql, sql + offset + len);
+    return new_sql;
+}
+
+gboolean
+sharding_plan_set_in_list(sharding_plan_t *plan, const char *start, const char *end)
+{
+    const char *sql = plan->orig_sql->str;
+    if (start < sql || end > sql + plan->orig_sql->len || start >= end) {
+        return FALSE;           /* not parsed from orig_sql */
+    }
+    plan->in_list_start = start;
+    plan->in_list_end = end;
+    return TRUE;
+}
+
+void
+sharding_plan_add_group_in_list(sharding_plan_t *plan, GString *gp_name, GString *keys)
+{
+    g_assert(plan->in_list_start);
+    const char *sql = plan->orig_sql->str;
+    GString *new_sql = sql_replace_in_list(sql, plan->in_list_start - sql,
+                                           plan->in_list_end - plan->in_list_start, keys);
+    sharding_plan_add_group_sql(plan, gp_name, new_sql);
+
+    struct _group_sql_pair *pair = g_new0(struct _group_sql_pair, 1);
+    pair->gp_name = gp_name;
+    pair->sql = keys;
+    plan->in_list_mapping = g_list_append(plan->in_list_mapping, pair);
+}
+
+/**
+ * the modified sql is constructed from AST, which copies the key list verbatim,
+ * locate it and redo the per-group IN list on top of modified sql
+ */
+static void
+sharding_plan_rewrite_in_list(sharding_plan_t *plan, const GString *sql)
+{
+    gsize len = plan->in_list_end - plan->in_list_start;
+    char *list = g_strndup(plan->in_list_start, len);
+    const char *found = strstr(sql->str, list);
+    gboolean unique = found && strstr(found + 1, list) == NULL;
+    g_free(list);
+
+    GList *l = plan->in_list_mapping;
+    for (; l != NULL; l = l->next) {
+        struct _group_sql_pair *pair = l->data;
+        if (unique) {
+            GString *new_sql = sql_replace_in_list(sql->str, found - sql->str, len, pair->sql);
+            sharding_plan_add_group_sql(plan, (GString *)pair->gp_name, new_sql);
+        } else {
+            /* can't locate the list, all groups use the whole modified sql */
+            sharding_plan_add_mapping(plan, pair->gp_name, NULL);
+        }
+    }
+}
+
 void
 sharding_plan_set_modified_sql(sharding_plan_t *plan, GString *sql)
 {
     plan->is_modified = TRUE;
     plan->modified_sql = sql;
+    if (plan->in_list_mapping) {
+        sharding_plan_rewrite_in_list(plan, sql);
+    }
 }
 
 static gint
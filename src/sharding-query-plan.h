@@ -48,6 +48,23 @@ typedef struct sharding_plan_t {
     const GString *orig_sql;
     const GString *modified_sql;
     enum sharding_table_type_t table_type;
+
+    /* IN list of sharding key, [in_list_start, in_list_end) references orig_sql */
+    const char *in_list_start;
+    const char *in_list_end;
+    GList *in_list_mapping;     /* GList<struct _group_sql_pair *>, sql is the group's own keys */
+
+    struct sharding_join_t *join;   /* cross-shard bind join, groups are the driver side */
+
+    /* SELECT reading only declared global tables of this db, borrowed from the AST */
+    const char *global_db;
+
+    guint64 generated_insert_id;    /* first sharding key generated for INSERT, 0 if none */
+
+    /* SELECT routed to one partition by equation on sharding key, borrowed from the AST */
+    const char *point_db;
+    const char *point_table;
+    struct sql_expr_t *point_key;   /* the key value */
 } sharding_plan_t;
 
 sharding_plan_t *sharding_plan_new(const GString *orig_sql);
@@ -70,6 +87,15 @@ void sharding_plan_clear_group(sharding_plan_t *);
 /* use group-specific sql */
 void sharding_plan_add_group_sql(sharding_plan_t *, GString *gp_name, GString *sql);
 
+/**
+ * use group-specific IN list of sharding key, the rest of sql is shared
+ *   "WHERE id IN (1,2,3,4)" ==> group1: "WHERE id IN (1,3)", group2: "WHERE id IN (2,4)"
+ * @param start, end the whole key list inside orig_sql
+ */
+gboolean sharding_plan_set_in_list(sharding_plan_t *, const char *start, const char *end);
+
+void sharding_plan_add_group_in_list(sharding_plan_t *, GString *gp_name, GString *keys);
+
 void sharding_plan_sort_groups(sharding_plan_t *);
 
 #endif /* SHARDING_QUERY_PLAN */